@@ -2,6 +2,8 @@ import paho.mqtt.client as mqtt
 import requests
 import json
 import time
+from decimal import Decimal
+import cbor2
 from datetime import datetime
 import pytz
 
@@ -18,8 +20,57 @@ TARGET_PHONE = "<YOUR_WHATSAPP_NUMBER>" # Your WhatsApp number with country code
 
 ist = pytz.timezone('Asia/Kolkata')
 
+# Wire keys of the firmware's CBOR payloads (CBOR_KEYS in
+# lib/TelemetryWriter/TelemetryWriter.cpp): the index is sent instead of the
+# name, and a value under a key with decimals is sent scaled by 10^decimals.
+# Append only, in step with the firmware.
+CBOR_KEYS = [
+    ("firmware_version", 0), ("zones", 0), ("interval_s", 0), ("duration_s", 0), ("temperature_c", 1),
+    ("humidity_pct", 1), ("cmd_latency_us", 0), ("cmd_latency_max_us", 0), ("dropped_cmds", 0),
+    ("sched_late_ms", 0), ("sched_late_max_ms", 0), ("nvs_commits", 0), ("nvs_writes_avoided", 0),
+    ("nvs_commit_us", 0), ("nvs_commit_max_us", 0), ("flow_total_ml", 0), ("next_on_time", 0),
+    ("current_time", 0), ("status", 0), ("zone", 0), ("flow_rate_lpm", 2), ("total_volume_l", 2),
+    ("interval", 0), ("duration", 0), ("Turn_ON_AT", 0), ("volume_l", 3), ("ota_check_result", 0),
+    ("check_timestamp", 0), ("spool_pending", 0), ("spool_dropped", 0), ("boot_ready_ms", 0),
+    ("first_actuation_ms", 0), ("mqtt_attempts", 0), ("wifi_outages", 0), ("wifi_outage_ms", 0),
+    ("wifi_reconnects", 0), ("boot_wifi_ms", 0), ("boot_mqtt_ms", 0), ("wifi_fast_boot", 0),
+]
+
 # --- Logic ---
 
+def decode_cbor(raw):
+    """Decodes a CBOR payload into the same dict the JSON form would give."""
+    data = cbor2.loads(raw)
+    if not isinstance(data, dict):
+        raise ValueError("CBOR payload is not a map")
+    decoded = {}
+    for key, value in data.items():
+        if isinstance(key, int) and 0 <= key < len(CBOR_KEYS):
+            key, decimals = CBOR_KEYS[key]
+            if decimals and isinstance(value, int):
+                value = value / 10 ** decimals
+        if isinstance(value, Decimal):  # tag 4 decimal fraction
+            value = float(value)
+        decoded[key] = value
+    return decoded
+
+def decode_payload(raw):
+    """Returns a message as a dict whether it was sent as JSON or CBOR, or as a
+    str if it is plain text (zone 0 acks "ON"/"OFF" by default)."""
+    # a CBOR map from the firmware starts with 0xBF, which no JSON or text does
+    if raw[:1] == b"\xbf":
+        try:
+            return decode_cbor(raw)
+        except (ValueError, cbor2.CBORDecodeError) as e:
+            print(f"Undecodable CBOR payload: {e}")
+            return raw.hex()
+    text = raw.decode(errors="replace")
+    try:
+        data = json.loads(text)
+    except json.JSONDecodeError:
+        return text
+    return data if isinstance(data, dict) else text
+
 def send_whatsapp_alert(message_text):
     """Sends a POST request to the local WABridge API."""
     payload = {
@@ -45,14 +96,13 @@ def on_connect(client, userdata, flags, rc):
 
 def on_message(client, userdata, msg):
     """Callback for when a message is received on the subscribed topic."""
-    payload = msg.payload.decode()
-    print(f"New MQTT Message: {payload}")
+    data = decode_payload(msg.payload)
+    print(f"New MQTT Message: {data}")
 
     timestamp = datetime.now(ist).strftime("%H:%M %d-%m-%Y")
     
-    # check if payload is valid JSON and extract flow rate, volume, temperature, and humidity if available
-    try:
-        data = json.loads(payload)
+    # extract flow rate, volume, temperature, and humidity if the ack carries them
+    if isinstance(data, dict):
         status = data.get("status", "N/A")
         flow_rate = data.get("flow_rate_lpm", "N/A")
         total_volume = data.get("total_volume_l", "N/A")
@@ -64,8 +114,9 @@ def on_message(client, userdata, msg):
                       f"Temperature: {temperature} °C\n"
                       f"Humidity: {humidity} %")
 
-    except json.JSONDecodeError:
-        # If payload is not valid JSON, use a default message
+    else:
+        # a plain ON/OFF ack, use a default message
+        status = data
         alert_text = f"Watering was completed at {timestamp}"
 
     if status == "OFF":
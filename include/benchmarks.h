@@ -0,0 +1,6 @@
+#pragma once
+
+// Micro benchmarks, built only with -D RUN_BENCHMARKS. They run at boot in
+// env:esp32doit-devkit-v1-bench and as the whole program in env:native.
+// Results go to Serial.
+void runBenchmarks();
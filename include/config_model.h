@@ -0,0 +1,9 @@
+#pragma once
+
+// Host-only (env:native) run of ConfigParser over hostile /config payloads:
+// every prefix of well-formed nested payloads, unterminated keys and strings
+// inside skipped values, nesting past the skip depth and typed field errors.
+// Each payload is copied into a buffer of exactly its length, so a read past
+// the end shows up under -fsanitize=address. Returns 0 when no payload is
+// read out of bounds and each one gets the expected result.
+int runConfigModel();
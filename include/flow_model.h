@@ -0,0 +1,7 @@
+#pragma once
+
+// Host-only (env:native) model run of WaterFlowSensor: the same pulse train,
+// glitches included, is fed to a PCNT-backed and a GPIO-interrupt-backed sensor
+// through lib/NativeShim. Prints counted flow and ISR load per phase; returns 0
+// when both backends count exactly what their hardware would.
+int runFlowModel();
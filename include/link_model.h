@@ -0,0 +1,8 @@
+#pragma once
+
+// Host-only (env:native) model of the reconnect policy: a fleet of devices
+// loses the broker at the same instant and retries with Backoff until it is
+// back. Returns 0 when every wait stays inside its window, every device is
+// back within one capped wait of the broker, and jitter keeps the returning
+// fleet from arriving in the same second.
+int runLinkModel();
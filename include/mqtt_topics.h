@@ -5,5 +5,7 @@
 #define TOPIC_CONTROL       "/your_topic_header/control"
 #define TOPIC_ACK           "/your_topic_header/ack"
 #define TOPIC_HEARTBEAT     "/your_topic_header/heartbeat"
+#define TOPIC_ALERT         "/your_topic_header/alert"
+#define TOPIC_TELEMETRY     "/your_topic_header/telemetry"
 
 #define SERVER_URL          "http://<SERVER_IP>/esp32_images/updates.json"
@@ -0,0 +1,7 @@
+#pragma once
+
+// Host-only (env:native) discrete-event simulation of a year of irrigation with
+// injected reboots, power outages, NTP steps and late network. Prints a
+// throughput and actuation-accuracy report; returns 0 when every actuation
+// that no fault could excuse happened on time.
+int runYearSimulation();
@@ -0,0 +1,8 @@
+#pragma once
+
+// Host-only (env:native) run of the store-and-forward SpoolLog on the shim's
+// RAM flash: messages logged offline, replayed across reboots, the ring
+// wrapping over unsent segments and a write torn by a power cut. Returns 0
+// when every message that was not reported dropped is replayed exactly once,
+// in order, within the replay budget.
+int runSpoolModel();
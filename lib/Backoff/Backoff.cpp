@@ -0,0 +1,16 @@
+#include "Backoff.h"
+
+Backoff::Backoff(uint32_t baseMs, uint32_t maxMs) : _baseMs(baseMs), _maxMs(maxMs), _failures(0) {}
+
+uint32_t Backoff::window() const {
+    uint32_t window = _baseMs;
+    for (uint32_t i = 0; i < _failures && window < _maxMs; i++) window *= 2;
+    return window < _maxMs ? window : _maxMs;
+}
+
+uint32_t Backoff::fail(uint32_t random) {
+    uint32_t window = this->window();
+    _failures++;
+    uint32_t half = window / 2;
+    return window - half + random % (half + 1);
+}
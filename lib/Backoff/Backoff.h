@@ -0,0 +1,34 @@
+#ifndef BACKOFF_H
+#define BACKOFF_H
+
+#include <stdint.h>
+
+// Delay between reconnect attempts: doubling from baseMs after each failure up
+// to maxMs, with "equal jitter": the wait is drawn from the upper half of that
+// window. The lower half keeps a floor under the retry rate, and the random
+// half spreads a fleet of devices that lost the same broker so they do not
+// all come back in the same second.
+class Backoff {
+public:
+    Backoff(uint32_t baseMs, uint32_t maxMs);
+
+    // An attempt failed; returns how long to wait before the next one.
+    // random is any uniformly distributed 32-bit value (esp_random() on target).
+    uint32_t fail(uint32_t random);
+
+    // The link is up; the next failure starts from baseMs again
+    void reset() { _failures = 0; }
+
+    // Failures since the last reset()
+    uint32_t failures() const { return _failures; }
+
+    // Upper bound of the next wait
+    uint32_t window() const;
+
+private:
+    uint32_t _baseMs;
+    uint32_t _maxMs;
+    uint32_t _failures;
+};
+
+#endif
@@ -0,0 +1,238 @@
+#include "ConfigParser.h"
+#include <string.h>
+
+static const struct {
+    const char* name;
+    ConfigValueKind kind;
+} CONFIG_KEYS[CFG_FIELD_COUNT] = {
+    {"interval", VALUE_UNSIGNED},
+    {"duration", VALUE_UNSIGNED},
+    {"TURN_ON_AT", VALUE_UNSIGNED},
+    {"zone", VALUE_UNSIGNED},
+    {"cron", VALUE_STRING},
+    {"every_days", VALUE_UNSIGNED},
+    {"tz_offset_min", VALUE_SIGNED},
+    {"volume_l", VALUE_UNSIGNED},
+};
+
+// bounds how deep skipValue() follows nested objects/arrays of unknown keys
+static const uint8_t MAX_SKIP_DEPTH = 8;
+
+ConfigParser::ConfigParser() : _seed(0) {
+    for (uint8_t i = 0; i < CFG_FIELD_COUNT; i++) _length[i] = static_cast<uint8_t>(strlen(CONFIG_KEYS[i].name));
+    // Search for a seed under which every key lands in its own slot. With a
+    // handful of keys in 32 slots this succeeds within a few tries.
+    for (uint32_t seed = 1; seed < 1024; seed++) {
+        memset(_table, EMPTY_SLOT, sizeof(_table));
+        bool collision = false;
+        for (uint8_t i = 0; i < CFG_FIELD_COUNT && !collision; i++) {
+            uint8_t s = slot(CONFIG_KEYS[i].name, _length[i], seed);
+            if (_table[s] != EMPTY_SLOT) collision = true;
+            else _table[s] = i;
+        }
+        if (!collision) {
+            _seed = seed;
+            return;
+        }
+    }
+    // unreachable for any sane key set; every lookup will then miss
+    memset(_table, EMPTY_SLOT, sizeof(_table));
+}
+
+uint32_t ConfigParser::hash(uint32_t h, char c) {
+    return h * 31 + static_cast<uint8_t>(c);
+}
+
+uint8_t ConfigParser::slot(uint32_t h) {
+    return (h ^ (h >> 11)) & (TABLE_SIZE - 1);
+}
+
+uint8_t ConfigParser::slot(const char* key, size_t length, uint32_t seed) {
+    uint32_t h = seed;
+    for (size_t i = 0; i < length; i++) h = hash(h, key[i]);
+    return slot(h);
+}
+
+// h is the key's hash under _seed, computed by the caller while it scanned the key
+int ConfigParser::lookup(const char* key, size_t length, uint32_t h) const {
+    uint8_t index = _table[slot(h)];
+    if (index == EMPTY_SLOT) return -1;
+    if (_length[index] != length || memcmp(CONFIG_KEYS[index].name, key, length) != 0) return -1;
+    return index;
+}
+
+static const char* skipSpace(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+    return p;
+}
+
+// p points at the opening quote; returns the position after the closing quote or nullptr.
+// memchr finds each candidate quote; one preceded by an odd run of backslashes is escaped.
+static const char* skipString(const char* p, const char* end) {
+    for (p++; p < end;) {
+        const char* quote = static_cast<const char*>(memchr(p, '"', end - p));
+        if (quote == nullptr) return nullptr;
+        const char* run = quote;
+        while (run > p && run[-1] == '\\') run--;
+        if (((quote - run) & 1) == 0) return quote + 1;
+        p = quote + 1;
+    }
+    return nullptr;
+}
+
+// skip any JSON value; returns the position after it or nullptr if malformed
+static const char* skipValue(const char* p, const char* end, uint8_t depth) {
+    if (p >= end) return nullptr;
+    if (*p == '"') return skipString(p, end);
+
+    if (*p == '{' || *p == '[') {
+        if (depth >= MAX_SKIP_DEPTH) return nullptr;
+        char close = *p == '{' ? '}' : ']';
+        p = skipSpace(p + 1, end);
+        if (p < end && *p == close) return p + 1;
+        while (p < end) {
+            if (close == '}') {
+                if (*p != '"') return nullptr;
+                p = skipString(p, end);
+                if (p == nullptr) return nullptr;
+                p = skipSpace(p, end);
+                if (p >= end || *p != ':') return nullptr;
+                p = skipSpace(p + 1, end);
+            }
+            p = skipValue(p, end, depth + 1);
+            if (p == nullptr) return nullptr;
+            p = skipSpace(p, end);
+            if (p >= end) return nullptr;
+            if (*p == close) return p + 1;
+            if (*p != ',') return nullptr;
+            p = skipSpace(p + 1, end);
+        }
+        return nullptr;
+    }
+
+    // number or literal: consume up to the next delimiter
+    const char* start = p;
+    while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') p++;
+    return p > start ? p : nullptr;
+}
+
+static bool isDelimiter(char c) {
+    return c == ',' || c == '}' || c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// parse a 32-bit integer (optionally negative); the value must end at a delimiter
+static const char* parseInteger(const char* p, const char* end, bool allowSigned, uint32_t& value,
+                                ConfigFieldStatus& status) {
+    const char* start = p;
+    bool negative = allowSigned && p < end && *p == '-';
+    if (negative) p++;
+    const char* digits = p;
+    uint64_t limit = negative ? 0x80000000ULL : (allowSigned ? 0x7FFFFFFFULL : UINT32_MAX);
+    uint64_t acc = 0;
+    status = FIELD_OK;
+    while (p < end && *p >= '0' && *p <= '9') {
+        acc = acc * 10 + (*p - '0');
+        if (acc > limit) {
+            status = FIELD_OVERFLOW;
+            acc = limit + 1; // saturate so long inputs cannot wrap
+        }
+        p++;
+    }
+    if (p == digits || (p < end && !isDelimiter(*p))) {
+        // not a plain integer (string, fraction, literal...): report and skip it
+        status = FIELD_INVALID;
+        return skipValue(start, end, 0);
+    }
+    if (status != FIELD_OK) acc = 0;
+    value = negative ? 0u - static_cast<uint32_t>(acc) : static_cast<uint32_t>(acc);
+    return p;
+}
+
+// a string value without escape processing; anything else is reported and skipped
+static const char* parseText(const char* p, const char* end, const char*& text, uint16_t& length,
+                             ConfigFieldStatus& status) {
+    if (p >= end || *p != '"') {
+        status = FIELD_INVALID;
+        return skipValue(p, end, 0);
+    }
+    const char* close = skipString(p, end);
+    if (close == nullptr) return nullptr;
+    text = p + 1;
+    length = static_cast<uint16_t>(close - 1 - text);
+    status = FIELD_OK;
+    return close;
+}
+
+ConfigParseResult ConfigParser::parse(const char* payload, size_t length, config_fields_t& out) const {
+    memset(&out, 0, sizeof(out));
+
+    const char* end = payload + length;
+    const char* p = skipSpace(payload, end);
+    if (p >= end || *p != '{') return CONFIG_PARSE_MALFORMED;
+    p = skipSpace(p + 1, end);
+    if (p < end && *p == '}') return CONFIG_PARSE_OK;
+
+    while (p < end) {
+        if (*p != '"') return CONFIG_PARSE_MALFORMED;
+        // hash the key while looking for its closing quote; an escaped key is
+        // skipped as a string and cannot name a field
+        const char* key = p + 1;
+        const char* keyEnd = key;
+        uint32_t h = _seed;
+        while (keyEnd < end && *keyEnd != '"' && *keyEnd != '\\') h = hash(h, *keyEnd++);
+        int field = -1;
+        if (keyEnd < end && *keyEnd == '"') {
+            field = lookup(key, keyEnd - key, h);
+            keyEnd++;
+        } else {
+            keyEnd = skipString(p, end);
+            if (keyEnd == nullptr) return CONFIG_PARSE_MALFORMED;
+        }
+
+        p = skipSpace(keyEnd, end);
+        if (p >= end || *p != ':') return CONFIG_PARSE_MALFORMED;
+        p = skipSpace(p + 1, end);
+
+        if (field < 0) {
+            p = skipValue(p, end, 0);
+        } else {
+            uint32_t value = 0;
+            const char* text = nullptr;
+            uint16_t textLength = 0;
+            ConfigFieldStatus status = FIELD_INVALID;
+            if (CONFIG_KEYS[field].kind == VALUE_STRING) p = parseText(p, end, text, textLength, status);
+            else p = parseInteger(p, end, CONFIG_KEYS[field].kind == VALUE_SIGNED, value, status);
+            if (out.status[field] != FIELD_MISSING) {
+                out.status[field] = FIELD_DUPLICATE;
+            } else {
+                out.status[field] = status;
+                out.value[field] = value;
+                out.text[field] = text;
+                out.textLength[field] = textLength;
+            }
+        }
+        if (p == nullptr) return CONFIG_PARSE_MALFORMED;
+
+        p = skipSpace(p, end);
+        if (p >= end) return CONFIG_PARSE_MALFORMED;
+        if (*p == '}') return CONFIG_PARSE_OK;
+        if (*p != ',') return CONFIG_PARSE_MALFORMED;
+        p = skipSpace(p + 1, end);
+    }
+    return CONFIG_PARSE_MALFORMED;
+}
+
+const char* ConfigParser::fieldName(ConfigField field) {
+    return field < CFG_FIELD_COUNT ? CONFIG_KEYS[field].name : "?";
+}
+
+const char* ConfigParser::statusText(ConfigFieldStatus status) {
+    switch (status) {
+        case FIELD_MISSING: return "missing";
+        case FIELD_OK: return "ok";
+        case FIELD_INVALID: return "wrong type";
+        case FIELD_OVERFLOW: return "out of range";
+        case FIELD_DUPLICATE: return "given more than once";
+    }
+    return "?";
+}
@@ -0,0 +1,74 @@
+#ifndef CONFIG_PARSER_H
+#define CONFIG_PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Keys understood in a /config payload. To add one, append it here (before
+// CFG_FIELD_COUNT) and add its name and value kind at the same position in
+// CONFIG_KEYS.
+enum ConfigField {
+    CFG_INTERVAL,
+    CFG_DURATION,
+    CFG_TURN_ON_AT,
+    CFG_ZONE,
+    CFG_CRON,
+    CFG_EVERY_DAYS,
+    CFG_TZ_OFFSET_MIN,
+    CFG_VOLUME_L,
+    CFG_FIELD_COUNT
+};
+
+enum ConfigValueKind {
+    VALUE_UNSIGNED, // 0..UINT32_MAX, in value[]
+    VALUE_SIGNED,   // INT32_MIN..INT32_MAX, in value[] as two's complement
+    VALUE_STRING    // text[]/textLength[] point into the payload (no escape processing)
+};
+
+enum ConfigFieldStatus {
+    FIELD_MISSING = 0,   // key not present
+    FIELD_OK,
+    FIELD_INVALID,       // present but not of the field's kind
+    FIELD_OVERFLOW,      // integer does not fit in 32 bits
+    FIELD_DUPLICATE      // key given more than once; a payload with one is rejected
+};
+
+enum ConfigParseResult {
+    CONFIG_PARSE_OK,
+    CONFIG_PARSE_MALFORMED // not a JSON object; fields seen before the error are still reported
+};
+
+typedef struct {
+    ConfigFieldStatus status[CFG_FIELD_COUNT];
+    uint32_t value[CFG_FIELD_COUNT];
+    const char* text[CFG_FIELD_COUNT];
+    uint16_t textLength[CFG_FIELD_COUNT];
+} config_fields_t;
+
+// Single forward pass over a flat JSON object. Keys are matched exactly (no
+// substring hits) through a perfect hash built once at construction; values of
+// unknown keys, including nested objects and arrays, are skipped.
+class ConfigParser {
+public:
+    ConfigParser();
+
+    ConfigParseResult parse(const char* payload, size_t length, config_fields_t& out) const;
+
+    static const char* fieldName(ConfigField field);
+    static const char* statusText(ConfigFieldStatus status);
+
+private:
+    static const uint8_t TABLE_SIZE = 32; // power of two, comfortably above CFG_FIELD_COUNT
+    static const uint8_t EMPTY_SLOT = 0xFF;
+
+    static uint32_t hash(uint32_t h, char c);
+    static uint8_t slot(uint32_t h);
+    static uint8_t slot(const char* key, size_t length, uint32_t seed);
+    int lookup(const char* key, size_t length, uint32_t h) const;
+
+    uint32_t _seed;
+    uint8_t _table[TABLE_SIZE];
+    uint8_t _length[CFG_FIELD_COUNT]; // strlen of each key name
+};
+
+#endif
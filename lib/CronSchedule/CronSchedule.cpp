@@ -0,0 +1,168 @@
+#include "CronSchedule.h"
+
+#define MINUTES_PER_DAY 1440
+#define SECONDS_PER_DAY 86400L
+
+static const uint64_t ALL_MINUTES = (1ULL << 60) - 1;
+
+// decimal digits at q, at most limit; a longer number fails rather than wrapping
+static bool parseNumber(const char*& q, const char* end, uint32_t limit, uint32_t& value) {
+    if (q >= end || *q < '0' || *q > '9') return false;
+    value = 0;
+    while (q < end && *q >= '0' && *q <= '9') {
+        value = value * 10 + (*q++ - '0');
+        if (value > limit) return false;
+    }
+    return true;
+}
+
+// Parse one comma-separated cron field into a bitmask of values in [lo, hi].
+// Returns false on any syntax or range error.
+static bool parseField(const char* p, const char* end, uint8_t lo, uint8_t hi, uint64_t& mask) {
+    mask = 0;
+    while (p < end) {
+        const char* itemEnd = p;
+        while (itemEnd < end && *itemEnd != ',') itemEnd++;
+
+        uint32_t from = lo, to = hi, step = 1;
+        const char* q = p;
+        if (q < itemEnd && *q == '*') {
+            q++;
+        } else {
+            if (!parseNumber(q, itemEnd, hi, from)) return false;
+            to = from;
+            if (q < itemEnd && *q == '-') {
+                q++;
+                if (!parseNumber(q, itemEnd, hi, to)) return false;
+            }
+        }
+        if (q < itemEnd && *q == '/') {
+            q++;
+            // a step past hi is legal (it fires once), but still bounded
+            if (!parseNumber(q, itemEnd, 255, step)) return false;
+            // "a/n" means "a-hi/n"
+            if (to == from && *p != '*') to = hi;
+        }
+        if (q != itemEnd || step == 0 || from < lo || to > hi || from > to) return false;
+
+        for (uint32_t v = from; v <= to; v += step) mask |= 1ULL << v;
+        p = itemEnd < end ? itemEnd + 1 : end;
+    }
+    return mask != 0;
+}
+
+CronParseResult cronCompile(const char* expr, size_t length, cron_rule_t& rule) {
+    const char* fields[5];
+    const char* fieldEnds[5];
+    uint8_t count = 0;
+    const char* p = expr;
+    const char* end = expr + length;
+
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t')) p++;
+        if (p >= end) break;
+        if (count == 5) return CRON_BAD_FIELD_COUNT;
+        fields[count] = p;
+        while (p < end && *p != ' ' && *p != '\t') p++;
+        fieldEnds[count++] = p;
+    }
+    if (count != 5) return CRON_BAD_FIELD_COUNT;
+
+    uint64_t minutes, hours, weekdays;
+    if (!parseField(fields[0], fieldEnds[0], 0, 59, minutes)) return CRON_BAD_MINUTE;
+    if (!parseField(fields[1], fieldEnds[1], 0, 23, hours)) return CRON_BAD_HOUR;
+    if (fieldEnds[2] - fields[2] != 1 || *fields[2] != '*') return CRON_UNSUPPORTED_DAY_OF_MONTH;
+    if (fieldEnds[3] - fields[3] != 1 || *fields[3] != '*') return CRON_UNSUPPORTED_MONTH;
+    // 0 and 7 are both Sunday
+    if (!parseField(fields[4], fieldEnds[4], 0, 7, weekdays)) return CRON_BAD_WEEKDAY;
+    if (weekdays & (1 << 7)) weekdays = (weekdays | 1) & 0x7F;
+
+    rule.minutes = minutes;
+    rule.hours = static_cast<uint32_t>(hours);
+    rule.weekdays = static_cast<uint8_t>(weekdays);
+    rule.active = 1;
+    rule.everyDays = 0;
+    rule.anchorDay = 0;
+    return CRON_OK;
+}
+
+static bool dayMatches(const cron_rule_t& rule, int32_t day) {
+    // 1970-01-01 was a Thursday
+    uint8_t weekday = static_cast<uint8_t>(((day % 7) + 7 + 4) % 7);
+    if (!(rule.weekdays & (1 << weekday))) return false;
+    if (rule.everyDays <= 1) return true;
+    int32_t offset = day - static_cast<int32_t>(rule.anchorDay);
+    return offset >= 0 && offset % rule.everyDays == 0;
+}
+
+// first firing minute of the day at or after `start`, or -1
+static int32_t nextMinuteInDay(const cron_rule_t& rule, int32_t start) {
+    uint32_t hour = start / 60;
+    uint32_t minute = start % 60;
+
+    if (hour < 24 && (rule.hours & (1UL << hour))) {
+        uint64_t later = rule.minutes & (ALL_MINUTES << minute) & ALL_MINUTES;
+        if (later) return hour * 60 + __builtin_ctzll(later);
+    }
+    if (hour + 1 >= 24) return -1;
+    uint32_t laterHours = rule.hours & ~((2UL << hour) - 1);
+    if (!laterHours) return -1;
+    return __builtin_ctz(laterHours) * 60 + __builtin_ctzll(rule.minutes);
+}
+
+// next day after `day` that matches, or -1; at most seven candidates are checked
+static int32_t nextMatchingDay(const cron_rule_t& rule, int32_t day) {
+    int32_t candidate = day + 1;
+    int32_t step = 1;
+    if (rule.everyDays > 1) {
+        int32_t anchor = static_cast<int32_t>(rule.anchorDay);
+        if (candidate < anchor) {
+            candidate = anchor;
+        } else {
+            int32_t rem = (candidate - anchor) % rule.everyDays;
+            if (rem) candidate += rule.everyDays - rem;
+        }
+        step = rule.everyDays;
+    }
+    // the weekday repeats after at most seven steps of any size
+    for (uint8_t i = 0; i < 7; i++, candidate += step) {
+        if (dayMatches(rule, candidate)) return candidate;
+    }
+    return -1;
+}
+
+unsigned long cronNextFire(const cron_rule_t& rule, unsigned long after, int32_t tzOffsetSeconds) {
+    if (!rule.active || !rule.minutes || !rule.hours || !rule.weekdays) return 0;
+
+    int64_t local = static_cast<int64_t>(after) + tzOffsetSeconds;
+    // strictly after: start at the next whole minute
+    int64_t minuteIndex = local / 60 + 1;
+    int32_t day = static_cast<int32_t>(minuteIndex / MINUTES_PER_DAY);
+    int32_t minuteOfDay = static_cast<int32_t>(minuteIndex % MINUTES_PER_DAY);
+
+    int32_t minute = dayMatches(rule, day) ? nextMinuteInDay(rule, minuteOfDay) : -1;
+    if (minute < 0) {
+        day = nextMatchingDay(rule, day);
+        if (day < 0) return 0;
+        minute = nextMinuteInDay(rule, 0);
+    }
+    int64_t fire = static_cast<int64_t>(day) * SECONDS_PER_DAY + minute * 60 - tzOffsetSeconds;
+    return fire > 0 ? static_cast<unsigned long>(fire) : 0;
+}
+
+uint32_t cronLocalDay(unsigned long epoch, int32_t tzOffsetSeconds) {
+    return static_cast<uint32_t>((static_cast<int64_t>(epoch) + tzOffsetSeconds) / SECONDS_PER_DAY);
+}
+
+const char* cronResultText(CronParseResult result) {
+    switch (result) {
+        case CRON_OK: return "ok";
+        case CRON_BAD_FIELD_COUNT: return "expected 5 fields";
+        case CRON_BAD_MINUTE: return "bad minute field";
+        case CRON_BAD_HOUR: return "bad hour field";
+        case CRON_UNSUPPORTED_DAY_OF_MONTH: return "day-of-month must be *";
+        case CRON_UNSUPPORTED_MONTH: return "month must be *";
+        case CRON_BAD_WEEKDAY: return "bad day-of-week field";
+    }
+    return "?";
+}
@@ -0,0 +1,44 @@
+#ifndef CRON_SCHEDULE_H
+#define CRON_SCHEDULE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A calendar rule compiled to bitmasks. Supports the cron fields
+// "minute hour day-of-month month day-of-week" with *, a, a-b, */n, a-b/n and
+// comma lists; day-of-month and month must be "*" (use every_days for
+// multi-day cycles instead).
+typedef struct {
+    uint64_t minutes;   // bit n: fires at minute n (0-59)
+    uint32_t hours;     // bit n: fires during hour n (0-23)
+    uint8_t weekdays;   // bit n: fires on weekday n (0 = Sunday)
+    uint8_t active;     // 0: no rule; the zone uses plain interval scheduling
+    uint16_t everyDays; // 0 or 1: every matching day; N: only every Nth day from anchorDay
+    uint32_t anchorDay; // local day number (days since 1970-01-01) the N-day cycle counts from
+} cron_rule_t;
+
+enum CronParseResult {
+    CRON_OK,
+    CRON_BAD_FIELD_COUNT,
+    CRON_BAD_MINUTE,
+    CRON_BAD_HOUR,
+    CRON_UNSUPPORTED_DAY_OF_MONTH,
+    CRON_UNSUPPORTED_MONTH,
+    CRON_BAD_WEEKDAY
+};
+
+// Compile a cron expression into rule (rule.active is set on success)
+CronParseResult cronCompile(const char* expr, size_t length, cron_rule_t& rule);
+
+// First fire time strictly after `after` (epoch seconds), evaluated in local time
+// at tzOffsetSeconds from UTC. Constant work per call: the day and minute searches
+// are bit scans over at most seven candidate days, never a minute-by-minute walk.
+// Returns 0 if the rule can never fire.
+unsigned long cronNextFire(const cron_rule_t& rule, unsigned long after, int32_t tzOffsetSeconds);
+
+// Local day number for an epoch, used to anchor every_days cycles
+uint32_t cronLocalDay(unsigned long epoch, int32_t tzOffsetSeconds);
+
+const char* cronResultText(CronParseResult result);
+
+#endif
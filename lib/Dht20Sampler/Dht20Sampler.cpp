@@ -0,0 +1,95 @@
+#include "Dht20Sampler.h"
+
+Dht20Sampler::Dht20Sampler(TwoWire& wire, uint8_t address)
+    : _wire(wire), _address(address), _task(nullptr), _latest() {}
+
+void Dht20Sampler::begin(bool background) {
+    _wire.begin();
+    if (background &&
+        xTaskCreatePinnedToCore(samplingTask, "dht20", DHT20_TASK_STACK, this, DHT20_TASK_PRIORITY, &_task,
+                                xPortGetCoreID()) != pdPASS) {
+        Serial.println("Could not start the DHT20 sampling task");
+    }
+}
+
+void Dht20Sampler::samplingTask(void* arg) {
+    Dht20Sampler* sampler = static_cast<Dht20Sampler*>(arg);
+    // the sensor needs 100 ms after power-up before it answers
+    vTaskDelay(pdMS_TO_TICKS(100));
+    if (!sampler->calibrate()) Serial.println("DHT20 not responding");
+    for (;;) {
+        TickType_t started = xTaskGetTickCount();
+        sampler->update();
+        vTaskDelayUntil(&started, pdMS_TO_TICKS(DHT20_SAMPLE_INTERVAL_MS));
+    }
+}
+
+bool Dht20Sampler::calibrate() {
+    if (_wire.requestFrom(_address, (uint8_t)1) != 1) return false;
+    uint8_t status = _wire.read();
+    if ((status & 0x18) == 0x18) return true;
+    // calibration bits clear: load the factory coefficients
+    _wire.beginTransmission(_address);
+    _wire.write(0xBE);
+    _wire.write(0x08);
+    _wire.write(0x00);
+    if (_wire.endTransmission() != 0) return false;
+    vTaskDelay(pdMS_TO_TICKS(10));
+    return true;
+}
+
+bool Dht20Sampler::update() {
+    float temperatureC, humidity;
+    bool ok = measure(temperatureC, humidity);
+    if (ok) {
+        _latest.temperatureC = temperatureC;
+        _latest.humidity = humidity;
+        _latest.takenAtMs = millis();
+        _latest.samples++;
+    } else {
+        _latest.errors++;
+    }
+    // the sampler runs at priority 1 on the loop core: a reader that preempted it
+    // mid-write would spin until it ran again, so the write is not preemptible
+    portENTER_CRITICAL(&_writeLock);
+    _snapshot.write(_latest);
+    portEXIT_CRITICAL(&_writeLock);
+    return ok;
+}
+
+bool Dht20Sampler::measure(float& temperatureC, float& humidity) {
+    _wire.beginTransmission(_address);
+    _wire.write(0xAC);
+    _wire.write(0x33);
+    _wire.write(0x00);
+    if (_wire.endTransmission() != 0) return false;
+
+    // the task sleeps through the conversion; nothing else is held meanwhile
+    vTaskDelay(pdMS_TO_TICKS(DHT20_CONVERSION_MS));
+    uint8_t data[7];
+    for (uint8_t poll = 0;; poll++) {
+        if (_wire.requestFrom(_address, (uint8_t)sizeof(data)) != sizeof(data)) return false;
+        for (uint8_t i = 0; i < sizeof(data); i++) data[i] = _wire.read();
+        if (!(data[0] & 0x80)) break;
+        if (poll >= DHT20_BUSY_POLLS) return false;
+        vTaskDelay(pdMS_TO_TICKS(DHT20_BUSY_POLL_MS));
+    }
+    if (crc8(data, 6) != data[6]) return false;
+
+    // 20-bit humidity then 20-bit temperature, sharing the middle byte
+    uint32_t rawHumidity = ((uint32_t)data[1] << 12) | ((uint32_t)data[2] << 4) | (data[3] >> 4);
+    uint32_t rawTemperature = ((uint32_t)(data[3] & 0x0F) << 16) | ((uint32_t)data[4] << 8) | data[5];
+    humidity = rawHumidity / 1048576.0f;
+    temperatureC = rawTemperature / 1048576.0f * 200.0f - 50.0f;
+    return true;
+}
+
+uint8_t Dht20Sampler::crc8(const uint8_t* data, uint8_t length) {
+    // polynomial x^8 + x^5 + x^4 + 1, initial value 0xFF
+    uint8_t crc = 0xFF;
+    for (uint8_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (uint8_t bit = 0; bit < 8; bit++) crc = (crc & 0x80) ? (crc << 1) ^ 0x31 : crc << 1;
+    }
+    return crc;
+}
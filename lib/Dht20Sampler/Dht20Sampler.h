@@ -0,0 +1,74 @@
+#ifndef DHT20_SAMPLER_H
+#define DHT20_SAMPLER_H
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <Seqlock.h>
+
+#define DHT20_I2C_ADDRESS 0x38
+
+// The datasheet asks for at least 1 s between measurements so the sensor does
+// not warm itself; air temperature moves far slower than this anyway
+#define DHT20_SAMPLE_INTERVAL_MS 2000
+
+// Conversion time after the trigger command; the busy bit is polled at
+// DHT20_BUSY_POLL_MS past it, for at most DHT20_BUSY_POLLS more reads
+#define DHT20_CONVERSION_MS 80
+#define DHT20_BUSY_POLL_MS 10
+#define DHT20_BUSY_POLLS 5
+
+// Lowest priority above idle: sampling only ever waits on the bus and the
+// conversion, and nothing depends on it being prompt
+#define DHT20_TASK_STACK 2048
+#define DHT20_TASK_PRIORITY 1
+
+// Latest reading, published as one value
+typedef struct {
+    float temperatureC;
+    float humidity;       // relative, 0..1
+    uint32_t takenAtMs;   // millis() of the measurement, 0 if there has been none
+    uint32_t samples;     // measurements that passed the CRC
+    uint32_t errors;      // no answer, stuck busy or bad CRC
+} climate_snapshot_t;
+
+// DHT20 temperature/humidity sampled by a background task.
+//
+// The task triggers a measurement, sleeps through the conversion and reads
+// temperature and humidity in one 7-byte transfer, then publishes them behind
+// a seqlock. Readers take the cached value without touching the I2C bus, so a
+// heartbeat or ack costs a copy instead of two blocking conversions.
+//
+// A failed measurement keeps the last good reading and counts an error; the
+// age of the reading is in takenAtMs.
+class Dht20Sampler {
+public:
+    explicit Dht20Sampler(TwoWire& wire = Wire, uint8_t address = DHT20_I2C_ADDRESS);
+
+    // Start the bus and, unless background is false, the sampling task. With
+    // background false the caller runs update() itself.
+    void begin(bool background = true);
+
+    // One measurement and publish; blocks for the conversion, so only the
+    // sampling task may call it
+    bool update();
+
+    // Latest reading; O(1) and safe from any task
+    climate_snapshot_t snapshot() const { return _snapshot.read(); }
+
+private:
+    static void samplingTask(void* arg);
+    bool calibrate();
+    bool measure(float& temperatureC, float& humidity);
+    static uint8_t crc8(const uint8_t* data, uint8_t length);
+
+    TwoWire& _wire;
+    uint8_t _address;
+    TaskHandle_t _task;
+    climate_snapshot_t _latest; // only the sampler writes it
+    Seqlock<climate_snapshot_t> _snapshot;
+    portMUX_TYPE _writeLock = portMUX_INITIALIZER_UNLOCKED;
+};
+
+#endif
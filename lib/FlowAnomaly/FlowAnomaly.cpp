@@ -0,0 +1,179 @@
+#include "FlowAnomaly.h"
+#include <math.h>
+
+const char* flowAlertName(FlowAlertType type) {
+    switch (type) {
+    case FLOW_ALERT_LEAK: return "leak";
+    case FLOW_ALERT_BURST: return "burst";
+    case FLOW_ALERT_BLOCKED: return "blocked";
+    }
+    return "unknown";
+}
+
+FlowAnomalyDetector::FlowAnomalyDetector()
+    : _zones(), _sensors(), _started(false), _busy(false), _checkedAt(0), _pending(), _pendingCount(0), _dropped(0) {}
+
+uint32_t FlowAnomalyDetector::msUntilCheck(uint32_t nowMs) const {
+    if (!_started) return 0;
+    uint32_t interval = _busy ? FLOW_ANOMALY_INTERVAL_MS : FLOW_ANOMALY_IDLE_INTERVAL_MS;
+    uint32_t elapsed = nowMs - _checkedAt;
+    return elapsed >= interval ? 0 : interval - elapsed;
+}
+
+void FlowAnomalyDetector::check(const flow_bank_snapshot_t& flow, uint8_t zoneCount, uint32_t openZones,
+                                uint32_t nowMs) {
+    if (msUntilCheck(nowMs) > 0) return;
+
+    if (!_started) {
+        // the first readings are the baseline of every counter; nothing has changed yet
+        for (uint8_t zone = 0; zone < FLOW_ANOMALY_MAX_ZONES; zone++) _zones[zone].changedAt = nowMs;
+        for (uint8_t i = 0; i < FLOW_BANK_MAX_SENSORS; i++) {
+            _sensors[i].changedAt = nowMs;
+            _sensors[i].pulses = flow.sensors[i].lifetimePulses;
+        }
+    }
+    _busy = openZones != 0;
+    for (uint8_t zone = 0; zone < zoneCount && zone < FLOW_ANOMALY_MAX_ZONES; zone++)
+        checkZone(zone, flow, openZones, nowMs);
+    for (uint8_t i = 0; i < flow.count; i++) checkSensor(i, flow, openZones, nowMs);
+    _started = true;
+    _checkedAt = nowMs;
+}
+
+void FlowAnomalyDetector::checkZone(uint8_t zone, const flow_bank_snapshot_t& flow, uint32_t openZones,
+                                    uint32_t nowMs) {
+    zone_state_t& state = _zones[zone];
+    bool metered = false;
+    uint64_t pulses = 0;
+    for (uint8_t i = 0; i < flow.count; i++) {
+        if (!FlowSensorBank::meters(flow, i, zone)) continue;
+        metered = true;
+        pulses += flow.sensors[i].lifetimePulses;
+    }
+
+    bool open = (openZones >> zone) & 1;
+    if (open != state.open || !_started) {
+        state.open = open;
+        state.changedAt = nowMs;
+        state.pulsesAtOn = pulses;
+        state.lastPulseAt = nowMs;
+        state.cusum = 0;
+        state.raised = 0;
+    }
+    if (pulses != state.pulses) state.lastPulseAt = nowMs;
+    state.pulses = pulses;
+    if (!open || !metered) return;
+
+    float rate = FlowSensorBank::zoneInstantLpm(flow, zone);
+    float baseline = baselineLpm(zone);
+    uint32_t sinceOn = static_cast<uint32_t>(pulses - state.pulsesAtOn);
+
+    if (nowMs - state.lastPulseAt >= FLOW_ANOMALY_BLOCKED_MS) {
+        if (!(state.raised & (1 << FLOW_ALERT_BLOCKED))) {
+            raise(FLOW_ALERT_BLOCKED, zone, rate, baseline, sinceOn);
+            state.raised |= 1 << FLOW_ALERT_BLOCKED;
+        }
+        return;
+    }
+    state.raised &= ~(1 << FLOW_ALERT_BLOCKED);
+
+    // filling, stopped, or mixed with another zone's water: neither judged nor learned
+    if (nowMs - state.changedAt < FLOW_ANOMALY_SETTLE_MS || rate <= 0 || sharesMeter(flow, zone, openZones)) return;
+
+    if (baseline > 0) {
+        float deviation = sqrtf(state.m2 / (state.samples - 1));
+        float sigma = max(deviation, FLOW_ANOMALY_MIN_SIGMA * state.mean);
+        state.cusum = max(0.0f, state.cusum + (rate - state.mean) / sigma - FLOW_ANOMALY_CUSUM_K);
+        if (state.cusum > FLOW_ANOMALY_CUSUM_H) {
+            if (!(state.raised & (1 << FLOW_ALERT_BURST))) {
+                raise(FLOW_ALERT_BURST, zone, rate, baseline, sinceOn);
+                state.raised |= 1 << FLOW_ALERT_BURST;
+            }
+            return; // a burst must not become the new normal
+        }
+        if (state.cusum == 0) state.raised &= ~(1 << FLOW_ALERT_BURST);
+        if (state.raised & (1 << FLOW_ALERT_BURST)) return;
+    }
+
+    // Welford update; at the cap the oldest weight is dropped first so the baseline keeps adapting
+    if (state.samples >= FLOW_ANOMALY_MAX_SAMPLES)
+        state.m2 *= static_cast<float>(state.samples - 1) / state.samples;
+    else
+        state.samples++;
+    float delta = rate - state.mean;
+    state.mean += delta / state.samples;
+    state.m2 += delta * (rate - state.mean);
+}
+
+void FlowAnomalyDetector::checkSensor(uint8_t index, const flow_bank_snapshot_t& flow, uint32_t openZones,
+                                      uint32_t nowMs) {
+    sensor_state_t& state = _sensors[index];
+    const flow_snapshot_t& sensor = flow.sensors[index];
+
+    // a main line carries every zone's water, even where a branch meter is what the zone reads
+    uint8_t zone = flow.zones[index];
+    bool expected = zone == FLOW_BANK_ZONE_ANY ? openZones != 0 : zone < FLOW_ANOMALY_MAX_ZONES && ((openZones >> zone) & 1);
+    if (expected != state.expected) {
+        state.expected = expected;
+        state.changedAt = nowMs;
+        state.raised = false;
+    }
+    if (expected) return;
+
+    if (nowMs - state.changedAt < FLOW_ANOMALY_DRAIN_MS) {
+        // whatever drains out of the line is not a leak
+        state.pulses = sensor.lifetimePulses;
+        _busy = true;
+        return;
+    }
+
+    uint64_t leaked = sensor.lifetimePulses - state.pulses;
+    if (state.raised) {
+        // re-arm once the leak has stopped, so the next one is reported too
+        if (!sensor.flowing) {
+            state.raised = false;
+            state.pulses = sensor.lifetimePulses;
+        }
+        return;
+    }
+    if (leaked >= FLOW_ANOMALY_LEAK_PULSES) {
+        raise(FLOW_ALERT_LEAK, flow.zones[index], sensor.instantLpm, 0, leaked);
+        state.raised = true;
+    }
+    if (leaked > 0) _busy = true;
+}
+
+bool FlowAnomalyDetector::sharesMeter(const flow_bank_snapshot_t& flow, uint8_t zone, uint32_t openZones) {
+    for (uint8_t i = 0; i < flow.count; i++) {
+        if (!FlowSensorBank::meters(flow, i, zone)) continue;
+        // a branch meter carries only its own zone; the main line carries all of them
+        if (flow.zones[i] == FLOW_BANK_ZONE_ANY && (openZones & ~(1UL << zone)) != 0) return true;
+    }
+    return false;
+}
+
+float FlowAnomalyDetector::baselineLpm(uint8_t zone) const {
+    return _zones[zone].samples >= FLOW_ANOMALY_MIN_SAMPLES ? _zones[zone].mean : 0;
+}
+
+void FlowAnomalyDetector::raise(FlowAlertType type, uint8_t zone, float rateLpm, float baselineLpm,
+                                uint64_t pulses) {
+    if (_pendingCount >= FLOW_ANOMALY_MAX_PENDING) {
+        _dropped++;
+        return;
+    }
+    flow_alert_t& alert = _pending[_pendingCount++];
+    alert.type = type;
+    alert.zone = zone;
+    alert.rateLpm = rateLpm;
+    alert.baselineLpm = baselineLpm;
+    alert.pulses = pulses > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(pulses);
+}
+
+bool FlowAnomalyDetector::nextAlert(flow_alert_t& alert) {
+    if (_pendingCount == 0) return false;
+    alert = _pending[0];
+    _pendingCount--;
+    for (uint8_t i = 0; i < _pendingCount; i++) _pending[i] = _pending[i + 1];
+    return true;
+}
@@ -0,0 +1,127 @@
+#ifndef FLOW_ANOMALY_H
+#define FLOW_ANOMALY_H
+
+#include <Arduino.h>
+#include <FlowSensorBank.h>
+
+// Zones tracked; matches MAX_ZONES of the scheduler
+#define FLOW_ANOMALY_MAX_ZONES 32
+
+// Checks run this often while a zone is open or a line is draining, and at
+// the idle interval otherwise
+#define FLOW_ANOMALY_INTERVAL_MS 1000
+#define FLOW_ANOMALY_IDLE_INTERVAL_MS 5000
+
+// After a relay turns on, the line fills for this long before its rate is
+// judged or learned
+#define FLOW_ANOMALY_SETTLE_MS 5000
+
+// An open zone whose meters see no pulse for this long is blocked
+#define FLOW_ANOMALY_BLOCKED_MS 5000
+
+// After a relay turns off, pulses are the valve closing and the line draining
+// for this long; past it, this many pulses on a meter no open zone feeds are a
+// leak (5 pulses is about 11 mL on a YF-S201)
+#define FLOW_ANOMALY_DRAIN_MS 5000
+#define FLOW_ANOMALY_LEAK_PULSES 5
+
+// Baseline: a zone's rate is learned from this many steady one-second samples
+// before bursts are judged against it; past FLOW_ANOMALY_MAX_SAMPLES the
+// oldest samples fade out so the baseline follows slow changes (filters
+// clogging, pressure drifting over the seasons)
+#define FLOW_ANOMALY_MIN_SAMPLES 10
+#define FLOW_ANOMALY_MAX_SAMPLES 600
+
+// CUSUM on the rate in units of the baseline's standard deviation, which is
+// taken as at least FLOW_ANOMALY_MIN_SIGMA of the mean so a perfectly steady
+// line does not alarm on noise: drift allowance K, alarm threshold H. A rate
+// at 2x baseline alarms on the first sample, +30% in two.
+#define FLOW_ANOMALY_CUSUM_K 0.5f
+#define FLOW_ANOMALY_CUSUM_H 5.0f
+#define FLOW_ANOMALY_MIN_SIGMA 0.1f
+
+// Alerts raised but not yet taken by nextAlert(); further ones are dropped
+#define FLOW_ANOMALY_MAX_PENDING 8
+
+enum FlowAlertType {
+    FLOW_ALERT_LEAK,    // pulses on a meter while no zone it feeds is open
+    FLOW_ALERT_BURST,   // an open zone's rate far above its baseline
+    FLOW_ALERT_BLOCKED  // an open zone with no pulses
+};
+
+typedef struct {
+    FlowAlertType type;
+    uint8_t zone;        // FLOW_BANK_ZONE_ANY for a leak on the main line
+    float rateLpm;       // instantaneous rate when raised
+    float baselineLpm;   // learned rate of the zone, 0 if none yet
+    uint32_t pulses;     // leaked pulses (leak), pulses since the relay turned on (others)
+} flow_alert_t;
+
+// "leak", "burst" or "blocked"
+const char* flowAlertName(FlowAlertType type);
+
+// Streaming leak and anomaly detector over FlowSensorBank snapshots, in
+// constant memory. Each zone keeps a Welford mean/variance of its steady
+// instantaneous rate across cycles and a one-sided CUSUM against it; each
+// sensor keeps the pulse count at which it was last expected to stop. An
+// alert is raised once per episode and re-armed when the condition clears.
+//
+// check() is cheap and may be called at any rate; it only evaluates once its
+// interval has passed. Zones that read a shared main line while another zone
+// on it is open are not judged for bursts, since their rate is not their own.
+class FlowAnomalyDetector {
+public:
+    FlowAnomalyDetector();
+
+    // Evaluate the latest readings against the relays (bit n of openZones set
+    // while zone n is on); raised alerts queue for nextAlert()
+    void check(const flow_bank_snapshot_t& flow, uint8_t zoneCount, uint32_t openZones, uint32_t nowMs);
+
+    // How long until check() next evaluates
+    uint32_t msUntilCheck(uint32_t nowMs) const;
+
+    // Take the oldest raised alert
+    bool nextAlert(flow_alert_t& alert);
+
+    // Learned steady rate of a zone, 0 until FLOW_ANOMALY_MIN_SAMPLES are in
+    float baselineLpm(uint8_t zone) const;
+
+    uint32_t alertsDropped() const { return _dropped; }
+
+private:
+    typedef struct {
+        bool open;
+        uint32_t changedAt;    // millis() the relay last switched
+        uint64_t pulses;       // zone pulses at the last check
+        uint64_t pulsesAtOn;
+        uint32_t lastPulseAt;  // millis() the zone's pulse count last moved
+        uint32_t samples;      // Welford state of the steady rate
+        float mean;
+        float m2;
+        float cusum;
+        uint8_t raised;        // bit per FlowAlertType, cleared when the condition clears
+    } zone_state_t;
+
+    typedef struct {
+        bool expected;         // a zone whose water passes this sensor is open
+        uint32_t changedAt;
+        uint64_t pulses;       // lifetime pulses when flow last ceased to be expected
+        bool raised;
+    } sensor_state_t;
+
+    void checkZone(uint8_t zone, const flow_bank_snapshot_t& flow, uint32_t openZones, uint32_t nowMs);
+    void checkSensor(uint8_t index, const flow_bank_snapshot_t& flow, uint32_t openZones, uint32_t nowMs);
+    void raise(FlowAlertType type, uint8_t zone, float rateLpm, float baselineLpm, uint64_t pulses);
+    static bool sharesMeter(const flow_bank_snapshot_t& flow, uint8_t zone, uint32_t openZones);
+
+    zone_state_t _zones[FLOW_ANOMALY_MAX_ZONES];
+    sensor_state_t _sensors[FLOW_BANK_MAX_SENSORS];
+    bool _started;
+    bool _busy;                // something open or draining: check at the short interval
+    uint32_t _checkedAt;
+    flow_alert_t _pending[FLOW_ANOMALY_MAX_PENDING];
+    uint8_t _pendingCount;
+    uint32_t _dropped;
+};
+
+#endif
@@ -0,0 +1,94 @@
+#include "FlowEstimator.h"
+
+FlowEstimator::FlowEstimator()
+    : _window(), _head(0), _count(0), _rateIntervals(FLOW_RATE_INTERVALS), _ticksPerMs(1), _flowing(false),
+      _reported(false), _rate(0) {}
+
+void FlowEstimator::begin(uint32_t ticksPerSecond, uint8_t rateIntervals) {
+    _ticksPerMs = ticksPerSecond >= 1000 ? ticksPerSecond / 1000 : 1;
+    _rateIntervals = rateIntervals >= 1 && rateIntervals < FLOW_ESTIMATOR_WINDOW ? rateIntervals : FLOW_RATE_INTERVALS;
+    expire();
+    _reported = false;
+}
+
+const flow_sample_t& FlowEstimator::sampleAt(uint8_t age) const {
+    return _window[(_head + FLOW_ESTIMATOR_WINDOW - age) % FLOW_ESTIMATOR_WINDOW];
+}
+
+void FlowEstimator::addSample(const flow_sample_t& sample) {
+    if (_count > 0) {
+        const flow_sample_t& newest = sampleAt(0);
+        uint32_t pulses = sample.pulses - newest.pulses;
+        if (pulses == 0) return;
+
+        // slower than the slowest real flow: the run is over and this sample starts the next one
+        uint64_t limit = static_cast<uint64_t>(pulses) * FLOW_MAX_PULSE_PERIOD_MS * _ticksPerMs;
+        if (sample.ticks - newest.ticks > limit) {
+            _flowing = false;
+            _count = 0;
+        }
+    }
+
+    _head = (_head + 1) % FLOW_ESTIMATOR_WINDOW;
+    _window[_head] = sample;
+    if (_count < FLOW_ESTIMATOR_WINDOW) _count++;
+    if (_count >= 2) _flowing = true;
+}
+
+uint32_t FlowEstimator::stopAfterTicks() const {
+    // the longest recent interval, so one glitch landing just after a pulse cannot shorten the wait
+    uint64_t stop = 0;
+    uint8_t span = _count - 1 < _rateIntervals ? _count - 1 : _rateIntervals;
+    for (uint8_t age = 0; age < span; age++) {
+        const flow_sample_t& later = sampleAt(age);
+        const flow_sample_t& earlier = sampleAt(age + 1);
+        uint64_t wait = static_cast<uint64_t>(later.ticks - earlier.ticks) * FLOW_STOP_INTERVALS;
+        uint64_t slowest = static_cast<uint64_t>(later.pulses - earlier.pulses) * FLOW_MAX_PULSE_PERIOD_MS * _ticksPerMs;
+        if (wait > slowest) wait = slowest;
+        if (wait > stop) stop = wait;
+    }
+    uint64_t floor = static_cast<uint64_t>(FLOW_MIN_STOP_MS) * _ticksPerMs;
+    if (stop < floor) stop = floor;
+    return stop > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(stop);
+}
+
+FlowTransition FlowEstimator::update(uint32_t nowTicks) {
+    if (_flowing && nowTicks - sampleAt(0).ticks > stopAfterTicks()) _flowing = false;
+
+    _rate = 0;
+    if (_flowing) {
+        const flow_sample_t& newest = sampleAt(0);
+        uint8_t span = _count - 1 < _rateIntervals ? _count - 1 : _rateIntervals;
+        const flow_sample_t& oldest = sampleAt(span);
+        float pulses = static_cast<float>(newest.pulses - oldest.pulses);
+        uint32_t ticks = newest.ticks - oldest.ticks;
+        float ticksPerSecond = static_cast<float>(_ticksPerMs) * 1000.0f;
+        // samples in the same tick (a glitch riding on a pulse) carry no timing
+        if (ticks > 0) _rate = pulses * ticksPerSecond / ticks;
+
+        // the next sample is overdue, so the flow is at most one average sample's worth over the time waited
+        uint32_t elapsed = nowTicks - newest.ticks;
+        if (elapsed > ticks / span) {
+            float bound = pulses / span * ticksPerSecond / elapsed;
+            if (bound < _rate) _rate = bound;
+        }
+    }
+
+    if (_flowing == _reported) return FLOW_UNCHANGED;
+    _reported = _flowing;
+    return _flowing ? FLOW_STARTED : FLOW_STOPPED;
+}
+
+void FlowEstimator::expire() {
+    _count = 0;
+    _flowing = false;
+    _rate = 0;
+}
+
+int32_t FlowEstimator::msUntilStop(uint32_t nowTicks) const {
+    if (!_flowing) return -1;
+    uint32_t elapsed = nowTicks - sampleAt(0).ticks;
+    uint32_t stop = stopAfterTicks();
+    if (elapsed >= stop) return 0;
+    return static_cast<int32_t>((stop - elapsed + _ticksPerMs - 1) / _ticksPerMs);
+}
@@ -0,0 +1,87 @@
+#ifndef FLOW_ESTIMATOR_H
+#define FLOW_ESTIMATOR_H
+
+#include <stdint.h>
+
+// One pulse-counter event: when it happened (free-running 32-bit tick counter)
+// and the cumulative pulse total at that moment. The GPIO interrupt produces one
+// per pulse; on the PCNT path the accumulator reads the counter every
+// FLOW_UPDATE_INTERVAL_MS and produces one whenever the total has moved.
+typedef struct {
+    uint32_t ticks;
+    uint32_t pulses;
+} flow_sample_t;
+
+enum FlowTransition {
+    FLOW_UNCHANGED,
+    FLOW_STARTED,
+    FLOW_STOPPED
+};
+
+// Samples kept for the rate; by default the rate spans at most FLOW_RATE_INTERVALS of them
+#define FLOW_ESTIMATOR_WINDOW 8
+#define FLOW_RATE_INTERVALS 4
+
+// Flow counts as stopped once no sample has arrived for this many times the
+// longest of the sample intervals the rate spans (but never sooner
+// than FLOW_MIN_STOP_MS)
+#define FLOW_STOP_INTERVALS 3
+#define FLOW_MIN_STOP_MS 20
+
+// A pulse period longer than this is not flow (1 Hz is about 0.13 L/min on a YF-S201)
+#define FLOW_MAX_PULSE_PERIOD_MS 1000
+
+// Instantaneous flow from the spacing of pulse-counter samples. Flow starts
+// with the second sample that follows its predecessor within
+// FLOW_MAX_PULSE_PERIOD_MS per pulse, i.e. after two pulses on the GPIO path;
+// it stops FLOW_STOP_INTERVALS sample periods after the last sample. The rate
+// is pulses over ticks across the most recent samples, and decays as 1/t
+// while the next sample is overdue.
+//
+// Ticks wrap at 2^32; intervals are only valid while shorter than that, so the
+// owner must expire() the estimator if it has not heard from the counter for
+// that long.
+class FlowEstimator {
+public:
+    FlowEstimator();
+
+    // Tick rate of the sample clock; must be set before anything else.
+    // rateIntervals (at most FLOW_ESTIMATOR_WINDOW - 1) is how many sample
+    // intervals the rate and the stop wait look back over; coarse samples need
+    // more of them to average out the pulse that lands either side of a read.
+    void begin(uint32_t ticksPerSecond, uint8_t rateIntervals = FLOW_RATE_INTERVALS);
+
+    // Feed samples in the order they were taken
+    void addSample(const flow_sample_t& sample);
+
+    // Re-evaluate at nowTicks (not earlier than the last sample). Reports the
+    // change of flowing() since the previous update().
+    FlowTransition update(uint32_t nowTicks);
+
+    // Forget all samples, e.g. when the tick counter may have wrapped since the last one
+    void expire();
+
+    bool flowing() const { return _flowing; }
+
+    // Pulses per second as of the last update(); 0 when not flowing
+    float pulsesPerSecond() const { return _rate; }
+
+    // Milliseconds after nowTicks at which update() would declare a stop if no
+    // further sample arrives; -1 while not flowing
+    int32_t msUntilStop(uint32_t nowTicks) const;
+
+private:
+    const flow_sample_t& sampleAt(uint8_t age) const; // 0 is the newest
+    uint32_t stopAfterTicks() const;
+
+    flow_sample_t _window[FLOW_ESTIMATOR_WINDOW];
+    uint8_t _head;   // slot of the newest sample
+    uint8_t _count;  // samples in the current run of flow (0 after expire())
+    uint8_t _rateIntervals;
+    uint32_t _ticksPerMs;
+    bool _flowing;
+    bool _reported;  // flowing() as of the previous update()
+    float _rate;
+};
+
+#endif
@@ -0,0 +1,112 @@
+#include "FlowSensorBank.h"
+
+FlowSensorBank::FlowSensorBank() : _sensors(), _zones(), _count(0), _task(nullptr), _volumeBase() {}
+
+int FlowSensorBank::add(uint8_t pin, uint8_t zone, float calibrationFactor, FlowCounterBackend backend) {
+    if (_count >= FLOW_BANK_MAX_SENSORS) return -1;
+    _sensors[_count] = new WaterFlowSensor(pin, calibrationFactor, backend);
+    _zones[_count] = zone;
+    return _count++;
+}
+
+void FlowSensorBank::begin(bool background) {
+    // no per-sensor tasks: the bank samples them all
+    for (uint8_t i = 0; i < _count; i++) _sensors[i]->begin(false);
+    update();
+
+    // the interrupts were attached on this core, so their cycle-counter timestamps are only comparable here
+    if (background && _count > 0 &&
+        xTaskCreatePinnedToCore(accumulatorTask, "flowbank", FLOW_TASK_STACK, this, FLOW_TASK_PRIORITY, &_task,
+                                xPortGetCoreID()) != pdPASS) {
+        Serial.println("Could not start the flow accumulator task");
+    }
+}
+
+void FlowSensorBank::accumulatorTask(void* arg) {
+    FlowSensorBank* bank = static_cast<FlowSensorBank*>(arg);
+    for (;;) {
+        bank->update();
+        uint32_t waitMs = bank->msUntilUpdate();
+        vTaskDelay(pdMS_TO_TICKS(waitMs > 0 ? waitMs : 1));
+    }
+}
+
+void FlowSensorBank::update() {
+    flow_bank_snapshot_t snapshot = {};
+    snapshot.count = _count;
+    for (uint8_t i = 0; i < _count; i++) {
+        snapshot.zones[i] = _zones[i];
+        _sensors[i]->sample(snapshot.sensors[i]);
+    }
+    publish(snapshot);
+}
+
+void FlowSensorBank::publish(flow_bank_snapshot_t& snapshot) {
+    portENTER_CRITICAL(&_writeLock);
+    for (uint8_t i = 0; i < snapshot.count; i++) {
+        flow_snapshot_t& reading = snapshot.sensors[i];
+        // pulses may have been read just before a reset that read a later total
+        int32_t sinceReset = static_cast<int32_t>(reading.pulses - _volumeBase[i]);
+        reading.totalMilliliters =
+            sinceReset > 0 ? static_cast<uint32_t>(_sensors[i]->pulsesToMilliliters(sinceReset)) : 0;
+    }
+    _snapshot.write(snapshot);
+    portEXIT_CRITICAL(&_writeLock);
+}
+
+uint32_t FlowSensorBank::msUntilUpdate() {
+    uint32_t waitMs = FLOW_UPDATE_INTERVAL_MS;
+    for (uint8_t i = 0; i < _count; i++) waitMs = min(waitMs, _sensors[i]->msUntilUpdate());
+    return waitMs;
+}
+
+bool FlowSensorBank::meters(const uint8_t* zones, uint8_t count, uint8_t index, uint8_t zone) {
+    if (zones[index] == zone) return true;
+    if (zones[index] != FLOW_BANK_ZONE_ANY) return false;
+    // the main line stands in only for zones without a meter of their own
+    for (uint8_t i = 0; i < count; i++) {
+        if (zones[i] == zone) return false;
+    }
+    return true;
+}
+
+void FlowSensorBank::resetZoneVolume(uint8_t zone) {
+    uint32_t totals[FLOW_BANK_MAX_SENSORS];
+    for (uint8_t i = 0; i < _count; i++) {
+        if (meters(_zones, _count, i, zone)) totals[i] = _sensors[i]->pulseCount();
+    }
+
+    portENTER_CRITICAL(&_writeLock);
+    flow_bank_snapshot_t snapshot = _snapshot.read();
+    for (uint8_t i = 0; i < _count; i++) {
+        if (!meters(_zones, _count, i, zone)) continue;
+        _volumeBase[i] = totals[i];
+        snapshot.sensors[i].totalMilliliters = 0;
+    }
+    _snapshot.write(snapshot);
+    portEXIT_CRITICAL(&_writeLock);
+}
+
+uint32_t FlowSensorBank::zoneMilliliters(const flow_bank_snapshot_t& snapshot, uint8_t zone) {
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < snapshot.count; i++) {
+        if (meters(snapshot.zones, snapshot.count, i, zone)) total += snapshot.sensors[i].totalMilliliters;
+    }
+    return total;
+}
+
+float FlowSensorBank::zoneInstantLpm(const flow_bank_snapshot_t& snapshot, uint8_t zone) {
+    float total = 0;
+    for (uint8_t i = 0; i < snapshot.count; i++) {
+        if (meters(snapshot.zones, snapshot.count, i, zone)) total += snapshot.sensors[i].instantLpm;
+    }
+    return total;
+}
+
+float FlowSensorBank::zoneAverageLpm(const flow_bank_snapshot_t& snapshot, uint8_t zone) {
+    float total = 0;
+    for (uint8_t i = 0; i < snapshot.count; i++) {
+        if (meters(snapshot.zones, snapshot.count, i, zone)) total += snapshot.sensors[i].averageLpm;
+    }
+    return total;
+}
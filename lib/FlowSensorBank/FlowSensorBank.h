@@ -0,0 +1,93 @@
+#ifndef FLOW_SENSOR_BANK_H
+#define FLOW_SENSOR_BANK_H
+
+#include <Arduino.h>
+#include <WaterFlowSensor.h>
+
+// One per PCNT unit on the ESP32; GPIO-interrupt sensors count against it too
+#define FLOW_BANK_MAX_SENSORS 8
+
+// Zone of a main-line sensor that meters whichever zone is running
+#define FLOW_BANK_ZONE_ANY 0xFF
+
+// Every sensor's readings, published together
+typedef struct {
+    uint8_t count;
+    uint8_t zones[FLOW_BANK_MAX_SENSORS];
+    flow_snapshot_t sensors[FLOW_BANK_MAX_SENSORS];
+} flow_bank_snapshot_t;
+
+// Several WaterFlowSensors behind one accumulator task and one seqlock.
+//
+// Each sensor keeps its own counter (a PCNT unit while units last, then a GPIO
+// interrupt routed by the IDF's per-pin dispatch to that sensor) and its own
+// timestamp ring. One task samples them all on each pass and publishes a single
+// flow_bank_snapshot_t, so a reader gets every branch's pulses from the same
+// pass in one lock-free read, and the writer takes one critical section per
+// pass rather than one per sensor.
+//
+// Each sensor meters one zone, or FLOW_BANK_ZONE_ANY for a main line. A zone
+// reads the sum of its own sensors, or the main line when it has none, so
+// water through a branch meter is never counted twice.
+class FlowSensorBank {
+public:
+    FlowSensorBank();
+
+    // Register a sensor before begin(). Returns its index, or -1 when the bank is full.
+    int add(uint8_t pin, uint8_t zone, float calibrationFactor = 7.5, FlowCounterBackend backend = FLOW_COUNTER_PCNT);
+
+    uint8_t count() const { return _count; }
+    WaterFlowSensor& sensor(uint8_t index) { return *_sensors[index]; }
+    uint8_t zoneOf(uint8_t index) const { return _zones[index]; }
+
+    // Start every sensor's counter and, unless background is false, the shared
+    // accumulator task on the calling core. Restore lifetime totals first.
+    void begin(bool background = true);
+
+    // One pass over every sensor and one publish; only the accumulator may call it
+    void update();
+
+    // When update() should next run: the soonest any sensor needs it
+    uint32_t msUntilUpdate();
+
+    // Latest readings of every sensor; safe from any task, never blocks the accumulator
+    flow_bank_snapshot_t snapshot() const { return _snapshot.read(); }
+
+    // Restart the volume of the sensors metering zone
+    void resetZoneVolume(uint8_t zone);
+
+    // Whether the sensor at index is one that zone reads
+    static bool meters(const flow_bank_snapshot_t& snapshot, uint8_t index, uint8_t zone) {
+        return meters(snapshot.zones, snapshot.count, index, zone);
+    }
+
+    // Totals over the sensors that meter zone
+    static uint32_t zoneMilliliters(const flow_bank_snapshot_t& snapshot, uint8_t zone);
+    static float zoneInstantLpm(const flow_bank_snapshot_t& snapshot, uint8_t zone);
+    static float zoneAverageLpm(const flow_bank_snapshot_t& snapshot, uint8_t zone);
+
+    // Lifetime volume of one sensor, from its fixed-point calibration
+    uint64_t lifetimeMilliliters(const flow_bank_snapshot_t& snapshot, uint8_t index) const {
+        return _sensors[index]->pulsesToMilliliters(snapshot.sensors[index].lifetimePulses);
+    }
+
+    // Snapshots published so far (passes and resets)
+    uint32_t publishes() const { return _snapshot.writes(); }
+
+private:
+    static void accumulatorTask(void* arg);
+    static bool meters(const uint8_t* zones, uint8_t count, uint8_t index, uint8_t zone);
+    void publish(flow_bank_snapshot_t& snapshot);
+
+    WaterFlowSensor* _sensors[FLOW_BANK_MAX_SENSORS];
+    uint8_t _zones[FLOW_BANK_MAX_SENSORS];
+    uint8_t _count;
+    TaskHandle_t _task;
+
+    // publishing: update() and resetZoneVolume() both write, so writes are serialised
+    Seqlock<flow_bank_snapshot_t> _snapshot;
+    portMUX_TYPE _writeLock = portMUX_INITIALIZER_UNLOCKED;
+    uint32_t _volumeBase[FLOW_BANK_MAX_SENSORS]; // pulse totals at the last reset, guarded by _writeLock
+};
+
+#endif
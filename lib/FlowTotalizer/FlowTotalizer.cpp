@@ -0,0 +1,85 @@
+#include "FlowTotalizer.h"
+
+// on-flash layout of one slot
+typedef struct __attribute__((packed)) {
+    uint32_t sequence;
+    uint64_t pulses;
+    uint32_t crc;
+} totalizer_record_t;
+
+static uint32_t crc32(const uint8_t* data, size_t length) {
+    uint32_t crc = 0xFFFFFFFF;
+    while (length--) {
+        crc ^= *data++;
+        for (uint8_t bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
+// one digit per slot in the key
+static_assert(FLOW_TOTALIZER_SLOTS <= 10, "slot keys hold a single digit");
+
+FlowTotalizer::FlowTotalizer(Preferences& prefs, const char* prefix)
+    : _prefs(prefs), _ready(false), _prefix(), _sequence(0), _saved(0), _savedAt(0), _writes(0) {
+    if (strlen(prefix) > FLOW_TOTALIZER_MAX_PREFIX) {
+        Serial.printf("Flow total key prefix '%s' is too long; the total will not be kept\r\n", prefix);
+        return;
+    }
+    strcpy(_prefix, prefix);
+    _ready = true;
+}
+
+void FlowTotalizer::slotKey(uint8_t slot, char (&key)[FLOW_TOTALIZER_KEY_SIZE]) const {
+    snprintf(key, sizeof(key), "%s%c", _prefix, static_cast<char>('0' + slot));
+}
+
+uint64_t FlowTotalizer::load() {
+    if (!_ready) return 0;
+    bool found = false;
+    for (uint8_t slot = 0; slot < FLOW_TOTALIZER_SLOTS; slot++) {
+        char key[FLOW_TOTALIZER_KEY_SIZE];
+        slotKey(slot, key);
+        totalizer_record_t record;
+        if (_prefs.getBytesLength(key) != sizeof(record) ||
+            _prefs.getBytes(key, &record, sizeof(record)) != sizeof(record) ||
+            record.crc != crc32(reinterpret_cast<const uint8_t*>(&record), offsetof(totalizer_record_t, crc)))
+            continue;
+        // sequence numbers only grow, so the newest record wins even after the counter wraps
+        if (!found || static_cast<int32_t>(record.sequence - _sequence) > 0) {
+            _sequence = record.sequence;
+            _saved = record.pulses;
+            found = true;
+        }
+    }
+    _savedAt = millis();
+    return _saved;
+}
+
+void FlowTotalizer::service(uint64_t lifetimePulses) {
+    if (lifetimePulses - _saved >= FLOW_TOTALIZER_MIN_PULSES && millis() - _savedAt >= FLOW_TOTALIZER_INTERVAL_MS)
+        write(lifetimePulses);
+}
+
+void FlowTotalizer::flush(uint64_t lifetimePulses) {
+    if (lifetimePulses != _saved) write(lifetimePulses);
+}
+
+void FlowTotalizer::write(uint64_t lifetimePulses) {
+    if (!_ready) return;
+    totalizer_record_t record;
+    record.sequence = _sequence + 1;
+    record.pulses = lifetimePulses;
+    record.crc = crc32(reinterpret_cast<const uint8_t*>(&record), offsetof(totalizer_record_t, crc));
+
+    char key[FLOW_TOTALIZER_KEY_SIZE];
+    slotKey(record.sequence % FLOW_TOTALIZER_SLOTS, key);
+    _savedAt = millis();
+    if (_prefs.putBytes(key, &record, sizeof(record)) != sizeof(record)) {
+        // try again after the next interval
+        Serial.println("Failed to write flow total to NVS");
+        return;
+    }
+    _sequence = record.sequence;
+    _saved = lifetimePulses;
+    _writes++;
+}
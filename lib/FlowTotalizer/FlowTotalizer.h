@@ -0,0 +1,58 @@
+#ifndef FLOW_TOTALIZER_H
+#define FLOW_TOTALIZER_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+
+// Records rotate over this many NVS keys, so each flash write lands on a
+// different key and a write torn by power loss still leaves the previous
+// total intact in another slot
+#define FLOW_TOTALIZER_SLOTS 8
+
+// NVS keys are at most 15 characters; a key is the prefix plus one slot digit
+#define FLOW_TOTALIZER_KEY_SIZE 16
+#define FLOW_TOTALIZER_MAX_PREFIX (FLOW_TOTALIZER_KEY_SIZE - 2)
+
+// Write at most once per interval, and only once this many pulses have
+// accumulated (450 is 1 L on a YF-S201)
+#define FLOW_TOTALIZER_INTERVAL_MS 60000
+#define FLOW_TOTALIZER_MIN_PULSES 450
+
+// Persists the lifetime pulse count of a flow sensor across reboots. Each
+// record carries a sequence number and a CRC; load() returns the newest valid
+// one. Call service() regularly with the running total (and flush() before a
+// planned restart); a power cut loses at most one interval of counting.
+class FlowTotalizer {
+public:
+    // prefix names the NVS keys (prefix + slot digit). A prefix longer than
+    // FLOW_TOTALIZER_MAX_PREFIX is rejected: ready() is false, load() returns
+    // 0 and nothing is written.
+    FlowTotalizer(Preferences& prefs, const char* prefix = "flowtot");
+
+    // Newest valid stored total, 0 if none
+    uint64_t load();
+
+    // Persist the total once enough has flowed and the interval has passed
+    void service(uint64_t lifetimePulses);
+
+    // Persist the total now if anything is unsaved
+    void flush(uint64_t lifetimePulses);
+
+    bool ready() const { return _ready; }
+    uint64_t saved() const { return _saved; }
+    uint32_t writes() const { return _writes; }
+
+private:
+    void write(uint64_t lifetimePulses);
+    void slotKey(uint8_t slot, char (&key)[FLOW_TOTALIZER_KEY_SIZE]) const;
+
+    Preferences& _prefs;
+    bool _ready;
+    char _prefix[FLOW_TOTALIZER_MAX_PREFIX + 1];
+    uint32_t _sequence; // of the newest record in flash
+    uint64_t _saved;    // total in the newest record
+    uint32_t _savedAt;  // millis() of the last write (or load)
+    uint32_t _writes;
+};
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef NATIVE_SHIM_ARDUINO_H
+#define NATIVE_SHIM_ARDUINO_H
+
+// Host stand-in for the parts of the Arduino-ESP32 core used by the libraries
+// in lib/. Only built for env:native.
+//
+// Time is virtual: millis() and micros() move only when delay(), vTaskDelay()
+// or shimAdvanceMicros() move them, so schedule code can be stepped exactly.
+
+#include <ctype.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+
+using std::max;
+using std::min;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+#define IRAM_ATTR
+
+#define SHIM_PIN_COUNT 40
+#define digitalPinToInterrupt(pin) (((pin) < SHIM_PIN_COUNT) ? (pin) : -1)
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+void attachInterruptArg(uint8_t pin, void (*handler)(void*), void* arg, int mode);
+void detachInterrupt(uint8_t pin);
+void noInterrupts();
+void interrupts();
+
+// CPU clock of the modelled board; the cycle counter runs at this rate off the virtual clock
+#define SHIM_CPU_MHZ 240
+uint32_t getCpuFrequencyMhz();
+
+class EspClass {
+public:
+    uint32_t getCycleCount();
+};
+
+extern EspClass ESP;
+
+// Just enough of Arduino's String for MQTT callbacks
+class String {
+public:
+    String(const char* s = "") : _s(s ? s : "") {}
+    String(const std::string& s) : _s(s) {}
+
+    const char* c_str() const { return _s.c_str(); }
+    unsigned int length() const { return _s.length(); }
+    bool equals(const char* s) const { return _s == s; }
+    bool equals(const String& s) const { return _s == s._s; }
+    bool operator==(const char* s) const { return _s == s; }
+    String operator+(const String& rhs) const { return String(_s + rhs._s); }
+    String operator+(const char* rhs) const { return String(_s + rhs); }
+    friend String operator+(const char* lhs, const String& rhs) { return String(lhs + rhs._s); }
+
+private:
+    std::string _s;
+};
+
+// Serial writes to stdout; shimSerialMute() silences it for long simulations
+class HardwareSerial {
+public:
+    void begin(unsigned long) {}
+
+    size_t print(const char* s);
+    size_t print(const String& s) { return print(s.c_str()); }
+    size_t print(char c);
+    size_t print(int n) { return print(static_cast<long>(n)); }
+    size_t print(unsigned int n) { return print(static_cast<unsigned long>(n)); }
+    size_t print(long n);
+    size_t print(unsigned long n);
+    size_t print(double n, int digits = 2);
+
+    size_t println() { return print("\r\n"); }
+    template <typename T>
+    size_t println(const T& value) { return print(value) + println(); }
+    size_t println(double n, int digits) { return print(n, digits) + println(); }
+
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+extern HardwareSerial Serial;
+
+// --- shim controls, not part of the Arduino API ---
+
+// move the virtual clock forward
+void shimAdvanceMicros(uint64_t us);
+uint64_t shimMicros64();
+
+// Wall clock standing in for time(nullptr) after NTP sync. Before shimSetEpoch()
+// (or after shimSetEpoch(0)) it reports seconds since boot, as the ESP32 does.
+void shimSetEpoch(time_t epoch);
+time_t shimTime();
+
+// Power cycle: virtual clock back to 0, wall clock unset, pins low, interrupt
+// handlers detached and PCNT units unconfigured. Preferences keep their contents, as NVS does.
+void shimReboot();
+
+// run the handler attached to pin as if its edge had arrived
+void shimTriggerInterrupt(uint8_t pin);
+
+// run an interrupt handler (GPIO or peripheral) and count the ISR entry
+void shimRunInterrupt(void (*handler)(void*), void* arg);
+uint32_t shimInterruptCount();
+
+void shimSerialMute(bool mute);
+
+#endif
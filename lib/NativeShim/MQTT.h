@@ -0,0 +1,61 @@
+#ifndef NATIVE_SHIM_MQTT_H
+#define NATIVE_SHIM_MQTT_H
+
+#include <Arduino.h>
+
+// network client handed to MQTTClient::begin(); no sockets on the host
+class Client {};
+class WiFiClient : public Client {};
+
+typedef void (*MQTTClientCallbackSimple)(String& topic, String& payload);
+
+// Loopback MQTTClient: connect() always succeeds, publishes are recorded and
+// shimDeliver() feeds a message to the onMessage() callback as loop() would.
+class MQTTClient {
+public:
+    explicit MQTTClient(int bufSize = 128) { (void)bufSize; }
+
+    void begin(const char* hostname, int port, Client& client) { (void)hostname, (void)port, (void)client; }
+    void onMessage(MQTTClientCallbackSimple callback) { _callback = callback; }
+
+    bool connect(const char* clientId, const char* username = nullptr, const char* password = nullptr) {
+        (void)clientId, (void)username, (void)password;
+        _connected = true;
+        return true;
+    }
+    bool connected() { return _connected; }
+    bool disconnect() {
+        _connected = false;
+        return true;
+    }
+    bool subscribe(const char* topic) { return _connected && topic != nullptr; }
+    bool loop() { return _connected; }
+
+    bool publish(const char* topic, const char* payload) {
+        if (!_connected) return false;
+        _lastTopic = topic;
+        _lastPayload = payload;
+        _published++;
+        return true;
+    }
+    bool publish(const char* topic, const String& payload) { return publish(topic, payload.c_str()); }
+
+    // --- shim controls ---
+    void shimDeliver(const char* topic, const char* payload) {
+        String t(topic), p(payload);
+        if (_callback) _callback(t, p);
+    }
+    void shimSetConnected(bool connected) { _connected = connected; }
+    uint32_t shimPublished() const { return _published; }
+    const std::string& shimLastTopic() const { return _lastTopic; }
+    const std::string& shimLastPayload() const { return _lastPayload; }
+
+private:
+    MQTTClientCallbackSimple _callback = nullptr;
+    bool _connected = false;
+    uint32_t _published = 0;
+    std::string _lastTopic;
+    std::string _lastPayload;
+};
+
+#endif
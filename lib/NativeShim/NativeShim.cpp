@@ -0,0 +1,139 @@
+#include "Arduino.h"
+#include <stdarg.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+#include <driver/pcnt.h>
+#include <Wire.h>
+#include <chrono>
+
+HardwareSerial Serial;
+
+static uint64_t virtualMicros = 0;
+
+// wall clock as (epoch at the moment it was set, virtual time at that moment)
+static time_t epochBase = 0;
+static uint64_t epochSetAt = 0;
+
+static uint8_t pinLevels[SHIM_PIN_COUNT];
+static void (*pinHandlers[SHIM_PIN_COUNT])(void*);
+static void* pinHandlerArgs[SHIM_PIN_COUNT];
+
+static uint32_t interruptCount = 0;
+
+static bool serialMuted = false;
+
+uint32_t millis() { return static_cast<uint32_t>(virtualMicros / 1000); }
+uint32_t micros() { return static_cast<uint32_t>(virtualMicros); }
+void delay(uint32_t ms) { virtualMicros += static_cast<uint64_t>(ms) * 1000; }
+void delayMicroseconds(uint32_t us) { virtualMicros += us; }
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    if (pin < SHIM_PIN_COUNT && mode == INPUT_PULLUP) pinLevels[pin] = HIGH;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+    if (pin < SHIM_PIN_COUNT) pinLevels[pin] = val ? HIGH : LOW;
+}
+
+int digitalRead(uint8_t pin) { return pin < SHIM_PIN_COUNT ? pinLevels[pin] : LOW; }
+
+void attachInterruptArg(uint8_t pin, void (*handler)(void*), void* arg, int) {
+    if (pin >= SHIM_PIN_COUNT) return;
+    pinHandlers[pin] = handler;
+    pinHandlerArgs[pin] = arg;
+}
+
+void detachInterrupt(uint8_t pin) {
+    if (pin < SHIM_PIN_COUNT) pinHandlers[pin] = nullptr;
+}
+
+// handlers only run from shimTriggerInterrupt() on the calling thread
+void noInterrupts() {}
+void interrupts() {}
+
+size_t HardwareSerial::print(const char* s) {
+    if (serialMuted) return strlen(s);
+    return fputs(s, stdout) < 0 ? 0 : strlen(s);
+}
+
+size_t HardwareSerial::print(char c) {
+    if (!serialMuted) putchar(c);
+    return 1;
+}
+
+size_t HardwareSerial::print(long n) { return printf("%ld", n); }
+size_t HardwareSerial::print(unsigned long n) { return printf("%lu", n); }
+size_t HardwareSerial::print(double n, int digits) { return printf("%.*f", digits, n); }
+
+size_t HardwareSerial::printf(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int written = serialMuted ? vsnprintf(nullptr, 0, format, args) : vprintf(format, args);
+    va_end(args);
+    return written < 0 ? 0 : static_cast<size_t>(written);
+}
+
+void shimAdvanceMicros(uint64_t us) { virtualMicros += us; }
+uint64_t shimMicros64() { return virtualMicros; }
+
+void shimSetEpoch(time_t epoch) {
+    epochBase = epoch;
+    epochSetAt = virtualMicros;
+}
+
+time_t shimTime() {
+    if (epochBase == 0) return static_cast<time_t>(virtualMicros / 1000000);
+    return epochBase + static_cast<time_t>((virtualMicros - epochSetAt) / 1000000);
+}
+
+void shimReboot() {
+    virtualMicros = 0;
+    epochBase = 0;
+    epochSetAt = 0;
+    memset(pinLevels, 0, sizeof(pinLevels));
+    memset(pinHandlers, 0, sizeof(pinHandlers));
+    memset(pinHandlerArgs, 0, sizeof(pinHandlerArgs));
+    shimPcntReset();
+}
+
+void shimTriggerInterrupt(uint8_t pin) {
+    if (pin < SHIM_PIN_COUNT && pinHandlers[pin]) shimRunInterrupt(pinHandlers[pin], pinHandlerArgs[pin]);
+}
+
+void shimRunInterrupt(void (*handler)(void*), void* arg) {
+    interruptCount++;
+    handler(arg);
+}
+
+uint32_t shimInterruptCount() { return interruptCount; }
+
+EspClass ESP;
+
+uint32_t getCpuFrequencyMhz() { return SHIM_CPU_MHZ; }
+uint32_t EspClass::getCycleCount() { return static_cast<uint32_t>(virtualMicros * SHIM_CPU_MHZ); }
+
+void shimSerialMute(bool mute) { serialMuted = mute; }
+
+void vTaskDelay(TickType_t ticks) { virtualMicros += static_cast<uint64_t>(ticks) * portTICK_PERIOD_MS * 1000; }
+TickType_t xTaskGetTickCount() { return static_cast<TickType_t>(millis() / portTICK_PERIOD_MS); }
+
+void vTaskDelayUntil(TickType_t* previousWake, TickType_t ticks) {
+    *previousWake += ticks;
+    TickType_t now = xTaskGetTickCount();
+    if (static_cast<int32_t>(*previousWake - now) > 0) vTaskDelay(*previousWake - now);
+}
+
+TwoWire Wire;
+
+BaseType_t xTaskCreatePinnedToCore(void (*)(void*), const char*, uint32_t, void*, uint32_t, TaskHandle_t* handle,
+                                   BaseType_t) {
+    if (handle) *handle = nullptr;
+    return pdFAIL;
+}
+
+// benchmarks time real work, so this one clock is the host's, not the virtual one
+int64_t esp_timer_get_time() {
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
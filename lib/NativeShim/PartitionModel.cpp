@@ -0,0 +1,65 @@
+#include <Arduino.h>
+#include <esp_partition.h>
+
+#define FLASH_SECTOR 4096
+
+static const esp_partition_t spiffs = {ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, 0x290000,
+                                       SHIM_SPIFFS_SIZE, "spiffs", false};
+static uint8_t flash[SHIM_SPIFFS_SIZE];
+static bool flashInitialised = false;
+static bool tearArmed = false;
+static size_t tearBytes = 0;
+
+static void initialise() {
+    if (flashInitialised) return;
+    memset(flash, 0xFF, sizeof(flash));
+    flashInitialised = true;
+}
+
+static bool inRange(const esp_partition_t* partition, size_t offset, size_t size) {
+    return partition == &spiffs && offset <= partition->size && size <= partition->size - offset;
+}
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char* label) {
+    if (type != spiffs.type || (subtype != spiffs.subtype && subtype != ESP_PARTITION_SUBTYPE_ANY)) return nullptr;
+    if (label != nullptr && strcmp(label, spiffs.label) != 0) return nullptr;
+    initialise();
+    return &spiffs;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size) {
+    if (!inRange(partition, src_offset, size)) return ESP_ERR_INVALID_ARG;
+    memcpy(dst, flash + src_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t dst_offset, const void* src, size_t size) {
+    if (!inRange(partition, dst_offset, size)) return ESP_ERR_INVALID_ARG;
+    size_t written = size;
+    if (tearArmed) {
+        tearArmed = false;
+        written = tearBytes < size ? tearBytes : size;
+    }
+    // NOR flash: programming can only turn 1s into 0s
+    const uint8_t* bytes = static_cast<const uint8_t*>(src);
+    for (size_t i = 0; i < written; i++) flash[dst_offset + i] &= bytes[i];
+    return written == size ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size) {
+    if (!inRange(partition, offset, size) || offset % FLASH_SECTOR != 0 || size % FLASH_SECTOR != 0)
+        return ESP_ERR_INVALID_ARG;
+    memset(flash + offset, 0xFF, size);
+    return ESP_OK;
+}
+
+void shimFlashTearNextWrite(size_t bytes) {
+    tearArmed = true;
+    tearBytes = bytes;
+}
+
+void shimFlashErase() {
+    flashInitialised = false;
+    initialise();
+}
@@ -0,0 +1,158 @@
+#include <Arduino.h>
+#include <driver/pcnt.h>
+
+// APB clock the glitch filter counts in
+#define APB_CLOCK_NS 12.5
+
+typedef struct {
+    bool configured;
+    bool running;
+    int pin;
+    pcnt_count_mode_t posMode;
+    pcnt_count_mode_t negMode;
+    int16_t highLimit;
+    int16_t lowLimit;
+    int16_t count;
+    uint16_t filter;
+    bool filterEnabled;
+    uint32_t events;
+    int16_t threshold0;
+    int16_t threshold1;
+    void (*handler)(void*);
+    void* handlerArg;
+} pcnt_model_t;
+
+static pcnt_model_t units[PCNT_UNIT_MAX];
+static bool serviceInstalled = false;
+
+static bool valid(pcnt_unit_t unit) { return unit >= PCNT_UNIT_0 && unit < PCNT_UNIT_MAX; }
+
+esp_err_t pcnt_unit_config(const pcnt_config_t* config) {
+    if (!valid(config->unit) || config->counter_h_lim <= config->counter_l_lim) return ESP_ERR_INVALID_ARG;
+    pcnt_model_t& u = units[config->unit];
+    u.configured = true;
+    u.running = true;
+    u.pin = config->pulse_gpio_num;
+    u.posMode = config->pos_mode;
+    u.negMode = config->neg_mode;
+    u.highLimit = config->counter_h_lim;
+    u.lowLimit = config->counter_l_lim;
+    u.count = 0;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_get_counter_value(pcnt_unit_t unit, int16_t* count) {
+    if (!valid(unit) || count == nullptr) return ESP_ERR_INVALID_ARG;
+    *count = units[unit].count;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_counter_pause(pcnt_unit_t unit) {
+    if (!valid(unit)) return ESP_ERR_INVALID_ARG;
+    units[unit].running = false;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_counter_resume(pcnt_unit_t unit) {
+    if (!valid(unit)) return ESP_ERR_INVALID_ARG;
+    units[unit].running = true;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_counter_clear(pcnt_unit_t unit) {
+    if (!valid(unit)) return ESP_ERR_INVALID_ARG;
+    units[unit].count = 0;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_set_filter_value(pcnt_unit_t unit, uint16_t filterValue) {
+    if (!valid(unit) || filterValue > 1023) return ESP_ERR_INVALID_ARG;
+    units[unit].filter = filterValue;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_filter_enable(pcnt_unit_t unit) {
+    if (!valid(unit)) return ESP_ERR_INVALID_ARG;
+    units[unit].filterEnabled = true;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_filter_disable(pcnt_unit_t unit) {
+    if (!valid(unit)) return ESP_ERR_INVALID_ARG;
+    units[unit].filterEnabled = false;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_event_enable(pcnt_unit_t unit, pcnt_evt_type_t event) {
+    if (!valid(unit)) return ESP_ERR_INVALID_ARG;
+    units[unit].events |= event;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_event_disable(pcnt_unit_t unit, pcnt_evt_type_t event) {
+    if (!valid(unit)) return ESP_ERR_INVALID_ARG;
+    units[unit].events &= ~static_cast<uint32_t>(event);
+    return ESP_OK;
+}
+
+esp_err_t pcnt_set_event_value(pcnt_unit_t unit, pcnt_evt_type_t event, int16_t value) {
+    if (!valid(unit)) return ESP_ERR_INVALID_ARG;
+    if (event == PCNT_EVT_THRES_0) units[unit].threshold0 = value;
+    else if (event == PCNT_EVT_THRES_1) units[unit].threshold1 = value;
+    else return ESP_ERR_INVALID_ARG; // the limits come from pcnt_unit_config()
+    return ESP_OK;
+}
+
+esp_err_t pcnt_isr_service_install(int) {
+    if (serviceInstalled) return ESP_ERR_INVALID_STATE;
+    serviceInstalled = true;
+    return ESP_OK;
+}
+
+void pcnt_isr_service_uninstall() { serviceInstalled = false; }
+
+esp_err_t pcnt_isr_handler_add(pcnt_unit_t unit, void (*isrHandler)(void*), void* args) {
+    if (!serviceInstalled) return ESP_ERR_INVALID_STATE;
+    if (!valid(unit)) return ESP_ERR_INVALID_ARG;
+    units[unit].handler = isrHandler;
+    units[unit].handlerArg = args;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_isr_handler_remove(pcnt_unit_t unit) {
+    if (!valid(unit)) return ESP_ERR_INVALID_ARG;
+    units[unit].handler = nullptr;
+    return ESP_OK;
+}
+
+static void clock(pcnt_model_t& u, pcnt_count_mode_t mode) {
+    if (mode == PCNT_COUNT_DIS) return;
+    u.count += mode == PCNT_COUNT_INC ? 1 : -1;
+    if (u.count >= u.highLimit || u.count <= u.lowLimit) {
+        // the hardware restarts the counter at either limit, event or not
+        bool high = u.count >= u.highLimit;
+        u.count = 0;
+        if ((u.events & (high ? PCNT_EVT_H_LIM : PCNT_EVT_L_LIM)) && serviceInstalled && u.handler)
+            shimRunInterrupt(u.handler, u.handlerArg);
+        return;
+    }
+    bool threshold = ((u.events & PCNT_EVT_THRES_0) && u.count == u.threshold0) ||
+                     ((u.events & PCNT_EVT_THRES_1) && u.count == u.threshold1);
+    if (threshold && serviceInstalled && u.handler) shimRunInterrupt(u.handler, u.handlerArg);
+}
+
+void shimPulse(uint8_t pin, uint32_t widthNs) {
+    shimTriggerInterrupt(pin);
+    for (int i = 0; i < PCNT_UNIT_MAX; i++) {
+        pcnt_model_t& u = units[i];
+        if (!u.configured || !u.running || u.pin != pin) continue;
+        if (u.filterEnabled && widthNs < u.filter * APB_CLOCK_NS) continue;
+        clock(u, u.negMode); // falling edge starts the low pulse
+        clock(u, u.posMode); // rising edge ends it
+    }
+}
+
+void shimPcntReset() {
+    memset(units, 0, sizeof(units));
+    serviceInstalled = false;
+}
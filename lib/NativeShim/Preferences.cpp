@@ -0,0 +1,78 @@
+#include "Preferences.h"
+#include <string.h>
+
+uint32_t Preferences::_writes = 0;
+
+std::map<std::string, Preferences::Namespace>& Preferences::storage() {
+    static std::map<std::string, Namespace> namespaces;
+    return namespaces;
+}
+
+bool Preferences::begin(const char* name, bool readOnly) {
+    _ns = &storage()[name];
+    _readOnly = readOnly;
+    return true;
+}
+
+void Preferences::end() { _ns = nullptr; }
+
+bool Preferences::clear() {
+    if (!_ns || _readOnly) return false;
+    _ns->clear();
+    return true;
+}
+
+bool Preferences::remove(const char* key) {
+    if (!_ns || _readOnly) return false;
+    return _ns->erase(key) > 0;
+}
+
+bool Preferences::isKey(const char* key) { return _ns && _ns->count(key) > 0; }
+
+size_t Preferences::put(const char* key, const void* value, size_t len) {
+    if (!_ns || _readOnly) return 0;
+    const uint8_t* bytes = static_cast<const uint8_t*>(value);
+    (*_ns)[key].assign(bytes, bytes + len);
+    _writes++;
+    return len;
+}
+
+bool Preferences::get(const char* key, void* value, size_t len) {
+    if (!_ns) return false;
+    Namespace::const_iterator it = _ns->find(key);
+    if (it == _ns->end() || it->second.size() != len) return false;
+    memcpy(value, it->second.data(), len);
+    return true;
+}
+
+size_t Preferences::putInt(const char* key, int32_t value) { return put(key, &value, sizeof(value)); }
+size_t Preferences::putUInt(const char* key, uint32_t value) { return put(key, &value, sizeof(value)); }
+size_t Preferences::putULong(const char* key, uint32_t value) { return put(key, &value, sizeof(value)); }
+size_t Preferences::putBytes(const char* key, const void* value, size_t len) { return put(key, value, len); }
+
+int32_t Preferences::getInt(const char* key, int32_t defaultValue) {
+    int32_t value;
+    return get(key, &value, sizeof(value)) ? value : defaultValue;
+}
+
+uint32_t Preferences::getUInt(const char* key, uint32_t defaultValue) {
+    uint32_t value;
+    return get(key, &value, sizeof(value)) ? value : defaultValue;
+}
+
+uint32_t Preferences::getULong(const char* key, uint32_t defaultValue) { return getUInt(key, defaultValue); }
+
+size_t Preferences::getBytesLength(const char* key) {
+    if (!_ns) return 0;
+    Namespace::const_iterator it = _ns->find(key);
+    return it == _ns->end() ? 0 : it->second.size();
+}
+
+size_t Preferences::getBytes(const char* key, void* buf, size_t maxLen) {
+    size_t len = getBytesLength(key);
+    if (len == 0 || len > maxLen) return 0;
+    memcpy(buf, (*_ns)[key].data(), len);
+    return len;
+}
+
+void Preferences::shimEraseAll() { storage().clear(); }
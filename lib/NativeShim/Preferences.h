@@ -0,0 +1,49 @@
+#ifndef NATIVE_SHIM_PREFERENCES_H
+#define NATIVE_SHIM_PREFERENCES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+// In-memory NVS. Namespaces live for the whole process, so a new Preferences
+// instance after a simulated reboot sees what the previous one wrote.
+class Preferences {
+public:
+    bool begin(const char* name, bool readOnly = false);
+    void end();
+
+    bool clear();
+    bool remove(const char* key);
+    bool isKey(const char* key);
+
+    size_t putInt(const char* key, int32_t value);
+    size_t putUInt(const char* key, uint32_t value);
+    size_t putULong(const char* key, uint32_t value);
+    size_t putBytes(const char* key, const void* value, size_t len);
+
+    int32_t getInt(const char* key, int32_t defaultValue = 0);
+    uint32_t getUInt(const char* key, uint32_t defaultValue = 0);
+    uint32_t getULong(const char* key, uint32_t defaultValue = 0);
+    size_t getBytesLength(const char* key);
+    size_t getBytes(const char* key, void* buf, size_t maxLen);
+
+    // --- shim controls ---
+    static void shimEraseAll();
+    static uint32_t shimWrites() { return _writes; }
+
+private:
+    typedef std::map<std::string, std::vector<uint8_t> > Namespace;
+
+    Namespace* _ns = nullptr;
+    bool _readOnly = false;
+
+    static std::map<std::string, Namespace>& storage();
+    static uint32_t _writes;
+
+    size_t put(const char* key, const void* value, size_t len);
+    bool get(const char* key, void* value, size_t len);
+};
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef NATIVE_SHIM_WIRE_H
+#define NATIVE_SHIM_WIRE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// I2C bus with nothing attached: every address NACKs and reads return nothing
+class TwoWire {
+public:
+    bool begin() { return true; }
+    void beginTransmission(uint8_t address) { (void)address; }
+    size_t write(uint8_t data) { (void)data; return 1; }
+    uint8_t endTransmission(bool sendStop = true) { (void)sendStop; return 2; } // address NACK
+    uint8_t requestFrom(uint8_t address, uint8_t length) { (void)address; (void)length; return 0; }
+    int available() { return 0; }
+    int read() { return -1; }
+};
+
+extern TwoWire Wire;
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef NATIVE_SHIM_PCNT_H
+#define NATIVE_SHIM_PCNT_H
+
+// Model of the ESP-IDF 4.x legacy pulse counter driver. Pulses are fed with
+// shimPulse(); a unit counts the edges its config selects, drops pulses shorter
+// than its glitch filter, and restarts at 0 (running the ISR service handler if
+// PCNT_EVT_H_LIM is enabled) when it reaches counter_h_lim. An enabled
+// PCNT_EVT_THRES_0/1 runs the handler when the count lands on its value.
+
+#include <stdint.h>
+#include <esp_err.h>
+
+typedef enum {
+    PCNT_UNIT_0,
+    PCNT_UNIT_1,
+    PCNT_UNIT_2,
+    PCNT_UNIT_3,
+    PCNT_UNIT_4,
+    PCNT_UNIT_5,
+    PCNT_UNIT_6,
+    PCNT_UNIT_7,
+    PCNT_UNIT_MAX
+} pcnt_unit_t;
+
+typedef enum { PCNT_CHANNEL_0, PCNT_CHANNEL_1, PCNT_CHANNEL_MAX } pcnt_channel_t;
+
+typedef enum { PCNT_COUNT_DIS = 0, PCNT_COUNT_INC = 1, PCNT_COUNT_DEC = 2, PCNT_COUNT_MAX } pcnt_count_mode_t;
+
+typedef enum { PCNT_MODE_KEEP = 0, PCNT_MODE_REVERSE = 1, PCNT_MODE_DISABLE = 2, PCNT_MODE_MAX } pcnt_ctrl_mode_t;
+
+typedef enum {
+    PCNT_EVT_THRES_1 = 1 << 2,
+    PCNT_EVT_THRES_0 = 1 << 3,
+    PCNT_EVT_L_LIM = 1 << 4,
+    PCNT_EVT_H_LIM = 1 << 5,
+    PCNT_EVT_ZERO = 1 << 6
+} pcnt_evt_type_t;
+
+#define PCNT_PIN_NOT_USED (-1)
+
+typedef struct {
+    int pulse_gpio_num;
+    int ctrl_gpio_num;
+    pcnt_ctrl_mode_t lctrl_mode;
+    pcnt_ctrl_mode_t hctrl_mode;
+    pcnt_count_mode_t pos_mode;
+    pcnt_count_mode_t neg_mode;
+    int16_t counter_h_lim;
+    int16_t counter_l_lim;
+    pcnt_unit_t unit;
+    pcnt_channel_t channel;
+} pcnt_config_t;
+
+esp_err_t pcnt_unit_config(const pcnt_config_t* config);
+esp_err_t pcnt_get_counter_value(pcnt_unit_t unit, int16_t* count);
+esp_err_t pcnt_counter_pause(pcnt_unit_t unit);
+esp_err_t pcnt_counter_resume(pcnt_unit_t unit);
+esp_err_t pcnt_counter_clear(pcnt_unit_t unit);
+esp_err_t pcnt_set_filter_value(pcnt_unit_t unit, uint16_t filterValue);
+esp_err_t pcnt_filter_enable(pcnt_unit_t unit);
+esp_err_t pcnt_filter_disable(pcnt_unit_t unit);
+esp_err_t pcnt_event_enable(pcnt_unit_t unit, pcnt_evt_type_t event);
+esp_err_t pcnt_event_disable(pcnt_unit_t unit, pcnt_evt_type_t event);
+esp_err_t pcnt_set_event_value(pcnt_unit_t unit, pcnt_evt_type_t event, int16_t value);
+esp_err_t pcnt_isr_service_install(int intrAllocFlags);
+void pcnt_isr_service_uninstall();
+esp_err_t pcnt_isr_handler_add(pcnt_unit_t unit, void (*isrHandler)(void*), void* args);
+esp_err_t pcnt_isr_handler_remove(pcnt_unit_t unit);
+
+// --- shim controls ---
+
+// A low pulse of widthNs on pin: runs a FALLING/CHANGE GPIO handler attached to
+// the pin and clocks every PCNT unit whose pulse input is the pin.
+void shimPulse(uint8_t pin, uint32_t widthNs);
+
+// Forget every unit and the ISR service (use with shimReboot())
+void shimPcntReset();
+
+#endif
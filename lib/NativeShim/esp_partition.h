@@ -0,0 +1,48 @@
+#ifndef NATIVE_SHIM_ESP_PARTITION_H
+#define NATIVE_SHIM_ESP_PARTITION_H
+
+// Model of the ESP-IDF partition API over RAM flash. Only the "spiffs" data
+// partition of partitions/ota.csv exists, shrunk to SHIM_SPIFFS_SIZE so
+// wrap-around is reached quickly. It behaves as NOR flash: erase sets whole
+// 4 KB sectors to 0xFF and writes can only clear bits. Contents survive
+// shimReboot(), as flash does.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <esp_err.h>
+
+#define SHIM_SPIFFS_SIZE (16 * 4096)
+
+typedef enum { ESP_PARTITION_TYPE_APP = 0x00, ESP_PARTITION_TYPE_DATA = 0x01 } esp_partition_type_t;
+
+typedef enum {
+    ESP_PARTITION_SUBTYPE_DATA_OTA = 0x00,
+    ESP_PARTITION_SUBTYPE_DATA_NVS = 0x02,
+    ESP_PARTITION_SUBTYPE_DATA_SPIFFS = 0x82,
+    ESP_PARTITION_SUBTYPE_ANY = 0xff
+} esp_partition_subtype_t;
+
+typedef struct {
+    esp_partition_type_t type;
+    esp_partition_subtype_t subtype;
+    uint32_t address;
+    uint32_t size;
+    char label[17];
+    bool encrypted;
+} esp_partition_t;
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char* label);
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size);
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t dst_offset, const void* src, size_t size);
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size);
+
+// --- shim controls ---
+
+// power is cut during the next write: only its first bytes reach flash and it fails
+void shimFlashTearNextWrite(size_t bytes);
+
+// every sector back to 0xFF, as a freshly flashed board
+void shimFlashErase();
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef NATIVE_SHIM_ESP_TIMER_H
+#define NATIVE_SHIM_ESP_TIMER_H
+
+#include <stdint.h>
+
+// host monotonic microseconds (real time, unlike micros())
+int64_t esp_timer_get_time();
+
+#endif
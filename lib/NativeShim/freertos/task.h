@@ -0,0 +1,18 @@
+#ifndef NATIVE_SHIM_TASK_H
+#define NATIVE_SHIM_TASK_H
+
+#include <freertos/FreeRTOS.h>
+
+typedef void* TaskHandle_t;
+
+// advances the shim's virtual clock instead of yielding
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount();
+void vTaskDelayUntil(TickType_t* previousWake, TickType_t ticks);
+
+// there is no scheduler to run a task on, so creation always fails; host code
+// drives the work a task would do by calling it directly
+BaseType_t xTaskCreatePinnedToCore(void (*task)(void*), const char* name, uint32_t stackDepth, void* arg,
+                                   uint32_t priority, TaskHandle_t* handle, BaseType_t coreId);
+
+#endif
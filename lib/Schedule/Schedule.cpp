@@ -0,0 +1,172 @@
+#include "Schedule.h"
+#include <Arduino.h>
+
+unsigned long scheduleNextOn(const system_config_t& config, unsigned long now, int32_t tzOffsetSeconds) {
+    if (config.rule.active) return now >= MIN_VALID_EPOCH ? cronNextFire(config.rule, now, tzOffsetSeconds) : 0;
+    return now + config.interval;
+}
+
+ScheduleAction scheduleAdjustMissedOn(system_config_t& config, unsigned long now, int32_t tzOffsetSeconds) {
+    if ((config.interval == 0 && !config.rule.active) || config.next_on_time == 0) return SCHEDULE_NO_ACTION;
+    if (now <= config.next_on_time) return SCHEDULE_NO_ACTION;
+
+    unsigned long timeDiff = now - config.next_on_time;
+    if (timeDiff <= SCHEDULE_TOLERANCE_SECONDS) {
+        // Small miss: Log and skip adjustment to avoid over-correction
+        Serial.print("Small schedule miss (");
+        Serial.print(timeDiff);
+        Serial.println("s); skipping reschedule.");
+        return SCHEDULE_NO_ACTION;
+    }
+
+    Serial.print("Now is ahead of next_on_time (missed): ");
+    Serial.println(config.next_on_time);
+    if (!config.is_on) {
+        // Missed the ON while system was off — align schedule to now
+        config.next_on_time = scheduleNextOn(config, now, tzOffsetSeconds);
+        config.next_on_wall = false;
+        Serial.print("Rescheduled next ON to: ");
+        Serial.println(config.next_on_time);
+        return SCHEDULE_SAVE;
+    }
+    // System was marked ON but time moved past off_time — ensure we turn it off
+    if (config.off_time > 0 && now >= config.off_time) {
+        config.is_on = false;
+        config.off_time = 0;
+        config.next_on_time = scheduleNextOn(config, now, tzOffsetSeconds);
+        config.next_on_wall = false;
+        Serial.println("Off time passed while active; turning OFF and rescheduling");
+        return SCHEDULE_RELAY_OFF;
+    }
+    return SCHEDULE_NO_ACTION;
+}
+
+ScheduleAction scheduleFireOn(system_config_t& config, unsigned long now, int32_t tzOffsetSeconds) {
+    if (config.is_on || config.next_on_time == 0 || now < config.next_on_time) return SCHEDULE_NO_ACTION;
+
+    config.is_on = true;
+    config.off_time = now + config.duration;
+    // next ON is one interval (or the rule's next slot) after this one
+    config.next_on_time = scheduleNextOn(config, now, tzOffsetSeconds);
+    config.next_on_wall = false;
+    return SCHEDULE_RELAY_ON;
+}
+
+ScheduleAction scheduleFireOff(system_config_t& config, unsigned long now) {
+    if (!config.is_on || config.off_time == 0 || now < config.off_time) return SCHEDULE_NO_ACTION;
+
+    config.is_on = false;
+    config.off_time = 0;
+    return SCHEDULE_RELAY_OFF;
+}
+
+ScheduleAction scheduleConfigure(system_config_t& config, unsigned long interval, unsigned long duration,
+                                 const cron_rule_t& rule, unsigned long turnOnAt, unsigned long now,
+                                 int32_t tzOffsetSeconds) {
+    config.interval = interval;
+    config.duration = duration;
+    config.rule = rule;
+    config.next_on_wall = false;
+    if (now < MIN_VALID_EPOCH) {
+        Serial.println("System time not set yet; scheduling relative to uptime until time sync");
+        config.next_on_time = scheduleNextOn(config, now, tzOffsetSeconds);
+        return SCHEDULE_NO_ACTION;
+    }
+
+    // use explicit TURN_ON_AT if provided; otherwise use now + interval, or the rule's first slot
+    if (config.rule.everyDays > 1) config.rule.anchorDay = cronLocalDay(now, tzOffsetSeconds);
+    if (turnOnAt > 0) {
+        config.next_on_time = turnOnAt;
+        config.next_on_wall = true;
+        Serial.print("Set explicit TURN_ON_AT: ");
+        Serial.println(config.next_on_time);
+    } else {
+        config.next_on_time = scheduleNextOn(config, now, tzOffsetSeconds);
+    }
+    bool wasOn = config.is_on;
+    config.off_time = 0;
+    config.is_on = false;
+    return wasOn ? SCHEDULE_RELAY_OFF : SCHEDULE_SAVE;
+}
+
+ScheduleAction scheduleRestore(system_config_t& config, unsigned long now, unsigned long defaultTurnOnAt,
+                               int32_t tzOffsetSeconds) {
+    // if we are using the special default epoch value, convert it to a usable time
+    if (config.next_on_time == defaultTurnOnAt) {
+        // a wall-clock time: while it is still ahead it stays, and the schedule fires when time catches up
+        config.next_on_wall = true;
+        if (now < MIN_VALID_EPOCH) {
+            config.next_on_time = now + config.interval;
+            config.next_on_wall = false;
+            Serial.println("Offline startup: applied relative schedule from default");
+        } else if (now > defaultTurnOnAt) {
+            // once clock is synced and we've already passed the epoch
+            config.next_on_time = now + config.interval;
+            config.next_on_wall = false;
+            Serial.println("Default epoch passed; rescheduled relative to now");
+        }
+    }
+    // a schedule without a start time begins one interval (or at the rule's next slot) from now
+    if ((config.interval > 0 || config.rule.active) && config.next_on_time == 0) {
+        config.next_on_time = scheduleNextOn(config, now, tzOffsetSeconds);
+        config.next_on_wall = false;
+    }
+
+    ScheduleAction action = scheduleAdjustMissedOn(config, now, tzOffsetSeconds);
+    // enforce relay state if necessary
+    if (config.is_on && config.off_time > 0) {
+        if (now < config.off_time) return SCHEDULE_RELAY_ON;
+        config.is_on = false;
+        config.off_time = 0;
+        return SCHEDULE_SAVE;
+    }
+    // the relay starts released, so a RELAY_OFF here only needs persisting
+    return action == SCHEDULE_NO_ACTION ? SCHEDULE_NO_ACTION : SCHEDULE_SAVE;
+}
+
+ScheduleAction scheduleRebase(system_config_t& config, unsigned long offset) {
+    ScheduleAction action = SCHEDULE_NO_ACTION;
+    if (config.next_on_time != 0 && config.next_on_time < MIN_VALID_EPOCH) {
+        config.next_on_time += offset;
+        action = SCHEDULE_SAVE;
+    }
+    if (config.off_time != 0 && config.off_time < MIN_VALID_EPOCH) {
+        config.off_time += offset;
+        action = SCHEDULE_SAVE;
+    }
+    return action;
+}
+
+ScheduleAction scheduleStep(system_config_t& config, int32_t step) {
+    ScheduleAction action = SCHEDULE_NO_ACTION;
+    if (step == 0) return action;
+    if (config.next_on_time != 0 && !config.rule.active && !config.next_on_wall) {
+        config.next_on_time += step;
+        action = SCHEDULE_SAVE;
+    }
+    if (config.off_time != 0) {
+        config.off_time += step;
+        action = SCHEDULE_SAVE;
+    }
+    return action;
+}
+
+ScheduleAction scheduleResync(system_config_t& config, unsigned long now, int32_t tzOffsetSeconds) {
+    ScheduleAction action = SCHEDULE_NO_ACTION;
+    if (config.rule.active && config.next_on_time == 0 && now >= MIN_VALID_EPOCH) {
+        // calendar rules could not be placed before the clock was set
+        if (config.rule.everyDays > 1 && config.rule.anchorDay == 0)
+            config.rule.anchorDay = cronLocalDay(now, tzOffsetSeconds);
+        config.next_on_time = scheduleNextOn(config, now, tzOffsetSeconds);
+        action = SCHEDULE_SAVE;
+    }
+    ScheduleAction adjusted = scheduleAdjustMissedOn(config, now, tzOffsetSeconds);
+    if (adjusted != SCHEDULE_NO_ACTION) action = adjusted;
+
+    if (config.is_on && config.off_time > 0 && now >= config.off_time) {
+        config.is_on = false;
+        config.off_time = 0;
+        return SCHEDULE_RELAY_OFF;
+    }
+    return action;
+}
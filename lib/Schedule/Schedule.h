@@ -0,0 +1,82 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <stdint.h>
+#include <CronSchedule.h>
+
+// configuration struct for scheduled on/off
+typedef struct
+{
+  unsigned long interval;     // seconds until next ON
+  unsigned long duration;     // seconds to stay ON
+  unsigned long next_on_time; // epoch seconds for next ON (or relative seconds if time not available)
+  unsigned long off_time;     // epoch seconds when to turn OFF
+  bool is_on;
+  cron_rule_t rule;           // when rule.active, ON times come from the rule instead of interval
+  unsigned long volume_ml;    // when nonzero, a scheduled ON ends once this much has flowed; duration caps it
+  bool next_on_wall;          // next_on_time is a wall-clock time given as such (turn_on_at or the default
+                              // epoch), not one counted on from an earlier ON
+} system_config_t;
+
+// time() values below this are seconds since boot, not a synced wall clock
+#define MIN_VALID_EPOCH 100000UL
+
+// an ON missed by at most this much is still fired rather than rescheduled
+#define SCHEDULE_TOLERANCE_SECONDS 60
+
+// What the caller has to do after a schedule transition. The transitions below
+// only update the config; relays, NVS and MQTT stay with the caller so the same
+// state machine runs on the board and on the host.
+enum ScheduleAction {
+    SCHEDULE_NO_ACTION = 0, // nothing to persist or actuate
+    SCHEDULE_SAVE,          // fields changed; persist them
+    SCHEDULE_RELAY_ON,      // energise the relay, then persist
+    SCHEDULE_RELAY_OFF      // release the relay, then persist
+};
+
+// Next ON after `now`: from the calendar rule when there is one, otherwise one
+// interval later. Rules need wall-clock time and yield 0 (nothing queued) before it.
+unsigned long scheduleNextOn(const system_config_t& config, unsigned long now, int32_t tzOffsetSeconds);
+
+// An ON missed by more than SCHEDULE_TOLERANCE_SECONDS while the zone was off is
+// moved to the next slot after now (never retro-activated); a zone left ON past
+// its off_time is turned off.
+ScheduleAction scheduleAdjustMissedOn(system_config_t& config, unsigned long now, int32_t tzOffsetSeconds);
+
+// ON transition when next_on_time has been reached; queues the following ON.
+ScheduleAction scheduleFireOn(system_config_t& config, unsigned long now, int32_t tzOffsetSeconds);
+
+// OFF transition when off_time has been reached.
+ScheduleAction scheduleFireOff(system_config_t& config, unsigned long now);
+
+// New interval/duration (or rule) from /config. Until the clock is synced the
+// first ON is relative to uptime and nothing is persisted.
+ScheduleAction scheduleConfigure(system_config_t& config, unsigned long interval, unsigned long duration,
+                                 const cron_rule_t& rule, unsigned long turnOnAt, unsigned long now,
+                                 int32_t tzOffsetSeconds);
+
+// Boot-time fix-up of a loaded config: placeholder epoch, missing start, missed
+// ON and a relay that was on when power was lost. Returns SCHEDULE_RELAY_ON if
+// the zone is still inside its ON window.
+ScheduleAction scheduleRestore(system_config_t& config, unsigned long now, unsigned long defaultTurnOnAt,
+                               int32_t tzOffsetSeconds);
+
+// Clock first set to wall time: next_on_time/off_time still counted in seconds
+// since boot move onto it by offset (epoch minus uptime at the moment of sync),
+// so a wait already under way keeps its remaining length. Call before
+// scheduleResync().
+ScheduleAction scheduleRebase(system_config_t& config, unsigned long offset);
+
+// The clock the schedule runs on was stepped by step seconds (SNTP correcting
+// drift, or a bad reply and its correction). Interval ON times and OFF times
+// measure elapsed time, so they move with the step and keep their remaining
+// wait: no ON is skipped by a forward step or repeated by a backward one.
+// Calendar ON times and an explicit turn_on_at (next_on_wall) are wall-clock
+// times; they stay where they are, and the stepped clock now reaches them at
+// the right moment.
+ScheduleAction scheduleStep(system_config_t& config, int32_t step);
+
+// Re-check after the clock jumped to wall-clock time (NTP sync).
+ScheduleAction scheduleResync(system_config_t& config, unsigned long now, int32_t tzOffsetSeconds);
+
+#endif
@@ -0,0 +1,284 @@
+#include "ScheduleStore.h"
+
+#define SCHEDULE_RECORD_VERSION 4
+
+// on-flash layout; bump SCHEDULE_RECORD_VERSION when it changes
+typedef struct __attribute__((packed)) {
+    uint8_t version;
+    uint8_t is_on;
+    uint32_t interval;
+    uint32_t duration;
+    uint32_t next_on_time;
+    uint32_t off_time;
+    uint64_t rule_minutes;
+    uint32_t rule_hours;
+    uint8_t rule_weekdays;
+    uint8_t rule_active;
+    uint16_t rule_every_days;
+    uint32_t rule_anchor_day;
+    uint32_t volume_ml;
+    uint8_t next_on_wall;
+    uint32_t crc;
+} schedule_record_t;
+
+// version 3 did not mark an explicit (wall-clock) next ON; still accepted on load
+typedef struct __attribute__((packed)) {
+    uint8_t version;
+    uint8_t is_on;
+    uint32_t interval;
+    uint32_t duration;
+    uint32_t next_on_time;
+    uint32_t off_time;
+    uint64_t rule_minutes;
+    uint32_t rule_hours;
+    uint8_t rule_weekdays;
+    uint8_t rule_active;
+    uint16_t rule_every_days;
+    uint32_t rule_anchor_day;
+    uint32_t volume_ml;
+    uint32_t crc;
+} schedule_record_v3_t;
+
+// version 2 had no volume target; still accepted on load
+typedef struct __attribute__((packed)) {
+    uint8_t version;
+    uint8_t is_on;
+    uint32_t interval;
+    uint32_t duration;
+    uint32_t next_on_time;
+    uint32_t off_time;
+    uint64_t rule_minutes;
+    uint32_t rule_hours;
+    uint8_t rule_weekdays;
+    uint8_t rule_active;
+    uint16_t rule_every_days;
+    uint32_t rule_anchor_day;
+    uint32_t crc;
+} schedule_record_v2_t;
+
+// version 1 had no calendar rule; still accepted on load
+typedef struct __attribute__((packed)) {
+    uint8_t version;
+    uint8_t is_on;
+    uint32_t interval;
+    uint32_t duration;
+    uint32_t next_on_time;
+    uint32_t off_time;
+    uint32_t crc;
+} schedule_record_v1_t;
+
+// per-field keys written by firmware before the blob format; only read for migration
+static const char* const LEGACY_KEYS[] = {"interval", "duration", "next_on", "off_time", "is_on"};
+
+static uint32_t crc32(const uint8_t* data, size_t length) {
+    uint32_t crc = 0xFFFFFFFF;
+    while (length--) {
+        crc ^= *data++;
+        for (uint8_t bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
+static uint8_t diff(const system_config_t& a, const system_config_t& b) {
+    uint8_t mask = 0;
+    if (a.interval != b.interval) mask |= ScheduleStore::FIELD_INTERVAL;
+    if (a.duration != b.duration) mask |= ScheduleStore::FIELD_DURATION;
+    if (a.next_on_time != b.next_on_time || a.next_on_wall != b.next_on_wall) mask |= ScheduleStore::FIELD_NEXT_ON;
+    if (a.off_time != b.off_time) mask |= ScheduleStore::FIELD_OFF_TIME;
+    if (a.is_on != b.is_on) mask |= ScheduleStore::FIELD_IS_ON;
+    if (a.rule.active != b.rule.active || a.rule.minutes != b.rule.minutes || a.rule.hours != b.rule.hours ||
+        a.rule.weekdays != b.rule.weekdays || a.rule.everyDays != b.rule.everyDays ||
+        a.rule.anchorDay != b.rule.anchorDay)
+        mask |= ScheduleStore::FIELD_RULE;
+    if (a.volume_ml != b.volume_ml) mask |= ScheduleStore::FIELD_VOLUME;
+    return mask;
+}
+
+ScheduleStore::ScheduleStore(Preferences& prefs, const char* key, uint32_t commitWindowMs)
+    : _prefs(prefs), _commitWindowMs(commitWindowMs), _committed(), _pending(), _dirty(0), _dirtySince(0),
+      _commits(0), _writesAvoided(0), _lastCommitMicros(0), _maxCommitMicros(0) {
+    strncpy(_key, key, sizeof(_key) - 1);
+    _key[sizeof(_key) - 1] = '\0';
+}
+
+bool ScheduleStore::load(system_config_t& config) {
+    size_t length = _prefs.getBytesLength(_key);
+    schedule_record_t record;
+    if (length == sizeof(record) &&
+        _prefs.getBytes(_key, &record, sizeof(record)) == sizeof(record) &&
+        record.version == SCHEDULE_RECORD_VERSION &&
+        record.crc == crc32(reinterpret_cast<const uint8_t*>(&record), offsetof(schedule_record_t, crc))) {
+        config.interval = record.interval;
+        config.duration = record.duration;
+        config.next_on_time = record.next_on_time;
+        config.off_time = record.off_time;
+        config.is_on = record.is_on != 0;
+        config.rule.minutes = record.rule_minutes;
+        config.rule.hours = record.rule_hours;
+        config.rule.weekdays = record.rule_weekdays;
+        config.rule.active = record.rule_active;
+        config.rule.everyDays = record.rule_every_days;
+        config.rule.anchorDay = record.rule_anchor_day;
+        config.volume_ml = record.volume_ml;
+        config.next_on_wall = record.next_on_wall != 0;
+        _committed = _pending = config;
+        _dirty = 0;
+        return true;
+    }
+
+    schedule_record_v3_t v3;
+    if (length == sizeof(v3) &&
+        _prefs.getBytes(_key, &v3, sizeof(v3)) == sizeof(v3) &&
+        v3.version == 3 &&
+        v3.crc == crc32(reinterpret_cast<const uint8_t*>(&v3), offsetof(schedule_record_v3_t, crc))) {
+        config.interval = v3.interval;
+        config.duration = v3.duration;
+        config.next_on_time = v3.next_on_time;
+        config.off_time = v3.off_time;
+        config.is_on = v3.is_on != 0;
+        config.rule.minutes = v3.rule_minutes;
+        config.rule.hours = v3.rule_hours;
+        config.rule.weekdays = v3.rule_weekdays;
+        config.rule.active = v3.rule_active;
+        config.rule.everyDays = v3.rule_every_days;
+        config.rule.anchorDay = v3.rule_anchor_day;
+        config.volume_ml = v3.volume_ml;
+        config.next_on_wall = false;
+        upgrade(config);
+        return true;
+    }
+
+    schedule_record_v2_t v2;
+    if (length == sizeof(v2) &&
+        _prefs.getBytes(_key, &v2, sizeof(v2)) == sizeof(v2) &&
+        v2.version == 2 &&
+        v2.crc == crc32(reinterpret_cast<const uint8_t*>(&v2), offsetof(schedule_record_v2_t, crc))) {
+        config.interval = v2.interval;
+        config.duration = v2.duration;
+        config.next_on_time = v2.next_on_time;
+        config.off_time = v2.off_time;
+        config.is_on = v2.is_on != 0;
+        config.rule.minutes = v2.rule_minutes;
+        config.rule.hours = v2.rule_hours;
+        config.rule.weekdays = v2.rule_weekdays;
+        config.rule.active = v2.rule_active;
+        config.rule.everyDays = v2.rule_every_days;
+        config.rule.anchorDay = v2.rule_anchor_day;
+        config.volume_ml = 0;
+        config.next_on_wall = false;
+        upgrade(config);
+        return true;
+    }
+
+    schedule_record_v1_t v1;
+    if (length == sizeof(v1) &&
+        _prefs.getBytes(_key, &v1, sizeof(v1)) == sizeof(v1) &&
+        v1.version == 1 &&
+        v1.crc == crc32(reinterpret_cast<const uint8_t*>(&v1), offsetof(schedule_record_v1_t, crc))) {
+        config.interval = v1.interval;
+        config.duration = v1.duration;
+        config.next_on_time = v1.next_on_time;
+        config.off_time = v1.off_time;
+        config.is_on = v1.is_on != 0;
+        memset(&config.rule, 0, sizeof(config.rule));
+        config.volume_ml = 0;
+        config.next_on_wall = false;
+        upgrade(config);
+        return true;
+    }
+
+    if (_prefs.getBytesLength(_key) > 0) Serial.printf("Stored schedule '%s' is corrupt; ignoring it\r\n", _key);
+    return false;
+}
+
+bool ScheduleStore::migrateLegacy(system_config_t& config) {
+    if (!_prefs.isKey("interval")) return false;
+
+    config.interval = _prefs.getULong("interval", config.interval);
+    config.duration = _prefs.getULong("duration", config.duration);
+    config.next_on_time = _prefs.getULong("next_on", config.next_on_time);
+    config.off_time = _prefs.getULong("off_time", config.off_time);
+    config.is_on = _prefs.getULong("is_on", 0) ? true : false;
+    Serial.println("Migrating schedule to packed NVS record");
+    save(config, true);
+    for (size_t i = 0; i < sizeof(LEGACY_KEYS) / sizeof(LEGACY_KEYS[0]); i++) _prefs.remove(LEGACY_KEYS[i]);
+    return true;
+}
+
+void ScheduleStore::save(const system_config_t& config, bool force) {
+    bool wasPending = _dirty != 0;
+    _pending = config;
+    // a rewrite of an old layout stays owed until a commit succeeds
+    _dirty = diff(_pending, _committed) | (_dirty & FIELD_LAYOUT);
+
+    if (_dirty == 0) {
+        // nothing differs from flash (possibly a change that was undone before commit)
+        _writesAvoided++;
+        return;
+    }
+    if (force || (_dirty & SAFETY_FIELDS)) {
+        commit();
+        return;
+    }
+    if (wasPending) {
+        // folds into the commit already scheduled
+        _writesAvoided++;
+    } else {
+        _dirtySince = millis();
+    }
+}
+
+void ScheduleStore::service() {
+    if (_dirty != 0 && millis() - _dirtySince >= _commitWindowMs) commit();
+}
+
+void ScheduleStore::flush() {
+    if (_dirty != 0) commit();
+}
+
+int32_t ScheduleStore::msUntilCommit() const {
+    uint32_t elapsed = millis() - _dirtySince;
+    return elapsed >= _commitWindowMs ? 0 : static_cast<int32_t>(_commitWindowMs - elapsed);
+}
+
+void ScheduleStore::upgrade(const system_config_t& config) {
+    Serial.println("Upgrading schedule record to current layout");
+    _committed = _pending = config;
+    _dirty = FIELD_LAYOUT;
+    _dirtySince = millis();
+    commit();
+}
+
+void ScheduleStore::commit() {
+    schedule_record_t record;
+    record.version = SCHEDULE_RECORD_VERSION;
+    record.is_on = _pending.is_on ? 1 : 0;
+    record.interval = _pending.interval;
+    record.duration = _pending.duration;
+    record.next_on_time = _pending.next_on_time;
+    record.off_time = _pending.off_time;
+    record.rule_minutes = _pending.rule.minutes;
+    record.rule_hours = _pending.rule.hours;
+    record.rule_weekdays = _pending.rule.weekdays;
+    record.rule_active = _pending.rule.active;
+    record.rule_every_days = _pending.rule.everyDays;
+    record.rule_anchor_day = _pending.rule.anchorDay;
+    record.volume_ml = _pending.volume_ml;
+    record.next_on_wall = _pending.next_on_wall ? 1 : 0;
+    record.crc = crc32(reinterpret_cast<const uint8_t*>(&record), offsetof(schedule_record_t, crc));
+
+    uint32_t start = micros();
+    size_t written = _prefs.putBytes(_key, &record, sizeof(record));
+    _lastCommitMicros = micros() - start;
+    if (_lastCommitMicros > _maxCommitMicros) _maxCommitMicros = _lastCommitMicros;
+
+    if (written != sizeof(record)) {
+        // leave the fields dirty so the next service() retries
+        Serial.println("Failed to write schedule to NVS");
+        _dirtySince = millis();
+        return;
+    }
+    _committed = _pending;
+    _dirty = 0;
+    _commits++;
+}
@@ -0,0 +1,75 @@
+#ifndef SCHEDULE_STORE_H
+#define SCHEDULE_STORE_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <Schedule.h>
+
+// Persists system_config_t as one packed, CRC-protected NVS blob.
+//
+// save() only records what changed. Changes to the relay state (is_on/off_time)
+// are written immediately so a reboot restores the relay correctly; everything
+// else is held for commitWindowMs so a burst of schedule edits costs a single
+// flash write. Call service() regularly (and flush() before a planned restart).
+class ScheduleStore {
+public:
+    // dirty-field bits
+    static const uint8_t FIELD_INTERVAL = 1 << 0;
+    static const uint8_t FIELD_DURATION = 1 << 1;
+    static const uint8_t FIELD_NEXT_ON = 1 << 2;
+    static const uint8_t FIELD_OFF_TIME = 1 << 3;
+    static const uint8_t FIELD_IS_ON = 1 << 4;
+    static const uint8_t FIELD_RULE = 1 << 5;
+    static const uint8_t FIELD_VOLUME = 1 << 6;
+    static const uint8_t FIELD_LAYOUT = 1 << 7; // flash still holds an older record layout
+    static const uint8_t SAFETY_FIELDS = FIELD_OFF_TIME | FIELD_IS_ON;
+
+    // key names the NVS entry (at most 15 characters), one per zone
+    ScheduleStore(Preferences& prefs, const char* key = "sched", uint32_t commitWindowMs = 10000);
+
+    // Load the stored schedule into config. Returns false and leaves config
+    // untouched if nothing valid is stored.
+    bool load(system_config_t& config);
+
+    // Import the per-field keys written by firmware before the packed record,
+    // store them as a record and delete them. Returns false if there are none.
+    bool migrateLegacy(system_config_t& config);
+
+    // Record config as the state to persist; force writes it out right away
+    void save(const system_config_t& config, bool force = false);
+
+    // Commit pending changes once the coalescing window has expired
+    void service();
+
+    // Commit pending changes now
+    void flush();
+
+    bool pending() const { return _dirty != 0; }
+    // Milliseconds until service() will commit; only meaningful while pending()
+    int32_t msUntilCommit() const;
+
+    // counters
+    uint32_t commits() const { return _commits; }
+    uint32_t writesAvoided() const { return _writesAvoided; }
+    uint32_t lastCommitMicros() const { return _lastCommitMicros; }
+    uint32_t maxCommitMicros() const { return _maxCommitMicros; }
+
+private:
+    void commit();
+    void upgrade(const system_config_t& config);
+
+    Preferences& _prefs;
+    char _key[16];
+    uint32_t _commitWindowMs;
+    system_config_t _committed; // what is in flash
+    system_config_t _pending;   // what save() last asked for
+    uint8_t _dirty;             // fields where _pending differs from _committed
+    uint32_t _dirtySince;       // millis() of the first uncommitted change
+
+    uint32_t _commits;
+    uint32_t _writesAvoided;    // save() calls that did not cost a flash write of their own
+    uint32_t _lastCommitMicros;
+    uint32_t _maxCommitMicros;
+};
+
+#endif
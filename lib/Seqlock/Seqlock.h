@@ -0,0 +1,66 @@
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+
+// Sequence lock around a small trivially-copyable value. Readers never block
+// the writer and never write shared state, so any number of tasks on either
+// core may read() concurrently; a read that overlaps a write sees an odd or
+// changed sequence and retries.
+//
+// There must be one writer at a time: callers with several writers serialise
+// write() themselves (e.g. under a portMUX). A reader that can preempt the
+// writer on the same core would spin until the writer runs again, so writers
+// on ESP32 should hold a critical section for the (short) write.
+//
+// The value is kept as relaxed atomic words so a torn read is merely retried,
+// never undefined behaviour.
+template <typename T>
+class Seqlock {
+    static_assert(std::is_trivially_copyable<T>::value, "Seqlock values are copied word by word");
+
+public:
+    Seqlock() : _sequence(0) {
+        for (size_t i = 0; i < WORDS; i++) _words[i].store(0, std::memory_order_relaxed);
+    }
+
+    void write(const T& value) {
+        uint32_t words[WORDS] = {};
+        memcpy(words, &value, sizeof(T));
+
+        uint32_t sequence = _sequence.load(std::memory_order_relaxed);
+        _sequence.store(sequence + 1, std::memory_order_relaxed); // odd: write in progress
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < WORDS; i++) _words[i].store(words[i], std::memory_order_relaxed);
+        _sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    T read() const {
+        uint32_t words[WORDS];
+        uint32_t before, after;
+        do {
+            before = _sequence.load(std::memory_order_acquire);
+            for (size_t i = 0; i < WORDS; i++) words[i] = _words[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = _sequence.load(std::memory_order_relaxed);
+        } while ((before & 1) != 0 || before != after);
+
+        T value;
+        memcpy(&value, words, sizeof(T));
+        return value;
+    }
+
+    // Number of completed writes
+    uint32_t writes() const { return _sequence.load(std::memory_order_acquire) / 2; }
+
+private:
+    static const size_t WORDS = (sizeof(T) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+
+    std::atomic<uint32_t> _sequence;
+    std::atomic<uint32_t> _words[WORDS];
+};
+
+#endif
@@ -0,0 +1,261 @@
+#include "SpoolLog.h"
+#include <stddef.h>
+
+#define SPOOL_SEGMENT_MAGIC 0x4C4F5053 // "SPOL"
+#define SPOOL_ENTRY_MARKER 0xA5
+#define SPOOL_FIRST_ENTRY ((sizeof(segment_header_t) + 3) & ~3u)
+
+SpoolLog::SpoolLog()
+    : _partition(nullptr), _sectors(0), _oldest(0), _head(0), _writeOffset(0), _headClosed(false),
+      _readSequence(0), _readOffset(0), _pending(0), _dropped(0), _replayedAt(0), _message() {}
+
+bool SpoolLog::begin(const char* label) {
+    const esp_partition_t* partition =
+        esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, label);
+    if (partition == nullptr || partition->size / SPOOL_SECTOR_SIZE < 2) {
+        Serial.println("Spool: no log partition, offline messages will be dropped");
+        return false;
+    }
+    _partition = partition;
+    _sectors = partition->size / SPOOL_SECTOR_SIZE;
+
+    // the head is the newest segment; the ones before it back to a gap are still readable
+    bool found = false;
+    for (uint32_t sector = 0; sector < _sectors; sector++) {
+        uint32_t sequence;
+        if (readSegment(sector, sequence) && (!found || sequence > _head)) {
+            _head = sequence;
+            found = true;
+        }
+    }
+    if (!found) {
+        _oldest = 0;
+        _readSequence = 0;
+        _readOffset = SPOOL_FIRST_ENTRY;
+        if (!openSegment(0)) {
+            _partition = nullptr;
+            return false;
+        }
+        return true;
+    }
+    _oldest = _head;
+    for (uint32_t sequence; _oldest > 0 && _head - _oldest + 1 < _sectors &&
+                            readSegment((_oldest - 1) % _sectors, sequence) && sequence == _oldest - 1;) {
+        _oldest--;
+    }
+
+    // replay resumes at the first entry not yet sent; appending at the end of the head
+    bool cursorSet = false;
+    for (uint32_t sequence = _oldest; sequence <= _head; sequence++) {
+        uint32_t offset = SPOOL_FIRST_ENTRY;
+        entry_header_t header;
+        EntryRead read;
+        while ((read = readEntry(sequence, offset, header)) == ENTRY_OK) {
+            if (header.state == 0xFF) {
+                if (!cursorSet) {
+                    _readSequence = sequence;
+                    _readOffset = offset;
+                    cursorSet = true;
+                }
+                _pending++;
+            }
+            offset += entrySize(header);
+        }
+        if (sequence == _head) {
+            _writeOffset = offset;
+            _headClosed = read == ENTRY_CORRUPT;
+        }
+    }
+    if (!cursorSet) {
+        _readSequence = _head;
+        _readOffset = _writeOffset;
+    }
+    Serial.printf("Spool: %lu message(s) waiting in segments %lu-%lu\r\n", (unsigned long)_pending,
+                  (unsigned long)_oldest, (unsigned long)_head);
+    return true;
+}
+
+bool SpoolLog::readSegment(uint32_t sector, uint32_t& sequence) const {
+    segment_header_t header;
+    if (esp_partition_read(_partition, sector * SPOOL_SECTOR_SIZE, &header, sizeof(header)) != ESP_OK) return false;
+    if (header.magic != SPOOL_SEGMENT_MAGIC || header.check != ~header.sequence) return false;
+    // a segment only ever lives in its own sector
+    if (header.sequence % _sectors != sector) return false;
+    sequence = header.sequence;
+    return true;
+}
+
+SpoolLog::EntryRead SpoolLog::readEntry(uint32_t sequence, uint32_t offset, entry_header_t& header) {
+    if (offset + sizeof(header) > SPOOL_SECTOR_SIZE) return ENTRY_END;
+    size_t base = sectorOffset(sequence) + offset;
+    if (esp_partition_read(_partition, base, &header, sizeof(header)) != ESP_OK) return ENTRY_CORRUPT;
+    if (header.marker == 0xFF) return ENTRY_END;
+    if (header.marker != SPOOL_ENTRY_MARKER || header.topicLength > SPOOL_MAX_TOPIC ||
+        header.payloadLength > SPOOL_MAX_PAYLOAD || offset + entrySize(header) > SPOOL_SECTOR_SIZE)
+        return ENTRY_CORRUPT;
+
+    // topic and payload land in _message, each NUL-terminated
+    char* topic = _message;
+    char* payload = _message + header.topicLength + 1;
+    if (esp_partition_read(_partition, base + sizeof(header), topic, header.topicLength) != ESP_OK ||
+        esp_partition_read(_partition, base + sizeof(header) + header.topicLength, payload,
+                           header.payloadLength) != ESP_OK)
+        return ENTRY_CORRUPT;
+    topic[header.topicLength] = '\0';
+    payload[header.payloadLength] = '\0';
+
+    uint16_t crc = crc16(0xFFFF, &header.loggedAt, sizeof(header.loggedAt));
+    crc = crc16(crc, topic, header.topicLength);
+    crc = crc16(crc, payload, header.payloadLength);
+    return crc == header.crc ? ENTRY_OK : ENTRY_CORRUPT;
+}
+
+bool SpoolLog::openSegment(uint32_t sequence) {
+    if (sequence >= _sectors && sequence - _sectors == _oldest) {
+        // the ring is full: the oldest segment makes room, with whatever it still held
+        if (_readSequence == _oldest) {
+            uint32_t offset = _readOffset;
+            entry_header_t header;
+            while (readEntry(_oldest, offset, header) == ENTRY_OK) {
+                if (header.state == 0xFF && _pending > 0) {
+                    _pending--;
+                    _dropped++;
+                }
+                offset += entrySize(header);
+            }
+            nextReadSegment();
+        }
+        _oldest++;
+    }
+
+    size_t base = sectorOffset(sequence);
+    segment_header_t header = {SPOOL_SEGMENT_MAGIC, sequence, ~sequence};
+    if (esp_partition_erase_range(_partition, base, SPOOL_SECTOR_SIZE) != ESP_OK ||
+        esp_partition_write(_partition, base, &header, sizeof(header)) != ESP_OK) {
+        Serial.println("Spool: could not start a log segment");
+        return false;
+    }
+    _head = sequence;
+    _writeOffset = SPOOL_FIRST_ENTRY;
+    _headClosed = false;
+    return true;
+}
+
+void SpoolLog::nextReadSegment() {
+    _readSequence++;
+    _readOffset = SPOOL_FIRST_ENTRY;
+}
+
+bool SpoolLog::append(const char* topic, const char* payload, size_t payloadLength, uint32_t loggedAt) {
+    if (!ready()) return false;
+    size_t topicLength = strlen(topic);
+    if (topicLength > SPOOL_MAX_TOPIC || payloadLength > SPOOL_MAX_PAYLOAD) return false;
+
+    entry_header_t header;
+    header.marker = SPOOL_ENTRY_MARKER;
+    header.state = 0xFF;
+    header.topicLength = static_cast<uint8_t>(topicLength);
+    header.reserved = 0xFF;
+    header.payloadLength = static_cast<uint16_t>(payloadLength);
+    header.loggedAt = loggedAt;
+    uint16_t crc = crc16(0xFFFF, &header.loggedAt, sizeof(header.loggedAt));
+    crc = crc16(crc, topic, topicLength);
+    header.crc = crc16(crc, payload, payloadLength);
+
+    uint32_t size = entrySize(header);
+    if ((_headClosed || _writeOffset + size > SPOOL_SECTOR_SIZE) && !openSegment(_head + 1)) return false;
+
+    size_t base = sectorOffset(_head) + _writeOffset;
+    if (esp_partition_write(_partition, base, &header, sizeof(header)) != ESP_OK ||
+        esp_partition_write(_partition, base + sizeof(header), topic, topicLength) != ESP_OK ||
+        esp_partition_write(_partition, base + sizeof(header) + topicLength, payload, payloadLength) != ESP_OK) {
+        // whatever reached flash fails its CRC; start over in a fresh segment
+        _headClosed = true;
+        return false;
+    }
+    _writeOffset += size;
+    _pending++;
+    return true;
+}
+
+uint32_t SpoolLog::replay(SpoolPublisher publish, uint32_t nowMs) {
+    if (msUntilReplay(nowMs) > 0) return 0;
+    _replayedAt = nowMs;
+
+    uint32_t sent = 0, bytes = 0;
+    while (_pending > 0 && sent < SPOOL_REPLAY_MESSAGES && bytes < SPOOL_REPLAY_BYTES) {
+        entry_header_t header;
+        if (readEntry(_readSequence, _readOffset, header) != ENTRY_OK) {
+            if (_readSequence == _head) {
+                // nothing readable is left; the count was off
+                _pending = 0;
+                break;
+            }
+            nextReadSegment();
+            continue;
+        }
+        uint32_t size = entrySize(header);
+        if (header.state != 0xFF) {
+            _readOffset += size;
+            continue;
+        }
+
+        char* topic = _message;
+        char* payload = _message + header.topicLength + 1;
+        size_t length = header.payloadLength;
+        // say when it happened, since it is arriving late
+        if (header.loggedAt != 0)
+            length = addLoggedAt(payload, length, sizeof(_message) - header.topicLength - 1, header.loggedAt);
+        if (!publish(topic, payload, length)) break;
+
+        uint8_t replayed = 0x00;
+        esp_partition_write(_partition, sectorOffset(_readSequence) + _readOffset + offsetof(entry_header_t, state),
+                            &replayed, sizeof(replayed));
+        _readOffset += size;
+        _pending--;
+        sent++;
+        bytes += size;
+    }
+    return sent;
+}
+
+uint32_t SpoolLog::msUntilReplay(uint32_t nowMs) const {
+    if (!ready() || _pending == 0) return UINT32_MAX;
+    uint32_t elapsed = nowMs - _replayedAt;
+    return elapsed >= SPOOL_REPLAY_INTERVAL_MS ? 0 : SPOOL_REPLAY_INTERVAL_MS - elapsed;
+}
+
+uint32_t SpoolLog::entrySize(const entry_header_t& header) {
+    return (sizeof(entry_header_t) + header.topicLength + header.payloadLength + 3) & ~3u;
+}
+
+size_t SpoolLog::addLoggedAt(char* payload, size_t length, size_t room, uint32_t loggedAt) {
+    if (length >= 2 && payload[0] == '{' && payload[length - 1] == '}') {
+        int written = snprintf(payload + length - 1, room - length + 1, "%s\"logged_at\":%lu}", length > 2 ? "," : "",
+                               (unsigned long)loggedAt);
+        return length - 1 + written;
+    }
+    // CBOR indefinite-length map (as CborWriter writes): the key goes in before the break byte
+    static const char KEY[] = "\x69logged_at\x1a"; // text(9) "logged_at", then a uint32
+    if (length >= 2 && static_cast<uint8_t>(payload[0]) == 0xBF && static_cast<uint8_t>(payload[length - 1]) == 0xFF &&
+        length - 1 + sizeof(KEY) - 1 + 4 + 1 <= room) {
+        char* p = payload + length - 1;
+        memcpy(p, KEY, sizeof(KEY) - 1);
+        p += sizeof(KEY) - 1;
+        for (int shift = 24; shift >= 0; shift -= 8) *p++ = static_cast<char>(loggedAt >> shift);
+        *p++ = static_cast<char>(0xFF);
+        *p = '\0';
+        return p - payload;
+    }
+    return length;
+}
+
+uint16_t SpoolLog::crc16(uint16_t crc, const void* data, size_t length) {
+    // CRC-16/CCITT, polynomial 0x1021
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < length; i++) {
+        crc ^= static_cast<uint16_t>(bytes[i]) << 8;
+        for (uint8_t bit = 0; bit < 8; bit++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
@@ -0,0 +1,109 @@
+#ifndef SPOOL_LOG_H
+#define SPOOL_LOG_H
+
+#include <Arduino.h>
+#include <esp_partition.h>
+
+// Flash erase unit; each segment of the log is one sector
+#define SPOOL_SECTOR_SIZE 4096
+
+// Largest topic and payload an entry holds; a telemetry batch is the biggest
+// message the firmware sends
+#define SPOOL_MAX_TOPIC 96
+#define SPOOL_MAX_PAYLOAD 2048
+
+// Replay budget: at most this many messages or bytes per burst, one burst per
+// interval, so a long backlog drains in the background without crowding out
+// live publishes (about 16 messages or 8 KB a second)
+#define SPOOL_REPLAY_INTERVAL_MS 500
+#define SPOOL_REPLAY_MESSAGES 8
+#define SPOOL_REPLAY_BYTES 4096
+
+// Sends one replayed message (payload may be binary, hence the length); false
+// stops the burst and keeps the entry
+typedef bool (*SpoolPublisher)(const char* topic, const char* payload, size_t length);
+
+// Append-only store-and-forward log of MQTT messages in a raw flash partition.
+//
+// The partition is a ring of one-sector segments. Segment n (a sequence
+// number that only grows) lives in sector n % sectors and starts with a
+// header naming n; entries follow back to back, each a small header (with a
+// CRC over its contents) plus topic and payload. A replayed entry is marked by
+// clearing one byte of its header in place, which flash allows without an
+// erase, so after a reboot the scan in begin() resumes exactly after the last
+// message that went out. When the ring is full the oldest segment is erased
+// for the next one and whatever it still held is counted as dropped.
+//
+// A torn write (power lost mid-append) fails its CRC; the scan treats it as
+// the end of that segment and appending continues in a fresh one.
+class SpoolLog {
+public:
+    SpoolLog();
+
+    // Find the partition and recover the read and write positions from it.
+    // Returns false (and the log stays disabled) if there is no such partition.
+    bool begin(const char* label = "spiffs");
+
+    // Keep a message for later; loggedAt is the wall clock now, 0 if unknown
+    bool append(const char* topic, const char* payload, size_t length, uint32_t loggedAt);
+    bool append(const char* topic, const char* payload, uint32_t loggedAt) {
+        return append(topic, payload, strlen(payload), loggedAt);
+    }
+
+    // Send the oldest pending messages, within the replay budget, if a burst
+    // is due. A payload that is a JSON object or a CBOR indefinite-length map
+    // and was logged with a clock gets "logged_at":<epoch> added. Returns the
+    // number sent.
+    uint32_t replay(SpoolPublisher publish, uint32_t nowMs);
+
+    // When replay() next has a burst to send
+    uint32_t msUntilReplay(uint32_t nowMs) const;
+
+    bool ready() const { return _partition != nullptr; }
+    uint32_t pending() const { return _pending; }
+    uint32_t dropped() const { return _dropped; }
+
+private:
+    typedef struct {
+        uint32_t magic;
+        uint32_t sequence;
+        uint32_t check;       // ~sequence
+    } segment_header_t;
+
+    typedef struct {
+        uint8_t marker;       // SPOOL_ENTRY_MARKER once written, 0xFF past the last entry
+        uint8_t state;        // 0xFF pending, 0x00 replayed
+        uint8_t topicLength;
+        uint8_t reserved;
+        uint16_t payloadLength;
+        uint16_t crc;         // CRC-16 of loggedAt, topic and payload
+        uint32_t loggedAt;
+    } entry_header_t;
+
+    enum EntryRead { ENTRY_OK, ENTRY_END, ENTRY_CORRUPT };
+
+    size_t sectorOffset(uint32_t sequence) const { return (sequence % _sectors) * SPOOL_SECTOR_SIZE; }
+    bool readSegment(uint32_t sector, uint32_t& sequence) const;
+    // reads the entry's topic and payload into _message and checks its CRC
+    EntryRead readEntry(uint32_t sequence, uint32_t offset, entry_header_t& header);
+    bool openSegment(uint32_t sequence);
+    void nextReadSegment();
+    static uint32_t entrySize(const entry_header_t& header);
+    static size_t addLoggedAt(char* payload, size_t length, size_t room, uint32_t loggedAt);
+    static uint16_t crc16(uint16_t crc, const void* data, size_t length);
+
+    const esp_partition_t* _partition;
+    uint32_t _sectors;
+    uint32_t _oldest;        // sequence of the oldest segment still in flash
+    uint32_t _head;          // sequence of the segment being appended to
+    uint32_t _writeOffset;   // within the head segment
+    bool _headClosed;        // a torn entry ends the head; the next append opens a new one
+    uint32_t _readSequence;  // replay cursor
+    uint32_t _readOffset;
+    uint32_t _pending;
+    uint32_t _dropped;
+    uint32_t _replayedAt;
+    char _message[SPOOL_MAX_TOPIC + 1 + SPOOL_MAX_PAYLOAD + 32]; // topic, then payload (+ logged_at)
+};
+
+#endif
@@ -0,0 +1,36 @@
+#include "SystemClock.h"
+
+#define CLOCK_MARK_MAGIC 0x4B434C43 // "CLCK"
+
+SystemClock::SystemClock(clock_mark_t& mark) : _mark(mark), _source(CLOCK_UPTIME), _offsetUs(0), _syncs(0) {}
+
+uint32_t SystemClock::checkOf(const clock_mark_t& mark) {
+    return ~(mark.magic ^ mark.epoch ^ static_cast<uint32_t>(mark.rtcUs) ^ static_cast<uint32_t>(mark.rtcUs >> 32));
+}
+
+uint32_t SystemClock::restore(uint64_t rtcUs, int64_t monoUs) {
+    if (_mark.magic != CLOCK_MARK_MAGIC || _mark.check != checkOf(_mark) || rtcUs < _mark.rtcUs) return 0;
+    int64_t estimateUs = static_cast<int64_t>(_mark.epoch) * 1000000 + static_cast<int64_t>(rtcUs - _mark.rtcUs);
+    _offsetUs = estimateUs - monoUs;
+    _source = CLOCK_CACHED;
+    return nowSeconds(monoUs);
+}
+
+int32_t SystemClock::synced(int64_t wallUs, uint64_t rtcUs, int64_t monoUs) {
+    int64_t stepUs = wallUs - (monoUs + _offsetUs);
+    // whole seconds, rounded, so deadlines in seconds move by exactly as much as the clock
+    int32_t step = static_cast<int32_t>((stepUs >= 0 ? stepUs + 500000 : stepUs - 500000) / 1000000);
+    _offsetUs += static_cast<int64_t>(step) * 1000000;
+    _source = CLOCK_SYNCED;
+    _syncs++;
+    mark(rtcUs, monoUs);
+    return step;
+}
+
+void SystemClock::mark(uint64_t rtcUs, int64_t monoUs) {
+    if (_source != CLOCK_SYNCED) return;
+    _mark.magic = CLOCK_MARK_MAGIC;
+    _mark.epoch = nowSeconds(monoUs);
+    _mark.rtcUs = rtcUs;
+    _mark.check = checkOf(_mark);
+}
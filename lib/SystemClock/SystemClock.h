@@ -0,0 +1,72 @@
+#ifndef SYSTEM_CLOCK_H
+#define SYSTEM_CLOCK_H
+
+#include <stdint.h>
+
+// Where the current wall-clock time came from
+enum ClockSource {
+    CLOCK_UPTIME, // nothing yet: the clock counts seconds since boot
+    CLOCK_CACHED, // estimated at boot from the mark a previous run left in RTC memory
+    CLOCK_SYNCED  // set by SNTP since boot
+};
+
+// The last good wall time and the RTC counter reading it goes with. It lives
+// in RTC memory (RTC_NOINIT_ATTR), which keeps its contents through a software,
+// watchdog or OTA reset but not a power loss; the RTC counter runs on through
+// the same resets, so the two together date a warm boot.
+typedef struct {
+    uint32_t magic;
+    uint32_t epoch;
+    uint64_t rtcUs;
+    uint32_t check; // catches the random contents RTC memory has after power-up
+} clock_mark_t;
+
+// The clock every schedule decision runs on: the 64-bit monotonic microsecond
+// counter (esp_timer_get_time() on target) plus an offset that maps it to
+// epoch time. Reading it is an add and a divide, with no syscall, and it
+// never moves on its own; the offset changes only when the caller hands over
+// a sync, and then by whole seconds that synced() reports, so deadlines can be
+// moved with it. Until the first sync (or a restore) the offset is zero and
+// the clock counts seconds since boot, as before.
+//
+// restore() runs at boot, before anything is scheduled, and starts the clock
+// from the previous run's mark when it is usable. synced() is called from the
+// SNTP notification (via loop()) and mark() while the clock is good, so a
+// reset loses no more than the RTC drift since the last mark plus the reset
+// itself.
+class SystemClock {
+public:
+    explicit SystemClock(clock_mark_t& mark);
+
+    // Boot: start from the previous run's mark. Returns the estimated epoch,
+    // or 0 if there is no usable mark (cold boot) or the RTC counter has
+    // restarted since.
+    uint32_t restore(uint64_t rtcUs, int64_t monoUs);
+
+    // SNTP reports wallUs (epoch microseconds). Moves the clock onto it and
+    // returns by how many whole seconds it stepped: epoch minus uptime on the
+    // first sync of a cold boot, the drift or a bad reply's error after that.
+    // Steps under half a second are left for the next sync.
+    int32_t synced(int64_t wallUs, uint64_t rtcUs, int64_t monoUs);
+
+    // Record the current time as good; ignored until the clock has been synced
+    // this boot, so an unconfirmed estimate never overwrites a confirmed mark
+    void mark(uint64_t rtcUs, int64_t monoUs);
+
+    uint32_t nowSeconds(int64_t monoUs) const { return static_cast<uint32_t>((monoUs + _offsetUs) / 1000000); }
+    int64_t nowMillis(int64_t monoUs) const { return (monoUs + _offsetUs) / 1000; }
+
+    ClockSource source() const { return _source; }
+    bool wallTime() const { return _source != CLOCK_UPTIME; }
+    uint32_t syncs() const { return _syncs; }
+
+private:
+    static uint32_t checkOf(const clock_mark_t& mark);
+
+    clock_mark_t& _mark;
+    ClockSource _source;
+    int64_t _offsetUs; // clock minus the monotonic counter
+    uint32_t _syncs;
+};
+
+#endif
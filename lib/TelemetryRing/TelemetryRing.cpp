@@ -0,0 +1,116 @@
+#include "TelemetryRing.h"
+#include <TelemetryWriter.h>
+
+TelemetryRing::TelemetryRing(uint32_t flowPeriodMs, uint32_t climatePeriodMs, uint32_t flushIntervalMs)
+    : _records(), _tail(0), _count(0), _dropped(0), _flowPeriodMs(flowPeriodMs), _climatePeriodMs(climatePeriodMs),
+      _flushIntervalMs(flushIntervalMs), _started(false), _flowAt(0), _climateAt(0), _climateTaken(0),
+      _flushedAt(0), _running(), _anyRunning(false) {}
+
+void TelemetryRing::push(const telemetry_record_t& record) {
+    if (_count == TELEMETRY_RING_CAPACITY) {
+        _tail = (_tail + 1) % TELEMETRY_RING_CAPACITY;
+        _count--;
+        _dropped++;
+    }
+    _records[(_tail + _count) % TELEMETRY_RING_CAPACITY] = record;
+    _count++;
+}
+
+void TelemetryRing::sample(const FlowSensorBank& bank, const flow_bank_snapshot_t& flow,
+                           const climate_snapshot_t& climate, uint32_t nowMs) {
+    if (!_started) {
+        // first flush one interval after boot, not immediately
+        _started = true;
+        _flushedAt = nowMs;
+        _flowAt = nowMs - _flowPeriodMs;
+        _climateAt = nowMs - _climatePeriodMs;
+    }
+
+    if (nowMs - _flowAt >= _flowPeriodMs) {
+        _flowAt = nowMs;
+        _anyRunning = false;
+        for (uint8_t i = 0; i < flow.count; i++) {
+            const flow_snapshot_t& sensor = flow.sensors[i];
+            // an idle meter says nothing new; record it running, and once where it stopped
+            bool running = sensor.flowing || sensor.instantLpm > 0;
+            if (!running && !_running[i]) continue;
+            _running[i] = running;
+            _anyRunning |= running;
+
+            telemetry_record_t record = {};
+            record.takenAtMs = sensor.takenAtMs;
+            record.kind = TELEMETRY_FLOW;
+            record.source = i;
+            record.zone = flow.zones[i];
+            record.a = toFixed(running ? sensor.instantLpm : 0, 2);
+            record.b = static_cast<int32_t>(bank.lifetimeMilliliters(flow, i));
+            push(record);
+        }
+    }
+
+    if (climate.takenAtMs != 0 && climate.takenAtMs != _climateTaken && nowMs - _climateAt >= _climatePeriodMs) {
+        _climateAt = nowMs;
+        _climateTaken = climate.takenAtMs;
+        telemetry_record_t record = {};
+        record.takenAtMs = climate.takenAtMs;
+        record.kind = TELEMETRY_CLIMATE;
+        record.a = toFixed(climate.temperatureC, 1);
+        record.b = toFixed(climate.humidity * 100, 1);
+        push(record);
+    }
+}
+
+uint32_t TelemetryRing::msUntilDue(uint32_t nowMs) const {
+    if (!_started) return 0;
+    uint32_t waitMs = UINT32_MAX;
+    uint32_t periods[] = {_climatePeriodMs, _flowPeriodMs};
+    uint32_t since[] = {nowMs - _climateAt, nowMs - _flowAt};
+    // idle meters are not worth a wake-up; a start shows at the next sample() anything else causes
+    for (uint8_t i = 0; i < (_anyRunning ? 2 : 1); i++)
+        waitMs = min(waitMs, since[i] >= periods[i] ? 0 : periods[i] - since[i]);
+    if (_count > 0) {
+        uint32_t sinceFlush = nowMs - _flushedAt;
+        waitMs = min(waitMs, sinceFlush >= _flushIntervalMs ? 0 : _flushIntervalMs - sinceFlush);
+    }
+    return waitMs;
+}
+
+bool TelemetryRing::flushDue(uint32_t nowMs) const {
+    if (_count == 0) return false;
+    uint32_t sinceFlush = nowMs - _flushedAt;
+    return sinceFlush >= _flushIntervalMs ||
+           (_count >= TELEMETRY_RING_CAPACITY * 3 / 4 && sinceFlush >= TELEMETRY_MIN_FLUSH_MS);
+}
+
+const char* TelemetryRing::formatBatch(char* buffer, size_t size, uint32_t nowMs, uint32_t epoch,
+                                       size_t& count) const {
+    count = 0;
+    JsonWriter w(buffer, size);
+    w.addInt("ms", nowMs).addInt("epoch", epoch).addInt("dropped", _dropped).beginArray("r");
+    // rows are [kind, age_ms, ...]: age is taken back from ms (and epoch) to place the sample
+    while (count < _count && w.length() + TELEMETRY_ROW_MAX + 3 <= size) {
+        const telemetry_record_t& record = at(count);
+        w.beginArray(nullptr).addInt(nullptr, record.kind).addInt(nullptr, nowMs - record.takenAtMs);
+        if (record.kind == TELEMETRY_FLOW) {
+            w.addInt(nullptr, record.source)
+                .addInt(nullptr, record.zone == FLOW_BANK_ZONE_ANY ? -1 : record.zone)
+                .addFixed(nullptr, record.a, 2)
+                .addInt(nullptr, static_cast<uint32_t>(record.b));
+        } else {
+            w.addFixed(nullptr, record.a, 1).addFixed(nullptr, record.b, 1);
+        }
+        w.endArray();
+        count++;
+    }
+    w.endArray();
+    const char* batch = w.finish();
+    if (batch == nullptr) count = 0;
+    return batch;
+}
+
+void TelemetryRing::consume(size_t count, uint32_t nowMs) {
+    if (count > _count) count = _count;
+    _tail = (_tail + count) % TELEMETRY_RING_CAPACITY;
+    _count -= count;
+    _flushedAt = nowMs;
+}
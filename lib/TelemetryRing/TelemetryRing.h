@@ -0,0 +1,96 @@
+#ifndef TELEMETRY_RING_H
+#define TELEMETRY_RING_H
+
+#include <Arduino.h>
+#include <FlowSensorBank.h>
+#include <Dht20Sampler.h>
+
+// Records held in RAM between flushes (16 bytes each); when full, the oldest
+// record is overwritten
+#define TELEMETRY_RING_CAPACITY 256
+
+// A ring three quarters full is flushed early, but no sooner than this after
+// the last flush or failed attempt
+#define TELEMETRY_MIN_FLUSH_MS 5000
+
+// Longest row formatBatch() writes, so a batch is cut before a row can overflow it
+#define TELEMETRY_ROW_MAX 64
+
+enum TelemetryKind {
+    TELEMETRY_FLOW = 1,   // a: rate in hundredths of a L/min, b: lifetime mL of the sensor (low 32 bits)
+    TELEMETRY_CLIMATE = 2 // a: temperature in tenths of a degree, b: humidity in tenths of a percent
+};
+
+typedef struct {
+    uint32_t takenAtMs;
+    uint8_t kind;         // TelemetryKind
+    uint8_t source;       // bank index of the flow sensor; 0 for climate
+    uint8_t zone;         // zone the flow sensor meters (FLOW_BANK_ZONE_ANY for the main line)
+    uint8_t reserved;
+    int32_t a;
+    int32_t b;
+} telemetry_record_t;
+
+// Fixed-size ring of compact telemetry samples, flushed as batches.
+//
+// sample() is called from loop() with the latest snapshots and records each
+// kind at its own period: flow for every sensor that is running (plus the
+// reading at which it stopped), climate for each new DHT20 measurement. A
+// flush is due every flushIntervalMs, or sooner once the ring is three
+// quarters full; formatBatch() writes the oldest records that fit in one MQTT
+// message and consume() drops them once it has gone out. Records stay in the
+// ring while the broker is unreachable, and postpone() puts the next attempt
+// one interval out.
+class TelemetryRing {
+public:
+    TelemetryRing(uint32_t flowPeriodMs, uint32_t climatePeriodMs, uint32_t flushIntervalMs);
+
+    // Record whatever is due at nowMs; flow comes from bank
+    void sample(const FlowSensorBank& bank, const flow_bank_snapshot_t& flow, const climate_snapshot_t& climate,
+                uint32_t nowMs);
+
+    // Append one record, overwriting the oldest when full
+    void push(const telemetry_record_t& record);
+
+    // How long until sample() or a flush next has work
+    uint32_t msUntilDue(uint32_t nowMs) const;
+
+    // Whether a batch should go out now
+    bool flushDue(uint32_t nowMs) const;
+
+    // Write the oldest records that fit as one JSON batch; count receives how
+    // many were written. epoch is the wall clock at nowMs, 0 if unknown.
+    // Returns nullptr if not even the header fits.
+    const char* formatBatch(char* buffer, size_t size, uint32_t nowMs, uint32_t epoch, size_t& count) const;
+
+    // The oldest count records have been published
+    void consume(size_t count, uint32_t nowMs);
+
+    // A flush could not go out; try again after another interval
+    void postpone(uint32_t nowMs) { _flushedAt = nowMs; }
+
+    size_t size() const { return _count; }
+    const telemetry_record_t& at(size_t index) const { return _records[(_tail + index) % TELEMETRY_RING_CAPACITY]; }
+
+    // Records overwritten before they were published
+    uint32_t dropped() const { return _dropped; }
+
+private:
+    telemetry_record_t _records[TELEMETRY_RING_CAPACITY];
+    size_t _tail;  // oldest record
+    size_t _count;
+    uint32_t _dropped;
+
+    uint32_t _flowPeriodMs;
+    uint32_t _climatePeriodMs;
+    uint32_t _flushIntervalMs;
+    bool _started;
+    uint32_t _flowAt;      // millis() of the last flow sample
+    uint32_t _climateAt;   // millis() of the last climate record
+    uint32_t _climateTaken; // takenAtMs of the last recorded measurement
+    uint32_t _flushedAt;   // millis() of the last flush or postpone()
+    bool _running[FLOW_BANK_MAX_SENSORS]; // sensor was recorded as flowing last time
+    bool _anyRunning;
+};
+
+#endif
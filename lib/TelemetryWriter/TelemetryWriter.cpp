@@ -0,0 +1,379 @@
+#include "TelemetryWriter.h"
+#include <string.h>
+
+static const uint32_t POW10[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+JsonWriter::JsonWriter(char* buffer, size_t size)
+    : _buf(buffer), _size(size), _len(0), _first(true), _overflow(size < 2) {
+    put('{');
+}
+
+void JsonWriter::put(char c) {
+    // always keep one byte spare for the terminator
+    if (_len + 1 >= _size) {
+        _overflow = true;
+        return;
+    }
+    _buf[_len++] = c;
+}
+
+void JsonWriter::putRaw(const char* s) {
+    while (*s) put(*s++);
+}
+
+void JsonWriter::putEscaped(const char* s) {
+    for (; *s; s++) {
+        char c = *s;
+        if (c == '"' || c == '\\') {
+            put('\\');
+            put(c);
+        } else if (static_cast<unsigned char>(c) >= 0x20) {
+            put(c);
+        }
+        // control characters never appear in our payloads; drop them rather than escape
+    }
+}
+
+void JsonWriter::putKey(const char* key) {
+    if (!_first) put(',');
+    _first = false;
+    if (key == nullptr) return; // array element
+    put('"');
+    putRaw(key);
+    put('"');
+    put(':');
+}
+
+void JsonWriter::putUnsigned(uint64_t value, uint8_t minDigits) {
+    char digits[20];
+    uint8_t n = 0;
+    do {
+        digits[n++] = '0' + (value % 10);
+        value /= 10;
+    } while (value > 0 && n < sizeof(digits));
+    while (n < minDigits && n < sizeof(digits)) digits[n++] = '0';
+    while (n > 0) put(digits[--n]);
+}
+
+JsonWriter& JsonWriter::addString(const char* key, const char* value) {
+    putKey(key);
+    put('"');
+    putEscaped(value ? value : "");
+    put('"');
+    return *this;
+}
+
+JsonWriter& JsonWriter::addInt(const char* key, int64_t value) {
+    putKey(key);
+    if (value < 0) {
+        put('-');
+        putUnsigned(0 - static_cast<uint64_t>(value), 1);
+    } else {
+        putUnsigned(static_cast<uint64_t>(value), 1);
+    }
+    return *this;
+}
+
+JsonWriter& JsonWriter::addFixed(const char* key, int32_t scaled, uint8_t decimals) {
+    if (decimals == 0 || decimals >= sizeof(POW10) / sizeof(POW10[0])) return addInt(key, scaled);
+
+    putKey(key);
+    uint32_t magnitude = scaled < 0 ? 0u - static_cast<uint32_t>(scaled) : static_cast<uint32_t>(scaled);
+    if (scaled < 0) put('-');
+    putUnsigned(magnitude / POW10[decimals], 1);
+    put('.');
+    putUnsigned(magnitude % POW10[decimals], decimals);
+    return *this;
+}
+
+JsonWriter& JsonWriter::beginArray(const char* key) {
+    putKey(key);
+    put('[');
+    _first = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::endArray() {
+    put(']');
+    _first = false;
+    return *this;
+}
+
+const char* JsonWriter::finish() {
+    put('}');
+    if (_size > 0) _buf[_len < _size ? _len : _size - 1] = '\0';
+    return _overflow ? nullptr : _buf;
+}
+
+int32_t toFixed(float value, uint8_t decimals) {
+    float scaled = value * static_cast<float>(POW10[decimals < 9 ? decimals : 9]);
+    // round half away from zero without pulling in lroundf
+    return static_cast<int32_t>(scaled < 0 ? scaled - 0.5f : scaled + 0.5f);
+}
+
+// Wire keys of CborWriter: a key's index in this table is sent instead of its
+// name. Append only; Server/mqtt.py keeps the same table to decode them.
+// decimals is the addFixed() scaling the key is always written with.
+static const struct {
+    const char* name;
+    uint8_t decimals;
+} CBOR_KEYS[] = {
+    {"firmware_version", 0}, {"zones", 0}, {"interval_s", 0}, {"duration_s", 0}, {"temperature_c", 1},
+    {"humidity_pct", 1}, {"cmd_latency_us", 0}, {"cmd_latency_max_us", 0}, {"dropped_cmds", 0},
+    {"sched_late_ms", 0}, {"sched_late_max_ms", 0}, {"nvs_commits", 0}, {"nvs_writes_avoided", 0},
+    {"nvs_commit_us", 0}, {"nvs_commit_max_us", 0}, {"flow_total_ml", 0}, {"next_on_time", 0},
+    {"current_time", 0}, {"status", 0}, {"zone", 0}, {"flow_rate_lpm", 2}, {"total_volume_l", 2},
+    {"interval", 0}, {"duration", 0}, {"Turn_ON_AT", 0}, {"volume_l", 3}, {"ota_check_result", 0},
+    {"check_timestamp", 0}, {"spool_pending", 0}, {"spool_dropped", 0}, {"boot_ready_ms", 0},
+    {"first_actuation_ms", 0}, {"mqtt_attempts", 0}, {"wifi_outages", 0}, {"wifi_outage_ms", 0},
+    {"wifi_reconnects", 0}, {"boot_wifi_ms", 0}, {"boot_mqtt_ms", 0}, {"wifi_fast_boot", 0},
+};
+
+// CBOR major types
+#define CBOR_UNSIGNED 0
+#define CBOR_NEGATIVE 1
+#define CBOR_TEXT 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+#define CBOR_TAG 6
+#define CBOR_INDEFINITE 31
+#define CBOR_BREAK 0xFF
+#define CBOR_TAG_DECIMAL_FRACTION 4
+
+CborWriter::CborWriter(char* buffer, size_t size) : _buf(buffer), _size(size), _len(0), _overflow(false) {
+    put((CBOR_MAP << 5) | CBOR_INDEFINITE);
+}
+
+void CborWriter::put(uint8_t b) {
+    if (_len >= _size) {
+        _overflow = true;
+        return;
+    }
+    _buf[_len++] = static_cast<char>(b);
+}
+
+void CborWriter::putHead(uint8_t major, uint64_t value) {
+    uint8_t type = major << 5;
+    if (value < 24) {
+        put(type | value);
+        return;
+    }
+    // the argument follows big-endian in the smallest of 1, 2, 4 or 8 bytes
+    uint8_t bytes = value <= 0xFF ? 1 : value <= 0xFFFF ? 2 : value <= 0xFFFFFFFFULL ? 4 : 8;
+    put(type | (bytes == 1 ? 24 : bytes == 2 ? 25 : bytes == 4 ? 26 : 27));
+    for (int shift = (bytes - 1) * 8; shift >= 0; shift -= 8) put(static_cast<uint8_t>(value >> shift));
+}
+
+void CborWriter::putInt(int64_t value) {
+    if (value < 0) putHead(CBOR_NEGATIVE, static_cast<uint64_t>(-(value + 1)));
+    else putHead(CBOR_UNSIGNED, static_cast<uint64_t>(value));
+}
+
+void CborWriter::putText(const char* s) {
+    size_t n = strlen(s);
+    putHead(CBOR_TEXT, n);
+    for (size_t i = 0; i < n; i++) put(static_cast<uint8_t>(s[i]));
+}
+
+int CborWriter::putKey(const char* key) {
+    if (key == nullptr) return -1; // array element
+    for (size_t i = 0; i < sizeof(CBOR_KEYS) / sizeof(CBOR_KEYS[0]); i++) {
+        if (strcmp(CBOR_KEYS[i].name, key) == 0) {
+            putHead(CBOR_UNSIGNED, i);
+            return static_cast<int>(i);
+        }
+    }
+    putText(key); // not in the table: the name itself, still valid CBOR
+    return -1;
+}
+
+CborWriter& CborWriter::addString(const char* key, const char* value) {
+    putKey(key);
+    putText(value ? value : "");
+    return *this;
+}
+
+CborWriter& CborWriter::addInt(const char* key, int64_t value) {
+    putKey(key);
+    putInt(value);
+    return *this;
+}
+
+CborWriter& CborWriter::addFixed(const char* key, int32_t scaled, uint8_t decimals) {
+    int index = putKey(key);
+    if (decimals == 0 || (index >= 0 && CBOR_KEYS[index].decimals == decimals)) {
+        // the key's table entry carries the scaling
+        putInt(scaled);
+    } else {
+        // self-describing: decimal fraction [-decimals, scaled]
+        putHead(CBOR_TAG, CBOR_TAG_DECIMAL_FRACTION);
+        putHead(CBOR_ARRAY, 2);
+        putInt(-static_cast<int64_t>(decimals));
+        putInt(scaled);
+    }
+    return *this;
+}
+
+CborWriter& CborWriter::beginArray(const char* key) {
+    putKey(key);
+    put((CBOR_ARRAY << 5) | CBOR_INDEFINITE);
+    return *this;
+}
+
+CborWriter& CborWriter::endArray() {
+    put(CBOR_BREAK);
+    return *this;
+}
+
+size_t CborWriter::finish() {
+    put(CBOR_BREAK);
+    return _overflow ? 0 : _len;
+}
+
+// The fields of each payload, in output order, for either writer
+struct HeartbeatFields {
+    template <typename W>
+    static void write(W& w, const heartbeat_payload_t& p) {
+        w.addString("firmware_version", p.firmware_version)
+            .addInt("zones", p.zones)
+            .addInt("interval_s", p.interval_s)
+            .addInt("duration_s", p.duration_s);
+        if (p.has_climate)
+            w.addFixed("temperature_c", p.temperature_c10, 1).addFixed("humidity_pct", p.humidity_pct10, 1);
+        w.addInt("cmd_latency_us", p.cmd_latency_us)
+            .addInt("cmd_latency_max_us", p.cmd_latency_max_us)
+            .addInt("dropped_cmds", p.dropped_cmds)
+            .addInt("sched_late_ms", p.sched_late_ms)
+            .addInt("sched_late_max_ms", p.sched_late_max_ms)
+            .addInt("nvs_commits", p.nvs_commits)
+            .addInt("nvs_writes_avoided", p.nvs_writes_avoided)
+            .addInt("nvs_commit_us", p.nvs_commit_us)
+            .addInt("nvs_commit_max_us", p.nvs_commit_max_us)
+            .addInt("flow_total_ml", static_cast<int64_t>(p.flow_total_ml))
+            .addInt("spool_pending", p.spool_pending)
+            .addInt("spool_dropped", p.spool_dropped)
+            .addInt("boot_ready_ms", p.boot_ready_ms)
+            .addInt("first_actuation_ms", p.first_actuation_ms)
+            .addInt("mqtt_attempts", p.mqtt_attempts)
+            .addInt("wifi_outages", p.wifi_outages)
+            .addInt("wifi_outage_ms", p.wifi_outage_ms)
+            .addInt("wifi_reconnects", p.wifi_reconnects)
+            .addInt("boot_wifi_ms", p.boot_wifi_ms)
+            .addInt("boot_mqtt_ms", p.boot_mqtt_ms)
+            .addInt("wifi_fast_boot", p.wifi_fast_boot);
+        if (p.next_on_time) w.addString("next_on_time", p.next_on_time);
+        else w.addInt("next_on_time", p.next_on_epoch);
+        if (p.current_time) w.addString("current_time", p.current_time);
+        else w.addInt("current_time", p.current_epoch);
+    }
+};
+
+struct AckFields {
+    template <typename W>
+    static void write(W& w, const ack_payload_t& p) {
+        w.addString("status", p.status)
+            .addInt("zone", p.zone)
+            .addFixed("flow_rate_lpm", p.flow_rate_lpm100, 2)
+            .addFixed("total_volume_l", p.total_volume_l100, 2);
+        if (p.has_climate)
+            w.addFixed("temperature_c", p.temperature_c10, 1).addFixed("humidity_pct", p.humidity_pct10, 1);
+    }
+};
+
+struct ConfigAckFields {
+    template <typename W>
+    static void write(W& w, const config_ack_payload_t& p) {
+        w.addInt("interval", p.interval)
+            .addInt("duration", p.duration)
+            .addInt("Turn_ON_AT", p.turn_on_at)
+            .addInt("zone", p.zone);
+        if (p.volume_ml != 0) w.addFixed("volume_l", p.volume_ml, 3);
+    }
+};
+
+struct ControlAckFields {
+    template <typename W>
+    static void write(W& w, const control_ack_payload_t& p) {
+        w.addString("status", p.status).addInt("zone", p.zone);
+    }
+};
+
+struct FirmwareStatusFields {
+    template <typename W>
+    static void write(W& w, const firmware_status_payload_t& p) {
+        w.addString("firmware_version", p.firmware_version)
+            .addInt("ota_check_result", p.ota_check_result)
+            .addInt("check_timestamp", p.check_timestamp);
+    }
+};
+
+template <typename Fields, typename P>
+static const char* formatJson(char* buffer, size_t size, const P& p) {
+    JsonWriter w(buffer, size);
+    Fields::write(w, p);
+    return w.finish();
+}
+
+template <typename Fields, typename P>
+static size_t encodePayload(char* buffer, size_t size, PayloadEncoding encoding, const P& p) {
+    if (encoding == PAYLOAD_CBOR) {
+        CborWriter w(buffer, size);
+        Fields::write(w, p);
+        return w.finish();
+    }
+    JsonWriter w(buffer, size);
+    Fields::write(w, p);
+    return w.finish() != nullptr ? w.length() : 0;
+}
+
+const char* formatHeartbeat(char* buffer, size_t size, const heartbeat_payload_t& p) {
+    return formatJson<HeartbeatFields>(buffer, size, p);
+}
+
+const char* formatAck(char* buffer, size_t size, const ack_payload_t& p) {
+    return formatJson<AckFields>(buffer, size, p);
+}
+
+const char* formatConfigAck(char* buffer, size_t size, const config_ack_payload_t& p) {
+    return formatJson<ConfigAckFields>(buffer, size, p);
+}
+
+const char* formatControlAck(char* buffer, size_t size, const control_ack_payload_t& p) {
+    return formatJson<ControlAckFields>(buffer, size, p);
+}
+
+const char* formatFirmwareStatus(char* buffer, size_t size, const firmware_status_payload_t& p) {
+    return formatJson<FirmwareStatusFields>(buffer, size, p);
+}
+
+size_t encodeHeartbeat(char* buffer, size_t size, PayloadEncoding encoding, const heartbeat_payload_t& p) {
+    return encodePayload<HeartbeatFields>(buffer, size, encoding, p);
+}
+
+size_t encodeAck(char* buffer, size_t size, PayloadEncoding encoding, const ack_payload_t& p) {
+    return encodePayload<AckFields>(buffer, size, encoding, p);
+}
+
+size_t encodeConfigAck(char* buffer, size_t size, PayloadEncoding encoding, const config_ack_payload_t& p) {
+    return encodePayload<ConfigAckFields>(buffer, size, encoding, p);
+}
+
+size_t encodeControlAck(char* buffer, size_t size, PayloadEncoding encoding, const control_ack_payload_t& p) {
+    return encodePayload<ControlAckFields>(buffer, size, encoding, p);
+}
+
+size_t encodeFirmwareStatus(char* buffer, size_t size, PayloadEncoding encoding,
+                            const firmware_status_payload_t& p) {
+    return encodePayload<FirmwareStatusFields>(buffer, size, encoding, p);
+}
+
+const char* formatFlowAlert(char* buffer, size_t size, const flow_alert_payload_t& p) {
+    return JsonWriter(buffer, size)
+        .addString("alert", p.alert)
+        .addInt("zone", p.zone)
+        .addFixed("flow_rate_lpm", p.flow_rate_lpm100, 2)
+        .addFixed("baseline_lpm", p.baseline_lpm100, 2)
+        .addInt("pulses", p.pulses)
+        .addInt("timestamp", p.timestamp)
+        .finish();
+}
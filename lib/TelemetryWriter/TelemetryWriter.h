@@ -0,0 +1,184 @@
+#ifndef TELEMETRY_WRITER_H
+#define TELEMETRY_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Appends a JSON object into a caller-owned buffer. Numbers are written as
+// integers or fixed-point (value scaled by 10^decimals), so no float formatting
+// and no heap allocation is involved. If the buffer runs out the writer stops
+// and finish() returns nullptr.
+//
+// Arrays of rows are written with beginArray()/endArray(); inside an array the
+// key is nullptr, e.g. beginArray("r").beginArray(nullptr).addInt(nullptr, 1)...
+class JsonWriter {
+public:
+    JsonWriter(char* buffer, size_t size);
+
+    JsonWriter& addString(const char* key, const char* value);
+    JsonWriter& addInt(const char* key, int64_t value);
+    // e.g. addFixed("temperature_c", 235, 1) writes "temperature_c":23.5
+    JsonWriter& addFixed(const char* key, int32_t scaled, uint8_t decimals);
+    JsonWriter& beginArray(const char* key);
+    JsonWriter& endArray();
+
+    // Close the object and NUL-terminate; nullptr if the buffer overflowed
+    const char* finish();
+
+    size_t length() const { return _len; }
+    bool overflowed() const { return _overflow; }
+
+private:
+    void put(char c);
+    void putRaw(const char* s);
+    void putEscaped(const char* s);
+    void putKey(const char* key);
+    void putUnsigned(uint64_t value, uint8_t minDigits);
+
+    char* _buf;
+    size_t _size;
+    size_t _len;
+    bool _first;
+    bool _overflow;
+};
+
+// Writes the same calls as JsonWriter as CBOR (RFC 8949) into a caller-owned
+// buffer, for links where bytes on the wire matter more than readability.
+//
+// The payload is an indefinite-length map, so a single byte ends it and a
+// field can be appended later without re-encoding the rest. Keys the firmware
+// sends are written as small integers from a fixed table (see
+// TelemetryWriter.cpp); any other key is written as text. A fixed-point value
+// whose key has a known scaling goes out as the bare scaled integer, otherwise
+// as a decimal fraction (tag 4).
+class CborWriter {
+public:
+    CborWriter(char* buffer, size_t size);
+
+    CborWriter& addString(const char* key, const char* value);
+    CborWriter& addInt(const char* key, int64_t value);
+    CborWriter& addFixed(const char* key, int32_t scaled, uint8_t decimals);
+    CborWriter& beginArray(const char* key);
+    CborWriter& endArray();
+
+    // Close the map; returns the encoded length, 0 if the buffer overflowed.
+    // The output is binary and not NUL-terminated.
+    size_t finish();
+
+    size_t length() const { return _len; }
+    bool overflowed() const { return _overflow; }
+
+private:
+    void put(uint8_t b);
+    void putHead(uint8_t major, uint64_t value);
+    void putInt(int64_t value);
+    void putText(const char* s);
+    int putKey(const char* key); // index in the key table, -1 if written as text
+
+    char* _buf;
+    size_t _size;
+    size_t _len;
+    bool _overflow;
+};
+
+enum PayloadEncoding {
+    PAYLOAD_JSON,
+    PAYLOAD_CBOR
+};
+
+// Convert a float reading to the fixed-point representation used by addFixed()
+int32_t toFixed(float value, uint8_t decimals);
+
+// Payload shapes. Field order in the output is fixed by the format functions below.
+
+typedef struct {
+    const char* firmware_version;
+    uint8_t zones;             // number of configured zones; the schedule fields describe zone 0
+    uint32_t interval_s;
+    uint32_t duration_s;
+    int32_t temperature_c10;   // tenths of a degree
+    int32_t humidity_pct10;    // tenths of a percent
+    bool has_climate;          // false until the first DHT20 reading; the two fields above are left out
+    int64_t cmd_latency_us;
+    int64_t cmd_latency_max_us;
+    uint32_t dropped_cmds;
+    int64_t sched_late_ms;
+    int64_t sched_late_max_ms;
+    uint32_t nvs_commits;
+    uint32_t nvs_writes_avoided;
+    uint32_t nvs_commit_us;
+    uint32_t nvs_commit_max_us;
+    uint64_t flow_total_ml;    // lifetime meter reading
+    uint32_t spool_pending;    // messages logged offline, not yet replayed
+    uint32_t spool_dropped;    // logged messages lost to a full spool since boot
+    uint32_t boot_ready_ms;    // boot to the first pass of loop(), when the schedule starts running
+    uint32_t first_actuation_ms; // boot to the first relay switch, 0 if none yet
+    uint32_t mqtt_attempts;    // MQTT connection attempts since boot
+    uint32_t wifi_outages;     // WiFi outages recovered from since boot
+    uint32_t wifi_outage_ms;   // length of the last one
+    uint32_t wifi_reconnects;  // reconnect attempts it took
+    uint32_t boot_wifi_ms;     // boot to the station's first address, 0 if not yet
+    uint32_t boot_mqtt_ms;     // boot to the first MQTT session, 0 if not yet
+    uint8_t wifi_fast_boot;    // 1 if boot connected to the cached AP without a scan
+    const char* next_on_time;  // preformatted local time, or nullptr to send next_on_epoch
+    uint32_t next_on_epoch;
+    const char* current_time;  // preformatted local time, or nullptr to send current_epoch
+    uint32_t current_epoch;
+} heartbeat_payload_t;
+
+typedef struct {
+    const char* status;        // "ON" / "OFF"
+    uint8_t zone;
+    int32_t flow_rate_lpm100;  // hundredths of a L/min
+    int32_t total_volume_l100; // hundredths of a litre
+    int32_t temperature_c10;
+    int32_t humidity_pct10;
+    bool has_climate;          // as in heartbeat_payload_t
+} ack_payload_t;
+
+typedef struct {
+    uint32_t interval;
+    uint32_t duration;
+    uint32_t turn_on_at;
+    uint8_t zone;
+    uint32_t volume_ml;        // 0 for time-based cycles, which leave volume_l out
+} config_ack_payload_t;
+
+typedef struct {
+    const char* status;        // "ON" / "OFF"
+    uint8_t zone;
+} control_ack_payload_t;
+
+typedef struct {
+    const char* firmware_version;
+    int32_t ota_check_result;
+    uint32_t check_timestamp;
+} firmware_status_payload_t;
+
+typedef struct {
+    const char* alert;         // "leak" / "burst" / "blocked"
+    int16_t zone;              // -1 for the main line
+    int32_t flow_rate_lpm100;
+    int32_t baseline_lpm100;
+    uint32_t pulses;
+    uint32_t timestamp;
+} flow_alert_payload_t;
+
+// Each returns the formatted payload inside buffer, or nullptr if it did not fit
+const char* formatHeartbeat(char* buffer, size_t size, const heartbeat_payload_t& p);
+const char* formatAck(char* buffer, size_t size, const ack_payload_t& p);
+const char* formatConfigAck(char* buffer, size_t size, const config_ack_payload_t& p);
+const char* formatControlAck(char* buffer, size_t size, const control_ack_payload_t& p);
+const char* formatFirmwareStatus(char* buffer, size_t size, const firmware_status_payload_t& p);
+const char* formatFlowAlert(char* buffer, size_t size, const flow_alert_payload_t& p);
+
+// The same payloads in the chosen encoding. Each returns the length written to
+// buffer (JSON is also NUL-terminated), or 0 if it did not fit.
+size_t encodeHeartbeat(char* buffer, size_t size, PayloadEncoding encoding, const heartbeat_payload_t& p);
+size_t encodeAck(char* buffer, size_t size, PayloadEncoding encoding, const ack_payload_t& p);
+size_t encodeConfigAck(char* buffer, size_t size, PayloadEncoding encoding, const config_ack_payload_t& p);
+size_t encodeControlAck(char* buffer, size_t size, PayloadEncoding encoding, const control_ack_payload_t& p);
+size_t encodeFirmwareStatus(char* buffer, size_t size, PayloadEncoding encoding,
+                            const firmware_status_payload_t& p);
+
+#endif
@@ -0,0 +1,117 @@
+#include "VolumeShutoff.h"
+
+VolumeShutoff::VolumeShutoff(FlowSensorBank& bank, VolumeShutoffHandler handler)
+    : _bank(bank), _handler(handler), _runs() {
+    for (uint8_t zone = 0; zone < VOLUME_SHUTOFF_MAX_ZONES; zone++) {
+        _runs[zone].owner = this;
+        _runs[zone].zone = zone;
+        _runs[zone].sensor = -1;
+        _runs[zone].state = RUN_IDLE;
+        _runs[zone].closeMs = VOLUME_CLOSE_MS_DEFAULT;
+    }
+}
+
+bool VolumeShutoff::start(uint8_t zone, uint32_t milliliters) {
+    volume_run_t& run = _runs[zone];
+    cancel(zone);
+
+    flow_bank_snapshot_t flow = _bank.snapshot();
+    run.sensor = -1;
+    for (uint8_t i = 0; i < flow.count && run.sensor < 0; i++) {
+        if (FlowSensorBank::meters(flow, i, zone)) run.sensor = i;
+    }
+    if (run.sensor < 0) return false;
+
+    WaterFlowSensor& sensor = _bank.sensor(run.sensor);
+    run.startPulses = sensor.pulseCount();
+    run.targetPulses = static_cast<uint32_t>(milliliters * sensor.pulsesPerLitre() / 1000.0f + 0.5f);
+    run.reached = false;
+    run.state = RUN_ARMED;
+    // no rate yet: aim at the full volume until the flow has been measured
+    aim(run, 0, millis());
+    return true;
+}
+
+void VolumeShutoff::cancel(uint8_t zone) {
+    volume_run_t& run = _runs[zone];
+    if (run.state != RUN_ARMED) return;
+    _bank.sensor(run.sensor).disarmTarget();
+    run.reached = false;
+    run.state = RUN_IDLE;
+}
+
+void VolumeShutoff::aim(volume_run_t& run, float rateHz, uint32_t nowMs) {
+    float lead = rateHz * run.closeMs / 1000.0f;
+    uint32_t leadPulses = lead >= run.targetPulses ? run.targetPulses : static_cast<uint32_t>(lead + 0.5f);
+    run.rateHz = rateHz;
+    run.aimedAt = nowMs;
+
+    WaterFlowSensor& sensor = _bank.sensor(run.sensor);
+    if (!sensor.armTarget(run.startPulses + run.targetPulses - leadPulses, onTarget, &run)) {
+        // already there (the lead grew past what is left): the loop drops the relay
+        run.hitPulses = sensor.pulseCount();
+        run.reached = true;
+    }
+}
+
+void IRAM_ATTR VolumeShutoff::onTarget(void* arg, uint32_t pulses) {
+    volume_run_t* run = static_cast<volume_run_t*>(arg);
+    run->hitPulses = pulses;
+    run->reached = true;
+    run->owner->_handler(run->zone);
+}
+
+bool VolumeShutoff::nextReached(uint8_t& zone) {
+    for (uint8_t i = 0; i < VOLUME_SHUTOFF_MAX_ZONES; i++) {
+        volume_run_t& run = _runs[i];
+        if (run.state != RUN_ARMED || !run.reached) continue;
+        run.reached = false;
+        run.state = RUN_SETTLING;
+        run.hitAt = millis();
+        zone = i;
+        return true;
+    }
+    return false;
+}
+
+void VolumeShutoff::service(const flow_bank_snapshot_t& flow, uint32_t nowMs) {
+    for (uint8_t zone = 0; zone < VOLUME_SHUTOFF_MAX_ZONES; zone++) {
+        volume_run_t& run = _runs[zone];
+        if (run.state == RUN_ARMED && !run.reached && nowMs - run.aimedAt >= VOLUME_REAIM_MS) {
+            WaterFlowSensor& sensor = _bank.sensor(run.sensor);
+            aim(run, flow.sensors[run.sensor].instantLpm / 60.0f * sensor.pulsesPerLitre(), nowMs);
+        } else if (run.state == RUN_SETTLING && nowMs - run.hitAt >= VOLUME_SETTLE_MS) {
+            WaterFlowSensor& sensor = _bank.sensor(run.sensor);
+            uint32_t total = sensor.pulseCount();
+            run.delivered = static_cast<uint32_t>(sensor.pulsesToMilliliters(total - run.startPulses));
+            if (run.rateHz > 0) {
+                // the pulses that followed the shutoff, at the rate aimed with, are the close time
+                float measuredMs = (total - run.hitPulses) / run.rateHz * 1000.0f;
+                if (measuredMs > VOLUME_SETTLE_MS) measuredMs = VOLUME_SETTLE_MS;
+                run.closeMs = static_cast<uint32_t>(run.closeMs + VOLUME_LEARN_WEIGHT * (measuredMs - run.closeMs) + 0.5f);
+            }
+            Serial.printf("Zone %u delivered %lu mL; valve closes in about %lu ms\r\n", zone,
+                          (unsigned long)run.delivered, (unsigned long)run.closeMs);
+            run.state = RUN_IDLE;
+        }
+    }
+}
+
+uint32_t VolumeShutoff::msUntilService(uint32_t nowMs) const {
+    uint32_t waitMs = UINT32_MAX;
+    for (uint8_t zone = 0; zone < VOLUME_SHUTOFF_MAX_ZONES; zone++) {
+        const volume_run_t& run = _runs[zone];
+        uint32_t elapsed, interval;
+        if (run.state == RUN_ARMED) {
+            elapsed = nowMs - run.aimedAt;
+            interval = VOLUME_REAIM_MS;
+        } else if (run.state == RUN_SETTLING) {
+            elapsed = nowMs - run.hitAt;
+            interval = VOLUME_SETTLE_MS;
+        } else {
+            continue;
+        }
+        waitMs = min(waitMs, elapsed >= interval ? 0 : interval - elapsed);
+    }
+    return waitMs;
+}
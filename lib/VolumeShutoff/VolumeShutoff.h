@@ -0,0 +1,94 @@
+#ifndef VOLUME_SHUTOFF_H
+#define VOLUME_SHUTOFF_H
+
+#include <Arduino.h>
+#include <FlowSensorBank.h>
+
+// Zones tracked; matches MAX_ZONES of the scheduler
+#define VOLUME_SHUTOFF_MAX_ZONES 32
+
+// Until a zone has been measured, its valve is assumed to take this long to
+// close after the relay drops (a typical 1/2" solenoid)
+#define VOLUME_CLOSE_MS_DEFAULT 150
+
+// Pulses counted for this long after the shutoff are the overshoot; then the
+// run is over and the zone's close time is learned from it
+#define VOLUME_SETTLE_MS 3000
+
+// Weight of each cycle's measured close time in the zone's estimate
+#define VOLUME_LEARN_WEIGHT 0.5f
+
+// The target is re-aimed from the current rate at most this often
+#define VOLUME_REAIM_MS 1000
+
+// Relay shutoff, run from the counting interrupt: must only drop the relay and
+// signal a task
+typedef void (*VolumeShutoffHandler)(uint8_t zone);
+
+// Volume-targeted runs. start() arms a pulse target on the zone's meter; the
+// counting interrupt calls the handler the moment it is reached, so the relay
+// drops within microseconds of the pulse rather than at the next loop pass.
+//
+// Water keeps flowing while the valve closes, so the target is aimed short of
+// the requested volume by the predicted overshoot: the current rate times the
+// zone's valve close time. Each run measures its real overshoot once the line
+// has settled, and the close time is learned from it, so delivered volume
+// converges on the request even as the rate changes.
+//
+// A zone with several sensors of its own is dosed on the first; zones sharing
+// a main line should not run volume-targeted at the same time.
+class VolumeShutoff {
+public:
+    VolumeShutoff(FlowSensorBank& bank, VolumeShutoffHandler handler);
+
+    // Begin a run of zone that should deliver milliliters; call with the relay
+    // just energised. Returns false if the zone has no meter.
+    bool start(uint8_t zone, uint32_t milliliters);
+
+    // The relay dropped some other way (duration cap, OFF command); stop aiming
+    void cancel(uint8_t zone);
+
+    // Re-aim running targets from the latest rates and learn from settled runs;
+    // call regularly from loop()
+    void service(const flow_bank_snapshot_t& flow, uint32_t nowMs);
+
+    // Take a zone whose target was reached by the interrupt since the last call
+    bool nextReached(uint8_t& zone);
+
+    // When service() next has work: re-aiming or a run to settle
+    uint32_t msUntilService(uint32_t nowMs) const;
+
+    // Learned valve close time of a zone
+    uint32_t closeMs(uint8_t zone) const { return _runs[zone].closeMs; }
+
+    // Delivered volume of the zone's last settled run, overshoot included
+    uint32_t deliveredMilliliters(uint8_t zone) const { return _runs[zone].delivered; }
+
+private:
+    enum RunState { RUN_IDLE, RUN_ARMED, RUN_SETTLING };
+
+    typedef struct {
+        VolumeShutoff* owner;
+        uint8_t zone;
+        int8_t sensor;          // bank index the run is dosed on
+        RunState state;
+        volatile bool reached;  // set by the interrupt, taken by nextReached()
+        volatile uint32_t hitPulses;
+        uint32_t startPulses;
+        uint32_t targetPulses;  // requested volume in pulses
+        float rateHz;           // pulse rate the target was last aimed with
+        uint32_t aimedAt;       // millis() of the last aim
+        uint32_t hitAt;         // millis() the shutoff was taken
+        uint32_t closeMs;       // learned valve close time
+        uint32_t delivered;
+    } volume_run_t;
+
+    static void IRAM_ATTR onTarget(void* arg, uint32_t pulses);
+    void aim(volume_run_t& run, float rateHz, uint32_t nowMs);
+
+    FlowSensorBank& _bank;
+    VolumeShutoffHandler _handler;
+    volume_run_t _runs[VOLUME_SHUTOFF_MAX_ZONES];
+};
+
+#endif
@@ -1,43 +1,280 @@
 #include "WaterFlowSensor.h"
 
-WaterFlowSensor::WaterFlowSensor(uint8_t pin, float calibrationFactor) 
-    : _pin(pin), _calibrationFactor(calibrationFactor), _pulseCount(0), _lastMillis(0), _totalLiters(0.0) {}
+// A delay rounded to whole ticks can wake the accumulator up to a tick early;
+// a counter read that is due this soon is taken anyway
+#define FLOW_PCNT_READ_SLACK_US 2000
 
-void WaterFlowSensor::begin() {
+uint8_t WaterFlowSensor::_unitsInUse = 0;
+
+WaterFlowSensor::WaterFlowSensor(uint8_t pin, float calibrationFactor, FlowCounterBackend backend)
+    : _pin(pin), _calibrationFactor(calibrationFactor),
+      _pulsesPerKilolitre(static_cast<uint32_t>(calibrationFactor * 60000.0f + 0.5f)), _backend(backend),
+      _unit(PCNT_UNIT_0), _pulseCount(0), _samplesDropped(0), _task(nullptr), _lastSampleMillis(0), _readTicks(0),
+      _readTotal(0), _windowPulses(0), _windowMillis(0), _averageLpm(0), _starts(0), _stops(0), _lifetimeBase(0),
+      _pulses64(0), _lastTotal(0), _volumeBase(0), _targetArmed(false), _target(0), _targetCallback(nullptr), _targetArg(nullptr) {}
+
+void WaterFlowSensor::begin(bool background) {
     pinMode(_pin, INPUT_PULLUP);
-    // ESP32 specific: Pass 'this' pointer to the ISR
-    attachInterruptArg(digitalPinToInterrupt(_pin), handleInterrupt, this, FALLING);
+    _lastSampleMillis = _windowMillis = millis();
+    if (_backend == FLOW_COUNTER_PCNT && !beginPcnt()) {
+        Serial.printf("No PCNT unit for flow sensor on GPIO%u; counting with a GPIO interrupt\r\n", _pin);
+        _backend = FLOW_COUNTER_GPIO_ISR;
+    }
+    if (_backend == FLOW_COUNTER_GPIO_ISR) {
+        _estimator.begin(getCpuFrequencyMhz() * 1000000UL);
+        // ESP32 specific: Pass 'this' pointer to the ISR
+        attachInterruptArg(digitalPinToInterrupt(_pin), handleInterrupt, this, FALLING);
+    } else {
+        _estimator.begin(1000000UL, FLOW_PCNT_RATE_INTERVALS);
+        _readTicks = ticks();
+    }
+    flow_snapshot_t reading;
+    fill(reading, 0, _windowMillis);
+    publish(reading);
+
+    // the interrupt was attached on this core, so its cycle-counter timestamps are only comparable here
+    if (background &&
+        xTaskCreatePinnedToCore(accumulatorTask, "flow", FLOW_TASK_STACK, this, FLOW_TASK_PRIORITY, &_task,
+                                xPortGetCoreID()) != pdPASS) {
+        Serial.println("Could not start the flow accumulator task");
+    }
+}
+
+void WaterFlowSensor::accumulatorTask(void* arg) {
+    WaterFlowSensor* sensor = static_cast<WaterFlowSensor*>(arg);
+    for (;;) {
+        sensor->update();
+        uint32_t waitMs = sensor->msUntilUpdate();
+        vTaskDelay(pdMS_TO_TICKS(waitMs > 0 ? waitMs : 1));
+    }
+}
+
+bool WaterFlowSensor::beginPcnt() {
+    if (_unitsInUse >= PCNT_UNIT_MAX) return false;
+    _unit = static_cast<pcnt_unit_t>(_unitsInUse);
+
+    // count falling edges, like the GPIO path; no control pin
+    pcnt_config_t config = {};
+    config.pulse_gpio_num = _pin;
+    config.ctrl_gpio_num = PCNT_PIN_NOT_USED;
+    config.lctrl_mode = PCNT_MODE_KEEP;
+    config.hctrl_mode = PCNT_MODE_KEEP;
+    config.pos_mode = PCNT_COUNT_DIS;
+    config.neg_mode = PCNT_COUNT_INC;
+    config.counter_h_lim = FLOW_PCNT_OVERFLOW_LIMIT;
+    config.counter_l_lim = 0;
+    config.unit = _unit;
+    config.channel = PCNT_CHANNEL_0;
+    if (pcnt_unit_config(&config) != ESP_OK) return false;
+
+    pcnt_set_filter_value(_unit, FLOW_PCNT_FILTER_APB_CYCLES);
+    pcnt_filter_enable(_unit);
+    pcnt_event_enable(_unit, PCNT_EVT_H_LIM);
+    pcnt_event_disable(_unit, PCNT_EVT_THRES_0); // aimed by armTarget()
+    pcnt_counter_pause(_unit);
+    pcnt_counter_clear(_unit);
+
+    // another sensor may have installed the shared service already
+    esp_err_t err = pcnt_isr_service_install(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) return false;
+    if (pcnt_isr_handler_add(_unit, handlePcntOverflow, this) != ESP_OK) return false;
+
+    pcnt_counter_resume(_unit);
+    _unitsInUse++;
+    return true;
+}
+
+uint32_t WaterFlowSensor::ticks() const {
+    return _backend == FLOW_COUNTER_PCNT ? static_cast<uint32_t>(micros()) : ESP.getCycleCount();
+}
+
+// Timestamp the pulse total for the estimator; update() is the only consumer
+void IRAM_ATTR WaterFlowSensor::recordSample(uint32_t pulses) {
+    flow_sample_t sample = {ESP.getCycleCount(), pulses};
+    if (!_samples.push(sample)) _samplesDropped++;
 }
 
-// The ISR: simply increments the pulse count
+// The ISR: counts the pulse and timestamps it
 void IRAM_ATTR WaterFlowSensor::handleInterrupt(void* arg) {
     WaterFlowSensor* sensor = static_cast<WaterFlowSensor*>(arg);
-    sensor->_pulseCount++;
+    sensor->recordSample(++sensor->_pulseCount);
+    if (sensor->_targetArmed) sensor->checkTarget(sensor->_pulseCount, 0);
 }
 
-float WaterFlowSensor::getFlowRate() {
-    uint32_t now = millis();
-    uint32_t duration = now - _lastMillis;
+// The counter has just restarted from FLOW_PCNT_OVERFLOW_LIMIT at 0, or landed
+// on an armed target's threshold. Pulses are milliseconds apart, so the limit
+// still reads 0 here and a threshold its nonzero value.
+void IRAM_ATTR WaterFlowSensor::handlePcntOverflow(void* arg) {
+    WaterFlowSensor* sensor = static_cast<WaterFlowSensor*>(arg);
+    int16_t count = 0;
+    pcnt_get_counter_value(sensor->_unit, &count);
+    if (count == 0) sensor->_pulseCount += FLOW_PCNT_OVERFLOW_LIMIT;
+    if (sensor->_targetArmed) sensor->checkTarget(sensor->_pulseCount, count);
+}
+
+// Fire the target if the total has reached it, otherwise keep the threshold aimed
+void IRAM_ATTR WaterFlowSensor::checkTarget(uint32_t overflows, int16_t count) {
+    FlowTargetCallback callback = nullptr;
+    uint32_t total = overflows + static_cast<uint16_t>(count);
+    portENTER_CRITICAL_ISR(&_targetLock);
+    if (_targetArmed) {
+        if (static_cast<int32_t>(total - _target) >= 0) {
+            _targetArmed = false;
+            callback = _targetCallback;
+            if (_backend == FLOW_COUNTER_PCNT) pcnt_event_disable(_unit, PCNT_EVT_THRES_0);
+        } else if (_backend == FLOW_COUNTER_PCNT) {
+            aimThreshold(overflows);
+        }
+    }
+    portEXIT_CRITICAL_ISR(&_targetLock);
+    if (callback != nullptr) callback(_targetArg, total);
+}
+
+// Point the threshold event at the target once it falls inside the current counter cycle
+void IRAM_ATTR WaterFlowSensor::aimThreshold(uint32_t overflows) {
+    uint32_t remaining = _target - overflows;
+    if (remaining < FLOW_PCNT_OVERFLOW_LIMIT) {
+        pcnt_set_event_value(_unit, PCNT_EVT_THRES_0, static_cast<int16_t>(remaining));
+        pcnt_event_enable(_unit, PCNT_EVT_THRES_0);
+    } else {
+        pcnt_event_disable(_unit, PCNT_EVT_THRES_0);
+    }
+}
+
+bool WaterFlowSensor::armTarget(uint32_t target, FlowTargetCallback callback, void* arg) {
+    portENTER_CRITICAL(&_targetLock);
+    uint32_t overflows = _pulseCount;
+    int16_t count = 0;
+    if (_backend == FLOW_COUNTER_PCNT) pcnt_get_counter_value(_unit, &count);
+    bool reached = static_cast<int32_t>(overflows + static_cast<uint16_t>(count) - target) >= 0;
+    _target = target;
+    _targetCallback = callback;
+    _targetArg = arg;
+    _targetArmed = !reached;
+    if (_backend == FLOW_COUNTER_PCNT) {
+        if (reached) pcnt_event_disable(_unit, PCNT_EVT_THRES_0);
+        else aimThreshold(overflows);
+    }
+    portEXIT_CRITICAL(&_targetLock);
+    return !reached;
+}
+
+void WaterFlowSensor::disarmTarget() {
+    portENTER_CRITICAL(&_targetLock);
+    _targetArmed = false;
+    if (_backend == FLOW_COUNTER_PCNT) pcnt_event_disable(_unit, PCNT_EVT_THRES_0);
+    portEXIT_CRITICAL(&_targetLock);
+}
+
+uint32_t WaterFlowSensor::pulseCount() {
+    // aligned 32-bit reads are atomic on the ESP32, so no interrupt masking is needed
+    if (_backend == FLOW_COUNTER_GPIO_ISR) return _pulseCount;
+
+    // retry if an overflow was folded in between reading the total and the counter
+    uint32_t overflows;
+    int16_t count;
+    do {
+        overflows = _pulseCount;
+        pcnt_get_counter_value(_unit, &count);
+    } while (overflows != _pulseCount);
+    return overflows + static_cast<uint16_t>(count);
+}
 
-    if (duration == 0) return 0.0;
+FlowTransition WaterFlowSensor::update() {
+    flow_snapshot_t reading;
+    FlowTransition transition = sample(reading);
+    publish(reading);
+    return transition;
+}
+
+// PCNT path: timestamp the counter for the estimator once a read is due, and
+// before a stop is declared. Returns whether the total had moved.
+bool WaterFlowSensor::readCounter(uint32_t nowTicks) {
+    if (nowTicks - _readTicks + FLOW_PCNT_READ_SLACK_US < FLOW_UPDATE_INTERVAL_MS * 1000UL &&
+        _estimator.msUntilStop(nowTicks) != 0)
+        return false;
+    _readTicks = nowTicks;
+    uint32_t total = pulseCount();
+    if (total == _readTotal) return false;
+    _readTotal = total;
+    flow_sample_t sample = {nowTicks, total};
+    _estimator.addSample(sample);
+    return true;
+}
+
+FlowTransition WaterFlowSensor::sample(flow_snapshot_t& reading) {
+    flow_sample_t sample;
+    bool heard = false;
+    while (_samples.pop(sample)) {
+        _estimator.addSample(sample);
+        heard = true;
+    }
+    // read after draining so no queued sample is newer than the estimate's "now"
+    uint32_t nowTicks = ticks();
+    if (_backend == FLOW_COUNTER_PCNT) heard = readCounter(nowTicks);
+
+    uint32_t now = millis();
+    if (heard) {
+        _lastSampleMillis = now;
+    } else if (now - _lastSampleMillis >= FLOW_SAMPLE_STALE_MS) {
+        _estimator.expire();
+    }
+    FlowTransition transition = _estimator.update(nowTicks);
+    if (transition == FLOW_STARTED) _starts++;
+    if (transition == FLOW_STOPPED) _stops++;
 
-    // Pulse count is volatile; take a local snapshot to ensure atomicity
-    noInterrupts();
-    uint32_t pulses = _pulseCount;
-    _pulseCount = 0; // Reset for the next interval
-    interrupts();
+    uint32_t total = pulseCount();
+    _pulses64 += total - _lastTotal;
+    _lastTotal = total;
+    if (now - _windowMillis >= FLOW_AVERAGE_WINDOW_MS) {
+        // For YF-S201, typical F = 7.5 * Q (Q is L/min)
+        _averageLpm = (total - _windowPulses) / _calibrationFactor * 1000.0f / (now - _windowMillis);
+        _windowPulses = total;
+        _windowMillis = now;
+    }
+    fill(reading, total, now);
+    return transition;
+}
 
-    _lastMillis = now;
+void WaterFlowSensor::fill(flow_snapshot_t& reading, uint32_t pulses, uint32_t now) const {
+    reading.lifetimePulses = _lifetimeBase + _pulses64;
+    reading.pulses = pulses;
+    reading.totalMilliliters = 0;
+    reading.averageLpm = _averageLpm;
+    reading.instantLpm = _estimator.pulsesPerSecond() / _calibrationFactor;
+    reading.flowing = _estimator.flowing();
+    reading.starts = _starts;
+    reading.stops = _stops;
+    reading.takenAtMs = now;
+}
 
-    // Formula: (Pulses / Calibration Factor) * (1000ms / duration)
-    // For YF-S201, typical F = 7.5 * Q (Q is L/min)
-    float flowRate = (static_cast<float>(pulses) / _calibrationFactor) * (1000.0 / duration);
-    
-    // Track cumulative volume: (flowRate / 60 seconds) * (duration in seconds)
-    _totalLiters += (flowRate / 60.0) * (duration / 1000.0);
+void WaterFlowSensor::publish(flow_snapshot_t& reading) {
+    portENTER_CRITICAL(&_writeLock);
+    // pulses may have been read just before a resetVolume() that read a later total
+    int32_t sinceReset = static_cast<int32_t>(reading.pulses - _volumeBase);
+    reading.totalMilliliters = sinceReset > 0 ? static_cast<uint32_t>(pulsesToMilliliters(sinceReset)) : 0;
+    _snapshot.write(reading);
+    portEXIT_CRITICAL(&_writeLock);
+}
 
-    return flowRate;
+uint32_t WaterFlowSensor::msUntilUpdate() {
+    uint32_t nowTicks = ticks();
+    uint32_t waitMs = FLOW_UPDATE_INTERVAL_MS;
+    if (_backend == FLOW_COUNTER_PCNT) {
+        uint32_t sinceReadMs = (nowTicks - _readTicks) / 1000;
+        waitMs = sinceReadMs >= FLOW_UPDATE_INTERVAL_MS ? 0 : FLOW_UPDATE_INTERVAL_MS - sinceReadMs;
+    }
+    int32_t untilStop = _estimator.msUntilStop(nowTicks);
+    if (untilStop >= 0 && static_cast<uint32_t>(untilStop) < waitMs) return untilStop;
+    return waitMs;
 }
 
-float WaterFlowSensor::getTotalVolume() { return _totalLiters; }
-void WaterFlowSensor::resetVolume() { _totalLiters = 0; }
\ No newline at end of file
+void WaterFlowSensor::resetVolume() {
+    uint32_t total = pulseCount();
+    portENTER_CRITICAL(&_writeLock);
+    _volumeBase = total;
+    flow_snapshot_t snapshot = _snapshot.read();
+    snapshot.totalMilliliters = 0;
+    _snapshot.write(snapshot);
+    portEXIT_CRITICAL(&_writeLock);
+}
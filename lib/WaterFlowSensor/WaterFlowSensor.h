@@ -2,33 +2,195 @@
 #define WATER_FLOW_SENSOR_H
 
 #include <Arduino.h>
+#include <driver/pcnt.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <FlowEstimator.h>
+#include <Seqlock.h>
+#include <SpscRing.h>
+
+// How pulses reach the counter
+enum FlowCounterBackend {
+    FLOW_COUNTER_PCNT,    // pulse-counter peripheral: glitch-filtered, one interrupt per FLOW_PCNT_OVERFLOW_LIMIT pulses
+    FLOW_COUNTER_GPIO_ISR // one GPIO interrupt per pulse; the fallback when no PCNT unit can be set up
+};
+
+// Each time the PCNT counter reaches this limit it restarts at 0 and the
+// overflow interrupt folds the limit into the 32-bit total: about one
+// interrupt every 7 s at 200 L/min on a YF-S201
+#define FLOW_PCNT_OVERFLOW_LIMIT 10000
+
+// Timestamps the interrupt can queue between two update() calls: 170 ms of a
+// 1.5 kHz pulse train on the GPIO path, well over FLOW_UPDATE_INTERVAL_MS
+#define FLOW_SAMPLE_RING 256
+#define FLOW_UPDATE_INTERVAL_MS 100
+
+// The PCNT path has no per-pulse interrupt to timestamp. update() reads the
+// counter against micros() (esp_timer) every FLOW_UPDATE_INTERVAL_MS instead, and the
+// estimator takes its rate over this many of those reads, so the pulse that
+// lands either side of a read is under 4% at 5 L/min.
+#define FLOW_PCNT_RATE_INTERVALS 7
+
+// snapshot().averageLpm covers the last complete window of this length
+#define FLOW_AVERAGE_WINDOW_MS 1000
+
+// The accumulator task runs update(); it sits just above loop() so a busy loop
+// cannot delay a stop
+#define FLOW_TASK_STACK 2048
+#define FLOW_TASK_PRIORITY 2
+
+// The cycle counter the GPIO path timestamps with wraps every 17.9 s at
+// 240 MHz; an estimator that has heard nothing for this long is reset rather
+// than trusted across a wrap
+#define FLOW_SAMPLE_STALE_MS 8000
+
+// Pulses shorter than this many APB cycles (80 MHz, so 12.8 us) are ignored by
+// the PCNT glitch filter; 1023 is the hardware maximum. Real flow pulses are
+// milliseconds long even at 1 kHz.
+#define FLOW_PCNT_FILTER_APB_CYCLES 1023
+
+// Run from the counting interrupt when an armed pulse target is reached;
+// pulses is the total that reached it
+typedef void (*FlowTargetCallback)(void* arg, uint32_t pulses);
+
+// Everything a reader needs, published together by the accumulator
+typedef struct {
+    uint64_t lifetimePulses;   // restored total plus everything counted since begin()
+    uint32_t pulses;           // counted since begin() (wraps at 2^32)
+    uint32_t totalMilliliters; // since resetVolume()
+    float averageLpm;          // over the last complete FLOW_AVERAGE_WINDOW_MS
+    float instantLpm;          // from the spacing of the most recent pulses
+    bool flowing;
+    uint32_t starts;      // flow starts since begin(), so a reader can tell it slept through one
+    uint32_t stops;
+    uint32_t takenAtMs;   // millis() when this was published
+} flow_snapshot_t;
 
 class WaterFlowSensor {
 public:
     // Constructor handles pin assignment and basic init
-    WaterFlowSensor(uint8_t pin, float calibrationFactor = 7.5);
+    WaterFlowSensor(uint8_t pin, float calibrationFactor = 7.5, FlowCounterBackend backend = FLOW_COUNTER_PCNT);
+
+    // Initialize the counter (PCNT unit, or the interrupt configuration) and
+    // start the accumulator task on the calling core. With background false
+    // the caller drives update() itself instead.
+    void begin(bool background = true);
+
+    // Latest published readings. Never blocks the accumulator or disturbs the
+    // measurement, so any task may call it at any time.
+    flow_snapshot_t snapshot() const { return _snapshot.read(); }
+
+    // Average flow rate in L/min over the last window (snapshot().averageLpm)
+    float getFlowRate() const { return snapshot().averageLpm; }
+
+    // Get total volume passed in Liters since resetVolume()
+    float getTotalVolume() const { return snapshot().totalMilliliters / 1000.0f; }
 
-    // Initialize the interrupt configuration
-    void begin();
+    // Exact volume for a pulse count, from the fixed-point calibration. Valid
+    // up to 1.8e13 pulses (40 million m3 on a YF-S201).
+    uint64_t pulsesToMilliliters(uint64_t pulses) const { return pulses * 1000000ULL / _pulsesPerKilolitre; }
 
-    // Calculate and return flow rate in L/min
-    float getFlowRate();
+    // Lifetime meter reading
+    uint64_t lifetimeMilliliters() const { return pulsesToMilliliters(snapshot().lifetimePulses); }
 
-    // Get total volume passed in Liters
-    float getTotalVolume();
+    // Carry a lifetime total over from a previous boot (see FlowTotalizer); call before begin()
+    void restoreLifetimePulses(uint64_t pulses) { _lifetimeBase = pulses; }
 
-    // Reset the total counter
+    // Restart the volume total from zero; visible in the next snapshot() immediately
     void resetVolume();
 
+    // Backend in use after begin(); PCNT falls back to the GPIO interrupt if no unit is free
+    FlowCounterBackend backend() const { return _backend; }
+
+    // Pulses counted since begin() (wraps at 2^32)
+    uint32_t pulseCount();
+
+    // Calibration as pulses per litre
+    float pulsesPerLitre() const { return _pulsesPerKilolitre / 1000.0f; }
+
+    // Call callback from the counting interrupt the moment pulseCount()
+    // reaches target (compared modulo 2^32), then disarm. Replaces any armed
+    // target. Returns false, arming nothing, if the target has already been
+    // reached. With PCNT the unit's threshold event is aimed at the exact pulse
+    // once the target is within FLOW_PCNT_OVERFLOW_LIMIT of the count; should
+    // a pulse slip past while it is being aimed, the next limit event fires it.
+    bool armTarget(uint32_t target, FlowTargetCallback callback, void* arg);
+    void disarmTarget();
+    bool targetArmed() const { return _targetArmed; }
+
+    // One accumulator pass: feed the timestamps queued by the interrupt (or, on
+    // the PCNT path, a fresh read of the counter when one is due) to the
+    // estimator, roll the average window and publish a snapshot. Reports a flow
+    // start or stop since the last pass. Only the accumulator may call this,
+    // i.e. the caller of begin(false); cycle counters are per core, so it must
+    // run on the core that called begin().
+    FlowTransition update();
+
+    // The same pass without publishing, for an owner that publishes several
+    // sensors together (FlowSensorBank). Fills everything but totalMilliliters;
+    // snapshot() and resetVolume() are then the owner's business.
+    FlowTransition sample(flow_snapshot_t& reading);
+
+    // When update() should next run: in time to catch a stop, for the next
+    // counter read on the PCNT path, and before the timestamp ring can fill
+    uint32_t msUntilUpdate();
+
+    // Timestamps lost to a full ring (the pulse count itself is unaffected)
+    uint32_t samplesDropped() const { return _samplesDropped; }
+
 private:
-    // ISR needs to be static to be passed to attachInterrupt
+    // ISRs need to be static to be passed to the interrupt APIs
     static void IRAM_ATTR handleInterrupt(void* arg);
+    static void IRAM_ATTR handlePcntOverflow(void* arg);
+
+    static void accumulatorTask(void* arg);
+
+    bool beginPcnt();
+    uint32_t ticks() const; // the estimator's clock: cycles on the GPIO path, microseconds on PCNT
+    bool readCounter(uint32_t nowTicks);
+    void IRAM_ATTR recordSample(uint32_t pulses);
+    void IRAM_ATTR checkTarget(uint32_t overflows, int16_t count);
+    void IRAM_ATTR aimThreshold(uint32_t overflows);
+    void fill(flow_snapshot_t& reading, uint32_t pulses, uint32_t now) const;
+    void publish(flow_snapshot_t& reading);
+
+    static uint8_t _unitsInUse; // PCNT units are handed out in begin() order
 
     uint8_t _pin;
     float _calibrationFactor;
-    volatile uint32_t _pulseCount;
-    uint32_t _lastMillis;
-    float _totalLiters;
+    uint32_t _pulsesPerKilolitre; // calibration as an integer: F * 60 pulses per litre, times 1000
+    FlowCounterBackend _backend;
+    pcnt_unit_t _unit;
+    volatile uint32_t _pulseCount; // GPIO path: every pulse; PCNT path: completed overflows
+    SpscRing<flow_sample_t, FLOW_SAMPLE_RING> _samples; // ISR -> update(), GPIO path only
+    volatile uint32_t _samplesDropped;
+    TaskHandle_t _task;
+
+    // accumulator state, only touched by update()
+    FlowEstimator _estimator;
+    uint32_t _lastSampleMillis;
+    uint32_t _readTicks;     // PCNT path: when the counter was last read for the estimator
+    uint32_t _readTotal;     // and the total it read
+    uint32_t _windowPulses; // pulse total and millis() when the average window opened
+    uint32_t _windowMillis;
+    float _averageLpm;
+    uint32_t _starts;
+    uint32_t _stops;
+    uint64_t _lifetimeBase;  // restored before begin()
+    uint64_t _pulses64;      // pulseCount() extended past its 32-bit wrap
+    uint32_t _lastTotal;     // pulseCount() at the previous update()
+
+    // publishing: update() and resetVolume() both write, so writes are serialised
+    Seqlock<flow_snapshot_t> _snapshot;
+    portMUX_TYPE _writeLock = portMUX_INITIALIZER_UNLOCKED;
+    uint32_t _volumeBase; // pulse total at the last resetVolume(), guarded by _writeLock
+
+    // pulse target: armed by a task, fired and disarmed by the interrupt
+    portMUX_TYPE _targetLock = portMUX_INITIALIZER_UNLOCKED;
+    volatile bool _targetArmed;
+    uint32_t _target;
+    FlowTargetCallback _targetCallback;
+    void* _targetArg;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,56 @@
+#include "WifiLinkCache.h"
+#include <stddef.h>
+
+#define WIFI_LINK_MAGIC 0x4B4E494C // "LINK"
+
+WifiLinkCache::WifiLinkCache(wifi_link_t& rtc, Preferences& prefs, const char* key)
+    : _rtc(rtc), _prefs(prefs), _nvsWrites(0) {
+    strncpy(_key, key, sizeof(_key) - 1);
+    _key[sizeof(_key) - 1] = '\0';
+}
+
+uint32_t WifiLinkCache::checkOf(const wifi_link_t& link) {
+    // FNV-1a over everything before the check word
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&link);
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < offsetof(wifi_link_t, check); i++) hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
+
+bool WifiLinkCache::valid(const wifi_link_t& link) {
+    return link.magic == WIFI_LINK_MAGIC && link.check == checkOf(link) && link.channel != 0;
+}
+
+bool WifiLinkCache::readStored(wifi_link_t& link) {
+    return _prefs.getBytesLength(_key) == sizeof(link) && _prefs.getBytes(_key, &link, sizeof(link)) == sizeof(link);
+}
+
+bool WifiLinkCache::load(wifi_link_t& link) {
+    if (valid(_rtc)) {
+        link = _rtc;
+        return true;
+    }
+    wifi_link_t stored;
+    if (!readStored(stored) || !valid(stored)) return false;
+    _rtc = stored;
+    link = stored;
+    return true;
+}
+
+void WifiLinkCache::store(const wifi_link_t& link) {
+    wifi_link_t record = link;
+    record.magic = WIFI_LINK_MAGIC;
+    record.reserved = 0;
+    record.check = checkOf(record);
+    _rtc = record;
+
+    wifi_link_t stored;
+    if (readStored(stored) && memcmp(&stored, &record, sizeof(record)) == 0) return;
+    _prefs.putBytes(_key, &record, sizeof(record));
+    _nvsWrites++;
+}
+
+void WifiLinkCache::invalidate() {
+    memset(&_rtc, 0, sizeof(_rtc));
+    if (_prefs.isKey(_key)) _prefs.remove(_key);
+}
@@ -0,0 +1,57 @@
+#ifndef WIFI_LINK_CACHE_H
+#define WIFI_LINK_CACHE_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+
+// What a directed connect needs to skip the channel scan, and DHCP if the
+// lease is reused. Addresses are kept as IPAddress converts them to uint32_t;
+// 0 means unknown.
+typedef struct {
+    uint32_t magic;
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t reserved;
+    uint32_t ip;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+    uint32_t check; // catches the random contents RTC memory has after power-up
+} wifi_link_t;
+
+// The access point and lease of the last successful connection, kept in two
+// places. RTC memory (RTC_NOINIT_ATTR) survives warm resets and costs nothing
+// to update. NVS serves the next cold boot, and is written only when the link
+// differs from what it already holds: reconnecting to the same AP costs no
+// flash write, roaming to another one costs one.
+class WifiLinkCache {
+public:
+    // key names the NVS entry (at most 15 characters)
+    WifiLinkCache(wifi_link_t& rtc, Preferences& prefs, const char* key = "wifilink");
+
+    // The cached link, from RTC memory if it holds one, otherwise from NVS.
+    // Returns false if neither does.
+    bool load(wifi_link_t& link);
+
+    // The station is connected over link; bssid, channel and addresses are
+    // used, magic and check are filled in here
+    void store(const wifi_link_t& link);
+
+    // A directed connect with the cached link failed at boot; forget it so
+    // the next boot scans instead of trying it again
+    void invalidate();
+
+    uint32_t nvsWrites() const { return _nvsWrites; }
+
+private:
+    static uint32_t checkOf(const wifi_link_t& link);
+    static bool valid(const wifi_link_t& link);
+    bool readStored(wifi_link_t& link);
+
+    wifi_link_t& _rtc;
+    Preferences& _prefs;
+    char _key[16];
+    uint32_t _nvsWrites;
+};
+
+#endif
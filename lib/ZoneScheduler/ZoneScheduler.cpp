@@ -0,0 +1,104 @@
+#include "ZoneScheduler.h"
+
+ZoneScheduler::ZoneScheduler() : _zones(), _generation(), _zoneCount(0), _heap(), _heapSize(0) {}
+
+int ZoneScheduler::addZone(const system_config_t& config) {
+    if (_zoneCount >= MAX_ZONES) return -1;
+    uint8_t zone = _zoneCount++;
+    _zones[zone] = config;
+    reschedule(zone);
+    return zone;
+}
+
+bool ZoneScheduler::eventFor(uint8_t zone, zone_event_t& event) const {
+    const system_config_t& c = _zones[zone];
+    event.zone = zone;
+    event.generation = _generation[zone];
+    if (c.is_on) {
+        if (c.off_time == 0) return false; // manual ON: stays on until told otherwise
+        event.type = ZONE_EVENT_OFF;
+        event.deadline = c.off_time;
+        return true;
+    }
+    if (c.next_on_time == 0) return false;
+    event.type = ZONE_EVENT_ON;
+    event.deadline = c.next_on_time;
+    return true;
+}
+
+void ZoneScheduler::reschedule(uint8_t zone) {
+    if (zone >= _zoneCount) return;
+    // invalidate whatever is queued for this zone
+    _generation[zone]++;
+
+    zone_event_t event;
+    if (!eventFor(zone, event)) return;
+    if (_heapSize == HEAP_CAPACITY) rebuild();
+    push(event);
+}
+
+bool ZoneScheduler::nextDeadline(unsigned long& deadline) {
+    dropStale();
+    if (_heapSize == 0) return false;
+    deadline = _heap[0].deadline;
+    return true;
+}
+
+bool ZoneScheduler::popDue(unsigned long now, zone_event_t& event) {
+    dropStale();
+    if (_heapSize == 0 || _heap[0].deadline > now) return false;
+    event = _heap[0];
+    popTop();
+    // the zone has nothing queued until the caller reschedules it
+    _generation[event.zone]++;
+    return true;
+}
+
+void ZoneScheduler::push(const zone_event_t& event) {
+    _heap[_heapSize] = event;
+    siftUp(_heapSize++);
+}
+
+void ZoneScheduler::popTop() {
+    _heap[0] = _heap[--_heapSize];
+    if (_heapSize > 0) siftDown(0);
+}
+
+void ZoneScheduler::dropStale() {
+    while (_heapSize > 0 && !isCurrent(_heap[0])) popTop();
+}
+
+// Only reached when superseded entries have piled up below the top; keep the
+// live ones (at most one per zone) and re-heapify.
+void ZoneScheduler::rebuild() {
+    uint8_t live = 0;
+    for (uint8_t i = 0; i < _heapSize; i++) {
+        if (isCurrent(_heap[i])) _heap[live++] = _heap[i];
+    }
+    _heapSize = live;
+    for (int i = _heapSize / 2 - 1; i >= 0; i--) siftDown(i);
+}
+
+void ZoneScheduler::siftUp(uint8_t index) {
+    zone_event_t event = _heap[index];
+    while (index > 0) {
+        uint8_t parent = (index - 1) / 2;
+        if (_heap[parent].deadline <= event.deadline) break;
+        _heap[index] = _heap[parent];
+        index = parent;
+    }
+    _heap[index] = event;
+}
+
+void ZoneScheduler::siftDown(uint8_t index) {
+    zone_event_t event = _heap[index];
+    while (true) {
+        uint8_t child = 2 * index + 1;
+        if (child >= _heapSize) break;
+        if (child + 1 < _heapSize && _heap[child + 1].deadline < _heap[child].deadline) child++;
+        if (event.deadline <= _heap[child].deadline) break;
+        _heap[index] = _heap[child];
+        index = child;
+    }
+    _heap[index] = event;
+}
@@ -0,0 +1,71 @@
+#ifndef ZONE_SCHEDULER_H
+#define ZONE_SCHEDULER_H
+
+#include <stdint.h>
+#include <Schedule.h>
+
+#ifndef MAX_ZONES
+#define MAX_ZONES 32
+#endif
+
+enum ZoneEventType {
+    ZONE_EVENT_ON,  // next_on_time of a zone that is off
+    ZONE_EVENT_OFF  // off_time of a zone that is on
+};
+
+typedef struct {
+    unsigned long deadline;
+    uint32_t generation; // matches the zone's generation while the event is current
+    uint8_t zone;
+    uint8_t type;        // ZoneEventType
+} zone_event_t;
+
+// Holds one system_config_t per zone and keeps each zone's next ON or OFF in a
+// binary min-heap ordered by deadline, so finding and popping the next due event
+// is O(log n) regardless of how many zones are idle.
+//
+// A zone has at most one live event: OFF at off_time while is_on (and off_time is
+// set), otherwise ON at next_on_time (if set). After changing a zone's config call
+// reschedule(); superseded heap entries are recognised by their generation and
+// dropped when they surface.
+class ZoneScheduler {
+public:
+    ZoneScheduler();
+
+    // Returns the new zone's index, or -1 when MAX_ZONES are in use
+    int addZone(const system_config_t& config);
+    uint8_t zoneCount() const { return _zoneCount; }
+
+    system_config_t& config(uint8_t zone) { return _zones[zone]; }
+    const system_config_t& config(uint8_t zone) const { return _zones[zone]; }
+
+    // Re-queue the zone's next event after its config changed
+    void reschedule(uint8_t zone);
+
+    // Earliest pending deadline; false when no zone has anything scheduled
+    bool nextDeadline(unsigned long& deadline);
+
+    // Remove and return the earliest event if its deadline is <= now
+    bool popDue(unsigned long now, zone_event_t& event);
+
+private:
+    static const uint8_t HEAP_CAPACITY = 2 * MAX_ZONES;
+
+    bool eventFor(uint8_t zone, zone_event_t& event) const;
+    bool isCurrent(const zone_event_t& event) const { return event.generation == _generation[event.zone]; }
+    void push(const zone_event_t& event);
+    void popTop();
+    void dropStale();
+    void rebuild();
+    void siftUp(uint8_t index);
+    void siftDown(uint8_t index);
+
+    system_config_t _zones[MAX_ZONES];
+    uint32_t _generation[MAX_ZONES];
+    uint8_t _zoneCount;
+
+    zone_event_t _heap[HEAP_CAPACITY];
+    uint8_t _heapSize;
+};
+
+#endif
@@ -0,0 +1,338 @@
+#ifdef RUN_BENCHMARKS
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <TelemetryWriter.h>
+#include <ConfigParser.h>
+#include <SystemClock.h>
+#include <time.h>
+#include <sys/time.h>
+#include <cJSON.h> // ESP-IDF's copy on target, the cJSON lib_dep in env:native
+#include "benchmarks.h"
+
+#define BENCH_ITERATIONS 2000
+
+// count what cJSON asks of the heap so the comparison shows allocations, not just time
+static uint32_t benchAllocs = 0;
+
+static void *countingMalloc(size_t size)
+{
+  benchAllocs++;
+  return malloc(size);
+}
+
+static void countingFree(void *ptr)
+{
+  free(ptr);
+}
+
+static void report(const char *name, int64_t elapsedUs, uint32_t allocs, size_t bytes)
+{
+  Serial.printf("%-28s %8.2f us/op  %6.2f allocs/op  %4u bytes\r\n",
+                name, (double)elapsedUs / BENCH_ITERATIONS,
+                (double)allocs / BENCH_ITERATIONS, (unsigned)bytes);
+}
+
+// The payloads every encoder below is timed on, as a running device fills them in.
+// The fixed-point readings are converted again on each op, as loop() does.
+static heartbeat_payload_t benchHeartbeat()
+{
+  heartbeat_payload_t hb = {};
+  hb.firmware_version = "1.1.0";
+  hb.interval_s = 3600;
+  hb.duration_s = 30;
+  hb.next_on_time = "06:00 17-10";
+  hb.current_time = "05:42 17-10";
+  hb.has_climate = true;
+  return hb;
+}
+
+static ack_payload_t benchAck()
+{
+  ack_payload_t ack = {};
+  ack.status = "OFF";
+  ack.zone = 0;
+  ack.has_climate = true;
+  return ack;
+}
+
+static firmware_status_payload_t benchFirmwareStatus()
+{
+  firmware_status_payload_t fw;
+  fw.firmware_version = "1.1.0";
+  fw.ota_check_result = 0;
+  fw.check_timestamp = 1792218120;
+  return fw;
+}
+
+static void takeReadings(heartbeat_payload_t &hb)
+{
+  hb.temperature_c10 = toFixed(23.46f, 1);
+  hb.humidity_pct10 = toFixed(0.455f * 100, 1);
+}
+
+static void takeReadings(ack_payload_t &ack)
+{
+  ack.flow_rate_lpm100 = toFixed(7.25f, 2);
+  ack.total_volume_l100 = toFixed(42.5f, 2);
+  ack.temperature_c10 = toFixed(23.46f, 1);
+  ack.humidity_pct10 = toFixed(0.455f * 100, 1);
+}
+
+// cJSON_PrintUnformatted of a tree, the way loop() sent messages before
+// TelemetryWriter; returns the bytes it printed
+static size_t printCjson(cJSON *tree)
+{
+  char *str = cJSON_PrintUnformatted(tree);
+  size_t bytes = strlen(str);
+  countingFree(str);
+  cJSON_Delete(tree);
+  return bytes;
+}
+
+// The same fields as HeartbeatFields/AckFields/FirmwareStatusFields in
+// TelemetryWriter.cpp, in the same order, so both sides put the same message
+// on the wire. Fixed-point values go in as doubles.
+static cJSON *cjsonHeartbeat(const heartbeat_payload_t &p)
+{
+  cJSON *o = cJSON_CreateObject();
+  cJSON_AddStringToObject(o, "firmware_version", p.firmware_version);
+  cJSON_AddNumberToObject(o, "zones", p.zones);
+  cJSON_AddNumberToObject(o, "interval_s", p.interval_s);
+  cJSON_AddNumberToObject(o, "duration_s", p.duration_s);
+  if (p.has_climate)
+  {
+    cJSON_AddNumberToObject(o, "temperature_c", p.temperature_c10 / 10.0);
+    cJSON_AddNumberToObject(o, "humidity_pct", p.humidity_pct10 / 10.0);
+  }
+  cJSON_AddNumberToObject(o, "cmd_latency_us", p.cmd_latency_us);
+  cJSON_AddNumberToObject(o, "cmd_latency_max_us", p.cmd_latency_max_us);
+  cJSON_AddNumberToObject(o, "dropped_cmds", p.dropped_cmds);
+  cJSON_AddNumberToObject(o, "sched_late_ms", p.sched_late_ms);
+  cJSON_AddNumberToObject(o, "sched_late_max_ms", p.sched_late_max_ms);
+  cJSON_AddNumberToObject(o, "nvs_commits", p.nvs_commits);
+  cJSON_AddNumberToObject(o, "nvs_writes_avoided", p.nvs_writes_avoided);
+  cJSON_AddNumberToObject(o, "nvs_commit_us", p.nvs_commit_us);
+  cJSON_AddNumberToObject(o, "nvs_commit_max_us", p.nvs_commit_max_us);
+  cJSON_AddNumberToObject(o, "flow_total_ml", (double)p.flow_total_ml);
+  cJSON_AddNumberToObject(o, "spool_pending", p.spool_pending);
+  cJSON_AddNumberToObject(o, "spool_dropped", p.spool_dropped);
+  cJSON_AddNumberToObject(o, "boot_ready_ms", p.boot_ready_ms);
+  cJSON_AddNumberToObject(o, "first_actuation_ms", p.first_actuation_ms);
+  cJSON_AddNumberToObject(o, "mqtt_attempts", p.mqtt_attempts);
+  cJSON_AddNumberToObject(o, "wifi_outages", p.wifi_outages);
+  cJSON_AddNumberToObject(o, "wifi_outage_ms", p.wifi_outage_ms);
+  cJSON_AddNumberToObject(o, "wifi_reconnects", p.wifi_reconnects);
+  cJSON_AddNumberToObject(o, "boot_wifi_ms", p.boot_wifi_ms);
+  cJSON_AddNumberToObject(o, "boot_mqtt_ms", p.boot_mqtt_ms);
+  cJSON_AddNumberToObject(o, "wifi_fast_boot", p.wifi_fast_boot);
+  cJSON_AddStringToObject(o, "next_on_time", p.next_on_time);
+  cJSON_AddStringToObject(o, "current_time", p.current_time);
+  return o;
+}
+
+static cJSON *cjsonAck(const ack_payload_t &p)
+{
+  cJSON *o = cJSON_CreateObject();
+  cJSON_AddStringToObject(o, "status", p.status);
+  cJSON_AddNumberToObject(o, "zone", p.zone);
+  cJSON_AddNumberToObject(o, "flow_rate_lpm", p.flow_rate_lpm100 / 100.0);
+  cJSON_AddNumberToObject(o, "total_volume_l", p.total_volume_l100 / 100.0);
+  if (p.has_climate)
+  {
+    cJSON_AddNumberToObject(o, "temperature_c", p.temperature_c10 / 10.0);
+    cJSON_AddNumberToObject(o, "humidity_pct", p.humidity_pct10 / 10.0);
+  }
+  return o;
+}
+
+static cJSON *cjsonFirmwareStatus(const firmware_status_payload_t &p)
+{
+  cJSON *o = cJSON_CreateObject();
+  cJSON_AddStringToObject(o, "firmware_version", p.firmware_version);
+  cJSON_AddNumberToObject(o, "ota_check_result", p.ota_check_result);
+  cJSON_AddNumberToObject(o, "check_timestamp", p.check_timestamp);
+  return o;
+}
+
+static void benchCjson()
+{
+  cJSON_Hooks hooks = {countingMalloc, countingFree};
+  cJSON_InitHooks(&hooks);
+  heartbeat_payload_t hb = benchHeartbeat();
+  ack_payload_t ack = benchAck();
+  firmware_status_payload_t fw = benchFirmwareStatus();
+  size_t bytes = 0;
+
+  benchAllocs = 0;
+  int64_t start = esp_timer_get_time();
+  for (int i = 0; i < BENCH_ITERATIONS; i++)
+  {
+    takeReadings(hb);
+    bytes = printCjson(cjsonHeartbeat(hb));
+  }
+  report("heartbeat cJSON", esp_timer_get_time() - start, benchAllocs, bytes);
+
+  benchAllocs = 0;
+  start = esp_timer_get_time();
+  for (int i = 0; i < BENCH_ITERATIONS; i++)
+  {
+    takeReadings(ack);
+    bytes = printCjson(cjsonAck(ack));
+  }
+  report("ack cJSON", esp_timer_get_time() - start, benchAllocs, bytes);
+
+  benchAllocs = 0;
+  start = esp_timer_get_time();
+  for (int i = 0; i < BENCH_ITERATIONS; i++)
+    bytes = printCjson(cjsonFirmwareStatus(fw));
+  report("firmware status cJSON", esp_timer_get_time() - start, benchAllocs, bytes);
+
+  cJSON_InitHooks(nullptr);
+}
+
+// each payload in both encodings; bytes is what goes on the wire
+static void benchTelemetryWriter()
+{
+  static char buf[768]; // TELEMETRY_BUFFER_SIZE in main.cpp
+  static const PayloadEncoding encodings[] = {PAYLOAD_JSON, PAYLOAD_CBOR};
+  static const char *const names[] = {"JSON", "CBOR"};
+  char label[40];
+  size_t bytes = 0;
+  heartbeat_payload_t hb = benchHeartbeat();
+  ack_payload_t ack = benchAck();
+  firmware_status_payload_t fw = benchFirmwareStatus();
+
+  for (uint8_t e = 0; e < 2; e++)
+  {
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_ITERATIONS; i++)
+    {
+      takeReadings(hb);
+      bytes = encodeHeartbeat(buf, sizeof(buf), encodings[e], hb);
+    }
+    snprintf(label, sizeof(label), "heartbeat %s", names[e]);
+    report(label, esp_timer_get_time() - start, 0, bytes);
+
+    start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_ITERATIONS; i++)
+    {
+      takeReadings(ack);
+      bytes = encodeAck(buf, sizeof(buf), encodings[e], ack);
+    }
+    snprintf(label, sizeof(label), "ack %s", names[e]);
+    report(label, esp_timer_get_time() - start, 0, bytes);
+
+    start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_ITERATIONS; i++)
+      bytes = encodeFirmwareStatus(buf, sizeof(buf), encodings[e], fw);
+    snprintf(label, sizeof(label), "firmware status %s", names[e]);
+    report(label, esp_timer_get_time() - start, 0, bytes);
+  }
+}
+
+// the strstr-based extractor /config used before ConfigParser, kept here for comparison
+static unsigned long legacyParseNumber(const char *src, const char *key)
+{
+  const char *p = strstr(src, key);
+  if (!p)
+    return 0;
+  p = strchr(p, ':');
+  if (!p)
+    return 0;
+  p++;
+  while (*p && isspace((unsigned char)*p))
+    p++;
+  return strtoul(p, NULL, 10);
+}
+
+static void benchConfigPayload(const char *name, const char *payload)
+{
+  char label[40];
+  size_t len = strlen(payload);
+  volatile unsigned long sink = 0;
+
+  int64_t start = esp_timer_get_time();
+  for (int i = 0; i < BENCH_ITERATIONS; i++)
+  {
+    sink += legacyParseNumber(payload, "interval");
+    sink += legacyParseNumber(payload, "duration");
+    sink += legacyParseNumber(payload, "TURN_ON_AT");
+  }
+  snprintf(label, sizeof(label), "%s strstr", name);
+  report(label, esp_timer_get_time() - start, 0, len);
+
+  static ConfigParser parser;
+  config_fields_t fields;
+  start = esp_timer_get_time();
+  for (int i = 0; i < BENCH_ITERATIONS; i++)
+  {
+    parser.parse(payload, len, fields);
+    sink += fields.value[CFG_INTERVAL];
+  }
+  snprintf(label, sizeof(label), "%s ConfigParser", name);
+  report(label, esp_timer_get_time() - start, 0, len);
+}
+
+static void benchConfigParser()
+{
+  // what the server actually sends
+  benchConfigPayload("config minimal", "{\"interval\":3600,\"duration\":30}");
+  benchConfigPayload("config full", "{\"TURN_ON_AT\":1708532400,\"interval\":86400,\"duration\":600}");
+
+  // adversarial: near-miss keys, keys placed last behind a long unknown value, deep nesting
+  benchConfigPayload("config near-miss",
+                     "{\"xinterval\":1,\"intervals\":2,\"duration_s\":3,\"TURN_ON\":4,"
+                     "\"interval\":3600,\"duration\":30}");
+  static char longPayload[1024];
+  if (longPayload[0] == '\0')
+  {
+    strcpy(longPayload, "{\"note\":\"");
+    size_t n = strlen(longPayload);
+    memset(longPayload + n, 'a', 900);
+    strcpy(longPayload + n + 900, "\",\"interval\":3600,\"duration\":30}");
+  }
+  benchConfigPayload("config long", longPayload);
+  benchConfigPayload("config nested",
+                     "{\"meta\":{\"a\":[1,2,{\"b\":{\"c\":[3,4,\"interval\"]}}]},"
+                     "\"interval\":3600,\"duration\":30}");
+}
+
+// reading "now" for a deadline check: the old time()/gettimeofday() pair against
+// the monotonic counter plus offset that SystemClock keeps
+static void benchClock()
+{
+  volatile int64_t sink = 0;
+  int64_t start = esp_timer_get_time();
+  for (int i = 0; i < BENCH_ITERATIONS; i++)
+  {
+    time_t t = time(nullptr);
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    sink = sink + t + (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+  }
+  report("clock time()+gettimeofday", esp_timer_get_time() - start, 0, 0);
+
+  clock_mark_t mark = {};
+  SystemClock clock(mark);
+  clock.synced((int64_t)1708532400 * 1000000, 0, esp_timer_get_time());
+  start = esp_timer_get_time();
+  for (int i = 0; i < BENCH_ITERATIONS; i++)
+  {
+    int64_t mono = esp_timer_get_time();
+    sink = sink + clock.nowSeconds(mono) + clock.nowMillis(mono);
+  }
+  report("clock SystemClock", esp_timer_get_time() - start, 0, 0);
+}
+
+void runBenchmarks()
+{
+  Serial.println("\n=== Benchmarks ===");
+  benchCjson();
+  benchTelemetryWriter();
+  benchConfigParser();
+  benchClock();
+  Serial.println("==================\n");
+}
+
+#endif
@@ -6,10 +6,32 @@
 #include "mqtt_topics.h"
 
 #include "ESP32OTAPull.h"
-
-#include <WaterFlowSensor.h>
-#include <Wire.h>
-#include "DFRobot_DHT20.h"
+#include "benchmarks.h"
+
+#include <FlowSensorBank.h>
+#include <FlowAnomaly.h>
+#include <VolumeShutoff.h>
+#include <FlowTotalizer.h>
+#include <SpscRing.h>
+#include <TelemetryWriter.h>
+#include <TelemetryRing.h>
+#include <SpoolLog.h>
+#include <ConfigParser.h>
+#include <Schedule.h>
+#include <ScheduleStore.h>
+#include <ZoneScheduler.h>
+#include <Dht20Sampler.h>
+#include <Backoff.h>
+#include <SystemClock.h>
+#include <WifiLinkCache.h>
+
+#include <esp_timer.h>
+#include <esp_wifi.h>
+#include <sys/time.h>
+#include <esp_sntp.h>
+#include <esp32/rtc.h>
+#include <lwip/sockets.h>
+#include <freertos/event_groups.h>
 
 #ifndef FIRMWARE_VERSION
 #define FIRMWARE_VERSION "0.0.1"
@@ -20,9 +42,86 @@
 
 // OTA firmware update check configuration
 #define DEFAULT_OTA_CHECK_INTERVAL 60 // check for updates every 1 minute (60 seconds)
+#define OTA_FLUSH_TIMEOUT_MS 5000     // how long an install waits for loop() to write out held-back NVS data
 
 #define JSON_URL SERVER_URL //this is where you'll post your JSON filter file
 
+#define HEARTBEAT_INTERVAL_MS 30000
+
+// Telemetry sampling and batching; flow is only sampled while a meter runs.
+// Override from build_flags, e.g. -D TELEMETRY_FLUSH_INTERVAL_MS=300000.
+#ifndef TELEMETRY_FLOW_PERIOD_MS
+#define TELEMETRY_FLOW_PERIOD_MS 1000
+#endif
+#ifndef TELEMETRY_CLIMATE_PERIOD_MS
+#define TELEMETRY_CLIMATE_PERIOD_MS 10000
+#endif
+#ifndef TELEMETRY_FLUSH_INTERVAL_MS
+#define TELEMETRY_FLUSH_INTERVAL_MS 60000
+#endif
+// one batch per publish; the MQTT client's buffer holds it plus topic and header
+#define TELEMETRY_BATCH_SIZE 1536
+#define MQTT_BUFFER_SIZE (TELEMETRY_BATCH_SIZE + 128)
+// Encoding of each status payload: PAYLOAD_JSON (default) or PAYLOAD_CBOR for
+// a smaller message, e.g. -D HEARTBEAT_ENCODING=PAYLOAD_CBOR. The server
+// decodes either; telemetry batches and alerts are always JSON.
+#ifndef HEARTBEAT_ENCODING
+#define HEARTBEAT_ENCODING PAYLOAD_JSON
+#endif
+#ifndef ACK_ENCODING
+#define ACK_ENCODING PAYLOAD_JSON
+#endif
+#ifndef STATUS_ENCODING
+#define STATUS_ENCODING PAYLOAD_JSON
+#endif
+#define FLOW_PRINT_INTERVAL_MS 1000
+// largest volume_l accepted in a config; kept in mL, so it must fit in 32 bits
+#define MAX_VOLUME_L 100000
+// upper bound on how long loop() may sleep so client.loop() can keep the MQTT session alive
+#define MQTT_SERVICE_INTERVAL_MS 5000
+// wait between MQTT connection attempts: doubles from the base after each failure, up to the max, jittered
+#define MQTT_BACKOFF_BASE_MS 1000
+#define MQTT_BACKOFF_MAX_MS 60000
+// wait between WiFi reconnect attempts, paced the same way; an attempt takes a few seconds to associate
+#define WIFI_BACKOFF_BASE_MS 8000
+#define WIFI_BACKOFF_MAX_MS 60000
+// setup() never waits on WiFi. A boot with stored credentials connects from loop() like a
+// reconnect; one that has none, or is still not connected at the first retry
+// WIFI_CONNECT_TIMEOUT_S after boot, opens WiFiManager's config portal next to the
+// schedule. loop() services it this often, and it closes after the timeout so the stored
+// AP is retried (an AP that was only slow to come back is then found without a visit)
+#define WIFI_CONNECT_TIMEOUT_S 10
+#define WIFI_PORTAL_TIMEOUT_S 180
+#define WIFI_PORTAL_SERVICE_MS 50
+
+// The first attempt at boot and of each outage goes straight to the last AP
+// (cached BSSID and channel) instead of scanning every channel. It gets at least
+// the timeout before the next attempt scans; a boot whose directed attempt fails
+// drops the cache. Build with -D WIFI_FAST_CONNECT=0 to always scan.
+#ifndef WIFI_FAST_CONNECT
+#define WIFI_FAST_CONNECT 1
+#endif
+#define WIFI_FAST_CONNECT_TIMEOUT_MS 4000
+
+// -D WIFI_STATIC_IP=1 also reuses the cached DHCP lease as a static address,
+// skipping DHCP on a directed connect. Only for networks whose router reserves
+// that address for this device.
+#ifndef WIFI_STATIC_IP
+#define WIFI_STATIC_IP 0
+#endif
+
+// wake-up sources for loop(); set from the deadline timer, the socket watcher and the OTA task
+#define EVT_DEADLINE (1 << 0)   // the next scheduled deadline has been reached
+#define EVT_NETWORK (1 << 1)    // the MQTT socket has data waiting to be read
+#define EVT_OTA_RESULT (1 << 2) // the OTA task finished a check and has a status to publish
+#define EVT_VOLUME (1 << 3)     // a zone's volume target was reached and its relay dropped
+#define EVT_MQTT_UP (1 << 4)    // the connection task brought the MQTT session up
+#define EVT_WIFI (1 << 5)       // the WiFi driver reported the station dropping or getting an address
+#define EVT_TIME (1 << 6)       // SNTP set the system clock
+#define EVT_OTA_FLUSH (1 << 7)  // the OTA task found an update and waits for NVS to be flushed
+#define EVT_ALL (EVT_DEADLINE | EVT_NETWORK | EVT_OTA_RESULT | EVT_VOLUME | EVT_MQTT_UP | EVT_WIFI | EVT_TIME | \
+                 EVT_OTA_FLUSH)
+
 // LED blink states used by the blink task (separate WIFI and MQTT states)
 enum BlinkState
 {
@@ -43,256 +142,621 @@ typedef struct config
 // shared state variable accessible from both setup() and the blink task
 volatile BlinkState blinkState = STATE_WIFI_CONNECTING;
 
+// MQTT session, driven by mqttConnectTask. loop() uses the client only while the
+// session is up and hands it back (MQTT_DOWN) when it finds the connection gone.
+enum MqttState
+{
+  MQTT_DOWN,       // no session; the task connects as soon as WiFi is up
+  MQTT_CONNECTING, // the task is inside client.connect()
+  MQTT_BACKOFF,    // the last attempt failed; the task waits before the next
+  MQTT_UP
+};
+volatile MqttState mqttState = MQTT_DOWN;
+
 // OTA firmware version and check interval
 const char* currentFirmwareVersion = FIRMWARE_VERSION;
 unsigned long otaCheckInterval = DEFAULT_OTA_CHECK_INTERVAL; // seconds between OTA checks
 unsigned long lastOtaCheckTime = 0; // timestamp of last OTA check
+volatile int otaResult = 0;                   // return code of the last OTA check, published by loop()
+volatile unsigned long otaResultTimestamp = 0; // time at which that check ran
 
-MQTTClient client;
+MQTTClient client(MQTT_BUFFER_SIZE);
 unsigned long lastMillis = 0;
+unsigned long lastPrint = 0;
 WiFiClient wifiClient;
+WiFiManager wm;
+bool wifiPortal = false; // the config portal is open and owns the radio
+bool wifiPortalOpened = false; // the portal has been opened this boot; it is offered once
 
 static const unsigned long WIFI_RECOVERY_TIMEOUT_MS = 10UL * 60UL * 1000UL;
-unsigned long wifiDisconnectStart = 0;
+unsigned long wifiDisconnectStart = 0; // millis() when the current outage began, 0 while connected
+unsigned long wifiRetryAt = 0;         // millis() of the next reconnect attempt during an outage
+Backoff wifiBackoff(WIFI_BACKOFF_BASE_MS, WIFI_BACKOFF_MAX_MS);
+uint32_t wifiOutages = 0;              // outages recovered from since boot
+uint32_t wifiLastOutageMs = 0;         // length of the last one
+uint32_t wifiLastReconnects = 0;       // reconnect attempts it took
+bool heartbeatDue = false;             // send the heartbeat at the next chance instead of waiting out the interval
+
+// event-driven control loop plumbing
+EventGroupHandle_t controlEvents = nullptr;
+esp_timer_handle_t deadlineTimer = nullptr;
+TaskHandle_t otaTaskHandle = nullptr;
+TaskHandle_t netWatchTaskHandle = nullptr;
+TaskHandle_t mqttTaskHandle = nullptr;
+Backoff mqttBackoff(MQTT_BACKOFF_BASE_MS, MQTT_BACKOFF_MAX_MS);
+uint32_t mqttAttempts = 0;            // MQTT connection attempts since boot
+volatile int mqttSocketFd = -1;       // socket watched by networkWatchTask, refreshed by loop()
+
+// latency counters reported in the heartbeat
+int64_t lastCommandLatencyUs = 0;  // message received -> relay written, for the last /control command
+int64_t maxCommandLatencyUs = 0;
+int64_t lastScheduleLatenessMs = 0; // scheduled deadline -> relay written, for the last ON/OFF
+int64_t maxScheduleLatenessMs = 0;
+unsigned long bootReadyMs = 0;      // millis() at the first pass of loop(), once the schedule runs
+unsigned long firstActuationMs = 0; // millis() of the first relay switch since boot, 0 until then
 
 // Relay pin (change if you use a different GPIO). Avoid using LED pin.
 #define RELAY_PIN 5
 
+// Relay GPIO per zone; zone 0 is the original single relay. Drive more valves by
+// overriding this from build_flags, e.g. -D ZONE_RELAY_PINS="{5,18,19,21}" (up to MAX_ZONES).
+#ifndef ZONE_RELAY_PINS
+#define ZONE_RELAY_PINS {RELAY_PIN}
+#endif
+static const uint8_t zoneRelayPins[] = ZONE_RELAY_PINS;
+#define ZONE_COUNT (sizeof(zoneRelayPins) / sizeof(zoneRelayPins[0]))
+static_assert(ZONE_COUNT <= MAX_ZONES, "more relay pins than MAX_ZONES");
+
+// Flow sensor GPIOs and the zone each one meters; FLOW_BANK_ZONE_ANY is a main
+// line that meters whichever zone runs. Per-branch meters, e.g.
+// -D FLOW_SENSOR_PINS="{15,4,16}" -D FLOW_SENSOR_ZONES="{0,1,2}".
+#ifndef FLOW_SENSOR_PINS
+#define FLOW_SENSOR_PINS {15}
+#define FLOW_SENSOR_ZONES {FLOW_BANK_ZONE_ANY}
+#endif
+#ifndef FLOW_SENSOR_ZONES
+#error "FLOW_SENSOR_PINS needs a matching FLOW_SENSOR_ZONES"
+#endif
+static const uint8_t flowSensorPins[] = FLOW_SENSOR_PINS;
+static const uint8_t flowSensorZones[] = FLOW_SENSOR_ZONES;
+#define FLOW_SENSOR_COUNT (sizeof(flowSensorPins) / sizeof(flowSensorPins[0]))
+static_assert(sizeof(flowSensorZones) == sizeof(flowSensorPins), "one FLOW_SENSOR_ZONES entry per flow sensor pin");
+static_assert(FLOW_SENSOR_COUNT <= FLOW_BANK_MAX_SENSORS, "more flow sensors than FLOW_BANK_MAX_SENSORS");
+
 // compile-time defaults used if no schedule is stored or MQTT config
 #define DEFAULT_INTERVAL 3600 // one hour between activations
 #define DEFAULT_DURATION 30   // relay on for 30 seconds
 // default explicit turn-on epoch (user asked for 1772431200)
 #define DEFAULT_TURN_ON_AT 1772431200UL
 
-#define SCHEDULE_TOLERANCE_SECONDS 60
+// local time used by calendar (cron) rules and heartbeat formatting; changed with
+// {"tz_offset_min":...} on the config topic and kept in NVS
+#define DEFAULT_TZ_OFFSET_MIN 330 // IST (UTC+5:30)
+int32_t tzOffsetSeconds = DEFAULT_TZ_OFFSET_MIN * 60;
 
-// configuration struct for scheduled on/off
-typedef struct
-{
-  unsigned long interval;     // seconds until next ON
-  unsigned long duration;     // seconds to stay ON
-  unsigned long next_on_time; // epoch seconds for next ON (or relative seconds if time not available)
-  unsigned long off_time;     // epoch seconds when to turn OFF
-  bool is_on;
-} system_config_t;
+// schedule changes other than relay ON/OFF are batched into one NVS write per window
+#define SCHEDULE_COMMIT_WINDOW_MS 10000
 
 // a default instance that will be used on first boot or when prefs are empty
 static const system_config_t DEFAULT_CONFIG = {DEFAULT_INTERVAL, DEFAULT_DURATION, DEFAULT_TURN_ON_AT, 0, false};
 
-// current active configuration (starts with defaults)
-system_config_t config = DEFAULT_CONFIG;
+// per-zone configuration and the queue of upcoming ON/OFF events
+ZoneScheduler scheduler;
+uint32_t openZones = 0; // bit n set while zone n's relay is energised
 
-// NVS (Preferences) for persisting schedule
+// last good wall time, kept through warm resets so the clock is usable before SNTP answers
+RTC_NOINIT_ATTR clock_mark_t clockMark;
+SystemClock systemClock(clockMark);
+
+// NVS (Preferences) for persisting schedule; one record per zone, created in setup()
 Preferences prefs;
+ScheduleStore *zoneStores[MAX_ZONES];
+
+// AP and lease of the last connection, for directed connects; RTC copy for warm
+// resets, NVS copy for cold boots
+RTC_NOINIT_ATTR wifi_link_t wifiLinkRtc;
+WifiLinkCache wifiLinks(wifiLinkRtc, prefs);
+bool wifiFastBoot = false;             // boot connected to the cached AP without a scan
+bool wifiDirected = false;             // the latest attempt went to the cached AP
+unsigned long bootWifiMs = 0;          // millis() when the station first had an address
+unsigned long bootMqttMs = 0;          // millis() when the first MQTT session came up
+
+ConfigParser configParser;
 
-WaterFlowSensor flowSensor(15); // example flow sensor on GPIO4; adjust as needed
-DFRobot_DHT20 dht20;
+// commands decoded by messageReceived() and applied by loop() after client.loop()
+enum CommandType
+{
+  CMD_CONFIG,
+  CMD_TIMEZONE,
+  CMD_OUTPUT_ON,
+  CMD_OUTPUT_OFF
+};
+
+typedef struct
+{
+  CommandType type;
+  uint8_t zone;
+  unsigned long interval;   // CMD_CONFIG: seconds until next ON
+  unsigned long duration;   // CMD_CONFIG: seconds to stay ON
+  unsigned long turn_on_at; // CMD_CONFIG: explicit first ON epoch, 0 if not given
+  cron_rule_t rule;         // CMD_CONFIG: calendar rule, rule.active == 0 for interval scheduling
+  unsigned long volume_ml;  // CMD_CONFIG: volume to deliver per cycle, 0 for time-based cycles
+  bool set_tz;              // CMD_CONFIG/CMD_TIMEZONE: tz_offset_min was given
+  int32_t tz_offset_min;
+  int64_t received_us;      // esp_timer time at which the client handed the message over
+} control_command_t;
+
+#define COMMAND_QUEUE_CAPACITY 8
+SpscRing<control_command_t, COMMAND_QUEUE_CAPACITY> commandQueue;
+uint32_t droppedCommands = 0;
+
+// every outgoing JSON payload is formatted here; only loop() publishes, so one buffer suffices
+#define TELEMETRY_BUFFER_SIZE 768
+static char telemetryBuf[TELEMETRY_BUFFER_SIZE];
+static char telemetryBatchBuf[TELEMETRY_BATCH_SIZE];
+TelemetryRing telemetry(TELEMETRY_FLOW_PERIOD_MS, TELEMETRY_CLIMATE_PERIOD_MS, TELEMETRY_FLUSH_INTERVAL_MS);
+SpoolLog spool; // messages that could not be published, in the spiffs partition until they can
+
+FlowSensorBank flowBank; // sensors registered in setup() from FLOW_SENSOR_PINS
+uint32_t flowStartsSeen[FLOW_BANK_MAX_SENSORS]; // flow_snapshot_t counters already logged by loop()
+uint32_t flowStopsSeen[FLOW_BANK_MAX_SENSORS];
+FlowTotalizer *flowTotalizers[FLOW_BANK_MAX_SENSORS]; // lifetime pulse counts, kept across reboots
+FlowAnomalyDetector flowAnomalies; // leak, burst and blocked-line alerts from the flow readings
+void volumeReachedIsr(uint8_t zone);
+VolumeShutoff volumeShutoff(flowBank, volumeReachedIsr); // ends volume_l cycles from the pulse counter
+static_assert(MAX_ZONES <= FLOW_ANOMALY_MAX_ZONES, "flow anomaly detector tracks fewer zones than MAX_ZONES");
+Dht20Sampler climate; // DHT20 sampled by its own task; readers take the cached reading
 
 void callback(int offset, int totallength);
 const char *errtext(int code);
 
-static void saveSchedule()
+static void saveSchedule(uint8_t zone)
 {
-  // store interval and duration as well so the schedule survives reboots
-  prefs.putULong("interval", config.interval);
-  prefs.putULong("duration", config.duration);
-  // store next_on_time, off_time, and is_on
-  prefs.putULong("next_on", config.next_on_time);
-  prefs.putULong("off_time", config.off_time);
-  prefs.putULong("is_on", config.is_on ? 1 : 0);
+  // relay state changes are written immediately, other edits are coalesced
+  zoneStores[zone]->save(scheduler.config(zone));
 }
 
-static void loadSchedule()
+static void loadSchedule(uint8_t zone, system_config_t &config)
 {
-  // load interval/duration and fall back to defaults if not present
-  config.interval = prefs.getULong("interval", DEFAULT_INTERVAL);
-  config.duration = prefs.getULong("duration", DEFAULT_DURATION);
-  // use DEFAULT_TURN_ON_AT if there is no stored value
-  config.next_on_time = prefs.getULong("next_on", DEFAULT_TURN_ON_AT);
-  config.off_time = prefs.getULong("off_time", 0);
-  config.is_on = prefs.getULong("is_on", 0) ? true : false;
+  // zone 0 keeps the key (and the pre-record migration) of the single-relay firmware
+  char key[16];
+  if (zone == 0)
+    strcpy(key, "sched");
+  else
+    snprintf(key, sizeof(key), "sched%u", zone);
+  zoneStores[zone] = new ScheduleStore(prefs, key, SCHEDULE_COMMIT_WINDOW_MS);
+
+  // keep DEFAULT_CONFIG (including the default turn-on epoch) if nothing is stored
+  config = DEFAULT_CONFIG;
+  if (!zoneStores[zone]->load(config) && zone == 0)
+    zoneStores[zone]->migrateLegacy(config);
+}
+
+static void setZoneRelay(uint8_t zone, bool on)
+{
+  digitalWrite(zoneRelayPins[zone], on ? HIGH : LOW);
+  if (firstActuationMs == 0)
+  {
+    firstActuationMs = max(millis(), 1UL);
+    Serial.printf("First relay actuation %lu ms after boot\r\n", firstActuationMs);
+  }
+  if (on)
+  {
+    openZones |= 1UL << zone;
+  }
+  else
+  {
+    openZones &= ~(1UL << zone);
+    volumeShutoff.cancel(zone); // however it was turned off, its volume target is void
+  }
+}
+
+// Runs in the flow counter's interrupt the moment a zone's volume target is
+// reached: the relay drops here, and loop() finishes the cycle when it wakes
+void IRAM_ATTR volumeReachedIsr(uint8_t zone)
+{
+  digitalWrite(zoneRelayPins[zone], LOW);
+  BaseType_t woken = pdFALSE;
+  xEventGroupSetBitsFromISR(controlEvents, EVT_VOLUME, &woken);
+  portYIELD_FROM_ISR(woken);
+}
+
+static void flushFlowTotals()
+{
+  flow_bank_snapshot_t flow = flowBank.snapshot();
+  for (uint8_t i = 0; i < flowBank.count(); i++)
+    flowTotalizers[i]->flush(flow.sensors[i].lifetimePulses);
+}
+
+// write out everything held back from NVS: coalesced schedule edits and the flow totals
+static void flushNvs()
+{
+  for (uint8_t zone = 0; zone < scheduler.zoneCount(); zone++)
+    zoneStores[zone]->flush();
+  flushFlowTotals();
+}
+
+// Carry out what a schedule transition asks for: relay first, then NVS.
+static void applyScheduleAction(uint8_t zone, ScheduleAction action)
+{
+  if (action == SCHEDULE_RELAY_ON || action == SCHEDULE_RELAY_OFF)
+    setZoneRelay(zone, action == SCHEDULE_RELAY_ON);
+  if (action != SCHEDULE_NO_ACTION)
+    saveSchedule(zone);
 }
 
 // Adjust schedule when system time is ahead of stored next_on_time.
 // If the system missed the ON while it was offline (config.is_on == false),
 // reschedule the next_on_time relative to now (don't retro-activate the relay).
-static void adjustScheduleForMissedOn(unsigned long now)
+static void adjustScheduleForMissedOn(uint8_t zone, unsigned long now)
 {
-  if (config.interval == 0 || config.next_on_time == 0)
-    return;
+  applyScheduleAction(zone, scheduleAdjustMissedOn(scheduler.config(zone), now, tzOffsetSeconds));
+}
 
-  if (now > config.next_on_time)
+// Re-check every zone once the clock has jumped from uptime to wall-clock time.
+static void resyncSchedules(unsigned long now)
+{
+  for (uint8_t zone = 0; zone < scheduler.zoneCount(); zone++)
   {
-    unsigned long timeDiff = now - config.next_on_time;
-    if (timeDiff <= SCHEDULE_TOLERANCE_SECONDS)
-    {
-      // Small miss: Log and skip adjustment to avoid over-correction
-      Serial.print("Small schedule miss (");
-      Serial.print(timeDiff);
-      Serial.println("s); skipping reschedule.");
-      return;
-    }
+    applyScheduleAction(zone, scheduleResync(scheduler.config(zone), now, tzOffsetSeconds));
+    scheduler.reschedule(zone);
+  }
+}
 
-    Serial.print("Now is ahead of next_on_time (missed): ");
-    Serial.println(config.next_on_time);
-    if (!config.is_on)
-    {
-      // Missed the ON while system was off — align schedule to now
-      config.next_on_time = now + config.interval;
-      Serial.print("Rescheduled next ON to: ");
-      Serial.println(config.next_on_time);
-      saveSchedule();
-    }
-    else
+// return current time in seconds on the schedule clock: epoch once NTP or the
+// RTC mark has set it, otherwise seconds since boot. It comes from the
+// monotonic esp_timer counter, so it costs no syscall and moves only in
+// handleTimeSync(), never under a loop pass.
+static unsigned long getCurrentTime()
+{
+  return systemClock.nowSeconds(esp_timer_get_time());
+}
+
+// SNTP has set the system clock (called from loop() on EVT_TIME). The schedule
+// does not follow time() directly: systemClock moves onto it here, and every
+// deadline that measures elapsed time moves by the same step. On the first sync
+// of a cold boot the step is epoch minus uptime and carries the deadlines
+// counted from boot onto the wall clock; after that it is SNTP correcting the
+// drift (or a bad reply), and interval ONs and OFFs keep their remaining wait
+// instead of being skipped or repeated. Zones are re-checked on the first sync
+// of each boot.
+static void handleTimeSync()
+{
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  if (tv.tv_sec < (time_t)MIN_VALID_EPOCH)
+    return;
+  ClockSource was = systemClock.source();
+  int32_t step = systemClock.synced((int64_t)tv.tv_sec * 1000000 + tv.tv_usec, esp_rtc_get_time_us(),
+                                    esp_timer_get_time());
+  if (step != 0)
+  {
+    for (uint8_t zone = 0; zone < scheduler.zoneCount(); zone++)
     {
-      // System was marked ON but time moved past off_time — ensure we turn it off
-      if (config.off_time > 0 && now >= config.off_time)
-      {
-        digitalWrite(RELAY_PIN, LOW);
-        config.is_on = false;
-        config.off_time = 0;
-        config.next_on_time = now + config.interval;
-        Serial.println("Off time passed while active; turning OFF and rescheduling");
-        saveSchedule();
-      }
+      system_config_t &config = scheduler.config(zone);
+      applyScheduleAction(zone, was == CLOCK_UPTIME ? scheduleRebase(config, (unsigned long)step)
+                                                    : scheduleStep(config, step));
+      scheduler.reschedule(zone);
     }
+    if (was != CLOCK_UPTIME || lastOtaCheckTime < MIN_VALID_EPOCH)
+      lastOtaCheckTime += step;
+    if (was != CLOCK_UPTIME)
+      Serial.printf("Clock stepped %ld s; interval deadlines moved with it\r\n", (long)step);
   }
+  // SNTP polls hourly; the zones were re-checked at the first sync
+  if (was == CLOCK_SYNCED)
+    return;
+
+  Serial.printf("NTP sync: epoch %lu\r\n", (unsigned long)tv.tv_sec);
+  Serial.println("Re‑adjusting schedule after NTP sync");
+  resyncSchedules(getCurrentTime());
 }
 
-// simple parser to extract integer value for a key in a JSON-like string
-static unsigned long parseNumber(const char *src, const char *key)
+// milliseconds left until a deadline expressed on the getCurrentTime() scale
+// (negative once the deadline has passed)
+static int64_t msUntil(unsigned long deadline)
 {
-  const char *p = strstr(src, key);
-  if (!p)
-    return 0;
-  p = strchr(p, ':');
-  if (!p)
-    return 0;
-  p++; // move past ':'
-  // skip whitespace
-  while (*p && isspace((unsigned char)*p))
-    p++;
-  // parse unsigned long
-  return strtoul(p, NULL, 10);
+  return (int64_t)deadline * 1000 - systemClock.nowMillis(esp_timer_get_time());
 }
 
-// return current time in seconds; if NTP/RTC not set yet then use uptime
-static unsigned long getCurrentTime()
+// how late a scheduled ON/OFF was actuated relative to its deadline
+static void recordScheduleLateness(unsigned long deadline)
+{
+  lastScheduleLatenessMs = -msUntil(deadline);
+  if (lastScheduleLatenessMs > maxScheduleLatenessMs)
+    maxScheduleLatenessMs = lastScheduleLatenessMs;
+  Serial.printf("Schedule lateness: %lld ms\r\n", lastScheduleLatenessMs);
+}
+
+// time from the MQTT client delivering the command to the relay being written
+static void recordCommandLatency(int64_t receivedMicros)
+{
+  lastCommandLatencyUs = esp_timer_get_time() - receivedMicros;
+  if (lastCommandLatencyUs > maxCommandLatencyUs)
+    maxCommandLatencyUs = lastCommandLatencyUs;
+  Serial.printf("Command latency: %lld us\r\n", lastCommandLatencyUs);
+}
+
+static void deadlineTimerCallback(void *arg)
+{
+  (void)arg;
+  xEventGroupSetBits(controlEvents, EVT_DEADLINE);
+}
+
+// Arm the one-shot deadline timer for whichever of the pending deadlines comes first:
+// the earliest zone ON or OFF, the next heartbeat, the next OTA check, a deferred
+// schedule commit and, while a relay is on, the periodic flow print. loop() sleeps
+// until that timer (or the network) wakes it.
+static void armDeadlineTimer()
 {
-  time_t t = time(nullptr);
-  if (t >= 100000)
+  int64_t waitMs = HEARTBEAT_INTERVAL_MS - (int64_t)(millis() - lastMillis);
+
+  unsigned long nextEvent;
+  if (scheduler.nextDeadline(nextEvent))
+    waitMs = min(waitMs, msUntil(nextEvent));
+
+  waitMs = min(waitMs, msUntil(lastOtaCheckTime + otaCheckInterval));
+
+  if (openZones != 0)
+    waitMs = min(waitMs, FLOW_PRINT_INTERVAL_MS - (int64_t)(millis() - lastPrint));
+  waitMs = min(waitMs, (int64_t)flowAnomalies.msUntilCheck(millis()));
+  waitMs = min(waitMs, (int64_t)volumeShutoff.msUntilService(millis()));
+  waitMs = min(waitMs, (int64_t)telemetry.msUntilDue(millis()));
+  if (mqttState == MQTT_UP)
+    waitMs = min(waitMs, (int64_t)spool.msUntilReplay(millis()));
+  if (wifiPortal)
+    waitMs = min(waitMs, (int64_t)WIFI_PORTAL_SERVICE_MS);
+  else if (wifiDisconnectStart != 0)
+    waitMs = min(waitMs, (int64_t)(long)(wifiRetryAt - millis()));
+  if (heartbeatDue && mqttState == MQTT_UP)
+    waitMs = 0;
+
+  for (uint8_t zone = 0; zone < scheduler.zoneCount(); zone++)
   {
-    return (unsigned long)t;
+    if (zoneStores[zone]->pending())
+      waitMs = min(waitMs, (int64_t)zoneStores[zone]->msUntilCommit());
   }
-  // no valid epoch, fall back to relative seconds since boot
-  return millis() / 1000;
+
+  esp_timer_stop(deadlineTimer); // no-op if it is not running
+  if (waitMs <= 0)
+  {
+    xEventGroupSetBits(controlEvents, EVT_DEADLINE);
+    return;
+  }
+  esp_timer_start_once(deadlineTimer, (uint64_t)waitMs * 1000);
 }
 
 // forward declaration of blink task and OTA task
 void blinkTask(void *param);
 void otaUpdateTask(void *param);
+void networkWatchTask(void *param);
+void mqttConnectTask(void *param);
+
+// Wall-clock epoch for timestamps, 0 until the clock has been set
+static uint32_t wallClock()
+{
+  return systemClock.wallTime() ? (uint32_t)getCurrentTime() : 0;
+}
 
-// attempt a single MQTT connection; returns true on success
-bool connectToMqtt()
+// Publish now, or keep the message in the flash spool for replay once the
+// broker is back; false if it could go neither way
+static bool publishOrSpool(const char *topic, const char *payload, size_t length)
 {
-  if (client.connected())
+  if (mqttState == MQTT_UP && client.publish(topic, payload, (int)length))
     return true;
+  return spool.append(topic, payload, length, wallClock());
+}
 
-  // Check WiFi status first
-  if (WiFi.status() != WL_CONNECTED) {
-    Serial.println("MQTT connect failed: WiFi not connected");
-    blinkState = STATE_MQTT_FAILED;
-    return false;
-  }
+static bool publishOrSpool(const char *topic, const char *payload)
+{
+  return publishOrSpool(topic, payload, strlen(payload));
+}
 
-  Serial.println("Connecting to MQTT...");
-  // indicate MQTT connection attempt
-  blinkState = STATE_MQTT_CONNECTING;
+static bool publishReplayed(const char *topic, const char *payload, size_t length)
+{
+  return client.publish(topic, payload, (int)length);
+}
 
-  if (client.connect("shortstop"))
-  {
-    Serial.println("connected!");
-    blinkState = STATE_MQTT_CONNECTED;
-    client.subscribe(TOPIC_CONFIG);
-    client.subscribe(TOPIC_CONTROL);
-    return true;
-  }
-  else
+// Publish the ON/OFF acknowledgment with flow rate, volume, temperature and humidity
+static void publishAck(uint8_t zone, const char *status)
+{
+  // one snapshot so rate and volume are from the same instant
+  flow_bank_snapshot_t flow = flowBank.snapshot();
+  ack_payload_t ack;
+  ack.status = status;
+  ack.zone = zone;
+  ack.flow_rate_lpm100 = toFixed(FlowSensorBank::zoneInstantLpm(flow, zone), 2);
+  ack.total_volume_l100 = FlowSensorBank::zoneMilliliters(flow, zone) / 10;
+  // before the first DHT20 reading the snapshot is all zeros, which is no reading
+  climate_snapshot_t air = climate.snapshot();
+  ack.has_climate = air.takenAtMs != 0;
+  ack.temperature_c10 = toFixed(air.temperatureC, 1);
+  ack.humidity_pct10 = toFixed(air.humidity * 100, 1);
+
+  size_t length = encodeAck(telemetryBuf, sizeof(telemetryBuf), ACK_ENCODING, ack);
+  if (length > 0)
+    publishOrSpool(TOPIC_ACK, telemetryBuf, length);
+}
+
+// Report a flow alert; it is raised once per episode, so it is published as soon as it is taken
+static void publishFlowAlert(const flow_alert_t &alert, unsigned long now)
+{
+  Serial.printf("Flow alert: %s on zone %d at %.2f L/min (baseline %.2f), %u pulses\r\n", flowAlertName(alert.type),
+                alert.zone == FLOW_BANK_ZONE_ANY ? -1 : alert.zone, alert.rateLpm, alert.baselineLpm, alert.pulses);
+  flow_alert_payload_t payload;
+  payload.alert = flowAlertName(alert.type);
+  payload.zone = alert.zone == FLOW_BANK_ZONE_ANY ? -1 : alert.zone;
+  payload.flow_rate_lpm100 = toFixed(alert.rateLpm, 2);
+  payload.baseline_lpm100 = toFixed(alert.baselineLpm, 2);
+  payload.pulses = alert.pulses;
+  payload.timestamp = now;
+  const char *alert_str = formatFlowAlert(telemetryBuf, sizeof(telemetryBuf), payload);
+  if (alert_str != nullptr)
+    publishOrSpool(TOPIC_ALERT, alert_str);
+}
+
+// Send the buffered telemetry as batches, oldest first (to the spool while
+// offline); records stay in the ring only if a batch could go nowhere
+static void publishTelemetry()
+{
+  while (telemetry.size() > 0)
   {
-    Serial.println("MQTT connect failed");
-    blinkState = STATE_MQTT_FAILED;
-    return false;
+    size_t count;
+    const char *batch = telemetry.formatBatch(telemetryBatchBuf, sizeof(telemetryBatchBuf), millis(), wallClock(),
+                                              count);
+    if (batch == nullptr || count == 0 || !publishOrSpool(TOPIC_TELEMETRY, batch))
+    {
+      telemetry.postpone(millis());
+      return;
+    }
+    telemetry.consume(count, millis());
   }
 }
 
+// Decode an incoming message into a command and queue it for loop(). Nothing here
+// touches the relay, NVS or the MQTT client: publishing from inside the client
+// callback can deadlock when other packets arrive while acknowledgments are sent.
 void messageReceived(String &topic, String &payload)
 {
+  // stamped here, not by the socket watcher: a message that arrives while the connect task is
+  // still subscribing is delivered without the watcher having seen the socket
+  int64_t receivedMicros = esp_timer_get_time();
   Serial.println("incoming: " + topic + " - " + payload);
 
   const char *cstr = payload.c_str();
+  control_command_t cmd = {};
+  cmd.received_us = receivedMicros;
 
   // handle config messages
   if (topic.equals(TOPIC_CONFIG))
   {
-    // parse simple JSON-like payload for interval and duration (seconds)
-    // example payload: {"interval":3600,"duration":30}
-    unsigned long interval = parseNumber(cstr, "interval");
-    unsigned long duration = parseNumber(cstr, "duration");
-
-    // check for explicit TURN_ON_AT epoch time
-    // example: {"TURN_ON_AT":1708532400,"duration":30}
-    unsigned long turn_on_at = parseNumber(cstr, "TURN_ON_AT");
-
-    if (interval == 0 || duration == 0)
+    // interval and duration are seconds; TURN_ON_AT is an optional explicit epoch
+    // and zone selects the valve (default 0). cron replaces interval with a
+    // calendar rule ("minute hour * * day-of-week", local time) and every_days
+    // restricts it to every Nth day. tz_offset_min alone only changes local time.
+    // example payloads: {"interval":3600,"duration":30}
+    //                   {"TURN_ON_AT":1708532400,"interval":3600,"duration":30,"zone":2}
+    //                   {"cron":"0 6 * * 1,3,5","duration":600,"zone":1}
+    //                   {"cron":"30 18 * * *","every_days":3,"duration":300}
+    //                   {"tz_offset_min":-300}
+    // volume_l (whole litres) ends each scheduled cycle once that much has
+    // flowed, with duration as the cap: {"interval":86400,"duration":1800,"volume_l":40}
+    config_fields_t fields;
+    if (configParser.parse(cstr, payload.length(), fields) != CONFIG_PARSE_OK)
     {
-      Serial.println("Invalid interval/duration in payload");
+      Serial.println("Malformed config payload");
       return;
     }
-
-    config.interval = interval;
-    config.duration = duration;
-    time_t now = time(nullptr);
-    if (now < 100000)
+    // any field that is present but not usable (including a repeated key) rejects the whole payload
+    bool fieldsOk = true;
+    for (int i = 0; i < CFG_FIELD_COUNT; i++)
     {
-      Serial.println("System time not set yet; scheduling will start after time sync");
-      // mark next_on_time as 0; loop() will initialize once time is available
-      config.next_on_time = 0;
+      if (fields.status[i] != FIELD_OK && fields.status[i] != FIELD_MISSING)
+      {
+        Serial.printf("Config field %s: %s\r\n", ConfigParser::fieldName((ConfigField)i),
+                      ConfigParser::statusText(fields.status[i]));
+        fieldsOk = false;
+      }
     }
-    else
+    if (!fieldsOk)
+      return;
+
+    if (fields.status[CFG_TZ_OFFSET_MIN] == FIELD_OK)
     {
-      // use explicit TURN_ON_AT if provided; otherwise use now + interval
-      if (turn_on_at > 0)
+      int32_t offset = (int32_t)fields.value[CFG_TZ_OFFSET_MIN];
+      if (offset < -12 * 60 || offset > 14 * 60)
       {
-        config.next_on_time = turn_on_at;
-        Serial.print("Set explicit TURN_ON_AT: ");
-        Serial.println(config.next_on_time);
+        Serial.println("Invalid tz_offset_min in payload");
+        return;
       }
-      else
+      cmd.set_tz = true;
+      cmd.tz_offset_min = offset;
+      if (fields.status[CFG_INTERVAL] == FIELD_MISSING && fields.status[CFG_DURATION] == FIELD_MISSING &&
+          fields.status[CFG_CRON] == FIELD_MISSING)
       {
-        // schedule first turn-on at now + interval
-        config.next_on_time = (unsigned long)now + config.interval;
+        cmd.type = CMD_TIMEZONE;
+        if (!commandQueue.push(cmd))
+        {
+          droppedCommands++;
+          Serial.println("Command queue full; dropping command");
+        }
+        return;
       }
-      config.off_time = 0;
-      config.is_on = false;
-      Serial.print("Scheduled next ON at epoch: ");
-      Serial.println(config.next_on_time);
-      // persist schedule
-      saveSchedule();
+    }
+    else if (fields.status[CFG_TZ_OFFSET_MIN] != FIELD_MISSING)
+    {
+      Serial.println("Invalid tz_offset_min in payload");
+      return;
     }
 
-    /* Publish back to acknowledge reception of config */
-    if (client.connected())
+    if (fields.status[CFG_CRON] != FIELD_MISSING)
     {
-      client.publish(TOPIC_ACK, "{\"interval\":" + String(config.interval) + ",\"duration\":" + String(config.duration) + ",\"Turn_ON_AT\":" + String(config.next_on_time) + "}");
+      if (fields.status[CFG_CRON] != FIELD_OK)
+      {
+        Serial.println("Invalid cron in payload");
+        return;
+      }
+      CronParseResult cron = cronCompile(fields.text[CFG_CRON], fields.textLength[CFG_CRON], cmd.rule);
+      if (cron != CRON_OK)
+      {
+        Serial.printf("Invalid cron in payload: %s\r\n", cronResultText(cron));
+        return;
+      }
+      if (fields.status[CFG_EVERY_DAYS] == FIELD_OK)
+      {
+        if (fields.value[CFG_EVERY_DAYS] == 0 || fields.value[CFG_EVERY_DAYS] > 365)
+        {
+          Serial.println("Invalid every_days in payload");
+          return;
+        }
+        cmd.rule.everyDays = fields.value[CFG_EVERY_DAYS];
+      }
+      else if (fields.status[CFG_EVERY_DAYS] != FIELD_MISSING)
+      {
+        Serial.println("Invalid every_days in payload");
+        return;
+      }
+    }
+    else if (fields.status[CFG_EVERY_DAYS] != FIELD_MISSING)
+    {
+      Serial.println("every_days needs a cron rule");
+      return;
     }
 
-    return;
+    // a rule takes the place of interval; either way a duration is required
+    bool intervalOk = cmd.rule.active ? fields.status[CFG_INTERVAL] == FIELD_MISSING
+                                      : fields.status[CFG_INTERVAL] == FIELD_OK && fields.value[CFG_INTERVAL] != 0;
+    if (!intervalOk || fields.status[CFG_DURATION] != FIELD_OK || fields.value[CFG_DURATION] == 0 ||
+        (fields.status[CFG_TURN_ON_AT] != FIELD_OK && fields.status[CFG_TURN_ON_AT] != FIELD_MISSING))
+    {
+      Serial.println("Invalid interval/duration/TURN_ON_AT in payload");
+      return;
+    }
+    if ((fields.status[CFG_ZONE] != FIELD_OK && fields.status[CFG_ZONE] != FIELD_MISSING) ||
+        fields.value[CFG_ZONE] >= ZONE_COUNT)
+    {
+      Serial.println("Invalid zone in payload");
+      return;
+    }
+    if (fields.status[CFG_VOLUME_L] == FIELD_OK && fields.value[CFG_VOLUME_L] <= MAX_VOLUME_L)
+    {
+      cmd.volume_ml = fields.value[CFG_VOLUME_L] * 1000UL;
+    }
+    else if (fields.status[CFG_VOLUME_L] != FIELD_MISSING)
+    {
+      Serial.println("Invalid volume_l in payload");
+      return;
+    }
+    cmd.zone = fields.value[CFG_ZONE];
+    cmd.type = CMD_CONFIG;
+    cmd.interval = fields.value[CFG_INTERVAL];
+    cmd.duration = fields.value[CFG_DURATION];
+    cmd.turn_on_at = fields.value[CFG_TURN_ON_AT];
   }
-
   // handle direct control messages
-  if (topic.equals(TOPIC_CONTROL))
+  else if (topic.equals(TOPIC_CONTROL))
   {
-    // payload can be just ON/OFF or JSON like {"output":"ON"}
+    // payload can be just ON/OFF (zone 0) or JSON like {"output":"ON","zone":2}
     char valbuf[16] = {0};
 
     cJSON *root = cJSON_Parse(cstr);
@@ -303,6 +767,17 @@ void messageReceived(String &topic, String &payload)
       {
         strncpy(valbuf, output->valuestring, sizeof(valbuf) - 1);
       }
+      cJSON *zone = cJSON_GetObjectItemCaseSensitive(root, "zone");
+      if (cJSON_IsNumber(zone))
+      {
+        if (zone->valueint < 0 || zone->valueint >= (int)ZONE_COUNT)
+        {
+          Serial.println("Invalid zone in control payload");
+          cJSON_Delete(root);
+          return;
+        }
+        cmd.zone = zone->valueint;
+      }
       cJSON_Delete(root);
     }
 
@@ -318,393 +793,747 @@ void messageReceived(String &topic, String &payload)
 
     if (strcmp(valbuf, "ON") == 0)
     {
-      digitalWrite(RELAY_PIN, HIGH);
-      config.is_on = true;
-      config.off_time = 0;
-      Serial.println("Control: OUTPUT ON");
-      if (client.connected())
-      {
-        client.publish(TOPIC_ACK, "ON");
-      }
-      // persist immediate control change
-      saveSchedule();
+      cmd.type = CMD_OUTPUT_ON;
     }
     else if (strcmp(valbuf, "OFF") == 0)
     {
-      digitalWrite(RELAY_PIN, LOW);
-      config.is_on = false;
-      config.off_time = 0;
-      Serial.println("Control: OUTPUT OFF");
-      if (client.connected())
-      {
-        client.publish(TOPIC_ACK, "OFF");
-      }
-      // persist immediate control change
-      saveSchedule();
+      cmd.type = CMD_OUTPUT_OFF;
     }
     else
     {
       Serial.println("Unknown control value");
+      return;
     }
+  }
+  else
+  {
+    return;
+  }
+
+  if (!commandQueue.push(cmd))
+  {
+    droppedCommands++;
+    Serial.println("Command queue full; dropping command");
+  }
+}
 
+// Acknowledge a /control command: plain ON/OFF for zone 0 as before, JSON naming the zone otherwise
+// (with binary acks every zone gets the map)
+static void publishControlAck(uint8_t zone, const char *status)
+{
+  if (zone == 0 && ACK_ENCODING == PAYLOAD_JSON)
+  {
+    publishOrSpool(TOPIC_ACK, status);
     return;
   }
+  control_ack_payload_t ack;
+  ack.status = status;
+  ack.zone = zone;
+  size_t length = encodeControlAck(telemetryBuf, sizeof(telemetryBuf), ACK_ENCODING, ack);
+  if (length > 0)
+    publishOrSpool(TOPIC_ACK, telemetryBuf, length);
+}
 
-  // Note: Do not use the client in the callback to publish, subscribe or
-  // unsubscribe as it may cause deadlocks when other things arrive while
-  // sending and receiving acknowledgments. Instead, change a global variable,
-  // or push to a queue and handle it in the loop after calling `client.loop()`.
+// Change the local-time offset and move every idle calendar-rule zone to its
+// next slot in the new local time.
+static void setTimezone(int32_t offsetMinutes)
+{
+  if (offsetMinutes * 60 == tzOffsetSeconds)
+    return;
+  tzOffsetSeconds = offsetMinutes * 60;
+  prefs.putInt("tz_off", offsetMinutes);
+  Serial.printf("Timezone offset set to %ld minutes\r\n", (long)offsetMinutes);
+
+  unsigned long now = getCurrentTime();
+  for (uint8_t zone = 0; zone < scheduler.zoneCount(); zone++)
+  {
+    system_config_t &config = scheduler.config(zone);
+    if (!config.rule.active || config.is_on)
+      continue;
+    config.next_on_time = scheduleNextOn(config, now, tzOffsetSeconds);
+    saveSchedule(zone);
+    scheduler.reschedule(zone);
+  }
 }
 
-void setup()
+// Apply one queued command: relay, schedule, NVS and the acknowledgment.
+static void handleCommand(const control_command_t &cmd)
 {
-  // WiFi.mode(WIFI_STA); // explicitly set mode, esp defaults to STA+AP
-  // it is a good practice to make sure your code sets wifi mode how you want it.
+  system_config_t &config = scheduler.config(cmd.zone);
 
-  // put your setup code here, to run once:
-  Serial.begin(115200);
-  Serial.printf("Firmware version: %s\n", FIRMWARE_VERSION);
+  switch (cmd.type)
+  {
+  case CMD_CONFIG:
+  {
+    if (cmd.set_tz)
+      setTimezone(cmd.tz_offset_min);
+    config.volume_ml = cmd.volume_ml;
+    ScheduleAction action = scheduleConfigure(config, cmd.interval, cmd.duration, cmd.rule, cmd.turn_on_at,
+                                              getCurrentTime(), tzOffsetSeconds);
+    if (action != SCHEDULE_NO_ACTION)
+      Serial.printf("Zone %u: scheduled next ON at epoch: %lu\r\n", cmd.zone, config.next_on_time);
+    applyScheduleAction(cmd.zone, action);
 
-  flowSensor.begin(); // initialize flow sensor
-  dht20.begin();
+    /* Publish back to acknowledge reception of config */
+    config_ack_payload_t ack;
+    ack.interval = config.interval;
+    ack.duration = config.duration;
+    ack.turn_on_at = config.next_on_time;
+    ack.zone = cmd.zone;
+    ack.volume_ml = config.volume_ml;
+    size_t length = encodeConfigAck(telemetryBuf, sizeof(telemetryBuf), ACK_ENCODING, ack);
+    if (length > 0)
+      publishOrSpool(TOPIC_ACK, telemetryBuf, length);
+    break;
+  }
 
-  // onboard LED initialization (DoIT ESP32 DevKit usually uses GPIO2)
-  pinMode(LED_BUILTIN, OUTPUT);
+  case CMD_TIMEZONE:
+    setTimezone(cmd.tz_offset_min);
+    break;
 
-  // relay pin setup
-  pinMode(RELAY_PIN, OUTPUT);
-  digitalWrite(RELAY_PIN, LOW);
+  case CMD_OUTPUT_ON:
+    setZoneRelay(cmd.zone, true);
+    recordCommandLatency(cmd.received_us);
+    config.is_on = true;
+    config.off_time = 0;
+    Serial.printf("Control: zone %u OUTPUT ON\r\n", cmd.zone);
+    publishControlAck(cmd.zone, "ON");
+    // persist immediate control change
+    saveSchedule(cmd.zone);
+    break;
+
+  case CMD_OUTPUT_OFF:
+    setZoneRelay(cmd.zone, false);
+    recordCommandLatency(cmd.received_us);
+    config.is_on = false;
+    config.off_time = 0;
+    Serial.printf("Control: zone %u OUTPUT OFF\r\n", cmd.zone);
+    publishControlAck(cmd.zone, "OFF");
+    // persist immediate control change
+    saveSchedule(cmd.zone);
+    break;
+  }
 
-  // start the blink thread before attempting WiFi connection
-  xTaskCreate(blinkTask, "blink", 1024, nullptr, 1, nullptr);
-  
-  // start the OTA update check thread
-  xTaskCreate(otaUpdateTask, "otaUpdate", 4096, nullptr, 1, nullptr);
+  scheduler.reschedule(cmd.zone);
+}
 
-  // --- configuration loading happens before WiFi so schedule can run when offline ---
-  prefs.begin("home_irrigator", false);
-  loadSchedule();
-  // if prefs were empty we now have DEFAULT_CONFIG values, including default turn-on
-  Serial.print("Initial schedule interval ");
-  Serial.print(config.interval);
-  Serial.print("s, duration ");
-  Serial.print(config.duration);
-  Serial.print("s, next_on_time ");
-  Serial.println(config.next_on_time);
-  // perform initial adjustments with whatever time source we have now
-  unsigned long startupNow = getCurrentTime();
-  // if we are using the special default epoch value, convert it to a usable time
-  if (config.next_on_time == DEFAULT_TURN_ON_AT)
+// Fire one due ON/OFF event and queue the zone's next one.
+static void handleZoneEvent(const zone_event_t &event, unsigned long now)
+{
+  uint8_t zone = event.zone;
+  system_config_t &config = scheduler.config(zone);
+
+  if (event.type == ZONE_EVENT_ON)
   {
-    if (startupNow < 100000) // still using uptime (no NTP yet)
-    {
-      config.next_on_time = startupNow + config.interval;
-      Serial.println("Offline startup: applied relative schedule from default");
-    }
-    else if (startupNow > DEFAULT_TURN_ON_AT)
+    // an ON that is far overdue (device was off, clock jumped) is rescheduled, not fired
+    adjustScheduleForMissedOn(zone, now);
+
+    // turn ON when it's time
+    unsigned long due = config.next_on_time;
+    if (scheduleFireOn(config, now, tzOffsetSeconds) == SCHEDULE_RELAY_ON)
     {
-      // once clock is synced and we've already passed the epoch
-      config.next_on_time = startupNow + config.interval;
-      Serial.println("Default epoch passed; rescheduled relative to now");
+      flowBank.resetZoneVolume(zone); // reset volume at the start of each ON cycle
+      setZoneRelay(zone, true);
+      if (config.volume_ml != 0 && !volumeShutoff.start(zone, config.volume_ml))
+        Serial.printf("Zone %u has no flow meter; running for its full duration\r\n", zone);
+      recordScheduleLateness(due);
+      Serial.printf("Zone %u turned ON at epoch: %lu\r\n", zone, now);
+      Serial.print("Scheduled OFF at epoch: ");
+      Serial.println(config.off_time);
+      Serial.print("Next ON scheduled at epoch: ");
+      Serial.println(config.next_on_time);
+      publishAck(zone, "ON");
+      // persist schedule changes
+      saveSchedule(zone);
     }
-    // otherwise leave the default epoch in place and schedule will fire when time catches up
   }
-  // store back any fixes
-  adjustScheduleForMissedOn(startupNow);
-  // enforce relay state if necessary
-  if (config.is_on && config.off_time > 0)
+  else
   {
-    if (startupNow < config.off_time)
-    {
-      digitalWrite(RELAY_PIN, HIGH);
-      Serial.print("Restored relay ON until epoch: ");
-      Serial.println(config.off_time);
-    }
-    else
+    // turn OFF when duration elapsed
+    unsigned long due = config.off_time;
+    if (scheduleFireOff(config, now) == SCHEDULE_RELAY_OFF)
     {
-      digitalWrite(RELAY_PIN, LOW);
-      config.is_on = false;
-      config.off_time = 0;
-      saveSchedule();
+      setZoneRelay(zone, false);
+      recordScheduleLateness(due);
+      Serial.printf("Zone %u turned OFF at epoch: %lu\r\n", zone, now);
+      publishAck(zone, "OFF");
+
+      flowBank.resetZoneVolume(zone); // reset total volume after each OFF cycle
+      flushFlowTotals(); // a cycle's water is never lost to a reboot
+
+      // persist schedule changes
+      saveSchedule(zone);
     }
   }
 
-  // WiFiManager, Local initialization. Once its business is done, there is no need to keep it around
-  WiFiManager wm;
+  scheduler.reschedule(zone);
+}
 
-  // reset settings - wipe stored credentials for testing
-  // these are stored by the esp library
-  // wm.resetSettings();
+// A volume_l cycle reached its target and the interrupt dropped the relay; end
+// the cycle as if its duration had run out
+static void endVolumeRun(uint8_t zone, unsigned long now)
+{
+  system_config_t &config = scheduler.config(zone);
+  if (!config.is_on)
+    return; // turned off another way in the meantime
+  Serial.printf("Zone %u reached its %lu mL target\r\n", zone, config.volume_ml);
+  config.off_time = now;
+  zone_event_t event = {now, 0, zone, ZONE_EVENT_OFF};
+  handleZoneEvent(event, now);
+}
 
-  // Automatically connect using saved credentials,
-  // if connection fails, it starts an access point with the specified name ( "AutoConnectAP"),
-  // if empty will auto generate SSID, if password is blank it will be anonymous AP (wm.autoConnect())
-  // then goes into a blocking loop awaiting configuration and will return success result
+// SNTP set the clock, from the lwIP task; loop() does the work
+static void timeSyncCallback(struct timeval *tv)
+{
+  (void)tv;
+  xEventGroupSetBits(controlEvents, EVT_TIME);
+}
 
-  bool res;
+// The WiFi driver's view of the station, from its event task; loop() does the work
+static void wifiEvent(WiFiEvent_t event)
+{
+  if (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED || event == ARDUINO_EVENT_WIFI_STA_GOT_IP)
+    xEventGroupSetBits(controlEvents, EVT_WIFI);
+}
 
-  // res = wm.autoConnect(); // auto generated AP name from chipid
-  // res = wm.autoConnect("AutoConnectAP"); // anonymous ap
-  res = wm.autoConnect("AutoConnectAP", "password"); // password protected ap
+// The credentials WiFiManager saved, from the driver's stored station config.
+// WiFi.SSID()/psk() describe the current association, so they are empty at boot
+// and during an outage, exactly when a directed connect is wanted. The config's
+// fields need not be NUL-terminated (32-byte SSID, 64-digit PSK). Returns false
+// if there are none.
+static bool storedCredentials(char (&ssid)[33], char (&pass)[65])
+{
+  wifi_config_t cfg;
+  if (esp_wifi_get_config(WIFI_IF_STA, &cfg) != ESP_OK || cfg.sta.ssid[0] == 0)
+    return false;
+  memcpy(ssid, cfg.sta.ssid, sizeof(cfg.sta.ssid));
+  ssid[sizeof(cfg.sta.ssid)] = 0;
+  memcpy(pass, cfg.sta.password, sizeof(cfg.sta.password));
+  pass[sizeof(cfg.sta.password)] = 0;
+  return true;
+}
 
-  if (!res)
+// Start associating with the cached AP on its channel, skipping the scan; with
+// WIFI_STATIC_IP also on the cached lease, skipping DHCP. Returns false if no
+// credentials are stored.
+static bool beginDirected(const wifi_link_t &link)
+{
+  char ssid[33], pass[65];
+  if (!storedCredentials(ssid, pass))
   {
-    Serial.println("Failed to connect");
-    blinkState = STATE_FAILED;
-    // ESP.restart();
+    Serial.println("WiFi: no stored credentials for a directed connect");
+    return false;
   }
-  else
-  {
-    // if you get here you have connected to the WiFi
-    Serial.println("connected...yeey :)");
-    blinkState = STATE_WIFI_CONNECTED;
+  if (WIFI_STATIC_IP && link.ip != 0 && link.gateway != 0 && link.subnet != 0)
+    WiFi.config(IPAddress(link.ip), IPAddress(link.gateway), IPAddress(link.subnet), IPAddress(link.dns));
+  Serial.printf("WiFi: directed connect to %02x:%02x:%02x:%02x:%02x:%02x on channel %u\r\n", link.bssid[0],
+                link.bssid[1], link.bssid[2], link.bssid[3], link.bssid[4], link.bssid[5], link.channel);
+  WiFi.begin(ssid, pass, link.channel, link.bssid);
+  return true;
+}
+
+// Forget the AP lock (and static address) a directed connect set, so the next
+// association scans for any AP with the SSID and asks DHCP for an address
+static void clearDirected()
+{
+  if (WIFI_STATIC_IP)
+    WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0));
+  char ssid[33], pass[65];
+  if (storedCredentials(ssid, pass))
+    WiFi.begin(ssid, pass, 0, nullptr, false);
+}
+
+// Connected: keep the AP and lease for the next boot or outage
+static void rememberWifiLink()
+{
+  const uint8_t *bssid = WiFi.BSSID();
+  if (bssid == nullptr)
+    return;
+  wifi_link_t link = {};
+  memcpy(link.bssid, bssid, sizeof(link.bssid));
+  link.channel = (uint8_t)WiFi.channel();
+  link.ip = (uint32_t)WiFi.localIP();
+  link.gateway = (uint32_t)WiFi.gatewayIP();
+  link.subnet = (uint32_t)WiFi.subnetMask();
+  link.dns = (uint32_t)WiFi.dnsIP();
+  wifiLinks.store(link);
+}
+
+// Open WiFiManager's config portal without waiting on it; serviceWifiPortal() runs it
+static void openWifiPortal()
+{
+  wm.startConfigPortal("AutoConnectAP", "password"); // password protected ap
+  wifiPortalOpened = true;
+  wifiPortal = wm.getConfigPortalActive();
+  blinkState = STATE_FAILED;
+  Serial.println(wifiPortal ? "WiFi: config portal AutoConnectAP open" : "WiFi: config portal did not open");
+}
 
-    // configure NTP (UTC) and wait for system time to be set
-    configTime(0, 0, "pool.ntp.org", "time.nist.gov");
-    Serial.println("Waiting for NTP time sync...");
-    time_t now = time(nullptr);
-    int retry = 0;
-    const int retry_count = 20;
-    while (now < 100000 && retry < retry_count)
+// Bring WiFi back without ever waiting on it: WiFi.reconnect() only starts an
+// attempt, attempts are paced by wifiBackoff on the deadline timer, and the
+// driver's events wake loop() the moment the link drops or returns. Relay
+// deadlines keep being served throughout. The first attempt of an outage goes
+// straight to the cached AP; if that fails, later attempts scan, in case the
+// AP moved channel or another one took over. A boot counts as an outage until
+// its first connection, and opens the config portal at its first retry past
+// WIFI_CONNECT_TIMEOUT_S, as autoConnect() would have, in case the stored
+// credentials are stale. An outage that outlasts WIFI_RECOVERY_TIMEOUT_MS
+// still restarts the system.
+static void serviceWifi()
+{
+  unsigned long nowMs = millis();
+  if (WiFi.status() == WL_CONNECTED)
+  {
+    if (wifiDisconnectStart == 0)
+      return;
+    if (bootWifiMs == 0)
     {
-      Serial.print(".");
-      delay(500);
-      now = time(nullptr);
-      retry++;
+      // the boot's first connection rather than a recovered outage
+      bootWifiMs = max(nowMs, 1UL);
+      wifiFastBoot = wifiDirected;
+      Serial.printf("WiFi up %lu ms after boot%s\r\n", bootWifiMs, wifiDirected ? " (directed)" : "");
     }
-    if (now < 100000)
+    else
     {
-      Serial.println("\nFailed to obtain time");
+      wifiOutages++;
+      wifiLastOutageMs = nowMs - wifiDisconnectStart;
+      wifiLastReconnects = wifiBackoff.failures();
+      Serial.printf("WiFi reconnected after %lu ms and %lu attempt(s)\r\n", (unsigned long)wifiLastOutageMs,
+                    (unsigned long)wifiLastReconnects);
     }
-    else
+    wifiDisconnectStart = 0;
+    wifiBackoff.reset();
+    blinkState = STATE_WIFI_CONNECTED;
+    rememberWifiLink();
+    // the heartbeat reports the outage as soon as the broker is reachable again
+    heartbeatDue = true;
+    // let the connection task retry now rather than at the end of its backoff
+    if (mqttState != MQTT_UP)
+      xTaskNotifyGive(mqttTaskHandle);
+    return;
+  }
+
+  if (wifiDisconnectStart == 0)
+  {
+    Serial.println("WiFi disconnected");
+    wifiDisconnectStart = max(nowMs, 1UL);
+    wifiRetryAt = nowMs;
+    blinkState = STATE_WIFI_CONNECTING;
+  }
+  if (nowMs - wifiDisconnectStart >= WIFI_RECOVERY_TIMEOUT_MS)
+  {
+    Serial.println("WiFi not restored within 10 minutes, restarting system...");
+    flushNvs();
+    delay(100);
+    ESP.restart();
+  }
+  if ((long)(nowMs - wifiRetryAt) >= 0)
+  {
+    if (bootWifiMs == 0 && !wifiPortalOpened && nowMs - wifiDisconnectStart >= WIFI_CONNECT_TIMEOUT_S * 1000UL)
     {
-      Serial.print("Current epoch: ");
-      Serial.println((unsigned long)now);
+      openWifiPortal();
+      return;
     }
-    // after syncing time it's worth re-checking schedule in case the clock jumped
-    unsigned long syncedNow = (unsigned long)now;
-    Serial.println("Re‑adjusting schedule after NTP sync");
-    adjustScheduleForMissedOn(syncedNow);
-    if (config.is_on && config.off_time > 0)
+    wifi_link_t link;
+    bool directed = WIFI_FAST_CONNECT && wifiBackoff.failures() == 0 && wifiLinks.load(link) && beginDirected(link);
+    if (!directed)
     {
-      if (syncedNow < config.off_time)
-      {
-        // leave relay as is
-      }
-      else
+      if (wifiDirected)
       {
-        digitalWrite(RELAY_PIN, LOW);
-        config.is_on = false;
-        config.off_time = 0;
-        saveSchedule();
+        // the cached AP did not take us; at boot it may be gone for good, so scan from now on
+        Serial.println("WiFi: directed connect failed, scanning");
+        if (bootWifiMs == 0)
+          wifiLinks.invalidate();
+        clearDirected();
       }
+      WiFi.reconnect();
     }
+    wifiDirected = directed;
+    uint32_t waitMs = wifiBackoff.fail(esp_random());
+    if (directed)
+      waitMs = max(waitMs, (uint32_t)WIFI_FAST_CONNECT_TIMEOUT_MS);
+    wifiRetryAt = nowMs + waitMs;
+    Serial.printf("WiFi %s attempt %lu, next in %lu ms\r\n", bootWifiMs == 0 ? "connect" : "reconnect",
+                  (unsigned long)wifiBackoff.failures(), (unsigned long)waitMs);
   }
+}
 
-  client.begin("broker.emqx.io", 1883, wifiClient);
-  client.onMessage(messageReceived);
+// Run the config portal openWifiPortal() opened. It only answers its web page and DNS
+// from process(), hence the WIFI_PORTAL_SERVICE_MS wake-ups while it is open.
+// Once it closes, connected with new credentials or timed out, serviceWifi()
+// takes the boot's outage from there: it records the connection, or retries the
+// stored AP on its backoff until WIFI_RECOVERY_TIMEOUT_MS restarts the system.
+static void serviceWifiPortal()
+{
+  wm.process();
+  if (wm.getConfigPortalActive())
+    return;
+  wifiPortal = false;
+  wifiRetryAt = millis();
+  blinkState = STATE_WIFI_CONNECTING;
+  Serial.println(WiFi.status() == WL_CONNECTED ? "WiFi: connected from the config portal"
+                                               : "WiFi: config portal closed, retrying the stored AP");
+  serviceWifi();
+}
 
-  // ensure MQTT is connected before leaving setup (blocks)
-  while (!connectToMqtt())
+// Apply everything messageReceived() queued during the last client.loop().
+static void drainCommands()
+{
+  control_command_t cmd;
+  while (commandQueue.pop(cmd))
+  {
+    handleCommand(cmd);
+  }
+}
+
+void setup()
+{
+  // WiFi.mode(WIFI_STA); // explicitly set mode, esp defaults to STA+AP
+  // it is a good practice to make sure your code sets wifi mode how you want it.
+
+  // put your setup code here, to run once:
+  Serial.begin(115200);
+  Serial.printf("Firmware version: %s\n", FIRMWARE_VERSION);
+
+#ifdef RUN_BENCHMARKS
+  runBenchmarks();
+#endif
+
+  climate.begin();
+  spool.begin();
+
+  // onboard LED initialization (DoIT ESP32 DevKit usually uses GPIO2)
+  pinMode(LED_BUILTIN, OUTPUT);
+
+  // relay pin setup, one per zone
+  for (uint8_t zone = 0; zone < ZONE_COUNT; zone++)
   {
-    delay(1000);
+    pinMode(zoneRelayPins[zone], OUTPUT);
+    digitalWrite(zoneRelayPins[zone], LOW);
   }
+
+  // wake-up plumbing for the event-driven loop
+  controlEvents = xEventGroupCreate();
+  const esp_timer_create_args_t deadlineTimerArgs = {
+      .callback = deadlineTimerCallback,
+      .arg = nullptr,
+      .dispatch_method = ESP_TIMER_TASK,
+      .name = "deadline"};
+  esp_timer_create(&deadlineTimerArgs, &deadlineTimer);
+
+  // start the blink thread before attempting WiFi connection
+  xTaskCreate(blinkTask, "blink", 1024, nullptr, 1, nullptr);
+  
+  // start the OTA update check thread; it sleeps until loop() signals that a check is due
+  xTaskCreate(otaUpdateTask, "otaUpdate", 4096, nullptr, 1, &otaTaskHandle);
+
+  // --- configuration loading happens before WiFi so schedule can run when offline ---
+  prefs.begin("home_irrigator", false);
+  tzOffsetSeconds = prefs.getInt("tz_off", DEFAULT_TZ_OFFSET_MIN) * 60;
+
+  // flow sensors; each lifetime meter continues from its last stored total
+  for (uint8_t i = 0; i < FLOW_SENSOR_COUNT; i++)
+  {
+    int index = flowBank.add(flowSensorPins[i], flowSensorZones[i]);
+    // sensor 0 keeps the key of the single-sensor firmware
+    char prefix[FLOW_TOTALIZER_MAX_PREFIX + 1];
+    if (index == 0)
+      strcpy(prefix, "flowtot");
+    else
+      snprintf(prefix, sizeof(prefix), "flow%u_", index);
+    flowTotalizers[index] = new FlowTotalizer(prefs, prefix);
+    flowBank.sensor(index).restoreLifetimePulses(flowTotalizers[index]->load());
+  }
+  flowBank.begin(); // initialize flow sensors and their accumulator task on this core
+  flow_bank_snapshot_t initialFlow = flowBank.snapshot();
+  for (uint8_t i = 0; i < flowBank.count(); i++)
+    Serial.printf("Flow meter %u on GPIO%u: %llu mL lifetime\r\n", i, flowSensorPins[i],
+                  flowBank.lifetimeMilliliters(initialFlow, i));
+  // a warm reset picks up the wall time the last run marked in RTC memory, plus the
+  // RTC counter's count since; schedules then start from it instead of from uptime
+  uint32_t estimate = systemClock.restore(esp_rtc_get_time_us(), esp_timer_get_time());
+  if (estimate > 0)
+    Serial.printf("Clock restored from RTC memory: epoch %lu (until NTP confirms)\r\n", (unsigned long)estimate);
+
+  // perform initial adjustments with whatever time source we have now
+  unsigned long startupNow = getCurrentTime();
+  for (uint8_t zone = 0; zone < ZONE_COUNT; zone++)
+  {
+    system_config_t config;
+    loadSchedule(zone, config);
+    // if prefs were empty we now have DEFAULT_CONFIG values, including default turn-on
+    Serial.printf("Zone %u initial schedule interval %lus, duration %lus, next_on_time %lu\r\n",
+                  zone, config.interval, config.duration, config.next_on_time);
+    scheduler.addZone(config);
+
+    // store back any fixes and enforce the relay state if the zone is still in its ON window
+    system_config_t &restored = scheduler.config(zone);
+    ScheduleAction action = scheduleRestore(restored, startupNow, DEFAULT_TURN_ON_AT, tzOffsetSeconds);
+    if (action == SCHEDULE_RELAY_ON)
+      Serial.printf("Restored zone %u ON until epoch: %lu\r\n", zone, restored.off_time);
+    applyScheduleAction(zone, action);
+    scheduler.reschedule(zone);
+  }
+
+  // WiFiManager never blocks here: its config portal, if it has to open, returns at
+  // once and loop() runs it next to the schedule
+  wm.setConfigPortalBlocking(false);
+  wm.setConfigPortalTimeout(WIFI_PORTAL_TIMEOUT_S);
+
+  // reset settings - wipe stored credentials for testing
+  // these are stored by the esp library
+  // wm.resetSettings();
+
+  // the boot starts out as an outage: serviceWifi() makes the first attempt in loop()'s
+  // first pass, straight to the cached AP if there is one (no channel scan and, with
+  // WIFI_STATIC_IP, no DHCP). With no credentials stored there is nothing to try, so
+  // the portal opens now.
+  WiFi.mode(WIFI_STA);
+  wifiDisconnectStart = max(millis(), 1UL);
+  wifiRetryAt = millis();
+  blinkState = STATE_WIFI_CONNECTING;
+  char ssid[33], pass[65];
+  if (!storedCredentials(ssid, pass))
+    openWifiPortal();
+
+  // NTP (UTC) runs in the background: nothing waits for it, and the sync callback
+  // wakes loop() to rebase the schedules whenever the first answer arrives
+  sntp_set_time_sync_notification_cb(timeSyncCallback);
+  configTime(0, 0, "pool.ntp.org", "time.nist.gov");
+
+  // from here on a dropped link is brought back by serviceWifi() on its own backoff, not by the driver
+  WiFi.setAutoReconnect(false);
+  WiFi.onEvent(wifiEvent);
+
+  client.begin("broker.emqx.io", 1883, wifiClient);
+  client.onMessage(messageReceived);
+
+  // watch the MQTT socket so loop() wakes as soon as a message arrives
+  xTaskCreate(networkWatchTask, "netWatch", 2048, nullptr, 2, &netWatchTaskHandle);
+
+  // the broker is connected in the background; the schedule does not wait for it
+  xTaskCreate(mqttConnectTask, "mqttConnect", 4096, nullptr, 1, &mqttTaskHandle);
   
   // Initialize last OTA check time
   lastOtaCheckTime = getCurrentTime();
-  
+
+  // arm the first deadline so loop() starts out sleeping on it
+  armDeadlineTimer();
 }
 
 void loop()
 {
-  client.loop();
+  // sleep until a deadline, the MQTT socket or the OTA task needs attention; the timeout
+  // only bounds how long client.loop() may go without running (keepalive)
+  EventBits_t events = xEventGroupWaitBits(controlEvents, EVT_ALL, pdTRUE, pdFALSE,
+                                           MQTT_SERVICE_INTERVAL_MS / portTICK_PERIOD_MS);
 
-  // Check WiFi status
-  if (WiFi.status() != WL_CONNECTED) {
-    if (wifiDisconnectStart == 0) {
-      wifiDisconnectStart = millis();
-    }
-    Serial.println("WiFi disconnected, attempting reconnect...");
-    blinkState = STATE_WIFI_CONNECTING;
-    WiFi.reconnect();
-    // Wait for reconnect, up to 10 seconds
-    int attempts = 0;
-    while (WiFi.status() != WL_CONNECTED && attempts < 20) {
-      vTaskDelay(500 / portTICK_PERIOD_MS);
-      attempts++;
-    }
-    if (WiFi.status() == WL_CONNECTED) {
-      Serial.println("WiFi reconnected!");
-      blinkState = STATE_WIFI_CONNECTED;
-      wifiDisconnectStart = 0;
-      // Attempt MQTT reconnect immediately if it was disconnected
-      if (!client.connected()) {
-        connectToMqtt();
-      }
-    } else {
-      Serial.println("WiFi reconnect failed");
-      blinkState = STATE_FAILED;
-      if (wifiDisconnectStart != 0 && millis() - wifiDisconnectStart >= WIFI_RECOVERY_TIMEOUT_MS) {
-        Serial.println("WiFi not restored within 10 minutes, restarting system...");
-        delay(100);
-        ESP.restart();
-      }
-      vTaskDelay(5000 / portTICK_PERIOD_MS);
-    }
-  } else {
-    wifiDisconnectStart = 0;
+  if (bootReadyMs == 0)
+  {
+    bootReadyMs = max(millis(), 1UL);
+    Serial.printf("Schedule running %lu ms after boot\r\n", bootReadyMs);
   }
 
-  if (!client.connected())
+  // a new session gets a heartbeat straight away, with the boot and reconnect timings
+  if (events & EVT_MQTT_UP)
+    heartbeatDue = true;
+
+  // the session is loop()'s while it is up; once it drops, the connection task takes over
+  if (mqttState == MQTT_UP)
   {
-    // try reconnecting with a short backoff to avoid busy-looping
-    if (!connectToMqtt())
+    client.loop();
+    if (!client.connected())
     {
-      // failed again, blink state already updated; wait before retrying
-      vTaskDelay(5000 / portTICK_PERIOD_MS);
+      Serial.println("MQTT connection lost");
+      mqttState = MQTT_DOWN;
+      xTaskNotifyGive(mqttTaskHandle);
     }
   }
+  drainCommands();
+
+  // tell the socket watcher that pending data has been consumed and which socket to watch
+  mqttSocketFd = mqttState == MQTT_UP ? wifiClient.fd() : -1;
+  if (netWatchTaskHandle != nullptr)
+    xTaskNotifyGive(netWatchTaskHandle);
+
+  // while the config portal is open it owns the radio
+  if (wifiPortal)
+    serviceWifiPortal();
+  else
+    serviceWifi();
+
+  // publish the result of a finished OTA check from this task rather than the OTA task
+  if ((events & EVT_OTA_RESULT) && mqttState == MQTT_UP)
+  {
+    firmware_status_payload_t fw;
+    fw.firmware_version = currentFirmwareVersion;
+    fw.ota_check_result = otaResult;
+    fw.check_timestamp = otaResultTimestamp;
+    size_t length = encodeFirmwareStatus(telemetryBuf, sizeof(telemetryBuf), STATUS_ENCODING, fw);
+    if (length > 0)
+      client.publish("/cardoz/status/firmware", telemetryBuf, (int)length);
+  }
+
+  // an update is about to be installed, and a successful one reboots from the OTA task:
+  // don't leave schedule edits or flow totals in RAM
+  if (events & EVT_OTA_FLUSH)
+  {
+    flushNvs();
+    xTaskNotifyGive(otaTaskHandle);
+  }
+
+  // hand the OTA check to its task once the interval has elapsed
+  if (getCurrentTime() - lastOtaCheckTime >= otaCheckInterval && WiFi.status() == WL_CONNECTED)
+  {
+    lastOtaCheckTime = getCurrentTime();
+    xTaskNotifyGive(otaTaskHandle);
+  }
 
   // Publish a heartbeat message every 30 seconds
   unsigned long nowMillis = millis();
-  if (nowMillis - lastMillis > 30000)
+  if (nowMillis - lastMillis >= HEARTBEAT_INTERVAL_MS || (heartbeatDue && mqttState == MQTT_UP))
   {
     lastMillis = nowMillis;
+    heartbeatDue = false;
     
-    // Create JSON heartbeat payload
-    cJSON *heartbeat = cJSON_CreateObject();
-    cJSON_AddStringToObject(heartbeat, "firmware_version", currentFirmwareVersion);
-    cJSON_AddNumberToObject(heartbeat, "interval_s", config.interval);
-    cJSON_AddNumberToObject(heartbeat, "duration_s", config.duration);
-    // Round out the temperature and humidity values to 1 decimal place for cleaner output
-    cJSON_AddNumberToObject(heartbeat, "temperature_c", round(dht20.getTemperature() * 10) / 10.0);
-    cJSON_AddNumberToObject(heartbeat, "humidity_pct", round(dht20.getHumidity() * 1000) / 10.0);
+    heartbeat_payload_t hb = {};
+    hb.firmware_version = currentFirmwareVersion;
+    // zone 0 keeps the single-relay heartbeat fields; zones reports how many are configured
+    const system_config_t &config = scheduler.config(0);
+    hb.zones = scheduler.zoneCount();
+    hb.interval_s = config.interval;
+    hb.duration_s = config.duration;
+    climate_snapshot_t air = climate.snapshot();
+    hb.has_climate = air.takenAtMs != 0;
+    hb.temperature_c10 = toFixed(air.temperatureC, 1);
+    hb.humidity_pct10 = toFixed(air.humidity * 100, 1);
+    hb.cmd_latency_us = lastCommandLatencyUs;
+    hb.cmd_latency_max_us = maxCommandLatencyUs;
+    hb.dropped_cmds = droppedCommands;
+    hb.sched_late_ms = lastScheduleLatenessMs;
+    hb.sched_late_max_ms = maxScheduleLatenessMs;
+    for (uint8_t zone = 0; zone < scheduler.zoneCount(); zone++)
+    {
+      hb.nvs_commits += zoneStores[zone]->commits();
+      hb.nvs_writes_avoided += zoneStores[zone]->writesAvoided();
+      hb.nvs_commit_us = max(hb.nvs_commit_us, zoneStores[zone]->lastCommitMicros());
+      hb.nvs_commit_max_us = max(hb.nvs_commit_max_us, zoneStores[zone]->maxCommitMicros());
+    }
+    flow_bank_snapshot_t flow = flowBank.snapshot();
+    for (uint8_t i = 0; i < flowBank.count(); i++)
+      hb.flow_total_ml += flowBank.lifetimeMilliliters(flow, i);
+    hb.spool_pending = spool.pending();
+    hb.spool_dropped = spool.dropped();
+    hb.boot_ready_ms = bootReadyMs;
+    hb.first_actuation_ms = firstActuationMs;
+    hb.mqtt_attempts = mqttAttempts;
+    hb.wifi_outages = wifiOutages;
+    hb.wifi_outage_ms = wifiLastOutageMs;
+    hb.wifi_reconnects = wifiLastReconnects;
+    hb.boot_wifi_ms = bootWifiMs;
+    hb.boot_mqtt_ms = bootMqttMs;
+    hb.wifi_fast_boot = wifiFastBoot ? 1 : 0;
   
-    // Convert next_on_time to human readable format (IST)
+    // Convert next_on_time to human readable local time
     char next_on_str[25]; // Buffer for "HH:MM DD-MM" format
-    time_t next_on_time = (time_t)config.next_on_time + 19800; // Add IST offset (UTC+5:30)
+    time_t next_on_time = (time_t)config.next_on_time + tzOffsetSeconds;
     struct tm *timeinfo = localtime(&next_on_time);
     if (timeinfo != NULL) {
       strftime(next_on_str, sizeof(next_on_str), "%H:%M %d-%m", timeinfo);
-      cJSON_AddStringToObject(heartbeat, "next_on_time", next_on_str);
+      hb.next_on_time = next_on_str;
     } else {
       // Fallback to epoch time if conversion fails
-      cJSON_AddNumberToObject(heartbeat, "next_on_time", config.next_on_time);
+      hb.next_on_epoch = config.next_on_time;
     }
     
-    // Convert current_time to human readable format (IST)
+    // Convert current_time to human readable local time
     char current_time_str[25]; // Buffer for "HH:MM DD-MM" format
-    time_t current_time = (time_t)getCurrentTime() + 19800; // Add IST offset (UTC+5:30)
+    time_t current_time = (time_t)getCurrentTime() + tzOffsetSeconds;
     struct tm *current_timeinfo = localtime(&current_time);
     if (current_timeinfo != NULL) {
       strftime(current_time_str, sizeof(current_time_str), "%H:%M %d-%m", current_timeinfo);
-      cJSON_AddStringToObject(heartbeat, "current_time", current_time_str);
+      hb.current_time = current_time_str;
     } else {
       // Fallback to epoch time if conversion fails
-      cJSON_AddNumberToObject(heartbeat, "current_time", getCurrentTime());
+      hb.current_epoch = getCurrentTime();
     }
     
-    char *heartbeat_str = cJSON_PrintUnformatted(heartbeat);
-    client.publish(TOPIC_HEARTBEAT, heartbeat_str);
-    free(heartbeat_str);
-    cJSON_Delete(heartbeat);
+    size_t length = encodeHeartbeat(telemetryBuf, sizeof(telemetryBuf), HEARTBEAT_ENCODING, hb);
+    if (length > 0)
+      publishOrSpool(TOPIC_HEARTBEAT, telemetryBuf, length);
   }
 
-  // scheduling: use current time (epoch or uptime) to control relay based on config
+  // scheduling: fire every zone event whose deadline (epoch or uptime) has been reached
+  if (events & EVT_TIME)
+    handleTimeSync();
   unsigned long now = getCurrentTime();
-
-  // if we have a configuration but next_on_time is not initialized, set it now
-  if (config.interval > 0 && config.next_on_time == 0)
+  // keep the RTC mark current so a reset loses no more than the time it takes
+  systemClock.mark(esp_rtc_get_time_us(), esp_timer_get_time());
+  zone_event_t event;
+  while (scheduler.popDue(now, event))
   {
-    config.next_on_time = now + config.interval;
-    Serial.print("Initialized scheduling, next ON at: ");
-    Serial.println(config.next_on_time);
+    handleZoneEvent(event, now);
   }
+  uint8_t reachedZone;
+  while (volumeShutoff.nextReached(reachedZone))
+    endVolumeRun(reachedZone, now);
 
-  // if now is ahead of next_on_time (e.g., device booted after scheduled ON), adjust
-  adjustScheduleForMissedOn(now);
-
-  // turn ON when it's time
-  if (!config.is_on && config.next_on_time > 0 && now >= config.next_on_time)
+  // the bank's accumulator task detects flow starts and stops; report any since the last wake
+  flow_bank_snapshot_t flow = flowBank.snapshot();
+  for (uint8_t i = 0; i < flow.count; i++)
   {
-    flowSensor.resetVolume(); // reset volume at the start of each ON cycle
-    digitalWrite(RELAY_PIN, HIGH);
-    config.is_on = true;
-    config.off_time = now + config.duration;
-    // reset next_on_time to after this duration + interval
-    config.next_on_time = now + config.interval;
-    Serial.print("Turned ON at epoch: ");
-    Serial.println(now);
-    Serial.print("Scheduled OFF at epoch: ");
-    Serial.println(config.off_time);
-    Serial.print("Next ON scheduled at epoch: ");
-    Serial.println(config.next_on_time);
-    if (client.connected())
-    {
-      // create a JSON payload that includes flowrate, volume, temperature, and humidity at time of turn-off
-      cJSON *ack = cJSON_CreateObject();
-      cJSON_AddStringToObject(ack, "status", "ON");
-      cJSON_AddNumberToObject(ack, "flow_rate_lpm", flowSensor.getFlowRate());
-      cJSON_AddNumberToObject(ack, "total_volume_l", flowSensor.getTotalVolume());
-      // Round out the temperature and humidity values to 1 decimal place for cleaner output
-      cJSON_AddNumberToObject(ack, "temperature_c", round(dht20.getTemperature() * 10) / 10.0);
-      cJSON_AddNumberToObject(ack, "humidity_pct", round(dht20.getHumidity() * 1000) / 10.0);
-
-      char *ack_str = cJSON_PrintUnformatted(ack);
-
-      client.publish(TOPIC_ACK, ack_str);
-      free(ack_str);
-      cJSON_Delete(ack);
-    }
-    // persist schedule changes
-    saveSchedule();
-  }
-
-  // turn OFF when duration elapsed
-  if (config.is_on && config.off_time > 0 && now >= config.off_time)
-  {
-    digitalWrite(RELAY_PIN, LOW);
-    config.is_on = false;
-    config.off_time = 0;
-    Serial.print("Turned OFF at epoch: ");
-    Serial.println(now);
-    if (client.connected())
+    const flow_snapshot_t &sensor = flow.sensors[i];
+    if (sensor.starts != flowStartsSeen[i] || sensor.stops != flowStopsSeen[i])
     {
-      // create a JSON payload that includes flowrate, volume, temperature, and humidity at time of turn-off
-      cJSON *ack = cJSON_CreateObject();
-      cJSON_AddStringToObject(ack, "status", "OFF");
-      cJSON_AddNumberToObject(ack, "flow_rate_lpm", flowSensor.getFlowRate());
-      cJSON_AddNumberToObject(ack, "total_volume_l", flowSensor.getTotalVolume());
-      // Round out the temperature and humidity values to 1 decimal place for cleaner output
-      cJSON_AddNumberToObject(ack, "temperature_c", round(dht20.getTemperature() * 10) / 10.0);
-      cJSON_AddNumberToObject(ack, "humidity_pct", round(dht20.getHumidity() * 1000) / 10.0);
-      char *ack_str = cJSON_PrintUnformatted(ack);
-
-      client.publish(TOPIC_ACK, ack_str);
-      free(ack_str);
-      cJSON_Delete(ack);
+      Serial.printf("Flow %u %s: %.2f L/min\r\n", i, sensor.flowing ? "started" : "stopped", sensor.instantLpm);
+      flowStartsSeen[i] = sensor.starts;
+      flowStopsSeen[i] = sensor.stops;
     }
-
-    flowSensor.resetVolume(); // reset total volume after each OFF cycle
-
-    // persist schedule changes
-    saveSchedule();
   }
 
+  // keep volume targets aimed at the current rate, and learn from finished runs
+  volumeShutoff.service(flow, millis());
+
+  // leak, burst and blocked-line detection against the relay states
+  flowAnomalies.check(flow, scheduler.zoneCount(), openZones, millis());
+  flow_alert_t alert;
+  while (flowAnomalies.nextAlert(alert))
+    publishFlowAlert(alert, now);
 
-  static uint32_t lastPrint = 0;
-  if (millis() - lastPrint > 1000) {
-      Serial.printf("Flow: %.2f L/min | Total: %.2f L\r\n", 
-                    flowSensor.getFlowRate(), 
-                    flowSensor.getTotalVolume());
-      float temperature = dht20.getTemperature();
-      float humidity = dht20.getHumidity();
-      Serial.printf("Temperature: %.1f °C | Humidity: %.1f %%\r\n", temperature, humidity * 100);
+  // flow readout is only interesting while water is running
+  if (openZones != 0 && millis() - lastPrint >= FLOW_PRINT_INTERVAL_MS) {
+      for (uint8_t zone = 0; zone < scheduler.zoneCount(); zone++)
+      {
+        if (!(openZones & (1UL << zone)))
+          continue;
+        Serial.printf("Zone %u flow: %.2f L/min (now %.2f) | Total: %.2f L\r\n", zone,
+                      FlowSensorBank::zoneAverageLpm(flow, zone),
+                      FlowSensorBank::zoneInstantLpm(flow, zone),
+                      FlowSensorBank::zoneMilliliters(flow, zone) / 1000.0f);
+      }
+      climate_snapshot_t air = climate.snapshot();
+      if (air.takenAtMs != 0)
+        Serial.printf("Temperature: %.1f °C | Humidity: %.1f %%\r\n", air.temperatureC, air.humidity * 100);
       lastPrint = millis();
   }
 
-  // main work can go here; blink task runs independently
-  vTaskDelay(1000 / portTICK_PERIOD_MS);
+  // fine-grained readings are kept in RAM and sent in batches
+  telemetry.sample(flowBank, flow, climate.snapshot(), millis());
+  if (telemetry.flushDue(millis()))
+    publishTelemetry();
+
+  // what was logged while offline goes out a burst at a time, between live messages
+  if (mqttState == MQTT_UP)
+    spool.replay(publishReplayed, millis());
+
+  // write out coalesced schedule changes once their window has passed
+  for (uint8_t zone = 0; zone < scheduler.zoneCount(); zone++)
+    zoneStores[zone]->service();
+  for (uint8_t i = 0; i < flow.count; i++)
+    flowTotalizers[i]->service(flow.sensors[i].lifetimePulses);
+
+  // sleep until the earliest pending deadline; blink task runs independently
+  armDeadlineTimer();
 }
 
 // blink task implementation
@@ -793,41 +1622,113 @@ void otaUpdateTask(void *param)
   
   while (true)
   {
-    // Check if it's time to run the OTA update check
+    // loop() notifies this task when the check interval has elapsed and WiFi is connected
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
     unsigned long now = getCurrentTime();
+
+    Serial.println("\n=== OTA Update Check Task ===\r");
+    Serial.printf("Checking %s for firmware updates...\r\n", JSON_URL);
+    Serial.printf("Current firmware version: %s\r\n", currentFirmwareVersion);
+    Serial.printf("Check interval: %lu seconds\r\n", otaCheckInterval);
+    
+    // Perform the OTA check; only install once loop() has flushed what it holds back
+    // from NVS, which it owns. Most checks find nothing and leave NVS alone.
+    ESP32OTAPull ota;
+    int ret = ota.CheckForOTAUpdate(JSON_URL, currentFirmwareVersion, ESP32OTAPull::DONT_DO_UPDATE);
+    if (ret == ESP32OTAPull::UPDATE_AVAILABLE)
+    {
+      xEventGroupSetBits(controlEvents, EVT_OTA_FLUSH);
+      if (ulTaskNotifyTake(pdTRUE, OTA_FLUSH_TIMEOUT_MS / portTICK_PERIOD_MS) == 0)
+        Serial.println("NVS flush timed out, installing anyway");
+      ret = ota.CheckForOTAUpdate(JSON_URL, currentFirmwareVersion);
+    }
+    Serial.printf("CheckForOTAUpdate returned %d (%s)\r\n", ret, errtext(ret));
+    Serial.println("===========================\r\n");
     
-    // Only check if enough time has elapsed and WiFi is connected
-    if ((now - lastOtaCheckTime) >= otaCheckInterval && WiFi.status() == WL_CONNECTED)
-    {
-      lastOtaCheckTime = now;
-      
-      Serial.println("\n=== OTA Update Check Task ===\r");
-      Serial.printf("Checking %s for firmware updates...\r\n", JSON_URL);
-      Serial.printf("Current firmware version: %s\r\n", currentFirmwareVersion);
-      Serial.printf("Check interval: %lu seconds\r\n", otaCheckInterval);
-      
-      // Perform the OTA check
-      ESP32OTAPull ota;
-      int ret = ota.CheckForOTAUpdate(JSON_URL, currentFirmwareVersion);
-      Serial.printf("CheckForOTAUpdate returned %d (%s)\r\n", ret, errtext(ret));
-      Serial.println("===========================\r\n");
-      
-      // Publish status to MQTT if connected
-      if (client.connected())
+    // loop() owns the MQTT client, so hand the status over for publishing
+    otaResult = ret;
+    otaResultTimestamp = now;
+    xEventGroupSetBits(controlEvents, EVT_OTA_RESULT);
+  }
+}
+
+// Watches the MQTT socket and wakes loop() as soon as data arrives, so a /control
+// command is handled within milliseconds instead of at the next poll.
+void networkWatchTask(void *param)
+{
+  (void)param;
+
+  while (true)
+  {
+    int fd = mqttSocketFd;
+    if (fd < 0)
+    {
+      // not connected; loop() notifies after every pass, which refreshes the socket
+      ulTaskNotifyTake(pdTRUE, 1000 / portTICK_PERIOD_MS);
+      continue;
+    }
+
+    fd_set readfds;
+    FD_ZERO(&readfds);
+    FD_SET(fd, &readfds);
+    struct timeval tv = {MQTT_SERVICE_INTERVAL_MS / 1000, 0};
+    if (select(fd + 1, &readfds, nullptr, nullptr, &tv) > 0)
+    {
+      xEventGroupSetBits(controlEvents, EVT_NETWORK);
+      // don't select again until loop() has drained the socket
+      ulTaskNotifyTake(pdTRUE, 1000 / portTICK_PERIOD_MS);
+    }
+  }
+}
+
+// Brings the MQTT session up, and back after it drops, so neither setup() nor
+// loop() ever waits on the broker. Failed attempts back off exponentially with
+// jitter; loop() notifies when it finds the session gone or WiFi back, which
+// also cuts a backoff short.
+void mqttConnectTask(void *param)
+{
+  (void)param;
+
+  while (true)
+  {
+    if (mqttState == MQTT_UP)
+    {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      continue;
+    }
+    if (WiFi.status() != WL_CONNECTED)
+    {
+      mqttState = MQTT_DOWN;
+      ulTaskNotifyTake(pdTRUE, 1000 / portTICK_PERIOD_MS);
+      continue;
+    }
+
+    Serial.println("Connecting to MQTT...");
+    mqttState = MQTT_CONNECTING;
+    blinkState = STATE_MQTT_CONNECTING;
+    mqttAttempts++;
+    if (client.connect("shortstop") && client.subscribe(TOPIC_CONFIG) && client.subscribe(TOPIC_CONTROL))
+    {
+      Serial.printf("MQTT connected after %lu failed attempt(s)\r\n", (unsigned long)mqttBackoff.failures());
+      if (bootMqttMs == 0)
       {
-        String status = "{\"firmware_version\":\"";
-        status += currentFirmwareVersion;
-        status += "\",\"ota_check_result\":";
-        status += String(ret);
-        status += ",\"check_timestamp\":";
-        status += String(now);
-        status += "}";
-        client.publish("/cardoz/status/firmware", status);
+        bootMqttMs = max(millis(), 1UL);
+        Serial.printf("MQTT up %lu ms after boot\r\n", bootMqttMs);
       }
+      mqttBackoff.reset();
+      blinkState = STATE_MQTT_CONNECTED;
+      mqttState = MQTT_UP;
+      // loop() picks up the socket and starts replaying the spool
+      xEventGroupSetBits(controlEvents, EVT_MQTT_UP);
+      continue;
     }
-    
-    // Check every minute if it's time to perform OTA check
-    vTaskDelay(60000 / portTICK_PERIOD_MS);
+
+    client.disconnect();
+    blinkState = STATE_MQTT_FAILED;
+    uint32_t waitMs = mqttBackoff.fail(esp_random());
+    Serial.printf("MQTT connect failed, retrying in %lu ms\r\n", (unsigned long)waitMs);
+    mqttState = MQTT_BACKOFF;
+    ulTaskNotifyTake(pdTRUE, waitMs / portTICK_PERIOD_MS);
   }
 }
 
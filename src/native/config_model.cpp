@@ -0,0 +1,111 @@
+// /config parser model (env:native): ConfigParser on truncated and malformed
+// payloads.
+//
+// A truncated payload is what a client that drops mid-publish, or a hostile
+// one, sends. Every strict prefix of a valid object must come back
+// CONFIG_PARSE_MALFORMED without the parser leaving the buffer, and the whole
+// payload must parse with its fields intact.
+#include <Arduino.h>
+#include <ConfigParser.h>
+#include <string.h>
+#include <vector>
+#include "config_model.h"
+
+static const ConfigParser parser;
+
+// parse from a heap copy with no terminator or slack past the last byte
+static ConfigParseResult parseExact(const char *payload, size_t length, config_fields_t &fields)
+{
+  std::vector<char> copy(payload, payload + length);
+  return parser.parse(copy.data(), copy.size(), fields);
+}
+
+typedef struct
+{
+  const char *payload;
+  ConfigParseResult result;
+  ConfigField field;        // checked when result is CONFIG_PARSE_OK
+  ConfigFieldStatus status;
+  uint32_t value;
+} config_case_t;
+
+static const config_case_t CASES[] = {
+    // unterminated key or string inside a skipped value
+    {"{\"meta\":{\"abc", CONFIG_PARSE_MALFORMED, CFG_INTERVAL, FIELD_MISSING, 0},
+    {"{\"meta\":{\"abc\\", CONFIG_PARSE_MALFORMED, CFG_INTERVAL, FIELD_MISSING, 0},
+    {"{\"meta\":{\"a\":{\"b", CONFIG_PARSE_MALFORMED, CFG_INTERVAL, FIELD_MISSING, 0},
+    {"{\"meta\":[{\"abc", CONFIG_PARSE_MALFORMED, CFG_INTERVAL, FIELD_MISSING, 0},
+    {"{\"meta\":[\"abc", CONFIG_PARSE_MALFORMED, CFG_INTERVAL, FIELD_MISSING, 0},
+    {"{\"interval\":3600,\"meta\":{\"abc", CONFIG_PARSE_MALFORMED, CFG_INTERVAL, FIELD_OK, 3600},
+    {"{\"cron\":\"0 6 * * *", CONFIG_PARSE_MALFORMED, CFG_CRON, FIELD_INVALID, 0},
+    // nesting past the skip depth is refused rather than followed
+    {"{\"m\":[[[[[[[[[1]]]]]]]]],\"interval\":1}", CONFIG_PARSE_MALFORMED, CFG_INTERVAL, FIELD_MISSING, 0},
+    {"{\"m\":[[[[[[[[1]]]]]]]],\"interval\":1}", CONFIG_PARSE_OK, CFG_INTERVAL, FIELD_OK, 1},
+    // escaped keys are skipped, never matched
+    {"{\"a\\\"b\":1,\"interval\":2}", CONFIG_PARSE_OK, CFG_INTERVAL, FIELD_OK, 2},
+    {"{\"inter\\u0076al\":5}", CONFIG_PARSE_OK, CFG_INTERVAL, FIELD_MISSING, 0},
+    {"{\"interval\\", CONFIG_PARSE_MALFORMED, CFG_INTERVAL, FIELD_MISSING, 0},
+    // typed field errors
+    {"{\"xinterval\":1,\"intervals\":2}", CONFIG_PARSE_OK, CFG_INTERVAL, FIELD_MISSING, 0},
+    {"{\"interval\":\"3600\"}", CONFIG_PARSE_OK, CFG_INTERVAL, FIELD_INVALID, 0},
+    {"{\"interval\":4294967296}", CONFIG_PARSE_OK, CFG_INTERVAL, FIELD_OVERFLOW, 0},
+    {"{\"interval\":1,\"interval\":2}", CONFIG_PARSE_OK, CFG_INTERVAL, FIELD_DUPLICATE, 1},
+    {"{\"tz_offset_min\":-60}", CONFIG_PARSE_OK, CFG_TZ_OFFSET_MIN, FIELD_OK, (uint32_t)-60},
+};
+
+// well-formed payloads whose every prefix is fed to the parser
+static const char *const TRUNCATED[] = {
+    "{\"interval\":3600,\"duration\":30}",
+    "{\"TURN_ON_AT\":1708532400,\"interval\":86400,\"duration\":600,\"zone\":1}",
+    "{\"meta\":{\"a\":[1,2,{\"b\":{\"c\":[3,4,\"interval\"]}}]},\"interval\":3600,\"duration\":30}",
+    "{\"note\":\"say \\\"hi\\\" \\\\\",\"list\":[{},[],\"\",{\"k\":null}],\"cron\":\"0 6 * * *\",\"interval\":5}",
+};
+
+int runConfigModel()
+{
+  Serial.println("\n=== Config parser model ===");
+  bool pass = true;
+  config_fields_t fields;
+
+  uint32_t caseFailures = 0;
+  for (const config_case_t &c : CASES)
+  {
+    ConfigParseResult result = parseExact(c.payload, strlen(c.payload), fields);
+    if (result != c.result || fields.status[c.field] != c.status ||
+        (c.status != FIELD_MISSING && fields.value[c.field] != c.value))
+    {
+      Serial.printf("config: unexpected result %d, %s %s for %s\r\n", result, ConfigParser::fieldName(c.field),
+                    ConfigParser::statusText(fields.status[c.field]), c.payload);
+      caseFailures++;
+    }
+  }
+  Serial.printf("config: %u malformed and typed payloads, %u wrong\r\n", (unsigned)(sizeof(CASES) / sizeof(CASES[0])),
+                caseFailures);
+
+  uint32_t prefixes = 0, prefixFailures = 0;
+  for (const char *payload : TRUNCATED)
+  {
+    size_t length = strlen(payload);
+    for (size_t n = 0; n < length; n++, prefixes++)
+    {
+      if (parseExact(payload, n, fields) != CONFIG_PARSE_MALFORMED)
+      {
+        Serial.printf("config: prefix of %u bytes accepted: %.*s\r\n", (unsigned)n, (int)n, payload);
+        prefixFailures++;
+      }
+    }
+    if (parseExact(payload, length, fields) != CONFIG_PARSE_OK || fields.status[CFG_INTERVAL] != FIELD_OK)
+    {
+      Serial.printf("config: full payload rejected: %s\r\n", payload);
+      prefixFailures++;
+    }
+  }
+  Serial.printf("config: %u truncated payloads, %u wrong\r\n", (unsigned)prefixes, prefixFailures);
+
+  if (caseFailures != 0 || prefixFailures != 0)
+    pass = false;
+
+  Serial.printf("result: %s\r\n", pass ? "PASS" : "FAIL");
+  Serial.println("===========================\n");
+  return pass ? 0 : 1;
+}
@@ -0,0 +1,631 @@
+// Drives both WaterFlowSensor backends with one synthetic pulse train on the
+// shim's virtual clock: steady flows from a garden line up to a large-bore
+// main, with sub-filter glitches mixed in, and the valve closing and reopening.
+// PCNT should count only real pulses and take one interrupt per
+// FLOW_PCNT_OVERFLOW_LIMIT of them; the GPIO path takes an interrupt for every
+// edge, glitches included. Both accumulators are stepped every millisecond, so
+// the reported start/stop latencies are the estimator's own, not the poll's
+// (PCNT still reads its counter only every FLOW_UPDATE_INTERVAL_MS); snapshots
+// are read on every step too, which must not disturb the averages.
+// Short runs of a multi-sensor bank then check per-zone attribution, the
+// leak and anomaly detector, volume-targeted shutoff and telemetry batching.
+#include <Arduino.h>
+#include <driver/pcnt.h>
+#include <Preferences.h>
+#include <WaterFlowSensor.h>
+#include <FlowSensorBank.h>
+#include <FlowAnomaly.h>
+#include <VolumeShutoff.h>
+#include <TelemetryRing.h>
+#include <FlowTotalizer.h>
+#include "flow_model.h"
+
+#define MODEL_PCNT_PIN 4
+#define MODEL_GPIO_PIN 5
+#define MODEL_CALIBRATION 7.5f    // YF-S201: F = 7.5 * Q
+#define MODEL_PHASE_SECONDS 600
+#define MODEL_GLITCH_WIDTH_NS 3000 // well under the 12.8 us filter
+#define MODEL_POLL_NS ((uint64_t)1000000)
+#define MODEL_RATE_TOLERANCE 0.05f
+#define MODEL_PRIOR_PULSES 4000000000ULL // lifetime total from earlier boots, past 2^31
+#define MODEL_BANK_SECONDS 30
+#define MODEL_SEGMENT_SECONDS 60
+#define MODEL_ANOMALY_POLL_NS ((uint64_t)10000000)
+#define MODEL_ALERT_SECONDS 10
+#define MODEL_VOLUME_LPM 12.0f
+#define MODEL_VOLUME_ML 10000
+#define MODEL_VOLUME_CYCLES 5
+#define MODEL_VALVE_CLOSE_MS 240
+#define MODEL_VOLUME_TOLERANCE_ML 5 // about two pulses
+#define MODEL_TELEMETRY_RUN_SECONDS 90
+#define MODEL_TELEMETRY_IDLE_SECONDS 60
+
+typedef struct
+{
+  const char *label;
+  float litresPerMinute;
+  uint32_t glitchesPerThousand; // extra sub-filter pulses per 1000 real ones
+} flow_phase_t;
+
+static const flow_phase_t PHASES[] = {
+    {"drip line 5 L/min", 5.0f, 0},
+    {"garden 30 L/min", 30.0f, 20},
+    {"large bore 200 L/min", 200.0f, 10},
+    {"valve closed", 0.0f, 0},
+    {"reopened 5 L/min", 5.0f, 0},
+    {"valve closed", 0.0f, 0},
+};
+
+// what one sensor's estimator did against the true flow
+typedef struct
+{
+  WaterFlowSensor *sensor;
+  uint64_t readNs;            // how far a sample's timestamp can trail its pulse: 0 for the ISR, a read interval for PCNT
+  uint32_t pulsesSinceStart;  // real pulses since the valve last opened
+  bool reportedFlowing;
+  uint32_t worstStartPulses;  // pulses seen before FLOW_STARTED
+  uint32_t startsLate;        // FLOW_STARTED later than two samples
+  uint64_t worstStopNs;       // time from the last pulse to FLOW_STOPPED
+  uint32_t stopsMissed;       // stop bound exceeded or never reported
+  uint32_t spurious;          // transitions the true flow does not explain
+  float instantRate;          // L/min late in the phase
+} estimator_check_t;
+
+static void pollSensor(estimator_check_t &check, bool valveOpen, uint64_t periodNs, uint64_t nowNs,
+                       uint64_t lastPulseNs)
+{
+  FlowTransition transition = check.sensor->update();
+  if (transition == FLOW_STARTED)
+  {
+    if (!valveOpen || check.reportedFlowing)
+      check.spurious++;
+    // two samples: two pulses, plus whatever arrives while the reads that carry them are due
+    if (valveOpen && check.pulsesSinceStart > 2 + 2 * check.readNs / periodNs)
+      check.startsLate++;
+    check.worstStartPulses = max(check.worstStartPulses, check.pulsesSinceStart);
+    check.reportedFlowing = true;
+  }
+  else if (transition == FLOW_STOPPED)
+  {
+    if (valveOpen || !check.reportedFlowing)
+      check.spurious++;
+    check.worstStopNs = max(check.worstStopNs, nowNs - lastPulseNs);
+    check.reportedFlowing = false;
+  }
+}
+
+static void advanceTo(uint64_t ns)
+{
+  uint64_t us = ns / 1000;
+  if (us > shimMicros64())
+    shimAdvanceMicros(us - shimMicros64());
+}
+
+// A bank of two branch meters (zones 0 and 1, PCNT) and a main line (GPIO ISR).
+// Zone 0 runs, then zone 2, which has no meter of its own and so reads the main
+// line; each zone's volume must be exactly its own pulses, and the bank must
+// publish once per pass however many sensors it holds.
+static bool runBankModel()
+{
+  const uint8_t pins[] = {21, 22, 23};
+  // lives for the program, as the firmware's does: its sensors' interrupts stay attached
+  static FlowSensorBank bank;
+  bank.add(pins[0], 0);
+  bank.add(pins[1], 1);
+  bank.add(pins[2], FLOW_BANK_ZONE_ANY, MODEL_CALIBRATION, FLOW_COUNTER_GPIO_ISR);
+  bank.begin(false);
+
+  const struct
+  {
+    uint8_t zone;
+    uint8_t pin; // branch meter the water passes, besides the main line
+    float litresPerMinute;
+  } runs[] = {{0, pins[0], 10.0f}, {2, 0, 20.0f}};
+
+  uint32_t passes = 0, resets = 0;
+  bool pass = true;
+  for (const auto &run : runs)
+  {
+    bank.resetZoneVolume(run.zone);
+    resets++;
+    uint64_t periodNs = (uint64_t)(1e9 / (run.litresPerMinute * MODEL_CALIBRATION));
+    uint64_t nowNs = shimMicros64() * 1000;
+    uint64_t endNs = nowNs + (uint64_t)MODEL_BANK_SECONDS * 1000000000;
+    uint64_t nextPulseNs = nowNs + periodNs;
+    uint64_t nextPollNs = nowNs + MODEL_POLL_NS;
+    uint32_t pulses = 0;
+    float instantLpm = 0;
+    while (nowNs < endNs)
+    {
+      nowNs = min(min(nextPulseNs, nextPollNs), endNs);
+      advanceTo(nowNs);
+      if (nowNs == nextPulseNs)
+      {
+        if (run.pin != 0)
+          shimPulse(run.pin, periodNs / 2);
+        shimPulse(pins[2], periodNs / 2);
+        pulses++;
+        nextPulseNs += periodNs;
+      }
+      if (nowNs == nextPollNs)
+      {
+        bank.update();
+        passes++;
+        instantLpm = FlowSensorBank::zoneInstantLpm(bank.snapshot(), run.zone);
+        nextPollNs += MODEL_POLL_NS;
+      }
+    }
+    bank.update();
+    passes++;
+
+    flow_bank_snapshot_t flow = bank.snapshot();
+    uint32_t exact = (uint32_t)bank.sensor(run.pin != 0 ? 0 : 2).pulsesToMilliliters(pulses);
+    Serial.printf("bank zone %u at %.0f L/min: %u mL (exact %u), now %.2f L/min\r\n", run.zone, run.litresPerMinute,
+                  FlowSensorBank::zoneMilliliters(flow, run.zone), exact, instantLpm);
+    if (FlowSensorBank::zoneMilliliters(flow, run.zone) != exact ||
+        fabsf(instantLpm - run.litresPerMinute) > MODEL_RATE_TOLERANCE * run.litresPerMinute)
+      pass = false;
+  }
+
+  // zone 1 saw no water; zone 0 keeps its branch total, untouched by the main line's reset
+  flow_bank_snapshot_t flow = bank.snapshot();
+  uint32_t zone0 = (uint32_t)bank.sensor(0).pulsesToMilliliters(bank.sensor(0).pulseCount());
+  Serial.printf("bank: zone 0 %u mL, zone 1 %u mL; %u snapshots for %u passes + %u resets\r\n",
+                FlowSensorBank::zoneMilliliters(flow, 0), FlowSensorBank::zoneMilliliters(flow, 1), bank.publishes(),
+                passes + 1, resets);
+  if (FlowSensorBank::zoneMilliliters(flow, 0) != zone0 || FlowSensorBank::zoneMilliliters(flow, 1) != 0 ||
+      bank.publishes() != passes + 1 + resets)
+    pass = false;
+  return pass;
+}
+
+// The leak and anomaly detector on a branch meter (zone 0) and a main line that
+// zone 1 reads: a baseline is learned, the line drains after OFF, then a leak
+// on the main line, a burst on zone 0 and a blocked zone 1 must each raise
+// exactly their alert within MODEL_ALERT_SECONDS, and nothing else may.
+static bool runAnomalyModel()
+{
+  const uint8_t branchPin = 25, mainPin = 26;
+  static FlowSensorBank bank;
+  bank.add(branchPin, 0);
+  bank.add(mainPin, FLOW_BANK_ZONE_ANY);
+  bank.begin(false);
+  FlowAnomalyDetector detector;
+
+  const struct
+  {
+    const char *label;
+    uint32_t openZones;
+    bool branch;           // water passes the zone 0 meter as well as the main line
+    float litresPerMinute;
+    uint32_t flowSeconds;  // water runs for this long, then stops
+    int alert;             // FlowAlertType expected, -1 for none
+    uint8_t zone;
+  } segments[] = {
+      {"zone 0 learns 10 L/min", 1, true, 10.0f, 60, -1, 0},
+      {"zone 0 off, line drains", 0, true, 10.0f, 2, -1, 0},
+      {"main line leak 0.5 L/min", 0, false, 0.5f, 60, FLOW_ALERT_LEAK, FLOW_BANK_ZONE_ANY},
+      {"zone 0 steady again", 1, true, 10.0f, 60, -1, 0},
+      {"zone 0 bursts to 25 L/min", 1, true, 25.0f, 60, FLOW_ALERT_BURST, 0},
+      {"zone 1 opens, no water", 2, false, 0.0f, 0, FLOW_ALERT_BLOCKED, 1},
+  };
+
+  bool pass = true;
+  for (const auto &segment : segments)
+  {
+    uint64_t startNs = shimMicros64() * 1000;
+    uint64_t endNs = startNs + (uint64_t)MODEL_SEGMENT_SECONDS * 1000000000;
+    uint64_t flowEndNs = startNs + (uint64_t)segment.flowSeconds * 1000000000;
+    uint64_t periodNs = segment.litresPerMinute > 0 ? (uint64_t)(1e9 / (segment.litresPerMinute * MODEL_CALIBRATION)) : 0;
+    uint64_t nextPulseNs = periodNs > 0 ? startNs + periodNs : UINT64_MAX;
+    uint64_t nextPollNs = startNs + MODEL_ANOMALY_POLL_NS;
+    uint64_t nowNs = startNs;
+    uint32_t alerts = 0;
+    uint64_t latencyNs = 0;
+    bool wrong = false;
+    while (nowNs < endNs)
+    {
+      nowNs = min(min(nextPulseNs, nextPollNs), endNs);
+      advanceTo(nowNs);
+      if (nowNs == nextPulseNs)
+      {
+        if (segment.branch)
+          shimPulse(branchPin, periodNs / 2);
+        shimPulse(mainPin, periodNs / 2);
+        nextPulseNs = nowNs + periodNs < flowEndNs ? nowNs + periodNs : UINT64_MAX;
+      }
+      if (nowNs == nextPollNs)
+      {
+        bank.update();
+        detector.check(bank.snapshot(), 2, segment.openZones, millis());
+        flow_alert_t alert;
+        while (detector.nextAlert(alert))
+        {
+          if (alerts++ == 0)
+            latencyNs = nowNs - startNs;
+          wrong = wrong || (int)alert.type != segment.alert || alert.zone != segment.zone;
+        }
+        nextPollNs += MODEL_ANOMALY_POLL_NS;
+      }
+    }
+
+    bool expected = segment.alert < 0 ? alerts == 0
+                                      : alerts == 1 && !wrong && latencyNs <= (uint64_t)MODEL_ALERT_SECONDS * 1000000000;
+    Serial.printf("%-26s %-8s %u alert(s), first after %.1f s, zone 0 baseline %.2f L/min%s\r\n", segment.label,
+                  segment.alert < 0 ? "none" : flowAlertName((FlowAlertType)segment.alert), alerts, latencyNs / 1e9,
+                  detector.baselineLpm(0), expected ? "" : "  <-- WRONG");
+    pass = pass && expected;
+  }
+  return pass;
+}
+
+// the relay handler VolumeShutoff calls from the counting interrupt: the model's valve starts closing
+static uint64_t volumeShutoffNs[2];
+static uint32_t volumeShutoffPulses[2];
+static WaterFlowSensor *volumeSensors[2];
+
+static void modelVolumeShutoff(uint8_t zone)
+{
+  volumeShutoffNs[zone] = shimMicros64() * 1000;
+  volumeShutoffPulses[zone] = volumeSensors[zone]->pulseCount();
+}
+
+// Volume-targeted cycles on a PCNT meter (zone 0) and a GPIO-interrupt meter
+// (zone 1) whose valves take MODEL_VALVE_CLOSE_MS to shut: the shutoff must
+// come from the interrupt on the aimed pulse itself, and as the close time is
+// learned the delivered volume must settle on the target.
+static bool runVolumeModel()
+{
+  static FlowSensorBank bank;
+  bank.add(27, 0);
+  bank.add(32, 1, MODEL_CALIBRATION, FLOW_COUNTER_GPIO_ISR);
+  bank.begin(false);
+  volumeSensors[0] = &bank.sensor(0);
+  volumeSensors[1] = &bank.sensor(1);
+  static VolumeShutoff shutoff(bank, modelVolumeShutoff);
+
+  const uint8_t pins[2] = {27, 32};
+  uint64_t periodNs = (uint64_t)(1e9 / (MODEL_VOLUME_LPM * MODEL_CALIBRATION));
+  bool pass = true;
+  for (uint8_t zone = 0; zone < 2; zone++)
+  {
+    int32_t firstError = 0, lastError = 0;
+    bool exact = true;
+    for (int cycle = 0; cycle < MODEL_VOLUME_CYCLES; cycle++)
+    {
+      volumeShutoffNs[zone] = 0;
+      shutoff.start(zone, MODEL_VOLUME_ML);
+      uint64_t nowNs = shimMicros64() * 1000;
+      uint64_t nextPulseNs = nowNs + periodNs;
+      uint64_t nextPollNs = nowNs + MODEL_ANOMALY_POLL_NS;
+      uint64_t settledNs = UINT64_MAX;
+      while (nowNs < settledNs)
+      {
+        nowNs = min(nextPulseNs, nextPollNs);
+        advanceTo(nowNs);
+        if (nowNs == nextPulseNs)
+        {
+          // water runs until the valve has finished closing
+          bool closed = volumeShutoffNs[zone] != 0 &&
+                        nowNs >= volumeShutoffNs[zone] + (uint64_t)MODEL_VALVE_CLOSE_MS * 1000000;
+          if (!closed)
+          {
+            uint32_t before = bank.sensor(zone).pulseCount();
+            shimPulse(pins[zone], periodNs / 2);
+            // the interrupt of the very pulse that reached the target must have dropped the relay
+            if (volumeShutoffNs[zone] == nowNs && volumeShutoffPulses[zone] != before + 1)
+              exact = false;
+          }
+          nextPulseNs += periodNs;
+        }
+        if (nowNs == nextPollNs)
+        {
+          bank.update();
+          shutoff.service(bank.snapshot(), millis());
+          uint8_t reached;
+          while (shutoff.nextReached(reached))
+            settledNs = nowNs + (uint64_t)(VOLUME_SETTLE_MS + 100) * 1000000;
+          nextPollNs += MODEL_ANOMALY_POLL_NS;
+        }
+      }
+      if (volumeShutoffNs[zone] == 0)
+        exact = false;
+      int32_t error = (int32_t)shutoff.deliveredMilliliters(zone) - MODEL_VOLUME_ML;
+      if (cycle == 0)
+        firstError = error;
+      lastError = error;
+    }
+    Serial.printf("volume %s: %u mL target, first cycle %+d mL, cycle %d %+d mL; valve close learned %u ms "
+                  "(true %u), shutoff on the target pulse: %s\r\n",
+                  zone == 0 ? "PCNT" : "GPIO ISR", MODEL_VOLUME_ML, firstError, MODEL_VOLUME_CYCLES, lastError,
+                  shutoff.closeMs(zone), MODEL_VALVE_CLOSE_MS, exact ? "yes" : "NO");
+    if (!exact || abs(lastError) > MODEL_VOLUME_TOLERANCE_ML)
+      pass = false;
+  }
+  return pass;
+}
+
+// A meter running for MODEL_TELEMETRY_RUN_SECONDS then idle, with a DHT20
+// reading every 2 s, sampled into a TelemetryRing and flushed through a small
+// buffer: every record must go out exactly once, in fewer messages than
+// records, and the last flow row must carry the meter's final total.
+static bool runTelemetryModel()
+{
+  static FlowSensorBank bank;
+  bank.add(33, 0);
+  bank.begin(false);
+  static TelemetryRing ring(1000, 10000, 30000);
+
+  uint64_t periodNs = (uint64_t)(1e9 / (10.0f * MODEL_CALIBRATION));
+  uint64_t nowNs = shimMicros64() * 1000;
+  uint64_t stopNs = nowNs + (uint64_t)MODEL_TELEMETRY_RUN_SECONDS * 1000000000;
+  uint64_t endNs = stopNs + (uint64_t)MODEL_TELEMETRY_IDLE_SECONDS * 1000000000;
+  uint64_t nextPulseNs = nowNs + periodNs;
+  uint64_t nextPollNs = nowNs + MODEL_ANOMALY_POLL_NS;
+  climate_snapshot_t climate = {};
+  char batch[512];
+  uint32_t batches = 0, flowRows = 0, climateRows = 0, sent = 0;
+  size_t longest = 0;
+  uint32_t lastTotalMl = 0;
+  bool pass = true;
+  auto flush = [&]()
+  {
+    while (ring.size() > 0)
+    {
+      size_t count;
+      const char *json = ring.formatBatch(batch, sizeof(batch), millis(), 0, count);
+      if (json == nullptr || count == 0)
+      {
+        pass = false;
+        return;
+      }
+      for (size_t i = 0; i < count; i++)
+      {
+        const telemetry_record_t &record = ring.at(i);
+        if (record.kind == TELEMETRY_FLOW)
+        {
+          flowRows++;
+          lastTotalMl = (uint32_t)record.b;
+        }
+        else
+          climateRows++;
+      }
+      for (const char *row = strstr(json, "[["); row != nullptr; row = strstr(row + 1, ",["))
+        sent++;
+      longest = max(longest, strlen(json));
+      batches++;
+      ring.consume(count, millis());
+    }
+  };
+  while (nowNs < endNs)
+  {
+    nowNs = min(nextPollNs, nextPulseNs < stopNs ? nextPulseNs : UINT64_MAX);
+    advanceTo(nowNs);
+    if (nowNs == nextPulseNs)
+    {
+      shimPulse(33, periodNs / 2);
+      nextPulseNs += periodNs;
+      continue;
+    }
+    nextPollNs += MODEL_ANOMALY_POLL_NS;
+    bank.update();
+    if (millis() - climate.takenAtMs >= 2000)
+    {
+      climate.temperatureC = 24.5f;
+      climate.humidity = 0.612f;
+      climate.takenAtMs = millis();
+    }
+    flow_bank_snapshot_t flow = bank.snapshot();
+    ring.sample(bank, flow, climate, millis());
+    if (ring.flushDue(millis()))
+      flush();
+  }
+  flush(); // whatever the last interval left
+
+  uint32_t exactMl = (uint32_t)bank.lifetimeMilliliters(bank.snapshot(), 0);
+  Serial.printf("telemetry: %u flow + %u climate rows in %u batches (longest %u bytes), last flow row %u mL "
+                "(meter %u), %u dropped\r\n",
+                flowRows, climateRows, batches, (unsigned)longest, lastTotalMl, exactMl, ring.dropped());
+  // one flow row per second of running plus the stop, one climate row per 10 s
+  if (flowRows < MODEL_TELEMETRY_RUN_SECONDS || flowRows > MODEL_TELEMETRY_RUN_SECONDS + 2 ||
+      climateRows < (MODEL_TELEMETRY_RUN_SECONDS + MODEL_TELEMETRY_IDLE_SECONDS) / 10 - 1 ||
+      sent != flowRows + climateRows || batches >= sent || lastTotalMl != exactMl || ring.dropped() != 0 ||
+      ring.size() != 0)
+    pass = false;
+  return pass;
+}
+
+int runFlowModel()
+{
+  WaterFlowSensor pcntSensor(MODEL_PCNT_PIN, MODEL_CALIBRATION, FLOW_COUNTER_PCNT);
+  WaterFlowSensor gpioSensor(MODEL_GPIO_PIN, MODEL_CALIBRATION, FLOW_COUNTER_GPIO_ISR);
+  // a meter that has run before: its total comes back through a fresh totalizer, as after a reboot
+  Preferences prefs;
+  prefs.begin("flowmodel");
+  prefs.clear();
+  FlowTotalizer(prefs).flush(MODEL_PRIOR_PULSES);
+  FlowTotalizer totalizer(prefs);
+  pcntSensor.restoreLifetimePulses(totalizer.load());
+
+  // no scheduler on the host: this loop stands in for the accumulator tasks
+  pcntSensor.begin(false);
+  gpioSensor.begin(false);
+
+  Serial.println("\n=== Flow counter model ===");
+  Serial.printf("PCNT sensor backend: %s\r\n", pcntSensor.backend() == FLOW_COUNTER_PCNT ? "PCNT" : "GPIO ISR (fallback)");
+  Serial.printf("%-22s %8s %8s %8s %8s %8s %10s %10s\r\n", "phase", "true", "PCNT", "GPIO", "PCNT now", "GPIO now",
+                "PCNT isr/s", "GPIO isr/s");
+
+  estimator_check_t checks[2] = {};
+  checks[0].sensor = &pcntSensor;
+  checks[0].readNs = (uint64_t)FLOW_UPDATE_INTERVAL_MS * 1000000;
+  checks[1].sensor = &gpioSensor;
+  checks[1].readNs = 0;
+
+  uint32_t truePulses = 0;
+  uint32_t resetPulses = 0;
+  uint32_t glitches = 0;
+  uint32_t pcntIsrs = 0;
+  uint32_t gpioIsrs = 0;
+  uint64_t nowNs = shimMicros64() * 1000;
+  uint64_t lastPulseNs = 0;
+  uint64_t lastPeriodNs = 0;
+  bool pass = true;
+
+  for (size_t p = 0; p < sizeof(PHASES) / sizeof(PHASES[0]); p++)
+  {
+    const flow_phase_t &phase = PHASES[p];
+    double hz = phase.litresPerMinute * MODEL_CALIBRATION;
+    uint64_t periodNs = hz > 0 ? (uint64_t)(1e9 / hz) : 0;
+    bool valveOpen = periodNs > 0;
+    uint32_t phasePcntIsrs = 0, phaseGpioIsrs = 0;
+    float pcntRate = 0, gpioRate = 0;
+
+    if (valveOpen && lastPeriodNs == 0)
+    {
+      // the firmware restarts the volume at each ON; it must read 0 straight away
+      for (estimator_check_t &check : checks)
+      {
+        check.pulsesSinceStart = 0;
+        check.sensor->resetVolume();
+        if (check.sensor->snapshot().totalMilliliters != 0)
+          pass = false;
+      }
+      resetPulses = truePulses;
+    }
+
+    uint64_t phaseEndNs = nowNs + (uint64_t)MODEL_PHASE_SECONDS * (uint64_t)1000000000;
+    uint64_t nextPulseNs = valveOpen ? nowNs + periodNs : UINT64_MAX;
+    uint64_t nextPollNs = nowNs + MODEL_POLL_NS;
+    uint64_t nextSecondNs = nowNs + (uint64_t)1000000000;
+    while (nowNs < phaseEndNs)
+    {
+      nowNs = min(min(nextPulseNs, nextPollNs), min(nextSecondNs, phaseEndNs));
+      advanceTo(nowNs);
+
+      if (nowNs == nextPulseNs)
+      {
+        truePulses++;
+        for (estimator_check_t &check : checks)
+          check.pulsesSinceStart++;
+        uint32_t before = shimInterruptCount();
+        shimPulse(MODEL_PCNT_PIN, periodNs / 2);
+        phasePcntIsrs += shimInterruptCount() - before;
+        before = shimInterruptCount();
+        shimPulse(MODEL_GPIO_PIN, periodNs / 2);
+        phaseGpioIsrs += shimInterruptCount() - before;
+
+        if (phase.glitchesPerThousand > 0 && truePulses % 1000 < phase.glitchesPerThousand)
+        {
+          glitches++;
+          before = shimInterruptCount();
+          shimPulse(MODEL_PCNT_PIN, MODEL_GLITCH_WIDTH_NS);
+          phasePcntIsrs += shimInterruptCount() - before;
+          before = shimInterruptCount();
+          shimPulse(MODEL_GPIO_PIN, MODEL_GLITCH_WIDTH_NS);
+          phaseGpioIsrs += shimInterruptCount() - before;
+        }
+        lastPulseNs = nowNs;
+        nextPulseNs += periodNs;
+      }
+      if (nowNs == nextPollNs)
+      {
+        for (estimator_check_t &check : checks)
+        {
+          pollSensor(check, valveOpen, periodNs, nowNs, lastPulseNs);
+          check.sensor->snapshot(); // an extra reader, as the acks are
+        }
+        nextPollNs += MODEL_POLL_NS;
+      }
+      if (nowNs == nextSecondNs)
+      {
+        pcntRate = pcntSensor.getFlowRate();
+        gpioRate = gpioSensor.getFlowRate();
+        for (estimator_check_t &check : checks)
+          check.instantRate = check.sensor->snapshot().instantLpm;
+        totalizer.service(pcntSensor.snapshot().lifetimePulses);
+        nextSecondNs += (uint64_t)1000000000;
+      }
+    }
+
+    // a stop must show within FLOW_STOP_INTERVALS sample periods of the last sample; a PCNT read
+    // sees the last pulse up to one interval late, and consecutive reads that moved are at most a
+    // pulse period and an interval apart
+    if (!valveOpen && lastPeriodNs > 0)
+    {
+      for (estimator_check_t &check : checks)
+      {
+        uint64_t boundNs = max((uint64_t)FLOW_STOP_INTERVALS * (lastPeriodNs + check.readNs),
+                               (uint64_t)FLOW_MIN_STOP_MS * 1000000) + check.readNs + MODEL_POLL_NS;
+        if (check.reportedFlowing || check.worstStopNs > boundNs)
+          check.stopsMissed++;
+      }
+    }
+    for (estimator_check_t &check : checks)
+    {
+      // the GPIO path sees glitches as pulses, so only clean phases hold it to the true rate
+      if (check.readNs == 0 && phase.glitchesPerThousand > 0)
+        continue;
+      float tolerance = MODEL_RATE_TOLERANCE * max(phase.litresPerMinute, 1.0f);
+      if (fabsf(check.instantRate - phase.litresPerMinute) > tolerance ||
+          fabsf(check.sensor->getFlowRate() - phase.litresPerMinute) > tolerance)
+        pass = false;
+    }
+    lastPeriodNs = periodNs;
+
+    pcntIsrs += phasePcntIsrs;
+    gpioIsrs += phaseGpioIsrs;
+    Serial.printf("%-22s %8.2f %8.2f %8.2f %8.2f %8.2f %10.1f %10.1f\r\n", phase.label, phase.litresPerMinute, pcntRate,
+                  gpioRate, checks[0].instantRate, checks[1].instantRate, (double)phasePcntIsrs / MODEL_PHASE_SECONDS,
+                  (double)phaseGpioIsrs / MODEL_PHASE_SECONDS);
+  }
+
+  uint32_t pcntCount = pcntSensor.pulseCount();
+  uint32_t gpioCount = gpioSensor.pulseCount();
+  Serial.printf("pulses: %u real + %u glitches; PCNT counted %u, GPIO ISR counted %u\r\n",
+                truePulses, glitches, pcntCount, gpioCount);
+  float trueVolume = (truePulses - resetPulses) / (MODEL_CALIBRATION * 60);
+  Serial.printf("volume since last reset: true %.2f L, PCNT %.2f L, GPIO ISR %.2f L\r\n", trueVolume,
+                pcntSensor.getTotalVolume(), gpioSensor.getTotalVolume());
+  if (fabsf(pcntSensor.getTotalVolume() - trueVolume) > 0.01f)
+    pass = false;
+  Serial.printf("interrupts: PCNT %u, GPIO ISR %u\r\n", pcntIsrs, gpioIsrs);
+
+  // lifetime meter: exact integer volume, persisted, and a torn last write falls back to the one before
+  uint64_t lifetime = MODEL_PRIOR_PULSES + truePulses;
+  uint64_t beforeFlush = totalizer.saved();
+  uint32_t writes = totalizer.writes();
+  totalizer.flush(pcntSensor.snapshot().lifetimePulses);
+  uint64_t reloaded = FlowTotalizer(prefs).load();
+  char newestKey[16];
+  snprintf(newestKey, sizeof(newestKey), "flowtot%u", (unsigned)((1 + writes + 1) % FLOW_TOTALIZER_SLOTS));
+  prefs.putBytes(newestKey, "torn", 4);
+  uint64_t afterTear = FlowTotalizer(prefs).load();
+  Serial.printf("lifetime: %llu pulses = %llu mL (exact %llu); %u NVS writes, reload %s, torn write recovers %s\r\n",
+                (unsigned long long)pcntSensor.snapshot().lifetimePulses,
+                (unsigned long long)pcntSensor.lifetimeMilliliters(),
+                (unsigned long long)(lifetime * 1000 * 1000 / (uint64_t)(MODEL_CALIBRATION * 60000)), writes + 1,
+                reloaded == lifetime ? "ok" : "WRONG", afterTear == beforeFlush ? "ok" : "WRONG");
+  if (pcntSensor.snapshot().lifetimePulses != lifetime ||
+      pcntSensor.lifetimeMilliliters() != lifetime * 1000 * 1000 / (uint64_t)(MODEL_CALIBRATION * 60000) ||
+      reloaded != lifetime || afterTear != beforeFlush)
+    pass = false;
+  const char *names[2] = {"PCNT", "GPIO ISR"};
+  for (int i = 0; i < 2; i++)
+  {
+    const estimator_check_t &check = checks[i];
+    Serial.printf("%s estimator: start after %u pulses, stop %.1f ms after the last pulse, %u late starts, "
+                  "%u missed stops, %u spurious, %u timestamps dropped\r\n",
+                  names[i], check.worstStartPulses, check.worstStopNs / 1e6, check.startsLate, check.stopsMissed,
+                  check.spurious, check.sensor->samplesDropped());
+    if (check.startsLate > 0 || check.stopsMissed > 0 || check.spurious > 0 || check.sensor->samplesDropped() > 0)
+      pass = false;
+  }
+
+  pass = runBankModel() && runAnomalyModel() && runVolumeModel() && runTelemetryModel() && pass && pcntSensor.backend() == FLOW_COUNTER_PCNT && pcntCount == truePulses &&
+         pcntIsrs == truePulses / FLOW_PCNT_OVERFLOW_LIMIT && gpioCount == truePulses + glitches &&
+         gpioIsrs == truePulses + glitches;
+  Serial.printf("result: %s\r\n", pass ? "PASS" : "FAIL");
+  Serial.println("==========================\n");
+  return pass ? 0 : 1;
+}
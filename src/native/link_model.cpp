@@ -0,0 +1,93 @@
+// Reconnect policy model (env:native): Backoff over simulated milliseconds.
+//
+// LINK_MODEL_DEVICES devices lose the broker at t = 0 and it comes back at
+// LINK_MODEL_OUTAGE_MS. Each failed attempt waits what Backoff hands out; the
+// first attempt after the broker is back succeeds. The same outage is then
+// replayed with the jitter forced to zero, which is what a fixed retry
+// schedule does to a fleet.
+#include <Arduino.h>
+#include <Backoff.h>
+#include <vector>
+#include "link_model.h"
+
+#define LINK_MODEL_DEVICES 200
+#define LINK_MODEL_OUTAGE_MS (10UL * 60UL * 1000UL)
+#define LINK_MODEL_BASE_MS 1000
+#define LINK_MODEL_MAX_MS 60000
+#define LINK_MODEL_SEED 0x9E3779B9u
+
+static uint32_t randomState = LINK_MODEL_SEED;
+
+static uint32_t nextRandom()
+{
+  // xorshift32
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 17;
+  randomState ^= randomState << 5;
+  return randomState;
+}
+
+typedef struct
+{
+  uint32_t attempts;        // across the fleet
+  uint32_t busiestSecond;   // most reconnects that landed in one second
+  uint32_t latestMs;        // last device back, after the broker
+  bool waitsInWindow;       // every wait within [window / 2, window]
+} outage_result_t;
+
+static outage_result_t runOutage(bool jitter)
+{
+  outage_result_t result = {0, 0, 0, true};
+  std::vector<uint32_t> perSecond(LINK_MODEL_MAX_MS / 1000 + 2, 0);
+
+  for (uint32_t device = 0; device < LINK_MODEL_DEVICES; device++)
+  {
+    Backoff backoff(LINK_MODEL_BASE_MS, LINK_MODEL_MAX_MS);
+    uint32_t t = 0;
+    for (;;)
+    {
+      result.attempts++;
+      if (t >= LINK_MODEL_OUTAGE_MS)
+        break;
+      uint32_t window = backoff.window();
+      uint32_t waitMs = backoff.fail(jitter ? nextRandom() : 0);
+      if (waitMs < window / 2 || waitMs > window)
+        result.waitsInWindow = false;
+      t += waitMs;
+    }
+    backoff.reset();
+    if (backoff.window() != LINK_MODEL_BASE_MS)
+      result.waitsInWindow = false;
+
+    uint32_t lateMs = t - LINK_MODEL_OUTAGE_MS;
+    result.latestMs = max(result.latestMs, lateMs);
+    uint32_t second = min<uint32_t>(lateMs / 1000, perSecond.size() - 1);
+    result.busiestSecond = max(result.busiestSecond, ++perSecond[second]);
+  }
+  return result;
+}
+
+int runLinkModel()
+{
+  Serial.println("\n=== Reconnect model ===");
+  bool pass = true;
+
+  outage_result_t jittered = runOutage(true);
+  outage_result_t fixed = runOutage(false);
+  Serial.printf("link: %u devices, broker down %lu s, backoff %u ms doubling to %u ms\r\n", LINK_MODEL_DEVICES,
+                LINK_MODEL_OUTAGE_MS / 1000, LINK_MODEL_BASE_MS, LINK_MODEL_MAX_MS);
+  Serial.printf("link: jittered %.1f attempts/device, all back %lu ms after the broker, busiest second %u devices\r\n",
+                (double)jittered.attempts / LINK_MODEL_DEVICES, (unsigned long)jittered.latestMs,
+                jittered.busiestSecond);
+  Serial.printf("link: no jitter %.1f attempts/device, all back %lu ms after the broker, busiest second %u devices\r\n",
+                (double)fixed.attempts / LINK_MODEL_DEVICES, (unsigned long)fixed.latestMs, fixed.busiestSecond);
+
+  // the jittered fleet must be spread out; a fixed schedule brings everyone back at once
+  if (!jittered.waitsInWindow || jittered.latestMs > LINK_MODEL_MAX_MS ||
+      jittered.busiestSecond > LINK_MODEL_DEVICES / 10 || fixed.busiestSecond != LINK_MODEL_DEVICES)
+    pass = false;
+
+  Serial.printf("result: %s\r\n", pass ? "PASS" : "FAIL");
+  Serial.println("=======================\n");
+  return pass ? 0 : 1;
+}
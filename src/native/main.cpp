@@ -0,0 +1,20 @@
+// Host entry point for env:native. The firmware's libraries are built against
+// lib/NativeShim instead of the ESP32 core, so this runs on any Linux/macOS box.
+#include <Arduino.h>
+#include "benchmarks.h"
+#include "config_model.h"
+#include "flow_model.h"
+#include "link_model.h"
+#include "simulator.h"
+#include "spool_model.h"
+
+int main()
+{
+  runBenchmarks();
+  int failures = runConfigModel();
+  failures += runFlowModel();
+  failures += runSpoolModel();
+  failures += runLinkModel();
+  failures += runYearSimulation();
+  return failures == 0 ? 0 : 1;
+}
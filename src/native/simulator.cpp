@@ -0,0 +1,616 @@
+// Discrete-event simulation of a year of irrigation (env:native).
+//
+// SimDevice repeats what main.cpp does in setup(), on the SNTP callback and in
+// loop(), through the same lib/Schedule, ZoneScheduler, ScheduleStore and
+// SystemClock code. The harness never steps through idle time: it jumps the
+// shim's virtual clock straight to whichever comes first of the device's next
+// deadline, the next injected fault or the next NTP event. Relay changes are logged in true time
+// and checked against the configured schedules at the end.
+#include <Arduino.h>
+#include <Preferences.h>
+#include <Schedule.h>
+#include <ScheduleStore.h>
+#include <ZoneScheduler.h>
+#include <SystemClock.h>
+#include <limits.h>
+#include <chrono>
+#include <vector>
+#include "simulator.h"
+
+#define SIM_START_EPOCH 1767225600UL // 2026-01-01 00:00 UTC
+#define SIM_DAYS 365
+#define SIM_SEED 0x2545F491u
+
+#define SIM_TZ_OFFSET_MIN 330
+#define SIM_COMMIT_WINDOW_MS 10000
+#define SIM_CONFIG_DELAY_SECONDS 60  // the server's /config arrives this long after the clock is set
+#define SIM_FIRST_NTP_SECONDS 7200   // first boot: /config arrives on time but NTP only after two hours
+
+// injected per simulated year
+#define SIM_REBOOTS 26        // power blips of up to 30 s
+#define SIM_RESETS 12         // watchdog, OTA or restart resets of 1 to 5 s; RTC memory survives
+#define SIM_OUTAGES 12        // 1 to 12 hours without power
+#define SIM_CLOCK_STEPS 12    // wall clock off by 90 s to 30 min until NTP corrects it
+#define SIM_LATE_NTP_ONE_IN 4 // boots whose network (and so NTP) is 1 to 6 hours late
+
+#define SIM_NEVER ULONG_MAX
+
+typedef struct
+{
+  const char *label;
+  unsigned long interval;
+  unsigned long duration;
+  const char *cron; // nullptr for interval scheduling
+  uint16_t everyDays;
+} sim_zone_t;
+
+static const sim_zone_t SIM_ZONES[] = {
+    {"interval 1h / 30s", 3600, 30, nullptr, 0},
+    {"interval 2h / 2min", 7200, 120, nullptr, 0},
+    {"cron 06:00 Mon,Wed,Fri / 10min", 0, 600, "0 6 * * 1,3,5", 0},
+    {"cron 18:30 every 3 days / 5min", 0, 300, "30 18 * * *", 3},
+};
+#define SIM_ZONE_COUNT (sizeof(SIM_ZONES) / sizeof(SIM_ZONES[0]))
+
+enum SimFaultType
+{
+  FAULT_REBOOT,
+  FAULT_RESET,
+  FAULT_OUTAGE,
+  FAULT_CLOCK_STEP
+};
+
+typedef struct
+{
+  unsigned long at;
+  SimFaultType type;
+  long amount; // seconds without power, or seconds the wall clock is moved by
+} sim_fault_t;
+
+typedef struct
+{
+  unsigned long on;
+  unsigned long off; // 0 while still on
+} sim_segment_t;
+
+typedef struct
+{
+  unsigned long from;
+  cron_rule_t rule;
+} sim_rule_span_t;
+
+// true (simulated) time in epoch seconds
+static unsigned long trueNow;
+
+// RTC memory and counter: both survive a warm reset, a power loss clears them
+static clock_mark_t rtcMark;
+static unsigned long poweredAt;
+
+static uint64_t rtcMicros()
+{
+  return (uint64_t)(trueNow - poweredAt) * 1000000;
+}
+
+static std::vector<sim_segment_t> segments[SIM_ZONE_COUNT];
+static std::vector<sim_rule_span_t> ruleSpans[SIM_ZONE_COUNT];
+
+typedef std::vector<std::pair<unsigned long, unsigned long> > sim_spans_t;
+
+// [start, end] spans in which a fault can legitimately shift, cut or skip an actuation
+static sim_spans_t disturbed;
+// spans in which the wall clock was wrong: calendar slots follow it, interval
+// schedules run on elapsed time and must not notice
+static sim_spans_t clockDisturbed;
+
+static uint32_t rngState = SIM_SEED;
+static uint32_t wakeups = 0;
+static uint32_t zoneEvents = 0;
+static uint32_t rebases = 0;
+static uint32_t stepped = 0;
+
+static uint32_t nextRandom()
+{
+  // xorshift32: deterministic across hosts, unlike rand()
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 17;
+  rngState ^= rngState << 5;
+  return rngState;
+}
+
+static unsigned long randomBetween(unsigned long lo, unsigned long hi)
+{
+  return lo + nextRandom() % (hi - lo + 1);
+}
+
+static void recordRelay(uint8_t zone, bool on)
+{
+  std::vector<sim_segment_t> &log = segments[zone];
+  if (on)
+  {
+    if (log.empty() || log.back().off != 0)
+      log.push_back({trueNow, 0});
+  }
+  else if (!log.empty() && log.back().off == 0)
+  {
+    log.back().off = trueNow;
+  }
+}
+
+static bool overlaps(const sim_spans_t &spans, unsigned long from, unsigned long to)
+{
+  for (size_t i = 0; i < spans.size(); i++)
+  {
+    if (from <= spans[i].second + SCHEDULE_TOLERANCE_SECONDS && to + SCHEDULE_TOLERANCE_SECONDS >= spans[i].first)
+      return true;
+  }
+  return false;
+}
+
+static bool isDisturbed(unsigned long from, unsigned long to, bool calendar)
+{
+  return overlaps(disturbed, from, to) || (calendar && overlaps(clockDisturbed, from, to));
+}
+
+// The firmware's scheduling path, minus WiFi, MQTT and sensors.
+class SimDevice
+{
+public:
+  SimDevice() : _stores(), _tzOffsetSeconds(SIM_TZ_OFFSET_MIN * 60), _clock(nullptr), _up(false) {}
+
+  bool up() const { return _up; }
+  ClockSource clockSource() const { return _clock->source(); }
+  const system_config_t &config(uint8_t zone) const { return _scheduler.config(zone); }
+
+  // setup(): load and restore every zone before the network is up
+  void boot()
+  {
+    _prefs.begin("home_irrigator", false);
+    _tzOffsetSeconds = _prefs.getInt("tz_off", SIM_TZ_OFFSET_MIN) * 60;
+    _scheduler = ZoneScheduler();
+    _up = true;
+
+    delete _clock;
+    _clock = new SystemClock(rtcMark);
+    _clock->restore(rtcMicros(), (int64_t)shimMicros64());
+
+    unsigned long startupNow = now();
+    for (uint8_t zone = 0; zone < SIM_ZONE_COUNT; zone++)
+    {
+      char key[16];
+      if (zone == 0)
+        strcpy(key, "sched");
+      else
+        snprintf(key, sizeof(key), "sched%u", zone);
+      _stores[zone] = new ScheduleStore(_prefs, key, SIM_COMMIT_WINDOW_MS);
+
+      system_config_t config = {};
+      _stores[zone]->load(config);
+      _scheduler.addZone(config);
+      // no DEFAULT_CONFIG placeholder epoch here: zones stay idle until the server configures them
+      apply(zone, scheduleRestore(_scheduler.config(zone), startupNow, SIM_NEVER, _tzOffsetSeconds));
+      _scheduler.reschedule(zone);
+    }
+  }
+
+  // handleTimeSync(): SNTP has set the system clock (shimTime()) and the
+  // schedule clock follows it, moving elapsed-time deadlines by the same step
+  void timeSynced()
+  {
+    ClockSource was = _clock->source();
+    int32_t step = _clock->synced((int64_t)shimTime() * 1000000, rtcMicros(), (int64_t)shimMicros64());
+    if (step != 0)
+    {
+      for (uint8_t zone = 0; zone < SIM_ZONE_COUNT; zone++)
+      {
+        system_config_t &config = _scheduler.config(zone);
+        ScheduleAction action =
+            was == CLOCK_UPTIME ? scheduleRebase(config, (unsigned long)step) : scheduleStep(config, step);
+        if (action != SCHEDULE_NO_ACTION)
+          (was == CLOCK_UPTIME ? rebases : stepped)++;
+        apply(zone, action);
+        _scheduler.reschedule(zone);
+      }
+    }
+    if (was != CLOCK_SYNCED)
+      resync(now());
+  }
+
+  // loop(): due zone events, deferred NVS commits, the RTC mark
+  void loop()
+  {
+    wakeups++;
+    unsigned long current = now();
+    _clock->mark(rtcMicros(), (int64_t)shimMicros64());
+
+    zone_event_t event;
+    while (_scheduler.popDue(current, event))
+    {
+      zoneEvents++;
+      handleZoneEvent(event, current);
+    }
+    for (uint8_t zone = 0; zone < SIM_ZONE_COUNT; zone++)
+      _stores[zone]->service();
+  }
+
+  // /config for one zone, as handleCommand() applies it
+  void configure(uint8_t zone, unsigned long interval, unsigned long duration, const cron_rule_t &rule)
+  {
+    apply(zone, scheduleConfigure(_scheduler.config(zone), interval, duration, rule, 0, now(), _tzOffsetSeconds));
+    _scheduler.reschedule(zone);
+  }
+
+  // device-clock second at which loop() next has work, false if none
+  bool nextWake(unsigned long &deadline)
+  {
+    bool any = _scheduler.nextDeadline(deadline);
+    for (uint8_t zone = 0; zone < SIM_ZONE_COUNT; zone++)
+    {
+      if (!_stores[zone]->pending())
+        continue;
+      unsigned long commitAt = now() + (_stores[zone]->msUntilCommit() + 999) / 1000;
+      if (!any || commitAt < deadline)
+        deadline = commitAt;
+      any = true;
+    }
+    return any;
+  }
+
+  // power lost or the chip reset: relays drop, RAM (including uncommitted
+  // schedule edits) is gone
+  void powerLoss()
+  {
+    for (uint8_t zone = 0; zone < SIM_ZONE_COUNT; zone++)
+    {
+      recordRelay(zone, false);
+      delete _stores[zone];
+      _stores[zone] = nullptr;
+    }
+    _prefs.end();
+    _up = false;
+  }
+
+  unsigned long now() const
+  {
+    // getCurrentTime(): uptime until the first sync or a restore, then epoch
+    return _clock->nowSeconds((int64_t)shimMicros64());
+  }
+
+private:
+  void apply(uint8_t zone, ScheduleAction action)
+  {
+    if (action == SCHEDULE_RELAY_ON || action == SCHEDULE_RELAY_OFF)
+      recordRelay(zone, action == SCHEDULE_RELAY_ON);
+    if (action != SCHEDULE_NO_ACTION)
+      _stores[zone]->save(_scheduler.config(zone));
+  }
+
+  void resync(unsigned long current)
+  {
+    for (uint8_t zone = 0; zone < SIM_ZONE_COUNT; zone++)
+    {
+      apply(zone, scheduleResync(_scheduler.config(zone), current, _tzOffsetSeconds));
+      _scheduler.reschedule(zone);
+    }
+  }
+
+  void handleZoneEvent(const zone_event_t &event, unsigned long current)
+  {
+    system_config_t &config = _scheduler.config(event.zone);
+    if (event.type == ZONE_EVENT_ON)
+    {
+      apply(event.zone, scheduleAdjustMissedOn(config, current, _tzOffsetSeconds));
+      apply(event.zone, scheduleFireOn(config, current, _tzOffsetSeconds));
+    }
+    else
+    {
+      apply(event.zone, scheduleFireOff(config, current));
+    }
+    _scheduler.reschedule(event.zone);
+  }
+
+  Preferences _prefs;
+  ScheduleStore *_stores[SIM_ZONE_COUNT];
+  ZoneScheduler _scheduler;
+  int32_t _tzOffsetSeconds;
+  SystemClock *_clock;
+  bool _up;
+};
+
+static SimDevice device;
+
+static void advanceTo(unsigned long t)
+{
+  if (device.up())
+    shimAdvanceMicros((uint64_t)(t - trueNow) * 1000000);
+  trueNow = t;
+}
+
+static std::vector<sim_fault_t> generateFaults(unsigned long start, unsigned long end)
+{
+  std::vector<sim_fault_t> faults;
+  for (int i = 0; i < SIM_REBOOTS; i++)
+    faults.push_back({randomBetween(start + 86400, end), FAULT_REBOOT, (long)randomBetween(0, 30)});
+  for (int i = 0; i < SIM_RESETS; i++)
+    faults.push_back({randomBetween(start + 86400, end), FAULT_RESET, (long)randomBetween(1, 5)});
+  for (int i = 0; i < SIM_OUTAGES; i++)
+    faults.push_back({randomBetween(start + 86400, end), FAULT_OUTAGE, (long)randomBetween(3600, 12 * 3600)});
+  for (int i = 0; i < SIM_CLOCK_STEPS; i++)
+  {
+    long step = (long)randomBetween(90, 1800);
+    faults.push_back({randomBetween(start + 86400, end), FAULT_CLOCK_STEP, (nextRandom() & 1) ? step : -step});
+  }
+  std::sort(faults.begin(), faults.end(),
+            [](const sim_fault_t &a, const sim_fault_t &b) { return a.at < b.at; });
+  return faults;
+}
+
+static cron_rule_t compileZoneRule(const sim_zone_t &zone)
+{
+  cron_rule_t rule = {};
+  if (zone.cron != nullptr)
+  {
+    cronCompile(zone.cron, strlen(zone.cron), rule);
+    rule.everyDays = zone.everyDays;
+  }
+  return rule;
+}
+
+// the server's retained /config, delivered whenever a zone does not match it
+static void deliverConfig()
+{
+  for (uint8_t zone = 0; zone < SIM_ZONE_COUNT; zone++)
+  {
+    const sim_zone_t &want = SIM_ZONES[zone];
+    const system_config_t &have = device.config(zone);
+    if (have.duration == want.duration && have.interval == want.interval &&
+        (have.rule.active != 0) == (want.cron != nullptr))
+      continue;
+    device.configure(zone, want.interval, want.duration, compileZoneRule(want));
+    ruleSpans[zone].push_back({trueNow, device.config(zone).rule});
+    disturbed.push_back(std::make_pair(trueNow, trueNow));
+  }
+}
+
+typedef struct
+{
+  uint32_t ons;
+  uint32_t checked;
+  uint32_t durationErrors;
+  uint32_t spacingErrors;
+  uint32_t slots;
+  uint32_t hits;
+  uint32_t excused;
+  uint32_t missed;
+  uint32_t spurious;
+  long maxError; // seconds between a slot and its ON, either way
+} zone_report_t;
+
+static zone_report_t checkZone(uint8_t zone, unsigned long end)
+{
+  const sim_zone_t &spec = SIM_ZONES[zone];
+  const std::vector<sim_segment_t> &log = segments[zone];
+  zone_report_t r = {};
+  r.ons = log.size();
+  bool calendar = spec.cron != nullptr;
+
+  std::vector<bool> matched(log.size(), false);
+  for (size_t i = 0; i < log.size(); i++)
+  {
+    const sim_segment_t &seg = log[i];
+    if (isDisturbed(seg.on, seg.off, calendar))
+      continue;
+    r.checked++;
+    if (seg.off - seg.on != spec.duration)
+      r.durationErrors++;
+    if (spec.cron == nullptr && i > 0 && !isDisturbed(log[i - 1].on, seg.on, calendar) &&
+        seg.on - log[i - 1].on != spec.interval)
+      r.spacingErrors++;
+  }
+
+  // every slot the rule defines must have an ON unless a fault overlaps it
+  const std::vector<sim_rule_span_t> &spans = ruleSpans[zone];
+  size_t next = 0;
+  for (size_t s = 0; s < spans.size() && spec.cron != nullptr; s++)
+  {
+    unsigned long until = s + 1 < spans.size() ? spans[s + 1].from : end;
+    for (unsigned long slot = cronNextFire(spans[s].rule, spans[s].from, SIM_TZ_OFFSET_MIN * 60);
+         slot != 0 && slot + spec.duration < until;
+         slot = cronNextFire(spans[s].rule, slot, SIM_TZ_OFFSET_MIN * 60))
+    {
+      r.slots++;
+      while (next < log.size() && log[next].on + SCHEDULE_TOLERANCE_SECONDS < slot)
+        next++;
+      if (next < log.size() && log[next].on <= slot + SCHEDULE_TOLERANCE_SECONDS)
+      {
+        matched[next] = true;
+        r.hits++;
+        r.maxError = max(r.maxError, labs((long)log[next].on - (long)slot));
+      }
+      else if (isDisturbed(slot, slot + spec.duration, calendar))
+      {
+        r.excused++;
+      }
+      else
+      {
+        r.missed++;
+      }
+    }
+  }
+  for (size_t i = 0; i < log.size() && spec.cron != nullptr; i++)
+  {
+    if (!matched[i] && !isDisturbed(log[i].on, log[i].off, calendar))
+      r.spurious++;
+  }
+  return r;
+}
+
+int runYearSimulation()
+{
+  const unsigned long start = SIM_START_EPOCH;
+  const unsigned long end = start + SIM_DAYS * 86400UL;
+
+  shimSerialMute(true);
+  Preferences::shimEraseAll();
+  std::vector<sim_fault_t> faults = generateFaults(start, end);
+  size_t nextFault = 0;
+
+  uint32_t reboots = 0, resets = 0, outages = 0, clockSteps = 0, lateSyncs = 0, warmBoots = 0;
+  unsigned long downSeconds = 0;
+
+  unsigned long clockSetAt = SIM_NEVER;  // next time NTP sets the wall clock
+  unsigned long configAt = SIM_NEVER;    // next /config delivery
+  long clockError = 0;                   // device wall clock minus true time
+
+  std::chrono::steady_clock::time_point wallStart = std::chrono::steady_clock::now();
+
+  trueNow = start;
+  poweredAt = start;
+  memset(&rtcMark, 0, sizeof(rtcMark));
+  bool bootPending = true;
+  while (true)
+  {
+    if (bootPending)
+    {
+      // setup() restores zones from the RTC mark's time if it has one, from uptime
+      // otherwise; NTP answers in the background and loop() runs straight away
+      bootPending = false;
+      shimReboot();
+      device.boot();
+      bool warm = device.clockSource() == CLOCK_CACHED;
+      if (warm)
+        warmBoots++;
+      clockError = warm ? (long)device.now() - (long)trueNow : 0;
+      unsigned long ntpDelay = randomBetween(3, 9);
+      if (trueNow == start)
+      {
+        // the broker is reachable but NTP is not: zones start out on uptime
+        ntpDelay = SIM_FIRST_NTP_SECONDS;
+        configAt = trueNow + SIM_CONFIG_DELAY_SECONDS;
+      }
+      else if (nextRandom() % SIM_LATE_NTP_ONE_IN == 0)
+      {
+        ntpDelay = randomBetween(3600, 6 * 3600);
+        lateSyncs++;
+      }
+      clockSetAt = trueNow + ntpDelay;
+      // with the clock restored only the reset itself disturbs the schedule; an
+      // error the mark carried moves calendar slots until NTP corrects it
+      if (trueNow != start && !warm)
+        disturbed.back().second = clockSetAt;
+      if (clockError != 0)
+        clockDisturbed.push_back(std::make_pair(trueNow, clockSetAt + labs(clockError)));
+    }
+
+    unsigned long deviceWake = SIM_NEVER;
+    unsigned long deadline;
+    if (device.up() && device.nextWake(deadline))
+    {
+      unsigned long deviceNow = device.now();
+      deviceWake = trueNow + (deadline > deviceNow ? deadline - deviceNow : 0);
+    }
+    // faults that fell while the power was off never happened
+    while (nextFault < faults.size() && faults[nextFault].at < trueNow)
+      nextFault++;
+    unsigned long faultAt = nextFault < faults.size() ? faults[nextFault].at : SIM_NEVER;
+
+    unsigned long t = min(min(faultAt, clockSetAt), min(configAt, min(deviceWake, end)));
+    advanceTo(t);
+    if (t == end)
+      break;
+
+    if (t == faultAt)
+    {
+      const sim_fault_t &fault = faults[nextFault++];
+      if (fault.type == FAULT_CLOCK_STEP)
+      {
+        // a bad SNTP reply; the next good sync puts it right
+        if (device.clockSource() != CLOCK_SYNCED || clockError != 0 || clockSetAt != SIM_NEVER)
+          continue;
+        clockSteps++;
+        clockError = fault.amount;
+        shimSetEpoch((time_t)(trueNow + clockError));
+        clockSetAt = trueNow + randomBetween(5 * 60, 60 * 60);
+        clockDisturbed.push_back(std::make_pair(trueNow, clockSetAt + labs(clockError)));
+        device.timeSynced();
+        device.loop();
+        continue;
+      }
+      if (!device.up())
+        continue;
+      if (fault.type == FAULT_REBOOT)
+        reboots++;
+      else if (fault.type == FAULT_RESET)
+        resets++;
+      else
+        outages++;
+      device.powerLoss();
+      downSeconds += fault.amount;
+      advanceTo(trueNow + fault.amount);
+      disturbed.push_back(std::make_pair(trueNow - fault.amount, trueNow));
+      if (fault.type != FAULT_RESET)
+      {
+        // RTC memory comes back as noise and the counter starts again from zero
+        uint8_t *bytes = (uint8_t *)&rtcMark;
+        for (size_t i = 0; i < sizeof(rtcMark); i++)
+          bytes[i] = (uint8_t)nextRandom();
+        poweredAt = trueNow;
+      }
+      bootPending = true;
+      clockSetAt = configAt = SIM_NEVER;
+      continue;
+    }
+
+    if (t == clockSetAt)
+    {
+      clockSetAt = SIM_NEVER;
+      clockError = 0;
+      shimSetEpoch((time_t)trueNow);
+      if (configAt == SIM_NEVER && device.clockSource() != CLOCK_SYNCED)
+        configAt = trueNow + SIM_CONFIG_DELAY_SECONDS;
+      device.timeSynced();
+      device.loop();
+      continue;
+    }
+
+    if (t == configAt)
+    {
+      configAt = SIM_NEVER;
+      deliverConfig();
+      continue;
+    }
+
+    device.loop();
+  }
+
+  double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wallStart).count();
+  // the last ON of each zone may be cut short by the end of the run
+  for (uint8_t zone = 0; zone < SIM_ZONE_COUNT; zone++)
+    recordRelay(zone, false);
+  disturbed.push_back(std::make_pair(end, end));
+  shimSerialMute(false);
+
+  uint64_t events = (uint64_t)wakeups + zoneEvents + reboots + resets + outages + clockSteps;
+  Serial.println("\n=== Year simulation ===");
+  Serial.printf("%d days, %u zones, seed 0x%08X\r\n", SIM_DAYS, (unsigned)SIM_ZONE_COUNT, SIM_SEED);
+  Serial.printf("faults: %u reboots, %u warm resets, %u outages (%.1f h down), %u clock steps, %u late NTP boots\r\n",
+                reboots, resets, outages, downSeconds / 3600.0, clockSteps, lateSyncs);
+  Serial.printf("clock: %u boots started from the RTC mark, %u zone schedules moved from uptime at NTP sync, %u moved with a clock step\r\n",
+                warmBoots, rebases, stepped);
+  Serial.printf("work: %u wake-ups, %u zone events, %u NVS writes in %.1f ms (%.0f events/s)\r\n",
+                wakeups, zoneEvents, Preferences::shimWrites(), wallMs, events / (wallMs / 1000.0));
+
+  uint32_t failures = 0;
+  for (uint8_t zone = 0; zone < SIM_ZONE_COUNT; zone++)
+  {
+    zone_report_t r = checkZone(zone, end);
+    failures += r.durationErrors + r.spacingErrors + r.missed + r.spurious;
+    Serial.printf("zone %u %-32s ON %5u  checked %5u  duration errors %u  spacing errors %u\r\n",
+                  zone, SIM_ZONES[zone].label, r.ons, r.checked, r.durationErrors, r.spacingErrors);
+    if (SIM_ZONES[zone].cron != nullptr)
+      Serial.printf("       slots %u  hit %u (max %ld s off)  excused by faults %u  missed %u  spurious %u\r\n",
+                    r.slots, r.hits, r.maxError, r.excused, r.missed, r.spurious);
+  }
+  Serial.printf("result: %s (%u unexcused actuation errors)\r\n", failures == 0 ? "PASS" : "FAIL", failures);
+  Serial.println("=======================\n");
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,199 @@
+// Store-and-forward log model (env:native): SpoolLog over the shim's RAM flash.
+//
+// Each message carries its sequence number; the publisher records what it is
+// handed so ordering, duplicates and the per-burst budget can be checked after
+// every phase. "Reboots" are a fresh SpoolLog on the same flash.
+#include <Arduino.h>
+#include <SpoolLog.h>
+#include <TelemetryWriter.h>
+#include <vector>
+#include "spool_model.h"
+
+#define SPOOL_MODEL_TOPIC "/your_topic_header/ack"
+#define SPOOL_MODEL_EPOCH 1767225600UL
+#define SPOOL_MODEL_FIRST 100  // logged offline, replayed over two boots
+#define SPOOL_MODEL_SPLIT 40   // sent before the reboot in the middle of a replay
+#define SPOOL_MODEL_FLOOD 2000 // far more than the shim partition holds
+#define SPOOL_MODEL_FLOOD_PAD 180
+
+static std::vector<uint32_t> received;
+static bool online = true;
+static uint32_t sentThisBurst = 0;
+static bool loggedAtSeen = true;
+
+static bool modelPublish(const char *topic, const char *payload, size_t length)
+{
+  if (!online)
+    return false;
+  unsigned long n;
+  if (strcmp(topic, SPOOL_MODEL_TOPIC) != 0 || length != strlen(payload) || sscanf(payload, "{\"n\":%lu", &n) != 1)
+    return false;
+  if (strstr(payload, ",\"logged_at\":") == nullptr)
+    loggedAtSeen = false;
+  received.push_back((uint32_t)n);
+  sentThisBurst++;
+  return true;
+}
+
+// a CBOR ack replayed with its logged_at key spliced in before the closing break
+static std::vector<char> binaryReplayed;
+
+static bool binaryPublish(const char *, const char *payload, size_t length)
+{
+  binaryReplayed.assign(payload, payload + length);
+  return true;
+}
+
+static void logMessages(SpoolLog &spool, uint32_t first, uint32_t count, size_t pad)
+{
+  std::vector<char> payload(pad + 64);
+  for (uint32_t n = first; n < first + count; n++)
+  {
+    int length = snprintf(payload.data(), payload.size(), "{\"n\":%lu,\"pad\":\"", (unsigned long)n);
+    memset(payload.data() + length, 'x', pad);
+    strcpy(payload.data() + length + pad, "\"}");
+    spool.append(SPOOL_MODEL_TOPIC, payload.data(), SPOOL_MODEL_EPOCH + n);
+  }
+}
+
+// replay until nothing is pending or limit messages have gone out; false if a burst broke its budget
+static bool drain(SpoolLog &spool, uint32_t limit)
+{
+  bool withinBudget = true;
+  uint32_t total = 0;
+  while (spool.pending() > 0 && total < limit)
+  {
+    shimAdvanceMicros((uint64_t)spool.msUntilReplay(millis()) * 1000);
+    sentThisBurst = 0;
+    total += spool.replay(modelPublish, millis());
+    if (sentThisBurst > SPOOL_REPLAY_MESSAGES)
+      withinBudget = false;
+    if (sentThisBurst == 0)
+      break;
+  }
+  return withinBudget;
+}
+
+// received must be exactly first, first + 1, ..., last
+static bool inOrder(uint32_t first, uint32_t last)
+{
+  if (received.size() != last - first + 1)
+    return false;
+  for (size_t i = 0; i < received.size(); i++)
+    if (received[i] != first + i)
+      return false;
+  return true;
+}
+
+int runSpoolModel()
+{
+  shimFlashErase();
+  bool pass = true;
+
+  // offline: everything is logged, nothing can go out
+  {
+    SpoolLog spool;
+    spool.begin();
+    logMessages(spool, 0, SPOOL_MODEL_FIRST, 20);
+    online = false;
+    shimAdvanceMicros(SPOOL_REPLAY_INTERVAL_MS * 1000);
+    uint32_t sent = spool.replay(modelPublish, millis());
+    online = true;
+    if (spool.pending() != SPOOL_MODEL_FIRST || sent != 0)
+      pass = false;
+  }
+
+  // back online after a reboot: part of the backlog goes out, then another reboot
+  received.clear();
+  {
+    SpoolLog spool;
+    spool.begin();
+    if (spool.pending() != SPOOL_MODEL_FIRST || !drain(spool, SPOOL_MODEL_SPLIT))
+      pass = false;
+  }
+  size_t beforeReboot = received.size();
+  uint32_t replayStartMs = millis();
+  {
+    SpoolLog spool;
+    spool.begin();
+    if (spool.pending() != SPOOL_MODEL_FIRST - beforeReboot || !drain(spool, UINT32_MAX) || spool.pending() != 0)
+      pass = false;
+  }
+  bool resumed = inOrder(0, SPOOL_MODEL_FIRST - 1) && loggedAtSeen;
+  Serial.printf("spool: %u logged offline, %u replayed before a reboot, %u after; in order, once each: %s "
+                "(%lu ms at %u per %u ms)\r\n",
+                SPOOL_MODEL_FIRST, (unsigned)beforeReboot, (unsigned)(received.size() - beforeReboot),
+                resumed ? "yes" : "NO", (unsigned long)(millis() - replayStartMs), SPOOL_REPLAY_MESSAGES,
+                SPOOL_REPLAY_INTERVAL_MS);
+  if (!resumed)
+    pass = false;
+
+  // a long outage overflows the partition: the oldest segments go, the newest survive
+  received.clear();
+  uint32_t dropped, kept;
+  {
+    SpoolLog spool;
+    spool.begin();
+    logMessages(spool, SPOOL_MODEL_FIRST, SPOOL_MODEL_FLOOD, SPOOL_MODEL_FLOOD_PAD);
+    dropped = spool.dropped();
+    kept = spool.pending();
+    if (dropped + kept != SPOOL_MODEL_FLOOD || !drain(spool, UINT32_MAX))
+      pass = false;
+  }
+  uint32_t last = SPOOL_MODEL_FIRST + SPOOL_MODEL_FLOOD - 1;
+  bool newest = inOrder(last - kept + 1, last);
+  Serial.printf("spool: %u logged into %u KB, %u dropped, %u replayed, newest in order: %s\r\n", SPOOL_MODEL_FLOOD,
+                SHIM_SPIFFS_SIZE / 1024, dropped, (unsigned)received.size(), newest ? "yes" : "NO");
+  if (!newest || dropped == 0)
+    pass = false;
+
+  // power cut halfway through an append: the torn entry is skipped, nothing else is lost
+  received.clear();
+  uint32_t next = last + 1;
+  {
+    SpoolLog spool;
+    spool.begin();
+    logMessages(spool, next, 5, 20);
+    shimFlashTearNextWrite(6);
+    logMessages(spool, next + 5, 1, 20);
+  }
+  {
+    SpoolLog spool;
+    spool.begin();
+    logMessages(spool, next + 5, 5, 20);
+    if (spool.pending() != 10 || !drain(spool, UINT32_MAX))
+      pass = false;
+  }
+  bool torn = inOrder(next, next + 9);
+  Serial.printf("spool: torn append skipped, %u of 10 intact messages replayed in order: %s\r\n",
+                (unsigned)received.size(), torn ? "yes" : "NO");
+  if (!torn)
+    pass = false;
+
+  // a binary payload: stored by length, embedded NULs and all, and stamped in CBOR
+  {
+    SpoolLog spool;
+    spool.begin();
+    drain(spool, UINT32_MAX);
+    ack_payload_t ack = {"ON", 0, 0, 0, 0, 0, true};
+    char encoded[64];
+    size_t length = encodeAck(encoded, sizeof(encoded), PAYLOAD_CBOR, ack);
+    spool.append(SPOOL_MODEL_TOPIC, encoded, length, SPOOL_MODEL_EPOCH);
+    shimAdvanceMicros(SPOOL_REPLAY_INTERVAL_MS * 1000);
+    spool.replay(binaryPublish, millis());
+    static const char STAMP[] = "\x69logged_at\x1a";
+    const char *expected = binaryReplayed.data() + length - 1;
+    bool stamped = binaryReplayed.size() == length + sizeof(STAMP) - 1 + 4 &&
+                   memcmp(binaryReplayed.data(), encoded, length - 1) == 0 &&
+                   memcmp(expected, STAMP, sizeof(STAMP) - 1) == 0 &&
+                   (uint8_t)expected[sizeof(STAMP) - 1] == (uint8_t)(SPOOL_MODEL_EPOCH >> 24) &&
+                   (uint8_t)binaryReplayed.back() == 0xFF;
+    Serial.printf("spool: %u-byte CBOR ack replayed as %u bytes with logged_at: %s\r\n", (unsigned)length,
+                  (unsigned)binaryReplayed.size(), stamped ? "yes" : "NO");
+    if (!stamped)
+      pass = false;
+  }
+
+  Serial.printf("result: %s\r\n", pass ? "PASS" : "FAIL");
+  return pass ? 0 : 1;
+}